@@ -0,0 +1,90 @@
+#include "./Cache.h"
+#include "./Memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(_WIN32)
+    #include <direct.h>
+    #define Cache_MakeDirectory(path) _mkdir(path)
+#else
+    #include <sys/stat.h>
+    #define Cache_MakeDirectory(path) mkdir(path, 0755)
+#endif
+
+u64 Hash_Bytes(u64 hash, const void* data, u64 size) {
+    const u8* bytes = data;
+    for (u64 i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+u64 Hash_String(u64 hash, const char* string) {
+    return Hash_Bytes(hash, string, strlen(string) + 1);
+}
+
+u64 Hash_U64(u64 hash, u64 value) {
+    return Hash_Bytes(hash, &value, sizeof(value));
+}
+
+b8 Cache_Init(const char* directory) {
+    return Cache_MakeDirectory(directory) == 0 || errno == EEXIST;
+}
+
+static void Cache_Path(char* buffer, u64 size, const char* directory, u64 key) {
+    snprintf(buffer, size, "%s/%016llx", directory, key);
+}
+
+char* Cache_Load(const char* directory, u64 key, u64* size) {
+    char path[1024];
+    Cache_Path(path, sizeof(path), directory, key);
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    u64 length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* data = Allocate(length + 1);
+    if (fread(data, sizeof(char), length, file) != length) {
+        fclose(file);
+        free(data);
+        return NULL;
+    }
+    data[length] = '\0';
+    fclose(file);
+
+    *size = length;
+    return data;
+}
+
+void Cache_Store(const char* directory, u64 key, const char* data, u64 size) {
+    char path[1024];
+    Cache_Path(path, sizeof(path), directory, key);
+
+    // Written under a temporary name first so a concurrent reader never sees a partial entry
+    char temporary[1040];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+
+    FILE* file = fopen(temporary, "wb");
+    if (!file) {
+        return;
+    }
+    b8 written = fwrite(data, sizeof(char), size, file) == size;
+    fclose(file);
+
+    if (!written) {
+        remove(temporary);
+        return;
+    }
+
+    remove(path);
+    rename(temporary, path);
+}
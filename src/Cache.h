@@ -0,0 +1,15 @@
+#pragma once
+
+#include "./Typedefs.h"
+
+#define Hash_Initial 14695981039346656037ull
+
+// FNV-1a, chain calls by passing the previous result as hash
+u64 Hash_Bytes(u64 hash, const void* data, u64 size);
+u64 Hash_String(u64 hash, const char* string);
+u64 Hash_U64(u64 hash, u64 value);
+
+// An on disk cache of blobs keyed by content hashes, one file per key
+b8 Cache_Init(const char* directory);
+char* Cache_Load(const char* directory, u64 key, u64* size); // Returns NULL on a miss, the result is null terminated
+void Cache_Store(const char* directory, u64 key, const char* data, u64 size);
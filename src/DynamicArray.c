@@ -1,4 +1,5 @@
 #include "./DynamicArray.h"
+#include "./Stats.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -6,6 +7,9 @@
 void* DynamicArrayCreate_(u64 capacity, u64 stride) {
     u64 headerSize = DynamicArrayField_Count * sizeof(u64);
     u64 arraySize = capacity * stride;
+    Allocations.DynamicArrayCalls++;
+    Allocations.DynamicArrayBytes += headerSize + arraySize;
+
     void* header = malloc(headerSize + arraySize);
     void* array = (cast(u64*) header) + DynamicArrayField_Count;
     DynamicArrayCapacity(array) = capacity;
@@ -79,7 +83,35 @@ void* DynamicArrayPopAt_(void* array, u64 index, void* dest) {
     if (dest) {
         memcpy(dest, &(cast(u8*) array)[index * DynamicArrayStride(array)], DynamicArrayStride(array));
     }
-    memmove(&(cast(u8*) array)[index * DynamicArrayStride(array)], &(cast(u8*) array)[(index + 1) * DynamicArrayStride(array)], (DynamicArrayLength(array) - index) * DynamicArrayStride(array));
+    memmove(&(cast(u8*) array)[index * DynamicArrayStride(array)], &(cast(u8*) array)[(index + 1) * DynamicArrayStride(array)], (DynamicArrayLength(array) - index - 1) * DynamicArrayStride(array));
     DynamicArrayLength(array)--;
     return array;
 }
+
+void* DynamicArrayReplace_(void* array, u64 index, u64 removed, const void* values, u64 count) {
+    if (index + removed > DynamicArrayLength(array)) {
+        ASSERT(FALSE);
+        return array;
+    }
+
+    u64 length = DynamicArrayLength(array) - removed + count;
+    if (length > DynamicArrayCapacity(array)) {
+        u64 capacity = DynamicArrayCapacity(array) != 0 ? DynamicArrayCapacity(array) * 2 : 1;
+        while (capacity < length) {
+            capacity *= 2;
+        }
+
+        void* newArray = DynamicArrayCreate_(capacity, DynamicArrayStride(array));
+        memcpy(newArray, array, DynamicArraySize(array));
+        DynamicArrayLength(newArray) = DynamicArrayLength(array);
+
+        DynamicArrayDestroy(array);
+        array = newArray;
+    }
+
+    u64 stride = DynamicArrayStride(array);
+    memmove(&(cast(u8*) array)[(index + count) * stride], &(cast(u8*) array)[(index + removed) * stride], (DynamicArrayLength(array) - index - removed) * stride);
+    memcpy(&(cast(u8*) array)[index * stride], values, count * stride);
+    DynamicArrayLength(array) = length;
+    return array;
+}
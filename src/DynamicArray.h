@@ -19,6 +19,8 @@ void* DynamicArrayPop_(void* array, void* dest);
 void* DynamicArrayInsert_(void* array, u64 index, const void* valuePtr);
 void* DynamicArrayPopAt_(void* array, u64 index, void* dest);
 
+void* DynamicArrayReplace_(void* array, u64 index, u64 removed, const void* values, u64 count);
+
 #define DynamicArrayCreate(type) \
     (cast(type*) DynamicArrayCreate_(1, sizeof(type)))
 
@@ -47,6 +49,12 @@ void* DynamicArrayPopAt_(void* array, u64 index, void* dest);
         (array) = DynamicArrayPopAt_((array), (index), (dest)); \
     } while (0)
 
+// Replaces removed elements starting at index with count elements from values
+#define DynamicArrayReplace(array, index, removed, values, count) \
+    do { \
+        (array) = DynamicArrayReplace_((array), (index), (removed), (values), (count)); \
+    } while (0)
+
 #define DynamicArrayGetField(array, field) \
     (*((cast(u64*) (array)) - DynamicArrayField_Count + field))
 
@@ -0,0 +1,825 @@
+#include "./Ir.h"
+#include "./Memory.h"
+#include "./Cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char* IrOpNames[IrOp_Count] = {
+    [IrOp_None] = "none",
+
+    [IrOp_Constant] = "const",
+    [IrOp_Undefined] = "undefined",
+    [IrOp_String] = "string",
+    [IrOp_ProcedureAddress] = "procedure",
+    [IrOp_Parameter] = "parameter",
+    [IrOp_Local] = "local",
+    [IrOp_Phi] = "phi",
+
+    [IrOp_Add] = "add",
+    [IrOp_Subtract] = "sub",
+    [IrOp_Multiply] = "mul",
+    [IrOp_Divide] = "div",
+    [IrOp_Modulo] = "mod",
+    [IrOp_And] = "and",
+    [IrOp_Or] = "or",
+    [IrOp_Equal] = "eq",
+    [IrOp_NotEqual] = "ne",
+    [IrOp_Less] = "lt",
+    [IrOp_LessEqual] = "le",
+
+    [IrOp_Negate] = "neg",
+    [IrOp_Not] = "not",
+    [IrOp_Convert] = "convert",
+
+    [IrOp_Splat] = "splat",
+    [IrOp_ExtractLane] = "extract",
+    [IrOp_InsertLane] = "insert",
+    [IrOp_Shuffle] = "shuffle",
+    [IrOp_ReduceAdd] = "reduce_add",
+    [IrOp_ReduceMin] = "reduce_min",
+    [IrOp_ReduceMax] = "reduce_max",
+
+    [IrOp_Offset] = "offset",
+    [IrOp_Load] = "load",
+    [IrOp_Store] = "store",
+    [IrOp_Zero] = "zero",
+    [IrOp_Copy] = "copy",
+    [IrOp_Call] = "call",
+    [IrOp_BoundsCheck] = "check",
+
+    [IrOp_Jump] = "jump",
+    [IrOp_Branch] = "branch",
+    [IrOp_Switch] = "switch",
+    [IrOp_Return] = "return",
+};
+
+IrType IrType_Make(IrTypeKind kind, u8 size, b8 isSigned) {
+    return (IrType){
+        .Kind = kind,
+        .Size = size,
+        .Signed = isSigned,
+    };
+}
+
+IrType IrType_MakeVector(IrType lane, u8 lanes) {
+    return (IrType){
+        .Kind = IrTypeKind_Vector,
+        .Size = lane.Size * lanes,
+        .Signed = lane.Signed,
+        .Lanes = lanes,
+        .LaneKind = lane.Kind,
+    };
+}
+
+IrType IrType_Lane(IrType vector) {
+    ASSERT(vector.Kind == IrTypeKind_Vector);
+    return IrType_Make(vector.LaneKind, vector.Size / vector.Lanes, vector.Signed);
+}
+
+b8 IrType_Equal(IrType a, IrType b) {
+    return a.Kind == b.Kind && a.Size == b.Size && a.Signed == b.Signed && a.Lanes == b.Lanes && a.LaneKind == b.LaneKind;
+}
+
+// Vector names like 'f32x4' are formatted once and kept
+static char IrType_VectorNames[64][16];
+static u64 IrType_VectorNameCount;
+
+const char* IrType_Name(IrType type) {
+    switch (type.Kind) {
+        case IrTypeKind_Void: return "void";
+        case IrTypeKind_Bool: return "bool";
+        case IrTypeKind_Pointer: return "ptr";
+
+        case IrTypeKind_Integer: {
+            switch (type.Size) {
+                case 1: return type.Signed ? "s8" : "u8";
+                case 2: return type.Signed ? "s16" : "u16";
+                case 4: return type.Signed ? "s32" : "u32";
+                case 8: return type.Signed ? "s64" : "u64";
+                default: break;
+            }
+        } break;
+
+        case IrTypeKind_Float: {
+            return type.Size == 4 ? "f32" : "f64";
+        } break;
+
+        case IrTypeKind_Vector: {
+            char name[16];
+            snprintf(name, sizeof(name), "%sx%u", IrType_Name(IrType_Lane(type)), type.Lanes);
+            for (u64 i = 0; i < IrType_VectorNameCount; i++) {
+                if (strcmp(IrType_VectorNames[i], name) == 0) {
+                    return IrType_VectorNames[i];
+                }
+            }
+
+            ASSERT(IrType_VectorNameCount < sizeof(IrType_VectorNames) / sizeof(IrType_VectorNames[0]));
+            strcpy(IrType_VectorNames[IrType_VectorNameCount], name);
+            return IrType_VectorNames[IrType_VectorNameCount++];
+        } break;
+
+        default: {
+        } break;
+    }
+
+    ASSERT(FALSE);
+    return "?";
+}
+
+IrModule* IrModule_Create(void) {
+    IrModule* module = Allocate(sizeof(IrModule));
+    module->Procedures = DynamicArrayCreate(IrProcedure*);
+    module->StringData = DynamicArrayCreate(char);
+    module->Strings = DynamicArrayCreate(IrString);
+    module->StringTableCapacity = 64;
+    module->StringTable = Allocate(module->StringTableCapacity * sizeof(u32));
+
+    // Index 0 marks empty slots of the table
+    DynamicArrayPush(module->Strings, ((IrString){}));
+    DynamicArrayPush(module->StringData, '\0');
+    return module;
+}
+
+// Returns the index of the string, equal contents share one copy
+u64 IrModule_InternString(IrModule* module, const char* data, u64 length) {
+    if ((DynamicArrayLength(module->Strings) + 1) * 2 > module->StringTableCapacity) {
+        u64 capacity = module->StringTableCapacity * 2;
+        u32* table = Allocate(capacity * sizeof(u32));
+        for (u64 i = 1; i < DynamicArrayLength(module->Strings); i++) {
+            IrString entry = module->Strings[i];
+            u64 index = Hash_Bytes(Hash_Initial, &module->StringData[entry.Offset], entry.Length) & (capacity - 1);
+            while (table[index]) {
+                index = (index + 1) & (capacity - 1);
+            }
+            table[index] = i;
+        }
+        free(module->StringTable);
+        module->StringTable = table;
+        module->StringTableCapacity = capacity;
+    }
+
+    u64 index = Hash_Bytes(Hash_Initial, data, length) & (module->StringTableCapacity - 1);
+    while (module->StringTable[index]) {
+        IrString entry = module->Strings[module->StringTable[index]];
+        if (entry.Length == length && memcmp(&module->StringData[entry.Offset], data, length) == 0) {
+            return module->StringTable[index];
+        }
+        index = (index + 1) & (module->StringTableCapacity - 1);
+    }
+
+    u64 string = DynamicArrayLength(module->Strings);
+    DynamicArrayPush(module->Strings, ((IrString){ .Offset = DynamicArrayLength(module->StringData), .Length = length }));
+    for (u64 i = 0; i < length; i++) {
+        DynamicArrayPush(module->StringData, data[i]);
+    }
+    DynamicArrayPush(module->StringData, '\0');
+    module->StringTable[index] = string;
+    return string;
+}
+
+IrProcedure* IrProcedure_Create(IrModule* module, const char* name, IrType returnType) {
+    IrProcedure* procedure = Allocate(sizeof(IrProcedure));
+    procedure->Name = name;
+    procedure->Module = module;
+    procedure->Parameters = DynamicArrayCreate(IrType);
+    procedure->ReturnType = returnType;
+    procedure->Blocks = DynamicArrayCreate(IrBlock*);
+    procedure->NextInstructionId = 1;
+    DynamicArrayPush(module->Procedures, procedure);
+    return procedure;
+}
+
+IrBlock* IrBlock_Create(IrProcedure* procedure) {
+    IrBlock* block = Allocate(sizeof(IrBlock));
+    block->Id = procedure->NextBlockId++;
+    block->Procedure = procedure;
+    block->Instructions = DynamicArrayCreate(IrInstruction*);
+    block->Predecessors = DynamicArrayCreate(IrBlock*);
+    block->Definitions = DynamicArrayCreate(IrDefinition);
+    block->IncompletePhis = DynamicArrayCreate(IrDefinition);
+    DynamicArrayPush(procedure->Blocks, block);
+    return block;
+}
+
+IrInstruction* IrInstruction_Create(IrProcedure* procedure, IrOp op, IrType type) {
+    IrInstruction* instruction = Allocate(sizeof(IrInstruction));
+    instruction->Op = op;
+    instruction->Type = type;
+    instruction->Id = procedure->NextInstructionId++;
+    instruction->Operands = DynamicArrayCreate(IrInstruction*);
+    return instruction;
+}
+
+b8 IrInstruction_IsTerminator(IrInstruction* instruction) {
+    return
+        instruction->Op == IrOp_Jump ||
+        instruction->Op == IrOp_Branch ||
+        instruction->Op == IrOp_Switch ||
+        instruction->Op == IrOp_Return;
+}
+
+b8 IrInstruction_HasSideEffects(IrInstruction* instruction) {
+    switch (instruction->Op) {
+        case IrOp_Store:
+        case IrOp_Zero:
+        case IrOp_Copy:
+        case IrOp_Call:
+        case IrOp_BoundsCheck:
+        case IrOp_Jump:
+        case IrOp_Branch:
+        case IrOp_Switch:
+        case IrOp_Return:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+b8 IrInstruction_IsCommutative(IrInstruction* instruction) {
+    switch (instruction->Op) {
+        case IrOp_Add:
+        case IrOp_Multiply:
+        case IrOp_And:
+        case IrOp_Or:
+        case IrOp_Equal:
+        case IrOp_NotEqual:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+IrInstruction* IrInstruction_Resolve(IrInstruction* instruction) {
+    IrInstruction* result = instruction;
+    while (result->Replacement) {
+        result = result->Replacement;
+    }
+
+    while (instruction->Replacement && instruction->Replacement != result) {
+        IrInstruction* next = instruction->Replacement;
+        instruction->Replacement = result;
+        instruction = next;
+    }
+
+    return result;
+}
+
+IrInstruction* IrBlock_Append(IrBlock* block, IrOp op, IrType type) {
+    u64 length = DynamicArrayLength(block->Instructions);
+    ASSERT(length == 0 || !IrInstruction_IsTerminator(block->Instructions[length - 1]));
+
+    IrInstruction* instruction = IrInstruction_Create(block->Procedure, op, type);
+    instruction->Block = block;
+    DynamicArrayPush(block->Instructions, instruction);
+    return instruction;
+}
+
+IrInstruction* IrBlock_AppendInteger(IrBlock* block, IrType type, u64 value) {
+    IrInstruction* instruction = IrBlock_Append(block, IrOp_Constant, type);
+    instruction->Integer = value;
+    return instruction;
+}
+
+IrInstruction* IrBlock_AppendFloat(IrBlock* block, IrType type, f64 value) {
+    IrInstruction* instruction = IrBlock_Append(block, IrOp_Constant, type);
+    instruction->Float = type.Size == 4 ? cast(f64) (cast(f32) value) : value; // Folding sees what an f32 register holds
+    return instruction;
+}
+
+IrInstruction* IrBlock_AppendUnary(IrBlock* block, IrOp op, IrType type, IrInstruction* operand) {
+    IrInstruction* instruction = IrBlock_Append(block, op, type);
+    DynamicArrayPush(instruction->Operands, operand);
+    return instruction;
+}
+
+IrInstruction* IrBlock_AppendBinary(IrBlock* block, IrOp op, IrType type, IrInstruction* left, IrInstruction* right) {
+    IrInstruction* instruction = IrBlock_Append(block, op, type);
+    DynamicArrayPush(instruction->Operands, left);
+    DynamicArrayPush(instruction->Operands, right);
+    return instruction;
+}
+
+IrInstruction* IrBlock_AppendJump(IrBlock* block, IrBlock* target) {
+    ASSERT(!target->Sealed);
+    IrInstruction* instruction = IrBlock_Append(block, IrOp_Jump, IrType_Void());
+    instruction->Targets[0] = target;
+    DynamicArrayPush(target->Predecessors, block);
+    return instruction;
+}
+
+IrInstruction* IrBlock_AppendBranch(IrBlock* block, IrInstruction* condition, IrBlock* then, IrBlock* else_) {
+    ASSERT(!then->Sealed && !else_->Sealed);
+    IrInstruction* instruction = IrBlock_Append(block, IrOp_Branch, IrType_Void());
+    DynamicArrayPush(instruction->Operands, condition);
+    instruction->Targets[0] = then;
+    instruction->Targets[1] = else_;
+    DynamicArrayPush(then->Predecessors, block);
+    DynamicArrayPush(else_->Predecessors, block);
+    return instruction;
+}
+
+// cases is a dynamic array that the switch keeps, a case may repeat a block or be the default
+IrInstruction* IrBlock_AppendSwitch(IrBlock* block, IrInstruction* value, u64 low, IrBlock* default_, IrBlock** cases) {
+    ASSERT(!default_->Sealed);
+    IrInstruction* instruction = IrBlock_Append(block, IrOp_Switch, IrType_Void());
+    DynamicArrayPush(instruction->Operands, value);
+    instruction->Targets[0] = default_;
+    instruction->Switch.Cases = cases;
+    instruction->Switch.Low = low;
+    DynamicArrayPush(default_->Predecessors, block);
+    for (u64 i = 0; i < DynamicArrayLength(cases); i++) {
+        ASSERT(!cases[i]->Sealed);
+        DynamicArrayPush(cases[i]->Predecessors, block);
+    }
+    return instruction;
+}
+
+IrInstruction* IrBlock_AppendReturn(IrBlock* block, IrInstruction* value) {
+    IrInstruction* instruction = IrBlock_Append(block, IrOp_Return, IrType_Void());
+    if (value) {
+        DynamicArrayPush(instruction->Operands, value);
+    }
+    return instruction;
+}
+
+IrInstruction* IrBlock_Terminator(IrBlock* block) {
+    u64 length = DynamicArrayLength(block->Instructions);
+    if (length == 0 || !IrInstruction_IsTerminator(block->Instructions[length - 1])) {
+        return NULL;
+    }
+    return block->Instructions[length - 1];
+}
+
+u64 IrBlock_SuccessorCount(IrBlock* block) {
+    IrInstruction* terminator = IrBlock_Terminator(block);
+    if (!terminator) {
+        return 0;
+    }
+
+    switch (terminator->Op) {
+        case IrOp_Jump: return 1;
+        case IrOp_Branch: return 2;
+        case IrOp_Switch: return 1 + DynamicArrayLength(terminator->Switch.Cases);
+        default: return 0;
+    }
+}
+
+IrBlock* IrBlock_Successor(IrBlock* block, u64 index) {
+    ASSERT(index < IrBlock_SuccessorCount(block));
+    return *IrInstruction_Target(IrBlock_Terminator(block), index);
+}
+
+// Where a successor of a terminator is kept, so passes can retarget the edges of jumps, branches and switches alike
+IrBlock** IrInstruction_Target(IrInstruction* terminator, u64 index) {
+    if (terminator->Op == IrOp_Switch && index > 0) {
+        return &terminator->Switch.Cases[index - 1];
+    }
+    return &terminator->Targets[index];
+}
+
+// The values compare as the type of the switch operand, so only the low bits of the difference matter
+IrBlock* IrInstruction_SwitchTarget(IrInstruction* instruction, u64 value) {
+    ASSERT(instruction->Op == IrOp_Switch);
+    u64 offset = value - instruction->Switch.Low;
+    u64 bits = instruction->Operands[0]->Type.Size * 8;
+    if (bits < 64) {
+        offset &= (1ull << bits) - 1;
+    }
+    if (offset < DynamicArrayLength(instruction->Switch.Cases)) {
+        return instruction->Switch.Cases[offset];
+    }
+    return instruction->Targets[0];
+}
+
+void IrBlock_RemovePredecessor(IrBlock* block, IrBlock* predecessor) {
+    for (u64 i = 0; i < DynamicArrayLength(block->Predecessors); i++) {
+        if (block->Predecessors[i] != predecessor) {
+            continue;
+        }
+
+        DynamicArrayPopAt(block->Predecessors, i, NULL);
+        for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+            IrInstruction* phi = block->Instructions[j];
+            if (phi->Op == IrOp_Phi && i < DynamicArrayLength(phi->Operands)) {
+                DynamicArrayPopAt(phi->Operands, i, NULL);
+            }
+        }
+        return;
+    }
+
+    ASSERT(FALSE);
+}
+
+void IrBlock_RemoveInstruction(IrBlock* block, IrInstruction* instruction) {
+    for (u64 i = 0; i < DynamicArrayLength(block->Instructions); i++) {
+        if (block->Instructions[i] == instruction) {
+            DynamicArrayPopAt(block->Instructions, i, NULL);
+            return;
+        }
+    }
+
+    ASSERT(FALSE);
+}
+
+void IrBlock_WriteVariable(IrBlock* block, const void* variable, IrInstruction* value) {
+    for (u64 i = 0; i < DynamicArrayLength(block->Definitions); i++) {
+        if (block->Definitions[i].Variable == variable) {
+            block->Definitions[i].Value = value;
+            return;
+        }
+    }
+
+    DynamicArrayPush(block->Definitions, ((IrDefinition){
+        .Variable = variable,
+        .Value = value,
+    }));
+}
+
+static IrInstruction* IrBlock_CreatePhi(IrBlock* block, IrType type) {
+    IrInstruction* phi = IrInstruction_Create(block->Procedure, IrOp_Phi, type);
+    phi->Block = block;
+    DynamicArrayInsert(block->Instructions, 0, phi);
+    return phi;
+}
+
+static IrInstruction* IrBlock_TryRemoveTrivialPhi(IrInstruction* phi) {
+    IrInstruction* same = NULL;
+    for (u64 i = 0; i < DynamicArrayLength(phi->Operands); i++) {
+        IrInstruction* operand = IrInstruction_Resolve(phi->Operands[i]);
+        if (operand == same || operand == phi) {
+            continue;
+        }
+        if (same) {
+            return phi;
+        }
+        same = operand;
+    }
+
+    if (!same) {
+        same = IrInstruction_Create(phi->Block->Procedure, IrOp_Undefined, phi->Type);
+        same->Block = phi->Block;
+        DynamicArrayInsert(phi->Block->Instructions, 0, same);
+    }
+
+    IrBlock_RemoveInstruction(phi->Block, phi);
+    phi->Replacement = same;
+    return same;
+}
+
+static IrInstruction* IrBlock_AddPhiOperands(IrBlock* block, const void* variable, IrInstruction* phi) {
+    for (u64 i = 0; i < DynamicArrayLength(block->Predecessors); i++) {
+        DynamicArrayPush(phi->Operands, IrBlock_ReadVariable(block->Predecessors[i], variable, phi->Type));
+    }
+    return IrBlock_TryRemoveTrivialPhi(phi);
+}
+
+IrInstruction* IrBlock_ReadVariable(IrBlock* block, const void* variable, IrType type) {
+    for (u64 i = 0; i < DynamicArrayLength(block->Definitions); i++) {
+        if (block->Definitions[i].Variable == variable) {
+            return IrInstruction_Resolve(block->Definitions[i].Value);
+        }
+    }
+
+    IrInstruction* value;
+    if (!block->Sealed) {
+        value = IrBlock_CreatePhi(block, type);
+        DynamicArrayPush(block->IncompletePhis, ((IrDefinition){
+            .Variable = variable,
+            .Value = value,
+        }));
+    } else if (DynamicArrayLength(block->Predecessors) == 1) {
+        value = IrBlock_ReadVariable(block->Predecessors[0], variable, type);
+    } else if (DynamicArrayLength(block->Predecessors) == 0) {
+        value = IrInstruction_Create(block->Procedure, IrOp_Undefined, type);
+        value->Block = block;
+        DynamicArrayInsert(block->Instructions, 0, value);
+    } else {
+        IrInstruction* phi = IrBlock_CreatePhi(block, type);
+        IrBlock_WriteVariable(block, variable, phi); // Break cycles through loops
+        value = IrBlock_AddPhiOperands(block, variable, phi);
+    }
+
+    IrBlock_WriteVariable(block, variable, value);
+    return value;
+}
+
+void IrBlock_Seal(IrBlock* block) {
+    ASSERT(!block->Sealed);
+    for (u64 i = 0; i < DynamicArrayLength(block->IncompletePhis); i++) {
+        IrBlock_AddPhiOperands(block, block->IncompletePhis[i].Variable, block->IncompletePhis[i].Value);
+    }
+    DynamicArrayLength(block->IncompletePhis) = 0;
+    block->Sealed = TRUE;
+}
+
+void IrProcedure_ApplyReplacements(IrProcedure* procedure) {
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Blocks); i++) {
+        IrBlock* block = procedure->Blocks[i];
+
+        u64 count = 0;
+        for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+            IrInstruction* instruction = block->Instructions[j];
+            if (instruction->Replacement) {
+                continue;
+            }
+
+            for (u64 k = 0; k < DynamicArrayLength(instruction->Operands); k++) {
+                instruction->Operands[k] = IrInstruction_Resolve(instruction->Operands[k]);
+            }
+            block->Instructions[count++] = instruction;
+        }
+        DynamicArrayLength(block->Instructions) = count;
+    }
+}
+
+static IrBlock* IrBlock_Intersect(IrBlock* a, IrBlock* b) {
+    while (a != b) {
+        while (a->Order > b->Order) {
+            a = a->Dominator;
+        }
+        while (b->Order > a->Order) {
+            b = b->Dominator;
+        }
+    }
+    return a;
+}
+
+void IrProcedure_Analyze(IrProcedure* procedure) {
+    u64 blockCount = DynamicArrayLength(procedure->Blocks);
+    if (blockCount == 0) {
+        return;
+    }
+
+    for (u64 i = 0; i < blockCount; i++) {
+        procedure->Blocks[i]->Order = ~0ull;
+        procedure->Blocks[i]->Dominator = NULL;
+    }
+
+    // Iterative depth first search, blocks are numbered in post order
+    typedef struct Visit {
+        IrBlock* Block;
+        u64 Next;
+    } Visit;
+
+    IrBlock** postOrder = DynamicArrayCreate(IrBlock*);
+    Visit* stack = DynamicArrayCreate(Visit);
+
+    IrBlock* entry = procedure->Blocks[0];
+    entry->Order = 0;
+    DynamicArrayPush(stack, ((Visit){ .Block = entry, .Next = 0 }));
+    while (DynamicArrayLength(stack) > 0) {
+        Visit* top = &stack[DynamicArrayLength(stack) - 1];
+        if (top->Next < IrBlock_SuccessorCount(top->Block)) {
+            IrBlock* successor = IrBlock_Successor(top->Block, top->Next++);
+            if (successor->Order == ~0ull) {
+                successor->Order = 0;
+                DynamicArrayPush(stack, ((Visit){ .Block = successor, .Next = 0 }));
+            }
+        } else {
+            DynamicArrayPush(postOrder, top->Block);
+            DynamicArrayPop(stack, NULL);
+        }
+    }
+    DynamicArrayDestroy(stack);
+
+    // Unreachable blocks no longer flow into their successors
+    for (u64 i = 0; i < blockCount; i++) {
+        IrBlock* block = procedure->Blocks[i];
+        if (block->Order != ~0ull) {
+            continue;
+        }
+
+        for (u64 j = 0; j < IrBlock_SuccessorCount(block); j++) {
+            IrBlock* successor = IrBlock_Successor(block, j);
+            if (successor->Order != ~0ull) {
+                IrBlock_RemovePredecessor(successor, block);
+            }
+        }
+    }
+
+    u64 reachableCount = DynamicArrayLength(postOrder);
+    DynamicArrayLength(procedure->Blocks) = 0;
+    for (u64 i = 0; i < reachableCount; i++) {
+        IrBlock* block = postOrder[reachableCount - i - 1];
+        block->Order = i;
+        DynamicArrayPush(procedure->Blocks, block);
+    }
+    DynamicArrayDestroy(postOrder);
+
+    // "A Simple, Fast Dominance Algorithm" (Cooper, Harvey and Kennedy)
+    entry->Dominator = entry;
+    b8 changed = TRUE;
+    while (changed) {
+        changed = FALSE;
+        for (u64 i = 1; i < reachableCount; i++) {
+            IrBlock* block = procedure->Blocks[i];
+
+            IrBlock* dominator = NULL;
+            for (u64 j = 0; j < DynamicArrayLength(block->Predecessors); j++) {
+                IrBlock* predecessor = block->Predecessors[j];
+                if (!predecessor->Dominator) {
+                    continue;
+                }
+                dominator = dominator ? IrBlock_Intersect(predecessor, dominator) : predecessor;
+            }
+
+            if (dominator != block->Dominator) {
+                block->Dominator = dominator;
+                changed = TRUE;
+            }
+        }
+    }
+    entry->Dominator = NULL;
+}
+
+b8 IrBlock_Dominates(IrBlock* a, IrBlock* b) {
+    while (b) {
+        if (a == b) {
+            return TRUE;
+        }
+        b = b->Dominator;
+    }
+    return FALSE;
+}
+
+static void IrInstruction_Print(FILE* file, IrInstruction* instruction) {
+    fprintf(file, "    ");
+    if (instruction->Type.Kind != IrTypeKind_Void) {
+        fprintf(file, "%%%llu = %s ", instruction->Id, IrType_Name(instruction->Type));
+    }
+    fprintf(file, "%s", IrOpNames[instruction->Op]);
+
+    switch (instruction->Op) {
+        case IrOp_Constant: {
+            switch (instruction->Type.Kind) {
+                case IrTypeKind_Float: {
+                    fprintf(file, " %f", instruction->Float);
+                } break;
+
+                case IrTypeKind_Bool: {
+                    fprintf(file, " %s", instruction->Integer ? "true" : "false");
+                } break;
+
+                default: {
+                    if (instruction->Type.Signed) {
+                        fprintf(file, " %lld", cast(s64) instruction->Integer);
+                    } else {
+                        fprintf(file, " %llu", instruction->Integer);
+                    }
+                } break;
+            }
+        } break;
+
+        case IrOp_String: {
+            fprintf(file, " %llu", instruction->Index);
+        } break;
+
+        case IrOp_ProcedureAddress: {
+            fprintf(file, " %s", instruction->Procedure->Name);
+        } break;
+
+        case IrOp_Parameter: {
+            fprintf(file, " %llu", instruction->Index);
+        } break;
+
+        case IrOp_ExtractLane:
+        case IrOp_InsertLane: {
+            for (u64 i = 0; i < DynamicArrayLength(instruction->Operands); i++) {
+                fprintf(file, "%s %%%llu", i > 0 ? "," : "", instruction->Operands[i]->Id);
+            }
+            fprintf(file, ", %llu", instruction->Index);
+        } break;
+
+        case IrOp_Shuffle: {
+            fprintf(file, " %%%llu, [", instruction->Operands[0]->Id);
+            for (u64 i = 0; i < instruction->Type.Lanes; i++) {
+                fprintf(file, "%s%u", i > 0 ? " " : "", instruction->Shuffle[i]);
+            }
+            fprintf(file, "]");
+        } break;
+
+        case IrOp_Local: {
+            fprintf(file, " %llu, %llu", instruction->Memory.Size, instruction->Memory.Align);
+        } break;
+
+        case IrOp_Phi: {
+            for (u64 i = 0; i < DynamicArrayLength(instruction->Operands); i++) {
+                fprintf(file, "%s [%%%llu, b%llu]", i > 0 ? "," : "", instruction->Operands[i]->Id, instruction->Block->Predecessors[i]->Id);
+            }
+        } break;
+
+        case IrOp_Call: {
+            u64 first = 0;
+            if (instruction->Procedure) {
+                fprintf(file, " %s(", instruction->Procedure->Name);
+            } else {
+                fprintf(file, " %%%llu(", instruction->Operands[0]->Id);
+                first = 1;
+            }
+            for (u64 i = first; i < DynamicArrayLength(instruction->Operands); i++) {
+                fprintf(file, "%s%%%llu", i > first ? ", " : "", instruction->Operands[i]->Id);
+            }
+            fprintf(file, ")");
+        } break;
+
+        case IrOp_Jump: {
+            fprintf(file, " b%llu", instruction->Targets[0]->Id);
+        } break;
+
+        case IrOp_Branch: {
+            fprintf(file, " %%%llu, b%llu, b%llu", instruction->Operands[0]->Id, instruction->Targets[0]->Id, instruction->Targets[1]->Id);
+        } break;
+
+        case IrOp_Switch: {
+            fprintf(file, " %%%llu, b%llu, %lld [", instruction->Operands[0]->Id, instruction->Targets[0]->Id, cast(s64) instruction->Switch.Low);
+            for (u64 i = 0; i < DynamicArrayLength(instruction->Switch.Cases); i++) {
+                fprintf(file, "%sb%llu", i > 0 ? " " : "", instruction->Switch.Cases[i]->Id);
+            }
+            fprintf(file, "]");
+        } break;
+
+        default: {
+            for (u64 i = 0; i < DynamicArrayLength(instruction->Operands); i++) {
+                fprintf(file, "%s %%%llu", i > 0 ? "," : "", instruction->Operands[i]->Id);
+            }
+
+            if (instruction->Op == IrOp_Zero || instruction->Op == IrOp_Copy) {
+                fprintf(file, ", %llu", instruction->Memory.Size);
+            }
+        } break;
+    }
+
+    fputc('\n', file);
+}
+
+void IrProcedure_Print(FILE* file, IrProcedure* procedure) {
+    fprintf(file, "procedure %s(", procedure->Name);
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Parameters); i++) {
+        fprintf(file, "%s%s", i > 0 ? ", " : "", IrType_Name(procedure->Parameters[i]));
+    }
+    fprintf(file, ") -> %s {\n", IrType_Name(procedure->ReturnType));
+
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Blocks); i++) {
+        IrBlock* block = procedure->Blocks[i];
+        fprintf(file, "b%llu:", block->Id);
+        if (DynamicArrayLength(block->Predecessors) > 0) {
+            fprintf(file, " ; preds");
+            for (u64 j = 0; j < DynamicArrayLength(block->Predecessors); j++) {
+                fprintf(file, " b%llu", block->Predecessors[j]->Id);
+            }
+        }
+        fputc('\n', file);
+
+        for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+            IrInstruction_Print(file, block->Instructions[j]);
+        }
+    }
+
+    fprintf(file, "}\n");
+}
+
+static void IrString_Print(FILE* file, IrModule* module, IrString string) {
+    fputc('"', file);
+    for (u64 i = 0; i < string.Length; i++) {
+        u8 c = cast(u8) module->StringData[string.Offset + i];
+        switch (c) {
+            case '"': fprintf(file, "\\\""); break;
+            case '\\': fprintf(file, "\\\\"); break;
+            case '\n': fprintf(file, "\\n"); break;
+            case '\r': fprintf(file, "\\r"); break;
+            case '\t': fprintf(file, "\\t"); break;
+            default: {
+                if (c < 0x20 || c >= 0x7F) {
+                    fprintf(file, "\\x%02x", c);
+                } else {
+                    fputc(c, file);
+                }
+            } break;
+        }
+    }
+    fputc('"', file);
+}
+
+void IrModule_PrintStrings(FILE* file, IrModule* module) {
+    if (DynamicArrayLength(module->Strings) > 1) {
+        fprintf(file, "strings {\n");
+        for (u64 i = 1; i < DynamicArrayLength(module->Strings); i++) {
+            fprintf(file, "    %llu = ", i);
+            IrString_Print(file, module, module->Strings[i]);
+            fputc('\n', file);
+        }
+        fprintf(file, "}\n\n");
+    }
+}
+
+void IrModule_Print(FILE* file, IrModule* module) {
+    IrModule_PrintStrings(file, module);
+    for (u64 i = 0; i < DynamicArrayLength(module->Procedures); i++) {
+        if (i > 0) {
+            fputc('\n', file);
+        }
+        IrProcedure_Print(file, module->Procedures[i]);
+    }
+}
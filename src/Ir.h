@@ -0,0 +1,242 @@
+#pragma once
+
+#include "./Typedefs.h"
+#include "./DynamicArray.h"
+
+#include <stdio.h>
+
+typedef struct IrInstruction IrInstruction;
+typedef struct IrBlock IrBlock;
+typedef struct IrProcedure IrProcedure;
+typedef struct IrModule IrModule;
+
+typedef enum IrTypeKind {
+    IrTypeKind_Void,
+    IrTypeKind_Bool,
+    IrTypeKind_Integer,
+    IrTypeKind_Float,
+    IrTypeKind_Pointer,
+    IrTypeKind_Vector, // Lives in an xmm register, or ymm once it is 32 bytes
+} IrTypeKind;
+
+typedef struct IrType {
+    IrTypeKind Kind;
+    u8 Size;
+    b8 Signed;
+    u8 Lanes; // Vectors only, every lane is of LaneKind and Size / Lanes bytes
+    IrTypeKind LaneKind;
+} IrType;
+
+IrType IrType_Make(IrTypeKind kind, u8 size, b8 isSigned);
+IrType IrType_MakeVector(IrType lane, u8 lanes);
+IrType IrType_Lane(IrType vector);
+b8 IrType_Equal(IrType a, IrType b);
+const char* IrType_Name(IrType type);
+
+#define IrType_Void() IrType_Make(IrTypeKind_Void, 0, FALSE)
+#define IrType_Bool() IrType_Make(IrTypeKind_Bool, 1, FALSE)
+#define IrType_Pointer() IrType_Make(IrTypeKind_Pointer, 8, FALSE)
+
+typedef enum IrOp {
+    IrOp_None,
+
+    IrOp_Constant,
+    IrOp_Undefined,
+    IrOp_String, // Address of a read only (data, length) slice
+    IrOp_ProcedureAddress,
+    IrOp_Parameter,
+    IrOp_Local,
+    IrOp_Phi,
+
+    IrOp_Add,
+    IrOp_Subtract,
+    IrOp_Multiply,
+    IrOp_Divide,
+    IrOp_Modulo,
+    IrOp_And,
+    IrOp_Or,
+    IrOp_Equal,
+    IrOp_NotEqual,
+    IrOp_Less,
+    IrOp_LessEqual,
+
+    IrOp_Negate,
+    IrOp_Not,
+    IrOp_Convert,
+
+    // Vectors, lanes are numbered from the lowest address
+    IrOp_Splat, // Every lane is the scalar operand
+    IrOp_ExtractLane,
+    IrOp_InsertLane, // A copy of the vector operand with lane Index replaced by the scalar operand
+    IrOp_Shuffle,
+    IrOp_ReduceAdd,
+    IrOp_ReduceMin,
+    IrOp_ReduceMax,
+
+    IrOp_Offset,
+    IrOp_Load,
+    IrOp_Store,
+    IrOp_Zero,
+    IrOp_Copy,
+    IrOp_Call,
+    IrOp_BoundsCheck, // Traps unless the index operand is below the count operand
+
+    IrOp_Jump,
+    IrOp_Branch,
+    IrOp_Switch, // Jump table, successor 0 is the default and the others are the cases, see IrInstruction_SwitchTarget
+    IrOp_Return,
+
+    IrOp_Count,
+} IrOp;
+
+extern const char* IrOpNames[IrOp_Count];
+
+struct IrInstruction {
+    IrOp Op;
+    IrType Type;
+    u64 Id;
+    IrBlock* Block;
+    IrInstruction** Operands;
+    IrBlock* Targets[2];
+
+    union {
+        u64 Integer;
+        f64 Float;
+        u64 Index;                  // IrOp_Parameter, IrOp_String into the strings of the module, lane of IrOp_ExtractLane and IrOp_InsertLane
+        u8* Shuffle;                // IrOp_Shuffle, the lane of the operand every lane is taken from
+        struct {
+            IrBlock** Cases;        // Taken for the values Low, Low + 1 and so on, the default is in Targets[0]
+            u64 Low;
+        } Switch;                   // IrOp_Switch
+        IrProcedure* Procedure;     // IrOp_Call, IrOp_ProcedureAddress
+        struct {
+            u64 Size;
+            u64 Align;
+        } Memory;                   // IrOp_Local, IrOp_Zero, IrOp_Copy
+    };
+
+    IrInstruction* Replacement; // Set by passes, uses are rewritten by IrProcedure_ApplyReplacements
+    b8 Mark;
+};
+
+typedef struct IrDefinition {
+    const void* Variable;
+    IrInstruction* Value;
+} IrDefinition;
+
+struct IrBlock {
+    u64 Id;
+    IrProcedure* Procedure;
+    IrInstruction** Instructions;
+    IrBlock** Predecessors;
+
+    // SSA construction state, see IrBlock_ReadVariable
+    IrDefinition* Definitions;
+    IrDefinition* IncompletePhis;
+    b8 Sealed;
+
+    // Filled in by IrProcedure_Analyze
+    u64 Order;
+    IrBlock* Dominator;
+};
+
+struct IrProcedure {
+    const char* Name;
+    IrType* Parameters;
+    IrType ReturnType;
+    IrBlock** Blocks;
+
+    u64 NextInstructionId;
+    u64 NextBlockId;
+
+    IrModule* Module;
+    b8 NoInline; // Slow paths that are kept out of line
+};
+
+typedef struct IrString {
+    u64 Offset; // Into StringData, a zero follows every string
+    u64 Length;
+} IrString;
+
+struct IrModule {
+    IrProcedure** Procedures;
+
+    // Read only data, every distinct string literal is kept once
+    char* StringData;
+    IrString* Strings;
+    u32* StringTable; // Open addressing, indices into Strings
+    u64 StringTableCapacity;
+
+    // Runtime support for '[..]T', created on first use by the front end
+    IrProcedure* Reallocate; // Declaration only, the default allocator
+    IrProcedure* GrowArray;
+
+    // Runtime support for switches on strings, also created on first use
+    IrProcedure* HashString;
+    IrProcedure* StringEqual;
+};
+
+IrModule* IrModule_Create(void);
+u64 IrModule_InternString(IrModule* module, const char* data, u64 length);
+IrProcedure* IrProcedure_Create(IrModule* module, const char* name, IrType returnType);
+IrBlock* IrBlock_Create(IrProcedure* procedure);
+
+IrInstruction* IrInstruction_Create(IrProcedure* procedure, IrOp op, IrType type);
+b8 IrInstruction_IsTerminator(IrInstruction* instruction);
+b8 IrInstruction_HasSideEffects(IrInstruction* instruction);
+b8 IrInstruction_IsCommutative(IrInstruction* instruction);
+IrInstruction* IrInstruction_Resolve(IrInstruction* instruction);
+
+IrInstruction* IrBlock_Append(IrBlock* block, IrOp op, IrType type);
+IrInstruction* IrBlock_AppendInteger(IrBlock* block, IrType type, u64 value);
+IrInstruction* IrBlock_AppendFloat(IrBlock* block, IrType type, f64 value);
+IrInstruction* IrBlock_AppendUnary(IrBlock* block, IrOp op, IrType type, IrInstruction* operand);
+IrInstruction* IrBlock_AppendBinary(IrBlock* block, IrOp op, IrType type, IrInstruction* left, IrInstruction* right);
+IrInstruction* IrBlock_AppendJump(IrBlock* block, IrBlock* target);
+IrInstruction* IrBlock_AppendBranch(IrBlock* block, IrInstruction* condition, IrBlock* then, IrBlock* else_);
+IrInstruction* IrBlock_AppendSwitch(IrBlock* block, IrInstruction* value, u64 low, IrBlock* default_, IrBlock** cases);
+IrInstruction* IrBlock_AppendReturn(IrBlock* block, IrInstruction* value);
+
+IrInstruction* IrBlock_Terminator(IrBlock* block);
+u64 IrBlock_SuccessorCount(IrBlock* block);
+IrBlock* IrBlock_Successor(IrBlock* block, u64 index);
+IrBlock** IrInstruction_Target(IrInstruction* terminator, u64 index);
+IrBlock* IrInstruction_SwitchTarget(IrInstruction* instruction, u64 value);
+void IrBlock_RemovePredecessor(IrBlock* block, IrBlock* predecessor);
+void IrBlock_RemoveInstruction(IrBlock* block, IrInstruction* instruction);
+
+// SSA construction as described in "Simple and Efficient Construction of Static Single Assignment Form" (Braun et al.)
+void IrBlock_WriteVariable(IrBlock* block, const void* variable, IrInstruction* value);
+IrInstruction* IrBlock_ReadVariable(IrBlock* block, const void* variable, IrType type);
+void IrBlock_Seal(IrBlock* block);
+
+void IrProcedure_ApplyReplacements(IrProcedure* procedure);
+void IrProcedure_Analyze(IrProcedure* procedure);
+b8 IrBlock_Dominates(IrBlock* a, IrBlock* b);
+
+void IrProcedure_Print(FILE* file, IrProcedure* procedure);
+void IrModule_PrintStrings(FILE* file, IrModule* module); // Followed by a blank line, nothing without strings
+void IrModule_Print(FILE* file, IrModule* module);
+
+// IrOptimize.c
+
+// Evaluates arithmetic, comparisons and conversions on constant operands, FALSE when the result is not defined
+b8 IrFold_Evaluate(IrOp op, IrType type, IrType operandType, u64 a, u64 b, u64* result);
+
+b8 IrPass_ConstantPropagation(IrProcedure* procedure);
+b8 IrPass_DeadCodeElimination(IrProcedure* procedure);
+b8 IrPass_GlobalValueNumbering(IrProcedure* procedure);
+b8 IrPass_SimplifyCfg(IrProcedure* procedure);
+b8 IrPass_LoopInvariantCodeMotion(IrProcedure* procedure);
+b8 IrPass_StrengthReduction(IrProcedure* procedure);
+b8 IrPass_BoundsCheckElimination(IrProcedure* procedure);
+b8 IrPass_Inline(IrProcedure* procedure); // Small, non recursive callees should be optimized before their callers
+
+void IrOptimize_Procedure(IrProcedure* procedure);
+void IrOptimize_Module(IrModule* module);
+
+// IrInterpret.c
+
+// Calls a procedure without parameters at compile time. Returns NULL and sets result to the returned value in the
+// representation of constants, or describes why it stopped.
+const char* IrInterpret_Run(IrModule* module, IrProcedure* procedure, u64* result);
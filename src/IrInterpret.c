@@ -0,0 +1,552 @@
+#include "./Ir.h"
+#include "./Memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Interpreter for compile time execution
+//
+// Values use the representation of constants: integers truncated to their type, floats as the bits of an f64 and
+// pointers as host addresses, a procedure address is the IrProcedure itself. Locals are only freed once the run is
+// over, a pointer to one can outlive its procedure. Vectors do not fit either, a vector value is the address of a
+// buffer of its lanes. Each instruction of a running procedure owns one buffer that every run of it overwrites.
+//
+// The program is not trusted, every address it loads from or stores to must be inside memory the interpreter handed
+// out, and no instruction may use an undefined value.
+
+#define IrInterpret_MaxSteps 100000000
+#define IrInterpret_MaxDepth 1000
+
+typedef enum IrAllocationKind {
+    IrAllocationKind_Local,
+    IrAllocationKind_Heap, // From the default allocator, freed by the program or at the end of the run
+    IrAllocationKind_ReadOnly, // Strings
+} IrAllocationKind;
+
+typedef struct IrAllocation {
+    u8* Data;
+    u64 Size;
+    IrAllocationKind Kind;
+} IrAllocation;
+
+typedef struct IrInterpreter {
+    IrModule* Module;
+    u64 Steps;
+    u64 Depth;
+    IrAllocation* Allocations; // Sorted by address
+    u64* Strings; // A (data, length) slice for every string of the module
+    const char* Error;
+} IrInterpreter;
+
+// Index of the allocation containing address, or of the first one after it
+static u64 IrInterpret_Find(IrInterpreter* interpreter, u64 address) {
+    u64 low = 0;
+    u64 high = DynamicArrayLength(interpreter->Allocations);
+    while (low < high) {
+        u64 middle = low + (high - low) / 2;
+        IrAllocation* allocation = &interpreter->Allocations[middle];
+        if (cast(u64) allocation->Data + allocation->Size <= address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static void IrInterpret_Own(IrInterpreter* interpreter, void* data, u64 size, IrAllocationKind kind) {
+    IrAllocation allocation = { .Data = data, .Size = size, .Kind = kind };
+    DynamicArrayInsert(interpreter->Allocations, IrInterpret_Find(interpreter, cast(u64) data), allocation);
+}
+
+// Whether size bytes at address are inside one allocation, sets the error otherwise
+static b8 IrInterpret_Check(IrInterpreter* interpreter, u64 address, u64 size, b8 write) {
+    if (size == 0) {
+        return TRUE;
+    }
+
+    u64 index = IrInterpret_Find(interpreter, address);
+    if (index < DynamicArrayLength(interpreter->Allocations)) {
+        IrAllocation* allocation = &interpreter->Allocations[index];
+        u64 start = cast(u64) allocation->Data;
+        if (address >= start && size <= allocation->Size && address - start <= allocation->Size - size) {
+            if (write && allocation->Kind == IrAllocationKind_ReadOnly) {
+                interpreter->Error = "it writes to a string literal";
+                return FALSE;
+            }
+            return TRUE;
+        }
+    }
+
+    if (address == 0) {
+        interpreter->Error = write ? "it writes through a null pointer" : "it reads through a null pointer";
+    } else {
+        interpreter->Error = write ? "it writes outside of any allocation" : "it reads outside of any allocation";
+    }
+    return FALSE;
+}
+
+// Pointers compare and convert like addresses
+static IrType IrInterpret_ValueType(IrType type) {
+    return type.Kind == IrTypeKind_Pointer ? IrType_Make(IrTypeKind_Integer, 8, FALSE) : type;
+}
+
+static u64 IrInterpret_Load(IrType type, const void* address) {
+    switch (type.Kind) {
+        case IrTypeKind_Bool: {
+            return *cast(const u8*) address != 0;
+        } break;
+
+        case IrTypeKind_Float: {
+            f64 value;
+            if (type.Size == 4) {
+                f32 single;
+                memcpy(&single, address, sizeof(f32));
+                value = single;
+            } else {
+                memcpy(&value, address, sizeof(f64));
+            }
+            u64 bits;
+            memcpy(&bits, &value, sizeof(f64));
+            return bits;
+        } break;
+
+        case IrTypeKind_Integer: {
+            u64 value = 0;
+            memcpy(&value, address, type.Size);
+            if (type.Size < 8 && type.Signed && (value & (1ull << (type.Size * 8 - 1)))) {
+                value |= ~((1ull << (type.Size * 8)) - 1);
+            }
+            return value;
+        } break;
+
+        default: {
+            u64 value;
+            memcpy(&value, address, sizeof(u64));
+            return value;
+        } break;
+    }
+}
+
+static void IrInterpret_Store(IrType type, void* address, u64 value) {
+    if (type.Kind == IrTypeKind_Float && type.Size == 4) {
+        f64 wide;
+        memcpy(&wide, &value, sizeof(f64));
+        f32 single = cast(f32) wide;
+        memcpy(address, &single, sizeof(f32));
+    } else {
+        memcpy(address, &value, type.Size);
+    }
+}
+
+// The buffer of a vector instruction, operands are always other instructions so it never holds one of them
+static u8* IrInterpret_Vector(u8** vectors, IrInstruction* instruction) {
+    if (!vectors[instruction->Id]) {
+        vectors[instruction->Id] = calloc(1, instruction->Type.Size);
+    }
+    return vectors[instruction->Id];
+}
+
+// Applies an arithmetic instruction lane by lane
+static b8 IrInterpret_Lanes(u8** vectors, IrInstruction* instruction, u64* operands, u64* result) {
+    IrType lane = IrType_Lane(instruction->Type);
+    IrType operandLane = IrType_Lane(instruction->Operands[0]->Type);
+    u8* vector = IrInterpret_Vector(vectors, instruction);
+    u8* a = cast(u8*) operands[0];
+    u8* b = cast(u8*) operands[1];
+
+    for (u64 i = 0; i < instruction->Type.Lanes; i++) {
+        u64 left = IrInterpret_Load(operandLane, a + i * operandLane.Size);
+        u64 right = b ? IrInterpret_Load(operandLane, b + i * operandLane.Size) : 0;
+        u64 value;
+        if (!IrFold_Evaluate(instruction->Op, lane, operandLane, left, right, &value)) {
+            return FALSE;
+        }
+        IrInterpret_Store(lane, vector + i * lane.Size, value);
+    }
+
+    *result = cast(u64) vector;
+    return TRUE;
+}
+
+static u64 IrInterpret_Reduce(IrInstruction* instruction, u64* operands) {
+    IrType lane = instruction->Type;
+    u8* vector = cast(u8*) operands[0];
+
+    u64 result = IrInterpret_Load(lane, vector);
+    for (u64 i = 1; i < instruction->Operands[0]->Type.Lanes; i++) {
+        u64 value = IrInterpret_Load(lane, vector + i * lane.Size);
+        u64 less = FALSE;
+        switch (instruction->Op) {
+            case IrOp_ReduceAdd: {
+                IrFold_Evaluate(IrOp_Add, lane, lane, result, value, &result);
+            } break;
+
+            case IrOp_ReduceMin: {
+                IrFold_Evaluate(IrOp_Less, IrType_Bool(), lane, value, result, &less);
+                result = less ? value : result;
+            } break;
+
+            case IrOp_ReduceMax: {
+                IrFold_Evaluate(IrOp_Less, IrType_Bool(), lane, result, value, &less);
+                result = less ? value : result;
+            } break;
+
+            default: {
+                ASSERT(FALSE);
+            } break;
+        }
+    }
+    return result;
+}
+
+static b8 IrInterpret_Procedure(IrInterpreter* interpreter, IrProcedure* procedure, u64* arguments, u8* vectorResult, u64* result);
+
+static b8 IrInterpret_Call(IrInterpreter* interpreter, IrInstruction* call, u64* values, u8** vectors, u64* result) {
+    u64 first = 0;
+    IrProcedure* callee = call->Procedure;
+    if (!callee) { // Indirect calls pass the callee as the first operand
+        callee = cast(IrProcedure*) values[call->Operands[0]->Id];
+        first = 1;
+
+        u64 i = 0;
+        while (i < DynamicArrayLength(interpreter->Module->Procedures) && interpreter->Module->Procedures[i] != callee) {
+            i++;
+        }
+        if (i == DynamicArrayLength(interpreter->Module->Procedures)) {
+            interpreter->Error = "it calls something that is not a procedure";
+            return FALSE;
+        }
+    }
+
+    u64 count = DynamicArrayLength(call->Operands) - first;
+    u64* arguments = malloc((count + 1) * sizeof(u64));
+    for (u64 i = 0; i < count; i++) {
+        arguments[i] = values[call->Operands[first + i]->Id];
+    }
+
+    b8 ok = TRUE;
+    if (DynamicArrayLength(callee->Blocks) > 0) {
+        u8* vector = call->Type.Kind == IrTypeKind_Vector ? IrInterpret_Vector(vectors, call) : NULL;
+        ok = IrInterpret_Procedure(interpreter, callee, arguments, vector, result);
+    } else if (callee == interpreter->Module->Reallocate) { // (data, old size, new size)
+        // Only memory it allocated before can be grown or freed
+        u64 index = IrInterpret_Find(interpreter, arguments[0]);
+        IrAllocation* allocation = index < DynamicArrayLength(interpreter->Allocations) ? &interpreter->Allocations[index] : NULL;
+        if (arguments[0] && (!allocation || allocation->Kind != IrAllocationKind_Heap || cast(u64) allocation->Data != arguments[0])) {
+            interpreter->Error = "it reallocates memory the allocator did not hand out";
+            ok = FALSE;
+        } else {
+            if (arguments[0]) {
+                DynamicArrayPopAt(interpreter->Allocations, index, NULL);
+            }
+            if (arguments[2] == 0) {
+                free(cast(void*) arguments[0]);
+                *result = 0;
+            } else {
+                *result = cast(u64) realloc(cast(void*) arguments[0], arguments[2]);
+                IrInterpret_Own(interpreter, cast(void*) *result, arguments[2], IrAllocationKind_Heap);
+            }
+        }
+    } else {
+        interpreter->Error = "it calls a procedure without a body";
+        ok = FALSE;
+    }
+
+    free(arguments);
+    return ok;
+}
+
+// A vector result is copied to vectorResult, the buffers of the procedure are gone once it returns
+static b8 IrInterpret_Procedure(IrInterpreter* interpreter, IrProcedure* procedure, u64* arguments, u8* vectorResult, u64* result) {
+    if (interpreter->Depth >= IrInterpret_MaxDepth) {
+        interpreter->Error = "its calls nest too deeply";
+        return FALSE;
+    }
+    interpreter->Depth++;
+
+    u64* values = calloc(procedure->NextInstructionId, sizeof(u64));
+    b8* undefined = calloc(procedure->NextInstructionId, sizeof(b8));
+    u8** vectors = calloc(procedure->NextInstructionId, sizeof(u8*));
+    b8 ok = TRUE;
+
+    IrBlock* previous = NULL;
+    IrBlock* block = procedure->Blocks[0];
+    while (block && ok) {
+        // Phis read the values of the edge that was taken, all at once
+        u64 edge = 0;
+        while (previous && block->Predecessors[edge] != previous) {
+            edge++;
+        }
+
+        u64 phiCount = 0;
+        while (phiCount < DynamicArrayLength(block->Instructions) && block->Instructions[phiCount]->Op == IrOp_Phi) {
+            phiCount++;
+        }
+        // A phi may pass on an undefined value, only using it is an error. Vectors are copied into the buffer of the
+        // phi, the instruction they came from overwrites its own when it runs again.
+        u64* incoming = malloc((phiCount + 1) * sizeof(u64));
+        b8* incomingUndefined = malloc(phiCount + 1);
+        for (u64 i = 0; i < phiCount; i++) {
+            IrInstruction* operand = block->Instructions[i]->Operands[edge];
+            incoming[i] = values[operand->Id];
+            incomingUndefined[i] = undefined[operand->Id];
+            if (operand->Type.Kind == IrTypeKind_Vector && !undefined[operand->Id]) {
+                u8* copy = malloc(operand->Type.Size);
+                memcpy(copy, cast(void*) values[operand->Id], operand->Type.Size);
+                incoming[i] = cast(u64) copy;
+            }
+        }
+        for (u64 i = 0; i < phiCount; i++) {
+            IrInstruction* phi = block->Instructions[i];
+            values[phi->Id] = incoming[i];
+            undefined[phi->Id] = incomingUndefined[i];
+            if (phi->Type.Kind == IrTypeKind_Vector && !incomingUndefined[i]) {
+                u8* buffer = IrInterpret_Vector(vectors, phi);
+                memcpy(buffer, cast(void*) incoming[i], phi->Type.Size);
+                free(cast(void*) incoming[i]);
+                values[phi->Id] = cast(u64) buffer;
+            }
+        }
+        free(incomingUndefined);
+        free(incoming);
+
+        IrBlock* next = NULL;
+        for (u64 i = phiCount; i < DynamicArrayLength(block->Instructions) && ok; i++) {
+            IrInstruction* instruction = block->Instructions[i];
+            u64 operands[2] = {};
+            for (u64 j = 0; j < DynamicArrayLength(instruction->Operands); j++) {
+                if (undefined[instruction->Operands[j]->Id]) {
+                    interpreter->Error = "it uses an undefined value, like the result of a procedure that did not return one";
+                    ok = FALSE;
+                } else if (j < 2) {
+                    operands[j] = values[instruction->Operands[j]->Id];
+                }
+            }
+            if (!ok) {
+                break;
+            }
+
+            if (++interpreter->Steps > IrInterpret_MaxSteps) {
+                interpreter->Error = "it ran for too long";
+                ok = FALSE;
+                break;
+            }
+
+            u64 value = 0;
+            switch (instruction->Op) {
+                case IrOp_Constant: {
+                    value = instruction->Integer;
+                } break;
+
+                case IrOp_Undefined: {
+                    undefined[instruction->Id] = TRUE;
+                } break;
+
+                case IrOp_String: {
+                    value = cast(u64) &interpreter->Strings[instruction->Index * 2];
+                } break;
+
+                case IrOp_ProcedureAddress: {
+                    value = cast(u64) instruction->Procedure;
+                } break;
+
+                case IrOp_Parameter: {
+                    value = arguments[instruction->Index];
+                } break;
+
+                case IrOp_Local: {
+                    void* memory = calloc(1, instruction->Memory.Size > 0 ? instruction->Memory.Size : 1);
+                    IrInterpret_Own(interpreter, memory, instruction->Memory.Size, IrAllocationKind_Local);
+                    value = cast(u64) memory;
+                } break;
+
+                case IrOp_Add:
+                case IrOp_Subtract:
+                case IrOp_Multiply:
+                case IrOp_Divide:
+                case IrOp_Modulo:
+                case IrOp_And:
+                case IrOp_Or:
+                case IrOp_Equal:
+                case IrOp_NotEqual:
+                case IrOp_Less:
+                case IrOp_LessEqual:
+                case IrOp_Negate:
+                case IrOp_Not:
+                case IrOp_Convert: {
+                    if (instruction->Type.Kind == IrTypeKind_Vector) {
+                        if (!IrInterpret_Lanes(vectors, instruction, operands, &value)) {
+                            interpreter->Error = instruction->Op == IrOp_Convert ? "it converts a float that is out of range" : "it divides by zero";
+                            ok = FALSE;
+                        }
+                        break;
+                    }
+
+                    IrType type = IrInterpret_ValueType(instruction->Type);
+                    IrType operandType = IrInterpret_ValueType(instruction->Operands[0]->Type);
+                    if (!IrFold_Evaluate(instruction->Op, type, operandType, operands[0], operands[1], &value)) {
+                        interpreter->Error = instruction->Op == IrOp_Convert ? "it converts a float that is out of range" : "it divides by zero";
+                        ok = FALSE;
+                    }
+                } break;
+
+                case IrOp_Offset: {
+                    value = operands[0] + operands[1];
+                } break;
+
+                case IrOp_Load: {
+                    if (!IrInterpret_Check(interpreter, operands[0], instruction->Type.Size, FALSE)) {
+                        ok = FALSE;
+                    } else if (instruction->Type.Kind == IrTypeKind_Vector) {
+                        u8* vector = IrInterpret_Vector(vectors, instruction);
+                        memcpy(vector, cast(void*) operands[0], instruction->Type.Size);
+                        value = cast(u64) vector;
+                    } else {
+                        value = IrInterpret_Load(instruction->Type, cast(void*) operands[0]);
+                    }
+                } break;
+
+                case IrOp_Store: {
+                    IrType type = instruction->Operands[1]->Type;
+                    if (!IrInterpret_Check(interpreter, operands[0], type.Size, TRUE)) {
+                        ok = FALSE;
+                    } else if (type.Kind == IrTypeKind_Vector) {
+                        memcpy(cast(void*) operands[0], cast(void*) operands[1], type.Size);
+                    } else {
+                        IrInterpret_Store(type, cast(void*) operands[0], operands[1]);
+                    }
+                } break;
+
+                case IrOp_Zero: {
+                    if (!IrInterpret_Check(interpreter, operands[0], instruction->Memory.Size, TRUE)) {
+                        ok = FALSE;
+                    } else {
+                        memset(cast(void*) operands[0], 0, instruction->Memory.Size);
+                    }
+                } break;
+
+                case IrOp_Copy: {
+                    if (!IrInterpret_Check(interpreter, operands[0], instruction->Memory.Size, TRUE) ||
+                        !IrInterpret_Check(interpreter, operands[1], instruction->Memory.Size, FALSE)) {
+                        ok = FALSE;
+                    } else {
+                        memmove(cast(void*) operands[0], cast(void*) operands[1], instruction->Memory.Size);
+                    }
+                } break;
+
+                case IrOp_Splat: {
+                    IrType lane = IrType_Lane(instruction->Type);
+                    u8* vector = IrInterpret_Vector(vectors, instruction);
+                    for (u64 j = 0; j < instruction->Type.Lanes; j++) {
+                        IrInterpret_Store(lane, vector + j * lane.Size, operands[0]);
+                    }
+                    value = cast(u64) vector;
+                } break;
+
+                case IrOp_ExtractLane: {
+                    value = IrInterpret_Load(instruction->Type, cast(u8*) operands[0] + instruction->Index * instruction->Type.Size);
+                } break;
+
+                case IrOp_InsertLane: {
+                    IrType lane = IrType_Lane(instruction->Type);
+                    u8* vector = IrInterpret_Vector(vectors, instruction);
+                    memcpy(vector, cast(void*) operands[0], instruction->Type.Size);
+                    IrInterpret_Store(lane, vector + instruction->Index * lane.Size, operands[1]);
+                    value = cast(u64) vector;
+                } break;
+
+                case IrOp_Shuffle: {
+                    u64 size = IrType_Lane(instruction->Type).Size;
+                    u8* vector = IrInterpret_Vector(vectors, instruction);
+                    for (u64 j = 0; j < instruction->Type.Lanes; j++) {
+                        memcpy(vector + j * size, cast(u8*) operands[0] + instruction->Shuffle[j] * size, size);
+                    }
+                    value = cast(u64) vector;
+                } break;
+
+                case IrOp_ReduceAdd:
+                case IrOp_ReduceMin:
+                case IrOp_ReduceMax: {
+                    value = IrInterpret_Reduce(instruction, operands);
+                } break;
+
+                case IrOp_Call: {
+                    ok = IrInterpret_Call(interpreter, instruction, values, vectors, &value);
+                } break;
+
+                case IrOp_BoundsCheck: {
+                    if (operands[0] >= operands[1]) {
+                        interpreter->Error = "it indexes out of bounds";
+                        ok = FALSE;
+                    }
+                } break;
+
+                case IrOp_Jump: {
+                    next = instruction->Targets[0];
+                } break;
+
+                case IrOp_Branch: {
+                    next = instruction->Targets[operands[0] ? 0 : 1];
+                } break;
+
+                case IrOp_Switch: {
+                    next = IrInstruction_SwitchTarget(instruction, operands[0]);
+                } break;
+
+                case IrOp_Return: {
+                    *result = DynamicArrayLength(instruction->Operands) > 0 ? operands[0] : 0;
+                    if (vectorResult) {
+                        memcpy(vectorResult, cast(void*) *result, procedure->ReturnType.Size);
+                        *result = cast(u64) vectorResult;
+                    }
+                } break;
+
+                default: {
+                    ASSERT(FALSE);
+                } break;
+            }
+            values[instruction->Id] = value;
+        }
+
+        previous = block;
+        block = next;
+    }
+
+    for (u64 i = 0; i < procedure->NextInstructionId; i++) {
+        free(vectors[i]);
+    }
+    free(vectors);
+    free(undefined);
+    free(values);
+
+    interpreter->Depth--;
+    return ok;
+}
+
+const char* IrInterpret_Run(IrModule* module, IrProcedure* procedure, u64* result) {
+    IrInterpreter interpreter = {
+        .Module = module,
+        .Allocations = DynamicArrayCreate(IrAllocation),
+        .Strings = malloc(DynamicArrayLength(module->Strings) * 2 * sizeof(u64)),
+    };
+
+    for (u64 i = 0; i < DynamicArrayLength(module->Strings); i++) {
+        interpreter.Strings[i * 2] = cast(u64) &module->StringData[module->Strings[i].Offset];
+        interpreter.Strings[i * 2 + 1] = module->Strings[i].Length;
+    }
+    IrInterpret_Own(&interpreter, interpreter.Strings, DynamicArrayLength(module->Strings) * 2 * sizeof(u64), IrAllocationKind_ReadOnly);
+    IrInterpret_Own(&interpreter, module->StringData, DynamicArrayLength(module->StringData), IrAllocationKind_ReadOnly);
+
+    *result = 0;
+    b8 ok = IrInterpret_Procedure(&interpreter, procedure, NULL, NULL, result);
+
+    for (u64 i = 0; i < DynamicArrayLength(interpreter.Allocations); i++) {
+        if (interpreter.Allocations[i].Kind != IrAllocationKind_ReadOnly) {
+            free(interpreter.Allocations[i].Data);
+        }
+    }
+    DynamicArrayDestroy(interpreter.Allocations);
+    free(interpreter.Strings);
+    return ok ? NULL : interpreter.Error;
+}
@@ -0,0 +1,1626 @@
+#include "./Ir.h"
+#include "./Memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Constant folding
+
+static u64 IrFold_Truncate(IrType type, u64 value) {
+    if (type.Kind == IrTypeKind_Bool) {
+        return value != 0;
+    }
+
+    if (type.Kind != IrTypeKind_Integer || type.Size >= 8) {
+        return value;
+    }
+
+    u64 bits = type.Size * 8;
+    u64 mask = (1ull << bits) - 1;
+    value &= mask;
+    if (type.Signed && (value & (1ull << (bits - 1)))) {
+        value |= ~mask;
+    }
+    return value;
+}
+
+static f64 IrFold_Round(IrType type, f64 value) {
+    return type.Size == 4 ? cast(f64) (cast(f32) value) : value;
+}
+
+static b8 IrFold_Instruction(IrOp op, IrType type, IrType operandType, u64 a, u64 b, u64* result) {
+    if (operandType.Kind == IrTypeKind_Float && op != IrOp_Convert) {
+        f64 x, y, z;
+        memcpy(&x, &a, sizeof(f64));
+        memcpy(&y, &b, sizeof(f64));
+
+        switch (op) {
+            case IrOp_Add: z = x + y; break;
+            case IrOp_Subtract: z = x - y; break;
+            case IrOp_Multiply: z = x * y; break;
+            case IrOp_Divide: z = x / y; break;
+            case IrOp_Negate: z = -x; break;
+            case IrOp_Equal: *result = x == y; return TRUE;
+            case IrOp_NotEqual: *result = x != y; return TRUE;
+            case IrOp_Less: *result = x < y; return TRUE;
+            case IrOp_LessEqual: *result = x <= y; return TRUE;
+            default: return FALSE;
+        }
+
+        z = IrFold_Round(type, z);
+        memcpy(result, &z, sizeof(f64));
+        return TRUE;
+    }
+
+    if (operandType.Kind != IrTypeKind_Integer && operandType.Kind != IrTypeKind_Bool) {
+        return FALSE;
+    }
+
+    switch (op) {
+        case IrOp_Add: *result = a + b; break;
+        case IrOp_Subtract: *result = a - b; break;
+        case IrOp_Multiply: *result = a * b; break;
+        case IrOp_And: *result = a & b; break;
+        case IrOp_Or: *result = a | b; break;
+        case IrOp_Negate: *result = 0 - a; break;
+        case IrOp_Not: *result = !a; break;
+        case IrOp_Equal: *result = a == b; return TRUE;
+        case IrOp_NotEqual: *result = a != b; return TRUE;
+        case IrOp_Less: *result = operandType.Signed ? cast(s64) a < cast(s64) b : a < b; return TRUE;
+        case IrOp_LessEqual: *result = operandType.Signed ? cast(s64) a <= cast(s64) b : a <= b; return TRUE;
+
+        case IrOp_Divide:
+        case IrOp_Modulo: {
+            if (b == 0) {
+                return FALSE;
+            }
+
+            if (operandType.Signed) {
+                s64 x = cast(s64) a;
+                s64 y = cast(s64) b;
+                if (y == -1) { // Avoids overflowing on the smallest value
+                    *result = op == IrOp_Divide ? 0 - a : 0;
+                } else {
+                    *result = cast(u64) (op == IrOp_Divide ? x / y : x % y);
+                }
+            } else {
+                *result = op == IrOp_Divide ? a / b : a % b;
+            }
+        } break;
+
+        case IrOp_Convert: {
+            if (type.Kind == IrTypeKind_Float) {
+                f64 value = operandType.Signed ? cast(f64) (cast(s64) a) : cast(f64) a;
+                value = IrFold_Round(type, value);
+                memcpy(result, &value, sizeof(f64));
+                return TRUE;
+            } else if (type.Kind == IrTypeKind_Integer || type.Kind == IrTypeKind_Bool) {
+                *result = a;
+            } else {
+                return FALSE;
+            }
+        } break;
+
+        default: {
+            return FALSE;
+        } break;
+    }
+
+    *result = IrFold_Truncate(type, *result);
+    return TRUE;
+}
+
+static b8 IrFold_FloatConvert(IrType type, IrType operandType, u64 a, u64* result) {
+    f64 value;
+    memcpy(&value, &a, sizeof(f64));
+
+    if (type.Kind == IrTypeKind_Float) {
+        value = IrFold_Round(type, value);
+        memcpy(result, &value, sizeof(f64));
+        return TRUE;
+    } else if (type.Kind == IrTypeKind_Integer) {
+        if (value != value || value >= 18446744073709551616.0 || value <= -9223372036854775809.0) {
+            return FALSE;
+        }
+        *result = IrFold_Truncate(type, type.Signed || value < 0.0 ? cast(u64) (cast(s64) value) : cast(u64) value);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+// Sparse conditional constant propagation, iterated densely over the blocks in reverse post order
+
+typedef enum IrLatticeState {
+    IrLatticeState_Top,
+    IrLatticeState_Constant,
+    IrLatticeState_Bottom,
+} IrLatticeState;
+
+typedef struct IrLattice {
+    IrLatticeState State;
+    u64 Value;
+} IrLattice;
+
+static IrLattice IrLattice_Meet(IrLattice a, IrLattice b) {
+    if (a.State == IrLatticeState_Top) {
+        return b;
+    }
+    if (b.State == IrLatticeState_Top) {
+        return a;
+    }
+    if (a.State == IrLatticeState_Bottom || b.State == IrLatticeState_Bottom || a.Value != b.Value) {
+        return (IrLattice){ .State = IrLatticeState_Bottom };
+    }
+    return a;
+}
+
+b8 IrFold_Evaluate(IrOp op, IrType type, IrType operandType, u64 a, u64 b, u64* result) {
+    if (op == IrOp_Convert && operandType.Kind == IrTypeKind_Float) {
+        return IrFold_FloatConvert(type, operandType, a, result);
+    }
+    return IrFold_Instruction(op, type, operandType, a, b, result);
+}
+
+static IrLattice IrLattice_Evaluate(IrInstruction* instruction, IrLattice* values, b8** executableEdges) {
+    IrLattice bottom = { .State = IrLatticeState_Bottom };
+    IrLattice top = { .State = IrLatticeState_Top };
+
+    switch (instruction->Op) {
+        case IrOp_Constant: {
+            return (IrLattice){ .State = IrLatticeState_Constant, .Value = instruction->Integer };
+        } break;
+
+        case IrOp_Undefined: {
+            return top;
+        } break;
+
+        case IrOp_Phi: {
+            IrLattice result = top;
+            b8* executable = executableEdges[instruction->Block->Id];
+            for (u64 i = 0; i < DynamicArrayLength(instruction->Operands); i++) {
+                if (executable[i]) {
+                    result = IrLattice_Meet(result, values[instruction->Operands[i]->Id]);
+                }
+            }
+            return result;
+        } break;
+
+        case IrOp_Add:
+        case IrOp_Subtract:
+        case IrOp_Multiply:
+        case IrOp_Divide:
+        case IrOp_Modulo:
+        case IrOp_And:
+        case IrOp_Or:
+        case IrOp_Equal:
+        case IrOp_NotEqual:
+        case IrOp_Less:
+        case IrOp_LessEqual:
+        case IrOp_Negate:
+        case IrOp_Not:
+        case IrOp_Convert: {
+            u64 operandCount = DynamicArrayLength(instruction->Operands);
+            u64 operands[2] = {};
+            for (u64 i = 0; i < operandCount; i++) {
+                IrLattice operand = values[instruction->Operands[i]->Id];
+                if (operand.State == IrLatticeState_Bottom) {
+                    return bottom;
+                }
+                if (operand.State == IrLatticeState_Top) {
+                    return top;
+                }
+                operands[i] = operand.Value;
+            }
+
+            IrType operandType = instruction->Operands[0]->Type;
+            u64 result = 0;
+            if (!IrFold_Evaluate(instruction->Op, instruction->Type, operandType, operands[0], operands[1], &result)) {
+                return bottom;
+            }
+            return (IrLattice){ .State = IrLatticeState_Constant, .Value = result };
+        } break;
+
+        default: {
+            return bottom;
+        } break;
+    }
+}
+
+static b8 IrLattice_MarkEdge(IrBlock* from, IrBlock* to, b8* executableBlocks, b8** executableEdges) {
+    b8 changed = !executableBlocks[to->Id];
+    executableBlocks[to->Id] = TRUE;
+
+    for (u64 i = 0; i < DynamicArrayLength(to->Predecessors); i++) {
+        if (to->Predecessors[i] == from && !executableEdges[to->Id][i]) {
+            executableEdges[to->Id][i] = TRUE;
+            changed = TRUE;
+        }
+    }
+    return changed;
+}
+
+// A switch on a known value keeps only one edge into the block it selects
+static void IrSwitch_ConvertToJump(IrBlock* block, u64 value) {
+    IrInstruction* terminator = IrBlock_Terminator(block);
+    IrBlock* taken = IrInstruction_SwitchTarget(terminator, value);
+    b8 kept = FALSE;
+    for (u64 i = 0; i < IrBlock_SuccessorCount(block); i++) {
+        IrBlock* target = IrBlock_Successor(block, i);
+        if (target == taken && !kept) {
+            kept = TRUE;
+        } else {
+            IrBlock_RemovePredecessor(target, block);
+        }
+    }
+
+    terminator->Op = IrOp_Jump;
+    terminator->Targets[0] = taken;
+    terminator->Targets[1] = NULL;
+    DynamicArrayLength(terminator->Operands) = 0;
+}
+
+b8 IrPass_ConstantPropagation(IrProcedure* procedure) {
+    u64 blockCount = DynamicArrayLength(procedure->Blocks);
+    if (blockCount == 0) {
+        return FALSE;
+    }
+
+    IrLattice* values = Allocate(procedure->NextInstructionId * sizeof(IrLattice));
+    b8* executableBlocks = Allocate(procedure->NextBlockId * sizeof(b8));
+    b8** executableEdges = Allocate(procedure->NextBlockId * sizeof(b8*));
+    for (u64 i = 0; i < blockCount; i++) {
+        IrBlock* block = procedure->Blocks[i];
+        executableEdges[block->Id] = Allocate(DynamicArrayLength(block->Predecessors) * sizeof(b8) + 1);
+    }
+
+    executableBlocks[procedure->Blocks[0]->Id] = TRUE;
+
+    b8 changed = TRUE;
+    while (changed) {
+        changed = FALSE;
+        for (u64 i = 0; i < blockCount; i++) {
+            IrBlock* block = procedure->Blocks[i];
+            if (!executableBlocks[block->Id]) {
+                continue;
+            }
+
+            for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+                IrInstruction* instruction = block->Instructions[j];
+
+                if (instruction->Op == IrOp_Jump) {
+                    changed |= IrLattice_MarkEdge(block, instruction->Targets[0], executableBlocks, executableEdges);
+                    continue;
+                } else if (instruction->Op == IrOp_Branch) {
+                    IrLattice condition = values[instruction->Operands[0]->Id];
+                    if (condition.State == IrLatticeState_Constant) {
+                        IrBlock* target = instruction->Targets[condition.Value ? 0 : 1];
+                        changed |= IrLattice_MarkEdge(block, target, executableBlocks, executableEdges);
+                    } else if (condition.State == IrLatticeState_Bottom) {
+                        changed |= IrLattice_MarkEdge(block, instruction->Targets[0], executableBlocks, executableEdges);
+                        changed |= IrLattice_MarkEdge(block, instruction->Targets[1], executableBlocks, executableEdges);
+                    }
+                    continue;
+                } else if (instruction->Op == IrOp_Switch) {
+                    IrLattice value = values[instruction->Operands[0]->Id];
+                    if (value.State == IrLatticeState_Constant) {
+                        IrBlock* target = IrInstruction_SwitchTarget(instruction, value.Value);
+                        changed |= IrLattice_MarkEdge(block, target, executableBlocks, executableEdges);
+                    } else if (value.State == IrLatticeState_Bottom) {
+                        for (u64 k = 0; k < IrBlock_SuccessorCount(block); k++) {
+                            changed |= IrLattice_MarkEdge(block, IrBlock_Successor(block, k), executableBlocks, executableEdges);
+                        }
+                    }
+                    continue;
+                }
+
+                IrLattice old = values[instruction->Id];
+                IrLattice new = IrLattice_Meet(old, IrLattice_Evaluate(instruction, values, executableEdges));
+                if (new.State != old.State || new.Value != old.Value) {
+                    values[instruction->Id] = new;
+                    changed = TRUE;
+                }
+            }
+        }
+    }
+
+    b8 result = FALSE;
+    for (u64 i = 0; i < blockCount; i++) {
+        IrBlock* block = procedure->Blocks[i];
+        if (!executableBlocks[block->Id]) {
+            continue;
+        }
+
+        for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+            IrInstruction* instruction = block->Instructions[j];
+            IrLattice value = values[instruction->Id];
+
+            if (instruction->Op == IrOp_Branch) {
+                IrLattice condition = values[instruction->Operands[0]->Id];
+                if (condition.State != IrLatticeState_Constant) {
+                    continue;
+                }
+
+                IrBlock* taken = instruction->Targets[condition.Value ? 0 : 1];
+                IrBlock* notTaken = instruction->Targets[condition.Value ? 1 : 0];
+                IrBlock_RemovePredecessor(notTaken, block);
+
+                instruction->Op = IrOp_Jump;
+                instruction->Targets[0] = taken;
+                instruction->Targets[1] = NULL;
+                DynamicArrayLength(instruction->Operands) = 0;
+                result = TRUE;
+            } else if (instruction->Op == IrOp_Switch) {
+                IrLattice switchValue = values[instruction->Operands[0]->Id];
+                if (switchValue.State == IrLatticeState_Constant) {
+                    IrSwitch_ConvertToJump(block, switchValue.Value);
+                    result = TRUE;
+                }
+            } else if (value.State == IrLatticeState_Constant && instruction->Op != IrOp_Constant) {
+                instruction->Op = IrOp_Constant;
+                instruction->Integer = value.Value;
+                DynamicArrayLength(instruction->Operands) = 0;
+                result = TRUE;
+            }
+        }
+    }
+
+    for (u64 i = 0; i < blockCount; i++) {
+        free(executableEdges[procedure->Blocks[i]->Id]);
+    }
+    free(executableEdges);
+    free(executableBlocks);
+    free(values);
+
+    if (result) {
+        IrProcedure_Analyze(procedure);
+    }
+    return result;
+}
+
+// Dead code elimination
+
+b8 IrPass_DeadCodeElimination(IrProcedure* procedure) {
+    IrInstruction** worklist = DynamicArrayCreate(IrInstruction*);
+
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Blocks); i++) {
+        IrBlock* block = procedure->Blocks[i];
+        for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+            IrInstruction* instruction = block->Instructions[j];
+            instruction->Mark = IrInstruction_HasSideEffects(instruction);
+            if (instruction->Mark) {
+                DynamicArrayPush(worklist, instruction);
+            }
+        }
+    }
+
+    while (DynamicArrayLength(worklist) > 0) {
+        IrInstruction* instruction;
+        DynamicArrayPop(worklist, &instruction);
+
+        for (u64 i = 0; i < DynamicArrayLength(instruction->Operands); i++) {
+            IrInstruction* operand = instruction->Operands[i];
+            if (!operand->Mark) {
+                operand->Mark = TRUE;
+                DynamicArrayPush(worklist, operand);
+            }
+        }
+    }
+    DynamicArrayDestroy(worklist);
+
+    b8 changed = FALSE;
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Blocks); i++) {
+        IrBlock* block = procedure->Blocks[i];
+
+        u64 count = 0;
+        for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+            IrInstruction* instruction = block->Instructions[j];
+            if (instruction->Mark) {
+                block->Instructions[count++] = instruction;
+            } else {
+                changed = TRUE;
+            }
+        }
+        DynamicArrayLength(block->Instructions) = count;
+    }
+    return changed;
+}
+
+// Global value numbering over the dominator tree
+
+static b8 IrValueNumber_Eligible(IrInstruction* instruction) {
+    switch (instruction->Op) {
+        case IrOp_Constant:
+        case IrOp_String:
+        case IrOp_ProcedureAddress:
+        case IrOp_Parameter:
+        case IrOp_Phi:
+        case IrOp_Add:
+        case IrOp_Subtract:
+        case IrOp_Multiply:
+        case IrOp_Divide:
+        case IrOp_Modulo:
+        case IrOp_And:
+        case IrOp_Or:
+        case IrOp_Equal:
+        case IrOp_NotEqual:
+        case IrOp_Less:
+        case IrOp_LessEqual:
+        case IrOp_Negate:
+        case IrOp_Not:
+        case IrOp_Convert:
+        case IrOp_Offset:
+        case IrOp_Splat:
+        case IrOp_ExtractLane:
+        case IrOp_InsertLane:
+        case IrOp_Shuffle: // Compares the pattern by address, equal patterns from different shuffles are kept apart
+        case IrOp_ReduceAdd:
+        case IrOp_ReduceMin:
+        case IrOp_ReduceMax:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+// Reading a lane that was inserted or broadcast reuses the scalar, lanes inserted in between are skipped
+static IrInstruction* IrValueNumber_ForwardLane(IrInstruction* extract) {
+    IrInstruction* vector = IrInstruction_Resolve(extract->Operands[0]);
+    while (vector->Op == IrOp_InsertLane && vector->Index != extract->Index) {
+        vector = IrInstruction_Resolve(vector->Operands[0]);
+    }
+
+    if (vector->Op == IrOp_InsertLane || vector->Op == IrOp_Splat) {
+        return IrInstruction_Resolve(vector->Operands[vector->Op == IrOp_InsertLane ? 1 : 0]);
+    }
+    return NULL;
+}
+
+static u64 IrValueNumber_Hash(IrInstruction* instruction) {
+    u64 hash = 14695981039346656037ull;
+    hash = (hash ^ instruction->Op) * 1099511628211ull;
+    hash = (hash ^ instruction->Type.Kind) * 1099511628211ull;
+    hash = (hash ^ instruction->Type.Size) * 1099511628211ull;
+    hash = (hash ^ instruction->Integer) * 1099511628211ull;
+
+    // Xor keeps the hash independent of operand order for commutative instructions
+    u64 operands = 0;
+    for (u64 i = 0; i < DynamicArrayLength(instruction->Operands); i++) {
+        operands ^= IrInstruction_Resolve(instruction->Operands[i])->Id * 0x9E3779B97F4A7C15ull;
+    }
+    hash = (hash ^ operands) * 1099511628211ull;
+    return hash;
+}
+
+static b8 IrValueNumber_Equal(IrInstruction* a, IrInstruction* b) {
+    if (a->Op != b->Op || !IrType_Equal(a->Type, b->Type) || a->Integer != b->Integer) {
+        return FALSE;
+    }
+
+    u64 count = DynamicArrayLength(a->Operands);
+    if (count != DynamicArrayLength(b->Operands)) {
+        return FALSE;
+    }
+
+    if (a->Op == IrOp_Phi && a->Block != b->Block) {
+        return FALSE;
+    }
+
+    b8 same = TRUE;
+    for (u64 i = 0; i < count; i++) {
+        if (IrInstruction_Resolve(a->Operands[i]) != IrInstruction_Resolve(b->Operands[i])) {
+            same = FALSE;
+            break;
+        }
+    }
+
+    if (!same && count == 2 && IrInstruction_IsCommutative(a)) {
+        same =
+            IrInstruction_Resolve(a->Operands[0]) == IrInstruction_Resolve(b->Operands[1]) &&
+            IrInstruction_Resolve(a->Operands[1]) == IrInstruction_Resolve(b->Operands[0]);
+    }
+    return same;
+}
+
+b8 IrPass_GlobalValueNumbering(IrProcedure* procedure) {
+    u64 capacity = 16;
+    while (capacity < procedure->NextInstructionId * 2) {
+        capacity *= 2;
+    }
+    IrInstruction** table = Allocate(capacity * sizeof(IrInstruction*));
+
+    b8 changed = FALSE;
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Blocks); i++) {
+        IrBlock* block = procedure->Blocks[i];
+        for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+            IrInstruction* instruction = block->Instructions[j];
+            if (!IrValueNumber_Eligible(instruction)) {
+                continue;
+            }
+
+            if (instruction->Op == IrOp_ExtractLane) {
+                instruction->Replacement = IrValueNumber_ForwardLane(instruction);
+                if (instruction->Replacement) {
+                    changed = TRUE;
+                    continue;
+                }
+            }
+
+            u64 slot = IrValueNumber_Hash(instruction) & (capacity - 1);
+            while (table[slot]) {
+                IrInstruction* existing = table[slot];
+                if (IrValueNumber_Equal(existing, instruction) && IrBlock_Dominates(existing->Block, block)) {
+                    instruction->Replacement = existing;
+                    changed = TRUE;
+                    break;
+                }
+                slot = (slot + 1) & (capacity - 1);
+            }
+
+            if (!instruction->Replacement) {
+                table[slot] = instruction;
+            }
+        }
+    }
+
+    free(table);
+
+    if (changed) {
+        IrProcedure_ApplyReplacements(procedure);
+    }
+    return changed;
+}
+
+// Control flow graph simplification
+
+static void IrBlock_ConvertToJump(IrBlock* block, IrBlock* target) {
+    IrInstruction* terminator = IrBlock_Terminator(block);
+    terminator->Op = IrOp_Jump;
+    terminator->Targets[0] = target;
+    terminator->Targets[1] = NULL;
+    DynamicArrayLength(terminator->Operands) = 0;
+}
+
+static b8 IrBlock_HasPhis(IrBlock* block) {
+    for (u64 i = 0; i < DynamicArrayLength(block->Instructions); i++) {
+        if (block->Instructions[i]->Op == IrOp_Phi) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static b8 IrSimplify_Branches(IrProcedure* procedure) {
+    b8 changed = FALSE;
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Blocks); i++) {
+        IrBlock* block = procedure->Blocks[i];
+        IrInstruction* terminator = IrBlock_Terminator(block);
+        if (terminator && terminator->Op == IrOp_Switch) {
+            IrInstruction* value = IrInstruction_Resolve(terminator->Operands[0]);
+            if (value->Op == IrOp_Constant) {
+                IrSwitch_ConvertToJump(block, value->Integer);
+                changed = TRUE;
+            }
+            continue;
+        } else if (!terminator || terminator->Op != IrOp_Branch) {
+            continue;
+        }
+
+        IrInstruction* condition = IrInstruction_Resolve(terminator->Operands[0]);
+        if (condition->Op == IrOp_Constant) {
+            IrBlock* taken = terminator->Targets[condition->Integer ? 0 : 1];
+            IrBlock* notTaken = terminator->Targets[condition->Integer ? 1 : 0];
+            IrBlock_RemovePredecessor(notTaken, block);
+            IrBlock_ConvertToJump(block, taken);
+            changed = TRUE;
+        } else if (terminator->Targets[0] == terminator->Targets[1]) {
+            IrBlock* target = terminator->Targets[0];
+
+            // Both edges must carry the same values into the target's phis
+            b8 same = TRUE;
+            u64 first = ~0ull;
+            u64 second = ~0ull;
+            for (u64 j = 0; j < DynamicArrayLength(target->Predecessors); j++) {
+                if (target->Predecessors[j] == block) {
+                    if (first == ~0ull) {
+                        first = j;
+                    } else {
+                        second = j;
+                    }
+                }
+            }
+            for (u64 j = 0; j < DynamicArrayLength(target->Instructions); j++) {
+                IrInstruction* phi = target->Instructions[j];
+                if (phi->Op == IrOp_Phi &&
+                    IrInstruction_Resolve(phi->Operands[first]) != IrInstruction_Resolve(phi->Operands[second])) {
+                    same = FALSE;
+                }
+            }
+
+            if (same) {
+                IrBlock_RemovePredecessor(target, block);
+                IrBlock_ConvertToJump(block, target);
+                changed = TRUE;
+            }
+        }
+    }
+    return changed;
+}
+
+static b8 IrSimplify_TrivialPhis(IrProcedure* procedure) {
+    b8 changed = FALSE;
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Blocks); i++) {
+        IrBlock* block = procedure->Blocks[i];
+        for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+            IrInstruction* phi = block->Instructions[j];
+            if (phi->Op != IrOp_Phi || phi->Replacement) {
+                continue;
+            }
+
+            IrInstruction* same = NULL;
+            b8 trivial = TRUE;
+            for (u64 k = 0; k < DynamicArrayLength(phi->Operands); k++) {
+                IrInstruction* operand = IrInstruction_Resolve(phi->Operands[k]);
+                if (operand == phi || operand == same) {
+                    continue;
+                }
+                if (same) {
+                    trivial = FALSE;
+                    break;
+                }
+                same = operand;
+            }
+
+            if (trivial && same) {
+                phi->Replacement = same;
+                changed = TRUE;
+            }
+        }
+    }
+
+    if (changed) {
+        IrProcedure_ApplyReplacements(procedure);
+    }
+    return changed;
+}
+
+static void IrProcedure_RemoveBlock(IrProcedure* procedure, IrBlock* block) {
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Blocks); i++) {
+        if (procedure->Blocks[i] == block) {
+            DynamicArrayPopAt(procedure->Blocks, i, NULL);
+            return;
+        }
+    }
+    ASSERT(FALSE);
+}
+
+static void IrBlock_ReplacePredecessor(IrBlock* block, IrBlock* old, IrBlock* new) {
+    for (u64 i = 0; i < DynamicArrayLength(block->Predecessors); i++) {
+        if (block->Predecessors[i] == old) {
+            block->Predecessors[i] = new;
+        }
+    }
+}
+
+static b8 IrSimplify_MergeBlocks(IrProcedure* procedure) {
+    b8 changed = FALSE;
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Blocks); i++) {
+        IrBlock* block = procedure->Blocks[i];
+        IrInstruction* terminator = IrBlock_Terminator(block);
+        if (!terminator || terminator->Op != IrOp_Jump) {
+            continue;
+        }
+
+        IrBlock* successor = terminator->Targets[0];
+        if (successor == block || successor == procedure->Blocks[0] || DynamicArrayLength(successor->Predecessors) != 1) {
+            continue;
+        }
+
+        DynamicArrayPop(block->Instructions, NULL);
+        for (u64 j = 0; j < DynamicArrayLength(successor->Instructions); j++) {
+            IrInstruction* instruction = successor->Instructions[j];
+            if (instruction->Op == IrOp_Phi) {
+                instruction->Replacement = instruction->Operands[0];
+                continue;
+            }
+            instruction->Block = block;
+            DynamicArrayPush(block->Instructions, instruction);
+        }
+
+        for (u64 j = 0; j < IrBlock_SuccessorCount(successor); j++) {
+            IrBlock_ReplacePredecessor(IrBlock_Successor(successor, j), successor, block);
+        }
+
+        IrProcedure_RemoveBlock(procedure, successor);
+        IrProcedure_ApplyReplacements(procedure);
+        changed = TRUE;
+        i--; // The merged block may now be mergeable with its new successor
+    }
+    return changed;
+}
+
+static b8 IrSimplify_ForwardingBlocks(IrProcedure* procedure) {
+    b8 changed = FALSE;
+    for (u64 i = 1; i < DynamicArrayLength(procedure->Blocks); i++) {
+        IrBlock* block = procedure->Blocks[i];
+        if (DynamicArrayLength(block->Instructions) != 1 || block->Instructions[0]->Op != IrOp_Jump) {
+            continue;
+        }
+
+        IrBlock* successor = block->Instructions[0]->Targets[0];
+        if (successor == block || IrBlock_HasPhis(successor) || DynamicArrayLength(block->Predecessors) == 0) {
+            continue;
+        }
+
+        for (u64 j = 0; j < DynamicArrayLength(block->Predecessors); j++) {
+            IrBlock* predecessor = block->Predecessors[j];
+            IrInstruction* predecessorTerminator = IrBlock_Terminator(predecessor);
+            for (u64 k = 0; k < IrBlock_SuccessorCount(predecessor); k++) {
+                IrBlock** target = IrInstruction_Target(predecessorTerminator, k);
+                if (*target == block) {
+                    *target = successor;
+                    DynamicArrayPush(successor->Predecessors, predecessor);
+                }
+            }
+        }
+
+        DynamicArrayLength(block->Predecessors) = 0; // Now unreachable, IrProcedure_Analyze removes its edge into successor
+        changed = TRUE;
+    }
+    return changed;
+}
+
+b8 IrPass_SimplifyCfg(IrProcedure* procedure) {
+    b8 changed = FALSE;
+
+    b8 progress = TRUE;
+    while (progress) {
+        progress = FALSE;
+        progress |= IrSimplify_Branches(procedure);
+        IrProcedure_Analyze(procedure);
+        progress |= IrSimplify_TrivialPhis(procedure);
+        progress |= IrSimplify_MergeBlocks(procedure);
+        progress |= IrSimplify_ForwardingBlocks(procedure);
+        changed |= progress;
+    }
+
+    IrProcedure_Analyze(procedure);
+    return changed;
+}
+
+// Inlining
+
+#define IrInline_CalleeBudget 32        // Instructions a callee may cost before it is no longer inlined
+#define IrInline_ConstantArgumentBonus 4 // Constant arguments usually let the inlined body fold away
+#define IrInline_CallerBudget 2048      // Instructions a caller may grow to through inlining
+
+static u64 IrProcedure_InstructionCount(IrProcedure* procedure) {
+    u64 count = 0;
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Blocks); i++) {
+        count += DynamicArrayLength(procedure->Blocks[i]->Instructions);
+    }
+    return count;
+}
+
+static u64 IrInline_Cost(IrProcedure* procedure) {
+    u64 cost = 0;
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Blocks); i++) {
+        IrBlock* block = procedure->Blocks[i];
+        for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+            IrInstruction* instruction = block->Instructions[j];
+            switch (instruction->Op) {
+                case IrOp_Parameter:
+                case IrOp_Local:
+                case IrOp_Jump:
+                case IrOp_Return: {
+                } break;
+
+                case IrOp_Call: {
+                    cost += 4;
+                } break;
+
+                default: {
+                    cost += 1;
+                } break;
+            }
+        }
+    }
+    return cost;
+}
+
+// Whether target can be reached from procedure through direct calls
+static b8 IrInline_Reaches(IrProcedure* procedure, IrProcedure* target, IrProcedure*** visited) {
+    for (u64 i = 0; i < DynamicArrayLength(*visited); i++) {
+        if ((*visited)[i] == procedure) {
+            return FALSE;
+        }
+    }
+    DynamicArrayPush(*visited, procedure);
+
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Blocks); i++) {
+        IrBlock* block = procedure->Blocks[i];
+        for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+            IrInstruction* instruction = block->Instructions[j];
+            if (instruction->Op != IrOp_Call || !instruction->Procedure) {
+                continue;
+            }
+            if (instruction->Procedure == target || IrInline_Reaches(instruction->Procedure, target, visited)) {
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+static b8 IrInline_IsRecursive(IrProcedure* procedure) {
+    IrProcedure** visited = DynamicArrayCreate(IrProcedure*);
+    b8 recursive = IrInline_Reaches(procedure, procedure, &visited);
+    DynamicArrayDestroy(visited);
+    return recursive;
+}
+
+static b8 IrInline_ShouldInline(IrProcedure* caller, IrInstruction* call) {
+    IrProcedure* callee = call->Procedure;
+    if (!callee || callee == caller || callee->NoInline || DynamicArrayLength(callee->Blocks) == 0) {
+        return FALSE;
+    }
+
+    s64 cost = cast(s64) IrInline_Cost(callee);
+    for (u64 i = 0; i < DynamicArrayLength(call->Operands); i++) {
+        if (call->Operands[i]->Op == IrOp_Constant) {
+            cost -= IrInline_ConstantArgumentBonus;
+        }
+    }
+
+    if (cost > IrInline_CalleeBudget) {
+        return FALSE;
+    }
+    if (IrProcedure_InstructionCount(caller) + IrProcedure_InstructionCount(callee) > IrInline_CallerBudget) {
+        return FALSE;
+    }
+    return !IrInline_IsRecursive(callee);
+}
+
+static void IrInline_Call(IrProcedure* caller, IrInstruction* call) {
+    IrProcedure* callee = call->Procedure;
+    IrBlock* block = call->Block;
+    IrBlock* entry = caller->Blocks[0];
+
+    // Everything after the call moves into a new block that the inlined returns jump to
+    u64 callIndex = 0;
+    while (block->Instructions[callIndex] != call) {
+        callIndex++;
+    }
+
+    IrBlock* after = IrBlock_Create(caller);
+    after->Sealed = TRUE;
+    for (u64 i = callIndex + 1; i < DynamicArrayLength(block->Instructions); i++) {
+        IrInstruction* instruction = block->Instructions[i];
+        instruction->Block = after;
+        DynamicArrayPush(after->Instructions, instruction);
+    }
+    DynamicArrayLength(block->Instructions) = callIndex;
+
+    for (u64 i = 0; i < IrBlock_SuccessorCount(after); i++) {
+        IrBlock_ReplacePredecessor(IrBlock_Successor(after, i), block, after);
+    }
+
+    // Clone the callee, operands are filled in once every instruction has a copy
+    u64 blockCount = DynamicArrayLength(callee->Blocks);
+    IrBlock** blocks = Allocate(callee->NextBlockId * sizeof(IrBlock*));
+    IrInstruction** values = Allocate(callee->NextInstructionId * sizeof(IrInstruction*));
+
+    for (u64 i = 0; i < blockCount; i++) {
+        blocks[callee->Blocks[i]->Id] = IrBlock_Create(caller);
+    }
+
+    for (u64 i = 0; i < blockCount; i++) {
+        IrBlock* original = callee->Blocks[i];
+        for (u64 j = 0; j < DynamicArrayLength(original->Instructions); j++) {
+            IrInstruction* instruction = original->Instructions[j];
+            if (instruction->Op == IrOp_Parameter) {
+                values[instruction->Id] = call->Operands[instruction->Index];
+                continue;
+            }
+
+            IrInstruction* clone = IrInstruction_Create(caller, instruction->Op, instruction->Type);
+            clone->Memory = instruction->Memory;
+            values[instruction->Id] = clone;
+
+            if (instruction->Op == IrOp_Local) { // Stack slots stay in the entry block so they are allocated once
+                clone->Block = entry;
+                DynamicArrayInsert(entry->Instructions, 0, clone);
+            } else {
+                clone->Block = blocks[original->Id];
+                DynamicArrayPush(clone->Block->Instructions, clone);
+            }
+        }
+    }
+
+    IrInstruction** results = DynamicArrayCreate(IrInstruction*);
+    for (u64 i = 0; i < blockCount; i++) {
+        IrBlock* original = callee->Blocks[i];
+        IrBlock* clone = blocks[original->Id];
+
+        for (u64 j = 0; j < DynamicArrayLength(original->Predecessors); j++) {
+            DynamicArrayPush(clone->Predecessors, blocks[original->Predecessors[j]->Id]);
+        }
+
+        for (u64 j = 0; j < DynamicArrayLength(original->Instructions); j++) {
+            IrInstruction* instruction = original->Instructions[j];
+            if (instruction->Op == IrOp_Parameter) {
+                continue;
+            }
+
+            IrInstruction* copy = values[instruction->Id];
+            for (u64 k = 0; k < DynamicArrayLength(instruction->Operands); k++) {
+                DynamicArrayPush(copy->Operands, values[instruction->Operands[k]->Id]);
+            }
+            if (instruction->Op == IrOp_Switch) { // Filled in below like the other targets
+                copy->Switch.Cases = DynamicArrayCreate(IrBlock*);
+                for (u64 k = 0; k < DynamicArrayLength(instruction->Switch.Cases); k++) {
+                    DynamicArrayPush(copy->Switch.Cases, NULL);
+                }
+            }
+            for (u64 k = 0; k < IrBlock_SuccessorCount(original) && IrInstruction_IsTerminator(instruction); k++) {
+                *IrInstruction_Target(copy, k) = blocks[(*IrInstruction_Target(instruction, k))->Id];
+            }
+
+            if (instruction->Op == IrOp_Return) {
+                if (DynamicArrayLength(copy->Operands) > 0) {
+                    DynamicArrayPush(results, copy->Operands[0]);
+                }
+                copy->Op = IrOp_Jump;
+                DynamicArrayLength(copy->Operands) = 0;
+                copy->Targets[0] = after;
+                DynamicArrayPush(after->Predecessors, clone);
+            }
+        }
+    }
+
+    IrBlock_AppendJump(block, blocks[callee->Blocks[0]->Id]);
+    for (u64 i = 0; i < blockCount; i++) {
+        blocks[callee->Blocks[i]->Id]->Sealed = TRUE;
+    }
+
+    if (call->Type.Kind != IrTypeKind_Void) {
+        if (DynamicArrayLength(results) == 1) {
+            call->Replacement = results[0];
+        } else if (DynamicArrayLength(results) == 0) {
+            call->Replacement = IrInstruction_Create(caller, IrOp_Undefined, call->Type);
+            call->Replacement->Block = after;
+            DynamicArrayInsert(after->Instructions, 0, call->Replacement);
+        } else {
+            IrInstruction* phi = IrInstruction_Create(caller, IrOp_Phi, call->Type);
+            phi->Block = after;
+            DynamicArrayDestroy(phi->Operands);
+            phi->Operands = results;
+            results = NULL;
+            DynamicArrayInsert(after->Instructions, 0, phi);
+            call->Replacement = phi;
+        }
+    }
+
+    if (results) {
+        DynamicArrayDestroy(results);
+    }
+    free(values);
+    free(blocks);
+}
+
+b8 IrPass_Inline(IrProcedure* procedure) {
+    b8 changed = FALSE;
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Blocks); i++) {
+        IrBlock* block = procedure->Blocks[i];
+        for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+            IrInstruction* instruction = block->Instructions[j];
+            if (instruction->Op != IrOp_Call) {
+                continue;
+            }
+
+            // Calls through a known procedure address become direct calls
+            if (!instruction->Procedure && instruction->Operands[0]->Op == IrOp_ProcedureAddress) {
+                instruction->Procedure = instruction->Operands[0]->Procedure;
+                DynamicArrayPopAt(instruction->Operands, 0, NULL);
+                changed = TRUE;
+            }
+
+            if (IrInline_ShouldInline(procedure, instruction)) {
+                IrInline_Call(procedure, instruction);
+                changed = TRUE;
+                break; // The rest of the block moved, it is visited again at the end of the list
+            }
+        }
+    }
+
+    if (changed) {
+        IrProcedure_ApplyReplacements(procedure);
+        IrProcedure_Analyze(procedure);
+    }
+    return changed;
+}
+
+// Loops
+
+typedef struct IrLoop {
+    IrBlock* Header;
+    IrBlock* Preheader; // The only predecessor outside the loop, NULL unless it jumps straight to the header
+    b8* Blocks; // Indexed by IrBlock::Order
+} IrLoop;
+
+// Natural loops of the back edges, the procedure must be analyzed. Inner loops come before the loops around them.
+static IrLoop* IrProcedure_FindLoops(IrProcedure* procedure) {
+    u64 blockCount = DynamicArrayLength(procedure->Blocks);
+    IrLoop* loops = DynamicArrayCreate(IrLoop);
+    IrBlock** worklist = DynamicArrayCreate(IrBlock*);
+
+    // A header comes after the headers of the loops around it in reverse post order
+    for (u64 i = blockCount; i > 0; i--) {
+        IrBlock* header = procedure->Blocks[i - 1];
+
+        b8* blocks = NULL;
+        for (u64 j = 0; j < DynamicArrayLength(header->Predecessors); j++) {
+            IrBlock* latch = header->Predecessors[j];
+            if (!IrBlock_Dominates(header, latch)) {
+                continue;
+            }
+
+            if (!blocks) {
+                blocks = Allocate(blockCount * sizeof(b8));
+                blocks[header->Order] = TRUE;
+            }
+
+            // Walk backwards from the latch up to the header
+            DynamicArrayPush(worklist, latch);
+            while (DynamicArrayLength(worklist) > 0) {
+                IrBlock* current;
+                DynamicArrayPop(worklist, &current);
+                if (blocks[current->Order]) {
+                    continue;
+                }
+
+                blocks[current->Order] = TRUE;
+                for (u64 k = 0; k < DynamicArrayLength(current->Predecessors); k++) {
+                    DynamicArrayPush(worklist, current->Predecessors[k]);
+                }
+            }
+        }
+
+        if (!blocks) {
+            continue;
+        }
+
+        IrBlock* preheader = NULL;
+        u64 outsideCount = 0;
+        for (u64 j = 0; j < DynamicArrayLength(header->Predecessors); j++) {
+            if (!blocks[header->Predecessors[j]->Order]) {
+                preheader = header->Predecessors[j];
+                outsideCount++;
+            }
+        }
+        if (outsideCount != 1 || IrBlock_SuccessorCount(preheader) != 1) {
+            preheader = NULL;
+        }
+
+        DynamicArrayPush(loops, ((IrLoop){ .Header = header, .Preheader = preheader, .Blocks = blocks }));
+    }
+
+    DynamicArrayDestroy(worklist);
+    return loops;
+}
+
+static void IrLoops_Destroy(IrLoop* loops) {
+    for (u64 i = 0; i < DynamicArrayLength(loops); i++) {
+        free(loops[i].Blocks);
+    }
+    DynamicArrayDestroy(loops);
+}
+
+// Loop invariant code motion
+
+// Division is left in place, hoisting it could trap on a path that never reached it
+static b8 IrLicm_Hoistable(IrInstruction* instruction) {
+    switch (instruction->Op) {
+        case IrOp_Constant:
+        case IrOp_String:
+        case IrOp_ProcedureAddress:
+        case IrOp_Add:
+        case IrOp_Subtract:
+        case IrOp_Multiply:
+        case IrOp_And:
+        case IrOp_Or:
+        case IrOp_Equal:
+        case IrOp_NotEqual:
+        case IrOp_Less:
+        case IrOp_LessEqual:
+        case IrOp_Negate:
+        case IrOp_Not:
+        case IrOp_Convert:
+        case IrOp_Offset:
+        case IrOp_Splat:
+        case IrOp_ExtractLane:
+        case IrOp_InsertLane:
+        case IrOp_Shuffle:
+        case IrOp_ReduceAdd:
+        case IrOp_ReduceMin:
+        case IrOp_ReduceMax:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+static b8 IrLicm_IsInvariant(IrInstruction* instruction, IrLoop* loop) {
+    if (!IrLicm_Hoistable(instruction)) {
+        return FALSE;
+    }
+
+    for (u64 i = 0; i < DynamicArrayLength(instruction->Operands); i++) {
+        if (loop->Blocks[instruction->Operands[i]->Block->Order]) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+b8 IrPass_LoopInvariantCodeMotion(IrProcedure* procedure) {
+    IrLoop* loops = IrProcedure_FindLoops(procedure);
+
+    b8 changed = FALSE;
+    for (u64 i = 0; i < DynamicArrayLength(loops); i++) {
+        IrLoop* loop = &loops[i];
+        IrBlock* preheader = loop->Preheader;
+        if (!preheader) {
+            continue;
+        }
+
+        IrInstruction* terminator;
+        DynamicArrayPop(preheader->Instructions, &terminator);
+
+        // Reverse post order moves operands out before the instructions that use them, phis are never hoisted
+        for (u64 j = 0; j < DynamicArrayLength(procedure->Blocks); j++) {
+            IrBlock* block = procedure->Blocks[j];
+            if (!loop->Blocks[block->Order]) {
+                continue;
+            }
+
+            u64 count = 0;
+            for (u64 k = 0; k < DynamicArrayLength(block->Instructions); k++) {
+                IrInstruction* instruction = block->Instructions[k];
+                if (IrLicm_IsInvariant(instruction, loop)) {
+                    instruction->Block = preheader;
+                    DynamicArrayPush(preheader->Instructions, instruction);
+                    changed = TRUE;
+                } else {
+                    block->Instructions[count++] = instruction;
+                }
+            }
+            DynamicArrayLength(block->Instructions) = count;
+        }
+
+        DynamicArrayPush(preheader->Instructions, terminator);
+    }
+
+    IrLoops_Destroy(loops);
+    return changed;
+}
+
+// Strength reduction
+//
+// An induction variable is a header phi advanced by a constant on the back edge. Multiplying one by a constant, like
+// the stride of an array index, becomes a second induction variable that is advanced by an add instead.
+
+typedef struct IrInduction {
+    IrInstruction* Phi;
+    u64 Step;
+} IrInduction;
+
+// The multiplied value is the phi itself or an integer conversion of it that keeps the size
+static b8 IrInduction_Matches(IrInstruction* value, IrInstruction* phi) {
+    if (value == phi) {
+        return TRUE;
+    }
+    return
+        value->Op == IrOp_Convert && value->Operands[0] == phi &&
+        value->Type.Kind == IrTypeKind_Integer && phi->Type.Kind == IrTypeKind_Integer &&
+        value->Type.Size == phi->Type.Size;
+}
+
+b8 IrPass_StrengthReduction(IrProcedure* procedure) {
+    IrLoop* loops = IrProcedure_FindLoops(procedure);
+    IrInduction* inductions = DynamicArrayCreate(IrInduction);
+    IrInstruction** multiplies = DynamicArrayCreate(IrInstruction*);
+
+    b8 changed = FALSE;
+    for (u64 i = 0; i < DynamicArrayLength(loops); i++) {
+        IrLoop* loop = &loops[i];
+        IrBlock* header = loop->Header;
+        IrBlock* preheader = loop->Preheader;
+        if (!preheader || DynamicArrayLength(header->Predecessors) != 2) {
+            continue;
+        }
+
+        u64 entryIndex = header->Predecessors[0] == preheader ? 0 : 1;
+        u64 latchIndex = 1 - entryIndex;
+        IrBlock* latch = header->Predecessors[latchIndex];
+
+        DynamicArrayLength(inductions) = 0;
+        for (u64 j = 0; j < DynamicArrayLength(header->Instructions); j++) {
+            IrInstruction* phi = header->Instructions[j];
+            if (phi->Op != IrOp_Phi || phi->Type.Kind != IrTypeKind_Integer) {
+                continue;
+            }
+
+            IrInstruction* next = phi->Operands[latchIndex];
+            if (next->Op != IrOp_Add) {
+                continue;
+            }
+
+            IrInstruction* step = next->Operands[0] == phi ? next->Operands[1] : next->Operands[0];
+            if ((next->Operands[0] == phi || next->Operands[1] == phi) && step->Op == IrOp_Constant) {
+                DynamicArrayPush(inductions, ((IrInduction){ .Phi = phi, .Step = step->Integer }));
+            }
+        }
+
+        if (DynamicArrayLength(inductions) == 0) {
+            continue;
+        }
+
+        // Collected first, the new instructions go into blocks of the loop
+        DynamicArrayLength(multiplies) = 0;
+        for (u64 j = 0; j < DynamicArrayLength(procedure->Blocks); j++) {
+            IrBlock* block = procedure->Blocks[j];
+            if (!loop->Blocks[block->Order]) {
+                continue;
+            }
+
+            for (u64 k = 0; k < DynamicArrayLength(block->Instructions); k++) {
+                IrInstruction* instruction = block->Instructions[k];
+                if (instruction->Op == IrOp_Multiply && instruction->Type.Kind == IrTypeKind_Integer &&
+                    (instruction->Operands[0]->Op == IrOp_Constant || instruction->Operands[1]->Op == IrOp_Constant)) {
+                    DynamicArrayPush(multiplies, instruction);
+                }
+            }
+        }
+
+        for (u64 j = 0; j < DynamicArrayLength(multiplies); j++) {
+            IrInstruction* multiply = multiplies[j];
+            b8 constantFirst = multiply->Operands[0]->Op == IrOp_Constant;
+            IrInstruction* factor = multiply->Operands[constantFirst ? 0 : 1];
+            IrInstruction* value = multiply->Operands[constantFirst ? 1 : 0];
+
+            IrInduction* induction = NULL;
+            for (u64 k = 0; k < DynamicArrayLength(inductions); k++) {
+                if (IrInduction_Matches(value, inductions[k].Phi)) {
+                    induction = &inductions[k];
+                    break;
+                }
+            }
+            if (!induction) {
+                continue;
+            }
+
+            IrType type = multiply->Type;
+            IrInstruction* terminator;
+
+            DynamicArrayPop(preheader->Instructions, &terminator);
+            IrInstruction* initial = induction->Phi->Operands[entryIndex];
+            if (value != induction->Phi) {
+                initial = IrBlock_AppendUnary(preheader, IrOp_Convert, type, initial);
+            }
+            IrInstruction* start = IrBlock_AppendBinary(preheader, IrOp_Multiply, type, initial, IrBlock_AppendInteger(preheader, type, factor->Integer));
+            DynamicArrayPush(preheader->Instructions, terminator);
+
+            IrInstruction* phi = IrInstruction_Create(procedure, IrOp_Phi, type);
+            phi->Block = header;
+            DynamicArrayPush(phi->Operands, start);
+            DynamicArrayPush(phi->Operands, start); // Overwritten with the advanced value below
+            DynamicArrayInsert(header->Instructions, 0, phi);
+
+            DynamicArrayPop(latch->Instructions, &terminator);
+            u64 step = IrFold_Truncate(type, induction->Step * factor->Integer);
+            IrInstruction* next = IrBlock_AppendBinary(latch, IrOp_Add, type, phi, IrBlock_AppendInteger(latch, type, step));
+            DynamicArrayPush(latch->Instructions, terminator);
+            phi->Operands[latchIndex] = next;
+
+            multiply->Replacement = phi;
+            changed = TRUE;
+        }
+    }
+
+    DynamicArrayDestroy(multiplies);
+    DynamicArrayDestroy(inductions);
+    IrLoops_Destroy(loops);
+
+    if (changed) {
+        IrProcedure_ApplyReplacements(procedure);
+    }
+    return changed;
+}
+
+// Bounds check elimination
+//
+// A check is removed when an earlier check of the same index dominates it, or when the index is proven to be in
+// range: constants, and values bounded by the comparisons of the branches that lead to the check, like the
+// condition of a for loop. Integer comparisons here are on the mathematical values, signed or not.
+
+typedef struct IrFact {
+    IrInstruction* Left;
+    IrInstruction* Right;
+    b8 Strict; // Left < Right, otherwise Left <= Right
+} IrFact;
+
+// Comparisons known to hold in block, from the branches on the edges into its dominators
+static void IrRange_CollectFacts(IrBlock* block, IrFact** facts) {
+    for (IrBlock* dominator = block; dominator; dominator = dominator->Dominator) {
+        if (DynamicArrayLength(dominator->Predecessors) != 1) {
+            continue;
+        }
+
+        IrBlock* predecessor = dominator->Predecessors[0];
+        IrInstruction* branch = predecessor->Instructions[DynamicArrayLength(predecessor->Instructions) - 1];
+        if (branch->Op != IrOp_Branch || branch->Targets[0] == branch->Targets[1]) {
+            continue;
+        }
+
+        IrInstruction* condition = branch->Operands[0];
+        if ((condition->Op != IrOp_Less && condition->Op != IrOp_LessEqual) || condition->Operands[0]->Type.Kind != IrTypeKind_Integer) {
+            continue;
+        }
+
+        b8 strict = condition->Op == IrOp_Less;
+        if (dominator == branch->Targets[0]) {
+            DynamicArrayPush(*facts, ((IrFact){ .Left = condition->Operands[0], .Right = condition->Operands[1], .Strict = strict }));
+        } else {
+            DynamicArrayPush(*facts, ((IrFact){ .Left = condition->Operands[1], .Right = condition->Operands[0], .Strict = !strict }));
+        }
+    }
+}
+
+static b8 IrRange_IsNegative(IrType type, u64 value) {
+    return type.Signed && cast(s64) value < 0;
+}
+
+// Whether every value below limit is representable in type
+static b8 IrRange_Fits(IrType type, u64 limit) {
+    u64 bits = type.Size * 8 - type.Signed;
+    return bits >= 64 || limit <= (1ull << bits);
+}
+
+static b8 IrRange_NonNegative(IrInstruction* value, IrBlock* block, u64 depth);
+
+// value < limit
+static b8 IrRange_Below(IrInstruction* value, u64 limit, IrBlock* block, u64 depth) {
+    if (value->Type.Kind != IrTypeKind_Integer || depth == 0) {
+        return FALSE;
+    }
+
+    if (value->Op == IrOp_Constant) {
+        return IrRange_IsNegative(value->Type, value->Integer) || value->Integer < limit;
+    }
+
+    // Converting a value that is already in range keeps it unchanged
+    if (value->Op == IrOp_Convert && value->Operands[0]->Type.Kind == IrTypeKind_Integer && IrRange_Fits(value->Type, limit) &&
+        IrRange_NonNegative(value->Operands[0], block, depth - 1) && IrRange_Below(value->Operands[0], limit, block, depth - 1)) {
+        return TRUE;
+    }
+
+    IrFact* facts = DynamicArrayCreate(IrFact);
+    IrRange_CollectFacts(block, &facts);
+
+    b8 below = FALSE;
+    for (u64 i = 0; i < DynamicArrayLength(facts) && !below; i++) {
+        IrFact fact = facts[i];
+        if (fact.Left != value || fact.Right->Op != IrOp_Constant) {
+            continue;
+        }
+
+        u64 bound = fact.Right->Integer;
+        below = IrRange_IsNegative(fact.Right->Type, bound) || (fact.Strict ? bound <= limit : bound < limit);
+    }
+
+    DynamicArrayDestroy(facts);
+    return below;
+}
+
+// An induction variable that starts at zero or above and only counts up by one while it is below something
+static b8 IrRange_NonNegativeInduction(IrInstruction* phi, u64 depth) {
+    IrBlock* header = phi->Block;
+    for (u64 i = 0; i < DynamicArrayLength(phi->Operands); i++) {
+        IrInstruction* operand = phi->Operands[i];
+        if (operand->Op != IrOp_Add) {
+            if (!IrRange_NonNegative(operand, header->Predecessors[i], depth - 1)) {
+                return FALSE;
+            }
+            continue;
+        }
+
+        IrInstruction* step = operand->Operands[0] == phi ? operand->Operands[1] : operand->Operands[0];
+        if ((operand->Operands[0] != phi && operand->Operands[1] != phi) || step->Op != IrOp_Constant || step->Integer != 1) {
+            return FALSE;
+        }
+
+        // The add cannot overflow when the phi is strictly below another value of its type
+        IrFact* facts = DynamicArrayCreate(IrFact);
+        IrRange_CollectFacts(operand->Block, &facts);
+
+        b8 bounded = FALSE;
+        for (u64 j = 0; j < DynamicArrayLength(facts); j++) {
+            bounded |= facts[j].Left == phi && facts[j].Strict;
+        }
+
+        DynamicArrayDestroy(facts);
+        if (!bounded) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// 0 <= value
+static b8 IrRange_NonNegative(IrInstruction* value, IrBlock* block, u64 depth) {
+    if (value->Type.Kind != IrTypeKind_Integer || depth == 0) {
+        return FALSE;
+    }
+
+    if (!value->Type.Signed) {
+        return TRUE;
+    }
+
+    switch (value->Op) {
+        case IrOp_Constant: {
+            return cast(s64) value->Integer >= 0;
+        } break;
+
+        case IrOp_Convert: {
+            IrType from = value->Operands[0]->Type;
+            if (from.Kind == IrTypeKind_Integer && !from.Signed && from.Size < value->Type.Size) {
+                return TRUE;
+            }
+            if (from.Kind == IrTypeKind_Integer && from.Signed && from.Size <= value->Type.Size &&
+                IrRange_NonNegative(value->Operands[0], block, depth - 1)) {
+                return TRUE;
+            }
+        } break;
+
+        case IrOp_Phi: {
+            if (IrRange_NonNegativeInduction(value, depth)) {
+                return TRUE;
+            }
+        } break;
+
+        default: {
+        } break;
+    }
+
+    IrFact* facts = DynamicArrayCreate(IrFact);
+    IrRange_CollectFacts(block, &facts);
+
+    b8 nonNegative = FALSE;
+    for (u64 i = 0; i < DynamicArrayLength(facts) && !nonNegative; i++) {
+        IrFact fact = facts[i];
+        if (fact.Right != value || fact.Left->Op != IrOp_Constant) {
+            continue;
+        }
+
+        s64 bound = cast(s64) fact.Left->Integer;
+        nonNegative = fact.Strict ? bound >= -1 : bound >= 0;
+    }
+
+    DynamicArrayDestroy(facts);
+    return nonNegative;
+}
+
+// checks holds the checks that were kept so far, in reverse post order
+static b8 IrBoundsCheck_IsRedundant(IrInstruction* check, IrInstruction** checks) {
+    IrInstruction* index = check->Operands[0];
+    IrInstruction* count = check->Operands[1];
+
+    for (u64 i = 0; i < DynamicArrayLength(checks); i++) {
+        IrInstruction* earlier = checks[i];
+        if (earlier->Operands[0] != index || !IrBlock_Dominates(earlier->Block, check->Block)) {
+            continue;
+        }
+
+        IrInstruction* earlierCount = earlier->Operands[1];
+        if (earlierCount == count || (earlierCount->Op == IrOp_Constant && count->Op == IrOp_Constant && earlierCount->Integer <= count->Integer)) {
+            return TRUE;
+        }
+    }
+
+    return
+        count->Op == IrOp_Constant &&
+        IrRange_NonNegative(index, check->Block, 8) &&
+        IrRange_Below(index, count->Integer, check->Block, 8);
+}
+
+b8 IrPass_BoundsCheckElimination(IrProcedure* procedure) {
+    IrInstruction** checks = DynamicArrayCreate(IrInstruction*);
+
+    b8 changed = FALSE;
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Blocks); i++) {
+        IrBlock* block = procedure->Blocks[i];
+
+        u64 count = 0;
+        for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+            IrInstruction* instruction = block->Instructions[j];
+            if (instruction->Op == IrOp_BoundsCheck) {
+                if (IrBoundsCheck_IsRedundant(instruction, checks)) {
+                    changed = TRUE;
+                    continue;
+                }
+                DynamicArrayPush(checks, instruction);
+            }
+            block->Instructions[count++] = instruction;
+        }
+        DynamicArrayLength(block->Instructions) = count;
+    }
+
+    DynamicArrayDestroy(checks);
+    return changed;
+}
+
+// Pipeline
+
+static void IrOptimize_Iterate(IrProcedure* procedure) {
+    for (u64 i = 0; i < 8; i++) {
+        b8 changed = FALSE;
+        changed |= IrPass_ConstantPropagation(procedure);
+        changed |= IrPass_SimplifyCfg(procedure);
+        changed |= IrPass_GlobalValueNumbering(procedure);
+        changed |= IrPass_DeadCodeElimination(procedure);
+        changed |= IrPass_LoopInvariantCodeMotion(procedure);
+        changed |= IrPass_StrengthReduction(procedure);
+        changed |= IrPass_BoundsCheckElimination(procedure);
+        if (!changed) {
+            break;
+        }
+    }
+}
+
+void IrOptimize_Procedure(IrProcedure* procedure) {
+    IrProcedure_ApplyReplacements(procedure);
+    IrProcedure_Analyze(procedure);
+
+    IrOptimize_Iterate(procedure);
+    if (IrPass_Inline(procedure)) {
+        IrOptimize_Iterate(procedure);
+    }
+}
+
+// Callees are pushed before their callers so they are already optimized when inlined
+static void IrOptimize_CallGraphPostOrder(IrProcedure* procedure, IrProcedure*** order, IrProcedure*** visited) {
+    for (u64 i = 0; i < DynamicArrayLength(*visited); i++) {
+        if ((*visited)[i] == procedure) {
+            return;
+        }
+    }
+    DynamicArrayPush(*visited, procedure);
+
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Blocks); i++) {
+        IrBlock* block = procedure->Blocks[i];
+        for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+            IrInstruction* instruction = block->Instructions[j];
+            if ((instruction->Op == IrOp_Call || instruction->Op == IrOp_ProcedureAddress) && instruction->Procedure) {
+                IrOptimize_CallGraphPostOrder(instruction->Procedure, order, visited);
+            }
+        }
+    }
+
+    DynamicArrayPush(*order, procedure);
+}
+
+void IrOptimize_Module(IrModule* module) {
+    IrProcedure** order = DynamicArrayCreate(IrProcedure*);
+    IrProcedure** visited = DynamicArrayCreate(IrProcedure*);
+    for (u64 i = 0; i < DynamicArrayLength(module->Procedures); i++) {
+        IrOptimize_CallGraphPostOrder(module->Procedures[i], &order, &visited);
+    }
+
+    for (u64 i = 0; i < DynamicArrayLength(order); i++) {
+        IrOptimize_Procedure(order[i]);
+    }
+
+    DynamicArrayDestroy(visited);
+    DynamicArrayDestroy(order);
+}
@@ -1,22 +1,20 @@
 #include "./Typedefs.h"
 #include "./DynamicArray.h"
+#include "./Memory.h"
+#include "./Ir.h"
+#include "./RegisterAllocator.h"
+#include "./Cache.h"
+#include "./Server.h"
+#include "./Stats.h"
+#include "./Trace.h"
+#include "./Writer.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <stdarg.h>
-
-void* Allocate(u64 size) {
-    void* ptr = malloc(size);
-    if (!ptr) {
-        perror("Allocate failed!");
-        abort();
-        return NULL;
-    }
-    memset(ptr, 0, size);
-    return ptr;
-}
+#include <setjmp.h>
 
 b8 MatchStrings(const char* a, const char* b) {
     // TODO: Intern all strings so pointer comparasion can be used
@@ -44,6 +42,8 @@ typedef enum TokenKind {
     TokenKind_Float,
     TokenKind_String,
     TokenKind_Keyword,
+    TokenKind_Directive,
+    TokenKind_Invalid, // Text the lexer could not make sense of, the parser reports it
 
     TokenKind_LParen,
     TokenKind_RParen,
@@ -76,10 +76,16 @@ typedef enum TokenKind {
     TokenKind_PercentEquals,
     TokenKind_ExclamationMarkEquals,
 
+    TokenKind_Less,
+    TokenKind_LessEquals,
+    TokenKind_Greater,
+    TokenKind_GreaterEquals,
+
     TokenKind_AmpersandAmpersand,
     TokenKind_PipePipe,
 
     TokenKind_RightArrow,
+    TokenKind_Dollar,
 } TokenKind;
 
 const char* TokenKindNames[] = {
@@ -90,6 +96,8 @@ const char* TokenKindNames[] = {
     [TokenKind_Float] = "Float",
     [TokenKind_String] = "String",
     [TokenKind_Keyword] = "Keyword",
+    [TokenKind_Directive] = "Directive",
+    [TokenKind_Invalid] = "Invalid",
 
     [TokenKind_LParen] = "(",
     [TokenKind_RParen] = ")",
@@ -122,10 +130,16 @@ const char* TokenKindNames[] = {
     [TokenKind_PercentEquals] = "%=",
     [TokenKind_ExclamationMarkEquals] = "!=",
 
+    [TokenKind_Less] = "<",
+    [TokenKind_LessEquals] = "<=",
+    [TokenKind_Greater] = ">",
+    [TokenKind_GreaterEquals] = ">=",
+
     [TokenKind_AmpersandAmpersand] = "&&",
     [TokenKind_PipePipe] = "||",
 
     [TokenKind_RightArrow] = "->",
+    [TokenKind_Dollar] = "$",
 };
 
 typedef enum Keyword {
@@ -138,6 +152,11 @@ typedef enum Keyword {
     Keyword_Struct,
     Keyword_SizeOf,
     Keyword_Cast,
+    Keyword_While,
+    Keyword_For,
+    Keyword_In,
+    Keyword_Switch,
+    Keyword_Case,
 
     Keyword_Count,
 } Keyword;
@@ -152,6 +171,11 @@ const char* KeywordNames[] = {
     [Keyword_Struct] = "struct",
     [Keyword_SizeOf] = "size_of",
     [Keyword_Cast] = "cast",
+    [Keyword_While] = "while",
+    [Keyword_For] = "for",
+    [Keyword_In] = "in",
+    [Keyword_Switch] = "switch",
+    [Keyword_Case] = "case",
 };
 
 typedef struct Token {
@@ -163,8 +187,13 @@ typedef struct Token {
         const char* Name;
         u64 Integer;
         f64 Float;
-        const char* String;
+        struct {
+            const char* String;
+            u64 StringLength; // Escapes are decoded, so it can contain zeros
+        };
         Keyword Keyword;
+        const char* Directive; // Name after the '#'
+        const char* Error; // Message of an invalid token
     };
 } Token;
 
@@ -178,6 +207,19 @@ b8 TokenIsAssignment(Token token) {
         token.Kind == TokenKind_PercentEquals;
 }
 
+char* String_Format(const char* format, ...) {
+    __builtin_va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    char* string = Allocate(length + 1);
+    va_start(args, format);
+    vsnprintf(string, length + 1, format, args);
+    va_end(args);
+    return string;
+}
+
 void Error(const char* message, ...) {
     __builtin_va_list args;
     va_start(args, message);
@@ -185,6 +227,7 @@ void Error(const char* message, ...) {
     va_end(args);
 
     putchar('\n');
+    fflush(stdout);
     ASSERT(FALSE);
     abort();
 }
@@ -209,6 +252,15 @@ void Lexer_Init(Lexer* lexer, const char* path, const char* source) {
     };
 }
 
+Token Lexer_InvalidToken(Lexer* lexer, SrcPos startPos, const char* message) {
+    return (Token){
+        .Kind = TokenKind_Invalid,
+        .Pos = startPos,
+        .Length = lexer->Pos.Position - startPos.Position,
+        .Error = message,
+    };
+}
+
 char Lexer_PeekChar(Lexer* lexer, u64 offset) {
     u64 index = lexer->Pos.Position + offset;
     if (index >= lexer->Src.Length) {
@@ -221,6 +273,18 @@ char Lexer_CurrentChar(Lexer* lexer) {
     return Lexer_PeekChar(lexer, 0);
 }
 
+// 16 for characters that are not hex digits
+u8 Lexer_HexDigit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return 16;
+}
+
 char Lexer_NextChar(Lexer* lexer) {
     char current = Lexer_CurrentChar(lexer);
     lexer->Pos.Position++;
@@ -259,6 +323,7 @@ Start:
         CHAR(';', TokenKind_Semicolon);
         CHAR('^', TokenKind_Caret);
         CHAR(',', TokenKind_Comma);
+        CHAR('$', TokenKind_Dollar);
 
         #undef CHAR
 
@@ -288,6 +353,8 @@ Start:
         CHAR2('*', TokenKind_Asterisk, '=', TokenKind_AsteriskEquals);
         CHAR2('%', TokenKind_Percent, '=', TokenKind_PercentEquals);
         CHAR2('!', TokenKind_ExclamationMark, '=', TokenKind_ExclamationMarkEquals);
+        CHAR2('<', TokenKind_Less, '=', TokenKind_LessEquals);
+        CHAR2('>', TokenKind_Greater, '=', TokenKind_GreaterEquals);
 
         CHAR2('&', TokenKind_Ampersand, '&', TokenKind_AmpersandAmpersand);
         CHAR2('|', TokenKind_Pipe, '|', TokenKind_PipePipe);
@@ -368,9 +435,8 @@ Start:
                     }
                 }
 
-                if (Lexer_CurrentChar(lexer) == '\0') {
-                    Error("Unexpected end of file in block comment!");
-                    return (Token){};
+                if (depth > 0) {
+                    return Lexer_InvalidToken(lexer, startPos, "Unexpected end of file in block comment");
                 }
 
                 goto Start;
@@ -470,6 +536,7 @@ Start:
 
             u64 length = 0;
             u64 integerValue = 0;
+            const char* error = NULL;
 
             u64 base = 10;
             if (Lexer_CurrentChar(lexer) == '0') {
@@ -509,7 +576,7 @@ Start:
                         u64 value = CharToInt[cast(u8) Lexer_NextChar(lexer)];
 
                         if (value >= base) {
-                            Error("Cannot have digit bigger than base!");
+                            error = "Cannot have digit bigger than base";
                         }
 
                         integerValue *= base;
@@ -522,6 +589,10 @@ Start:
                     } break;
 
                     case '.': {
+                        if (Lexer_PeekChar(lexer, 1) == '.') { // The start of a range, not a fraction
+                            break;
+                        }
+
                         length++;
                         Lexer_NextChar(lexer);
 
@@ -546,7 +617,7 @@ Start:
                                     u64 value = CharToInt[cast(u8) Lexer_NextChar(lexer)];
 
                                     if (value >= base) {
-                                        Error("Cannot have digit bigger than base!");
+                                        error = "Cannot have digit bigger than base";
                                     }
 
                                     denominator *= base;
@@ -559,8 +630,13 @@ Start:
                                 } continue;
 
                                 case '.': {
-                                    Error("Cannot have more than one '.' in a float literal");
-                                } break;
+                                    if (Lexer_PeekChar(lexer, 1) == '.') {
+                                        break;
+                                    }
+
+                                    Lexer_NextChar(lexer);
+                                    error = "Cannot have more than one '.' in a float literal";
+                                } continue;
 
                                 default: {
                                 } break;
@@ -568,10 +644,14 @@ Start:
                             break;
                         }
 
+                        if (error) {
+                            return Lexer_InvalidToken(lexer, startPos, error);
+                        }
+
                         return (Token){
                             .Kind = TokenKind_Float,
                             .Pos = startPos,
-                            .Length = length,
+                            .Length = lexer->Pos.Position - startPos.Position,
                             .Float = floatValue,
                         };
                     } break;
@@ -582,10 +662,14 @@ Start:
                 break;
             }
 
+            if (error) {
+                return Lexer_InvalidToken(lexer, startPos, error);
+            }
+
             return (Token){
                 .Kind = TokenKind_Integer,
                 .Pos = startPos,
-                .Length = length,
+                .Length = lexer->Pos.Position - startPos.Position,
                 .Integer = integerValue,
             };
         } break;
@@ -599,7 +683,8 @@ Start:
             while (TRUE) {
                 switch (Lexer_CurrentChar(lexer)) {
                     case '\0': {
-                        Error("Unexpected end of file in string literal!");
+                        DynamicArrayDestroy(buffer);
+                        return Lexer_InvalidToken(lexer, startPos, "Unexpected end of file in string literal");
                     } break;
 
                     case '"': {
@@ -607,6 +692,43 @@ Start:
                         Lexer_NextChar(lexer);
                     } break;
 
+                    // Escapes are decoded here once, everything after the lexer sees the bytes
+                    case '\\': {
+                        length += 2;
+                        Lexer_NextChar(lexer);
+                        char escape = Lexer_NextChar(lexer);
+                        switch (escape) {
+                            case 'n': DynamicArrayPush(buffer, '\n'); break;
+                            case 'r': DynamicArrayPush(buffer, '\r'); break;
+                            case 't': DynamicArrayPush(buffer, '\t'); break;
+                            case '0': DynamicArrayPush(buffer, '\0'); break;
+                            case '\\': DynamicArrayPush(buffer, '\\'); break;
+                            case '"': DynamicArrayPush(buffer, '"'); break;
+                            case '\'': DynamicArrayPush(buffer, '\''); break;
+
+                            case 'x': {
+                                u8 high = Lexer_HexDigit(Lexer_CurrentChar(lexer));
+                                u8 low = Lexer_HexDigit(Lexer_PeekChar(lexer, 1));
+                                if (high >= 16 || low >= 16) {
+                                    DynamicArrayDestroy(buffer);
+                                    return Lexer_InvalidToken(lexer, startPos, "Expected two hex digits after '\\x' in string literal");
+                                }
+                                length += 2;
+                                Lexer_NextChar(lexer);
+                                Lexer_NextChar(lexer);
+                                DynamicArrayPush(buffer, cast(char) (high * 16 + low));
+                            } break;
+
+                            default: {
+                                DynamicArrayDestroy(buffer);
+                                if (escape == '\0') {
+                                    return Lexer_InvalidToken(lexer, startPos, "Unexpected end of file in string literal");
+                                }
+                                return Lexer_InvalidToken(lexer, startPos, String_Format("Unknown escape sequence '\\%c' in string literal", escape));
+                            } break;
+                        }
+                    } continue;
+
                     default: {
                         length++;
                         DynamicArrayPush(buffer, Lexer_NextChar(lexer));
@@ -615,6 +737,8 @@ Start:
                 break;
             }
 
+            // Strings may contain zeros, the terminator is only for printing
+            u64 stringLength = DynamicArrayLength(buffer);
             DynamicArrayPush(buffer, '\0');
             char* string = Allocate(DynamicArraySize(buffer));
             memcpy(string, buffer, DynamicArraySize(buffer));
@@ -625,18 +749,159 @@ Start:
                 .Pos = startPos,
                 .Length = length,
                 .String = string,
+                .StringLength = stringLength,
+            };
+        } break;
+
+        case '#': {
+            Lexer_NextChar(lexer);
+
+            u64 length = 1;
+            char* buffer = DynamicArrayCreate(char);
+
+            while (TRUE) {
+                char c = Lexer_CurrentChar(lexer);
+                if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9' && length > 1) || c == '_') {
+                    length++;
+                    DynamicArrayPush(buffer, Lexer_NextChar(lexer));
+                } else {
+                    break;
+                }
+            }
+
+            if (length == 1) {
+                DynamicArrayDestroy(buffer);
+                return Lexer_InvalidToken(lexer, startPos, "Expected a directive name after '#'");
+            }
+
+            DynamicArrayPush(buffer, '\0');
+            char* directive = Allocate(DynamicArraySize(buffer));
+            memcpy(directive, buffer, DynamicArraySize(buffer));
+            DynamicArrayDestroy(buffer);
+
+            return (Token){
+                .Kind = TokenKind_Directive,
+                .Pos = startPos,
+                .Length = length,
+                .Directive = directive,
             };
         } break;
 
         default: {
-            Error("Unknown character '%c'", Lexer_NextChar(lexer));
-        } goto Start;
+            char c = Lexer_NextChar(lexer);
+            return Lexer_InvalidToken(lexer, startPos, String_Format("Unknown character '%c'", c));
+        } break;
     }
 
     ASSERT(FALSE);
     return (Token){};
 }
 
+// Incremental relexing
+//
+// Lexer_NextToken consumes whole comments and string literals, including the depth of nested block comments, in a
+// single call. The lexer therefore has no pending state at the start of a token, so restarting at an old token start is
+// always safe and the new stream is back in sync once a new token starts exactly where a shifted old token after the
+// edit starts.
+
+#define Lexer_Lookahead 1 // Lexer_NextToken looks at most this many characters past the end of a token
+
+typedef struct TextEdit {
+    u64 Offset;
+    u64 Removed;
+    const char* Inserted;
+    u64 InsertedLength;
+} TextEdit;
+
+// Old tokens [First, OldEnd) were replaced by the new tokens [First, NewEnd)
+typedef struct RelexResult {
+    u64 First;
+    u64 OldEnd;
+    u64 NewEnd;
+} RelexResult;
+
+// Applies the edit to the text of src, tokens that point at src stay valid
+void Src_ApplyEdit(Src* src, TextEdit edit) {
+    u64 length = src->Length - edit.Removed + edit.InsertedLength;
+    char* source = Allocate(length + 1);
+    memcpy(source, src->Source, edit.Offset);
+    memcpy(source + edit.Offset, edit.Inserted, edit.InsertedLength);
+    memcpy(source + edit.Offset + edit.InsertedLength, src->Source + edit.Offset + edit.Removed, src->Length - edit.Offset - edit.Removed);
+    source[length] = '\0';
+
+    src->Source = source;
+    src->Length = length;
+}
+
+// Updates the tokens of src after edit was applied to it, tokens must be the complete stream before the edit
+// including the end of file token, or empty to lex everything
+RelexResult Lexer_Relex(Src* src, Token** tokensPtr, TextEdit edit) {
+    Token* tokens = *tokensPtr;
+    u64 count = DynamicArrayLength(tokens);
+    u64 editEnd = edit.Offset + edit.Removed;
+    u64 shift = edit.InsertedLength - edit.Removed; // Wraps around when the edit removes more than it inserts
+
+    // Restart one token before the first one the edit could have changed, the edit may be between tokens
+    u64 first = 0;
+    while (first < count && tokens[first].Pos.Position + tokens[first].Length + Lexer_Lookahead <= edit.Offset) {
+        first++;
+    }
+    Lexer lexer;
+    lexer.Src = *src;
+    if (first > 0) {
+        first--;
+        lexer.Pos = tokens[first].Pos;
+    } else {
+        lexer.Pos = (SrcPos){ .Position = 0, .Line = 1, .Column = 1 };
+    }
+    lexer.Pos.Src = &lexer.Src;
+
+    Token* relexed = DynamicArrayCreate(Token);
+    u64 resync = count;
+    SrcPos resyncPos = {};
+    u64 old = first;
+    while (TRUE) {
+        Token token = Lexer_NextToken(&lexer);
+        token.Pos.Src = src;
+
+        while (old < count && (tokens[old].Pos.Position < editEnd || tokens[old].Pos.Position + shift < token.Pos.Position)) {
+            old++;
+        }
+        if (old < count && tokens[old].Pos.Position + shift == token.Pos.Position) {
+            resync = old;
+            resyncPos = token.Pos;
+            break;
+        }
+
+        DynamicArrayPush(relexed, token);
+        if (token.Kind == TokenKind_EndOfFile) {
+            break;
+        }
+    }
+
+    if (resync < count) {
+        SrcPos oldPos = tokens[resync].Pos;
+        for (u64 i = resync; i < count; i++) {
+            if (tokens[i].Pos.Line == oldPos.Line) {
+                tokens[i].Pos.Column += resyncPos.Column - oldPos.Column;
+            }
+            tokens[i].Pos.Line += resyncPos.Line - oldPos.Line;
+            tokens[i].Pos.Position += shift;
+        }
+    }
+
+    u64 relexedCount = DynamicArrayLength(relexed);
+    DynamicArrayReplace(tokens, first, resync - first, relexed, relexedCount);
+    DynamicArrayDestroy(relexed);
+
+    *tokensPtr = tokens;
+    return (RelexResult){
+        .First = first,
+        .OldEnd = resync,
+        .NewEnd = first + relexedCount,
+    };
+}
+
 typedef struct AstExpression AstExpression;
 typedef struct AstLiteral AstLiteral;
 typedef struct AstName AstName;
@@ -650,6 +915,8 @@ typedef struct AstCall AstCall;
 typedef struct AstIndex AstIndex;
 typedef struct AstSizeOf AstSizeOf;
 typedef struct AstCast AstCast;
+typedef struct AstRun AstRun;
+typedef struct AstPolymorph AstPolymorph;
 
 typedef struct AstStatement AstStatement;
 typedef struct AstScope AstScope;
@@ -657,10 +924,19 @@ typedef struct AstDeclaration AstDeclaration;
 typedef struct AstAssignment AstAssignment;
 typedef struct AstReturn AstReturn;
 typedef struct AstIf AstIf;
+typedef struct AstWhile AstWhile;
+typedef struct AstFor AstFor;
+typedef struct AstSwitch AstSwitch;
 
 typedef struct Ast Ast;
 typedef struct AstType AstType;
 
+typedef enum AstTypeCompletion {
+    AstTypeCompletion_Incomplete,
+    AstTypeCompletion_Completing,
+    AstTypeCompletion_Complete,
+} AstTypeCompletion;
+
 // Expression
 
 struct AstLiteral {
@@ -669,6 +945,7 @@ struct AstLiteral {
 
 struct AstName {
     Token Name;
+    AstDeclaration* Declaration; // Filled in by the checker
 };
 
 struct AstUnaryExpression {
@@ -685,26 +962,56 @@ struct AstBinaryExpression {
 struct AstField {
     AstExpression* Expression;
     Token Name;
+    u64 Index; // Index into the struct declarations or an ArrayField, filled in by the checker
+    b8 Called; // Set when this is the operand of a call, the methods of '[..]T' cannot be used otherwise
 };
 
 struct AstStruct {
     AstDeclaration* Declarations;
+    const char* Name;
+    b8 Packed;  // #packed, every field is aligned to 1
+    b8 Reorder; // #reorder, fields are laid out by decreasing alignment to minimize padding
+    u64* Offsets; // Indexed like Declarations, filled in by Layout_Struct
+    Token* TypeParameters; // 'struct($T)', NULL unless polymorphic, only its instances are checked
+    AstPolymorph* Instances;
+    AstStruct* Polymorph; // Set on instances, the polymorphic struct they were made from
+    AstType** TypeArguments; // Set on instances, parallel to the TypeParameters of Polymorph
 };
 
 typedef struct AstProcedureArgument {
     Token Name;
     AstType* Type;
+    AstStatement* Declaration; // So the body can find the argument with FindDeclaration
 } AstProcedureArgument;
 
+typedef struct AstCapture {
+    AstDeclaration* Declaration;
+    AstProcedure* Owner;
+} AstCapture;
+
 struct AstProcedure {
     AstProcedureArgument* Arguments;
     AstType* ReturnType;
     AstScope* Body;
+    const char* Name;
+    IrProcedure* Ir;
+    AstCapture* Captures; // Variables of enclosing procedures, callers pass their addresses in an environment
+    b8 Checked; // The body is complete, '#run' can only call procedures that are
+    Token* TypeParameters; // Every '$T' in the argument types, NULL unless polymorphic, only its instances are checked
+    AstPolymorph* Instances;
+};
+
+// A copy of a polymorphic procedure or struct checked with its type parameters bound to Types
+struct AstPolymorph {
+    AstType** Types;
+    u64 Hash; // Of Types, see Type_Hash
+    AstExpression* Instance;
 };
 
 struct AstCall {
     AstExpression* Operand;
     AstExpression** Arguments;
+    AstProcedure* Instance; // The instance called when the operand is a polymorphic procedure, filled in by the checker
 };
 
 struct AstIndex {
@@ -721,6 +1028,11 @@ struct AstCast {
     AstExpression* Expression;
 };
 
+struct AstRun {
+    AstExpression* Expression;
+    u64 Value; // Set by the checker, in the representation of IR constants
+};
+
 typedef enum AstExpressionKind {
     AstExpressionKind_None,
     AstExpressionKind_True,
@@ -737,13 +1049,34 @@ typedef enum AstExpressionKind {
     AstExpressionKind_Index,
     AstExpressionKind_Sizeof,
     AstExpressionKind_Cast,
+    AstExpressionKind_Run,
 } AstExpressionKind;
 
+const char* AstExpressionKindNames[] = {
+    [AstExpressionKind_None] = "None",
+    [AstExpressionKind_True] = "True",
+    [AstExpressionKind_False] = "False",
+    [AstExpressionKind_Null] = "Null",
+    [AstExpressionKind_Literal] = "Literal",
+    [AstExpressionKind_Name] = "Name",
+    [AstExpressionKind_Unary] = "Unary",
+    [AstExpressionKind_Binary] = "Binary",
+    [AstExpressionKind_Field] = "Field",
+    [AstExpressionKind_Struct] = "Struct",
+    [AstExpressionKind_Procedure] = "Procedure",
+    [AstExpressionKind_Call] = "Call",
+    [AstExpressionKind_Index] = "Index",
+    [AstExpressionKind_Sizeof] = "Sizeof",
+    [AstExpressionKind_Cast] = "Cast",
+    [AstExpressionKind_Run] = "Run",
+};
+
 struct AstExpression {
     AstExpressionKind Kind;
     AstType* Type;
     b8 IsLValue;
     b8 Constant;
+    AstType* TypeValue; // The type this expression names when its type is 'Type'
 
     union {
         AstLiteral Literal;
@@ -757,6 +1090,7 @@ struct AstExpression {
         AstIndex Index;
         AstSizeOf SizeOf;
         AstCast Cast;
+        AstRun Run;
     };
 };
 
@@ -765,6 +1099,9 @@ struct AstExpression {
 struct AstScope {
     AstScope* Parent;
     AstStatement** Statements;
+    AstProcedure* Procedure; // Set when this scope is the body of a procedure
+    AstStatement* Variable; // Set when this scope is the body of a for loop
+    b8 NoBoundsCheck; // Indexing inside is not checked, set by '#no_bounds_check'
 };
 
 struct AstDeclaration {
@@ -772,6 +1109,9 @@ struct AstDeclaration {
     AstType* Type;
     AstExpression* Value;
     b8 Constant;
+    b8 AddressTaken;
+    AstTypeCompletion Completion;
+    IrInstruction* Address; // Stack slot when the declaration does not live in a register
 };
 
 struct AstAssignment {
@@ -790,6 +1130,31 @@ struct AstIf {
     AstStatement* Else;
 };
 
+struct AstWhile {
+    AstExpression* Condition;
+    AstStatement* Body;
+};
+
+// 'for i in start..end', the range is half open and end is evaluated once
+struct AstFor {
+    AstStatement* Variable; // Declaration whose value is the start of the range
+    AstExpression* End;
+    AstScope* Body;
+};
+
+typedef struct AstCase {
+    AstExpression** Values;
+    AstStatement* Body;
+} AstCase;
+
+// 'switch value { case 1, 2 {} else {} }', at most one case runs and no two cases have the same value.
+// The values are constant integers or strings.
+struct AstSwitch {
+    AstExpression* Value;
+    AstCase* Cases;
+    AstStatement* Else;
+};
+
 typedef enum AstStatementKind {
     AstStatementKind_None,
     AstStatementKind_Expression,
@@ -798,8 +1163,24 @@ typedef enum AstStatementKind {
     AstStatementKind_Assignment,
     AstStatementKind_Return,
     AstStatementKind_If,
+    AstStatementKind_While,
+    AstStatementKind_For,
+    AstStatementKind_Switch,
 } AstStatementKind;
 
+const char* AstStatementKindNames[] = {
+    [AstStatementKind_None] = "None",
+    [AstStatementKind_Expression] = "Expression",
+    [AstStatementKind_Scope] = "Scope",
+    [AstStatementKind_Declaration] = "Declaration",
+    [AstStatementKind_Assignment] = "Assignment",
+    [AstStatementKind_Return] = "Return",
+    [AstStatementKind_If] = "If",
+    [AstStatementKind_While] = "While",
+    [AstStatementKind_For] = "For",
+    [AstStatementKind_Switch] = "Switch",
+};
+
 struct AstStatement {
     AstStatementKind Kind;
 
@@ -810,6 +1191,9 @@ struct AstStatement {
         AstAssignment Assignment;
         AstReturn Return;
         AstIf If;
+        AstWhile While;
+        AstFor For;
+        AstSwitch Switch;
     };
 };
 
@@ -817,6 +1201,8 @@ struct AstStatement {
 
 typedef struct AstTypeUnknown {
     Token Name;
+    b8 Polymorphic; // '$T', declares the type parameter T of a procedure
+    AstType** TypeArguments; // 'Name(A, B)' names an instance of a polymorphic struct, NULL otherwise
 } AstTypeUnknown;
 
 typedef struct AstTypePointer {
@@ -826,12 +1212,15 @@ typedef struct AstTypePointer {
 typedef struct AstTypeProcedure {
     AstProcedureArgument* Arguments;
     AstType* ReturnType;
+    AstProcedure* Polymorph; // Set when the procedure is polymorphic, its argument types are left as written then
 } AstTypeProcedure;
 
 typedef struct AstTypeArray {
     AstExpression* Count;
     b8 Dynamic;
+    b8 Soa; // Stored as one array per field of the struct, see Type_SoaColumn
     AstType* ArrayOf;
+    u64 ElementCount; // Value of Count, filled in by the checker
 } AstTypeArray;
 
 typedef enum AstTypeKind {
@@ -847,25 +1236,21 @@ typedef enum AstTypeKind {
     AstTypeKind_Procedure,
     AstTypeKind_Struct,
     AstTypeKind_Array,
+    AstTypeKind_Vector,
 } AstTypeKind;
 
-typedef enum AstTypeCompletion {
-    AstTypeCompletion_Incomplete,
-    AstTypeCompletion_Completing,
-    AstTypeCompletion_Complete,
-} AstTypeCompletion;
-
 struct AstType {
     AstTypeKind Kind;
     AstTypeCompletion Completion;
     u64 Size;
+    u64 Align; // Only stored for structs, see Type_Align
 
     union {
         AstTypeUnknown Unknown;
         AstTypePointer Pointer;
         AstTypeProcedure Procedure;
         AstStruct Struct;
-        AstTypeArray Array;
+        AstTypeArray Array; // Also '#vector(N) T', whose lanes are a fixed array that is never dynamic
         b8 Signed;
     };
 };
@@ -885,572 +1270,8431 @@ struct Ast {
     };
 };
 
-typedef struct Parser {
-    Lexer Lexer;
-    Token Current;
-} Parser;
+// Ast traversal
 
-void Parser_Init(Parser* parser, const char* path, const char* source) {
-    Lexer_Init(&parser->Lexer, path, source);
-    parser->Current = Lexer_NextToken(&parser->Lexer);
-}
+// Callbacks are called before the children of a node, returning FALSE skips the children. Types are not visited and
+// neither are the declarations of struct fields and procedure arguments, only the values of struct fields.
+typedef struct AstVisitor {
+    b8 (*Statement)(AstStatement* statement, void* userData);
+    b8 (*Expression)(AstExpression* expression, void* userData);
+    void* UserData;
+} AstVisitor;
 
-Token Parser_NextToken(Parser* parser) {
-    Token token = parser->Current;
-    parser->Current = Lexer_NextToken(&parser->Lexer);
-    return token;
-}
+typedef struct AstVisitItem {
+    b8 IsStatement;
+    union {
+        AstStatement* Statement;
+        AstExpression* Expression;
+    };
+} AstVisitItem;
 
-Token Parser_ExpectToken(Parser* parser, TokenKind kind) {
-    Token token = Parser_NextToken(parser);
-    if (token.Kind != kind) {
-        Error("Expected '%s' got '%s'", TokenKindNames[kind], TokenKindNames[token.Kind]);
+void AstVisit_PushStatement(AstVisitItem** stack, AstStatement* statement) {
+    if (statement) {
+        DynamicArrayPush(*stack, ((AstVisitItem){ .IsStatement = TRUE, .Statement = statement }));
     }
-    return token;
-}
-
-AstExpression* Parser_ParseExpression(Parser* parser, AstScope* parentScope);
-AstExpression* Parser_ParsePrimaryExpression(Parser* parser, AstScope* parentScope);
-AstExpression* Parser_ParseBinaryExpression(Parser* parser, u64 presedence, AstScope* parentScope);
-AstType* Parser_ParseType(Parser* parser, AstScope* parentScope);
-AstStatement* Parser_ParseStatement(Parser* parser, AstScope* parentScope);
-AstScope* Parser_ParseScope(Parser* parser, AstScope* parentScope);
-
-AstExpression* Parser_ParseExpression(Parser* parser, AstScope* parentScope) {
-    return Parser_ParseBinaryExpression(parser, 0, parentScope);
 }
 
-u64 Parser_GetUnaryPresedence(Token token) {
-    switch (token.Kind) {
-        case TokenKind_Plus:
-        case TokenKind_Minus:
-        case TokenKind_Caret:
-        case TokenKind_Asterisk:
-        case TokenKind_ExclamationMark:
-            return 5;
-        default:
-            return 0;
+void AstVisit_PushExpression(AstVisitItem** stack, AstExpression* expression) {
+    if (expression) {
+        DynamicArrayPush(*stack, ((AstVisitItem){ .IsStatement = FALSE, .Expression = expression }));
     }
 }
 
-u64 Parser_GetBinaryPresedence(Token token) {
-    switch (token.Kind) {
-        case TokenKind_Period:
-            return 6;
-        case TokenKind_Asterisk:
-        case TokenKind_Slash:
-        case TokenKind_Percent:
-        case TokenKind_Ampersand:
-        case TokenKind_Pipe:
-            return 4;
-        case TokenKind_Plus:
-        case TokenKind_Minus:
-            return 3;
-        case TokenKind_EqualsEquals:
-        case TokenKind_ExclamationMarkEquals:
-            return 2;
-        case TokenKind_AmpersandAmpersand:
-        case TokenKind_PipePipe:
-            return 1;
-        default:
-            return 0;
-    }
-}
+// Visits the tree in source order with an explicit stack, so it works on trees of any depth
+void Ast_Visit(AstStatement* root, AstVisitor* visitor) {
+    AstVisitItem* stack = DynamicArrayCreate(AstVisitItem);
+    AstVisit_PushStatement(&stack, root);
 
-AstExpression* Parser_ParseProcedure(Parser* parser, AstProcedureArgument* firstArg, AstScope* parentScope) {
-    AstProcedureArgument* arguments = DynamicArrayCreate(AstProcedureArgument);
-    if (firstArg) {
-        DynamicArrayPush(arguments, *firstArg); // TODO: Memory leak
-    }
+    // Children are pushed in reverse so the first one is visited next
+    while (DynamicArrayLength(stack) > 0) {
+        AstVisitItem item;
+        DynamicArrayPop(stack, &item);
 
-    while (parser->Current.Kind != TokenKind_RParen) {
-        Parser_ExpectToken(parser, TokenKind_Comma);
+        if (item.IsStatement) {
+            AstStatement* statement = item.Statement;
+            if (visitor->Statement && !visitor->Statement(statement, visitor->UserData)) {
+                continue;
+            }
 
-        Token nameToken = Parser_ExpectToken(parser, TokenKind_Name);
+            switch (statement->Kind) {
+                case AstStatementKind_Expression: {
+                    AstVisit_PushExpression(&stack, &statement->Expression);
+                } break;
 
-        Parser_ExpectToken(parser, TokenKind_Colon);
-        AstType* type = Parser_ParseType(parser, parentScope);
+                case AstStatementKind_Scope: {
+                    for (u64 i = DynamicArrayLength(statement->Scope.Statements); i > 0; i--) {
+                        AstVisit_PushStatement(&stack, statement->Scope.Statements[i - 1]);
+                    }
+                } break;
 
-        DynamicArrayPush(arguments, ((AstProcedureArgument){
-            .Name = nameToken,
-            .Type = type,
-        }));
-    }
+                case AstStatementKind_Declaration: {
+                    AstVisit_PushExpression(&stack, statement->Declaration.Value);
+                } break;
 
-    Parser_ExpectToken(parser, TokenKind_RParen);
+                case AstStatementKind_Assignment: {
+                    AstVisit_PushExpression(&stack, statement->Assignment.Value);
+                    AstVisit_PushExpression(&stack, statement->Assignment.Operand);
+                } break;
 
-    AstType* returnType = NULL;
-    if (parser->Current.Kind == TokenKind_RightArrow) {
-        Parser_ExpectToken(parser, TokenKind_RightArrow);
-        returnType = Parser_ParseType(parser, parentScope);
-    }
+                case AstStatementKind_Return: {
+                    AstVisit_PushExpression(&stack, statement->Return.Expression);
+                } break;
 
-    AstScope* body = Parser_ParseScope(parser, parentScope);
+                case AstStatementKind_If: {
+                    AstVisit_PushStatement(&stack, statement->If.Else);
+                    AstVisit_PushStatement(&stack, statement->If.Then);
+                    AstVisit_PushExpression(&stack, statement->If.Condition);
+                } break;
 
-    AstExpression* expression = Allocate(sizeof(AstExpression));
-    expression->Kind = AstExpressionKind_Procedure;
-    expression->Procedure.Arguments = arguments;
-    expression->Procedure.ReturnType = returnType;
-    expression->Procedure.Body = body;
+                case AstStatementKind_While: {
+                    AstVisit_PushStatement(&stack, statement->While.Body);
+                    AstVisit_PushExpression(&stack, statement->While.Condition);
+                } break;
 
-    return expression;
-}
+                case AstStatementKind_For: {
+                    AstStatement** statements = statement->For.Body->Statements;
+                    for (u64 i = DynamicArrayLength(statements); i > 0; i--) {
+                        AstVisit_PushStatement(&stack, statements[i - 1]);
+                    }
+                    AstVisit_PushExpression(&stack, statement->For.End);
+                    AstVisit_PushStatement(&stack, statement->For.Variable);
+                } break;
 
-AstExpression* Parser_ParsePrimaryExpression(Parser* parser, AstScope* parentScope) {
-    switch (parser->Current.Kind) {
-        case TokenKind_Name: {
-            Token nameToken = Parser_ExpectToken(parser, TokenKind_Name);
+                case AstStatementKind_Switch: {
+                    AstVisit_PushStatement(&stack, statement->Switch.Else);
+                    for (u64 i = DynamicArrayLength(statement->Switch.Cases); i > 0; i--) {
+                        AstCase* case_ = &statement->Switch.Cases[i - 1];
+                        AstVisit_PushStatement(&stack, case_->Body);
+                        for (u64 j = DynamicArrayLength(case_->Values); j > 0; j--) {
+                            AstVisit_PushExpression(&stack, case_->Values[j - 1]);
+                        }
+                    }
+                    AstVisit_PushExpression(&stack, statement->Switch.Value);
+                } break;
 
-            AstExpression* expression = Allocate(sizeof(AstExpression));
-            expression->Kind = AstExpressionKind_Name;
-            expression->Name.Name = nameToken;
+                default: {
+                    ASSERT(FALSE);
+                } break;
+            }
+        } else {
+            AstExpression* expression = item.Expression;
+            if (visitor->Expression && !visitor->Expression(expression, visitor->UserData)) {
+                continue;
+            }
 
-            return expression;
-        } break;
+            switch (expression->Kind) {
+                case AstExpressionKind_Unary: {
+                    AstVisit_PushExpression(&stack, expression->Unary.Operand);
+                } break;
 
-        case TokenKind_Keyword: {
-            switch (Parser_ExpectToken(parser, TokenKind_Keyword).Keyword) {
-                case Keyword_True: {
-                    AstExpression* expression = Allocate(sizeof(AstExpression));
-                    expression->Kind = AstExpressionKind_True;
-                    return expression;
+                case AstExpressionKind_Binary: {
+                    AstVisit_PushExpression(&stack, expression->Binary.Right);
+                    AstVisit_PushExpression(&stack, expression->Binary.Left);
                 } break;
 
-                case Keyword_False: {
-                    AstExpression* expression = Allocate(sizeof(AstExpression));
-                    expression->Kind = AstExpressionKind_False;
-                    return expression;
+                case AstExpressionKind_Field: {
+                    AstVisit_PushExpression(&stack, expression->Field.Expression);
                 } break;
 
-                case Keyword_Null: {
-                    AstExpression* expression = Allocate(sizeof(AstExpression));
-                    expression->Kind = AstExpressionKind_Null;
-                    return expression;
+                case AstExpressionKind_Struct: {
+                    for (u64 i = DynamicArrayLength(expression->Struct.Declarations); i > 0; i--) {
+                        AstVisit_PushExpression(&stack, expression->Struct.Declarations[i - 1].Value);
+                    }
                 } break;
 
-                case Keyword_Struct: {
-                    AstScope* scope = Parser_ParseScope(parser, parentScope); // TODO: Memory leak
+                case AstExpressionKind_Procedure: {
+                    AstStatement** statements = expression->Procedure.Body->Statements;
+                    for (u64 i = DynamicArrayLength(statements); i > 0; i--) {
+                        AstVisit_PushStatement(&stack, statements[i - 1]);
+                    }
+                } break;
 
-                    AstDeclaration* declarations = DynamicArrayCreate(AstDeclaration);
-                    for (u64 i = 0; i < DynamicArrayLength(scope->Statements); i++) {
-                        if (scope->Statements[i]->Kind != AstStatementKind_Declaration) {
-                            Error("Expected declaration in struct");
-                            return NULL;
-                        }
-                        DynamicArrayPush(declarations, scope->Statements[i]->Declaration);
+                case AstExpressionKind_Call: {
+                    for (u64 i = DynamicArrayLength(expression->Call.Arguments); i > 0; i--) {
+                        AstVisit_PushExpression(&stack, expression->Call.Arguments[i - 1]);
                     }
-
-                    AstExpression* expression = Allocate(sizeof(AstExpression));
-                    expression->Kind = AstExpressionKind_Struct;
-                    expression->Struct.Declarations = declarations;
-                    return expression;
+                    AstVisit_PushExpression(&stack, expression->Call.Operand);
                 } break;
 
-                case Keyword_SizeOf: {
-                    Parser_ExpectToken(parser, TokenKind_LParen);
-                    AstExpression* expression = Parser_ParseExpression(parser, parentScope);
-                    Parser_ExpectToken(parser, TokenKind_RParen);
+                case AstExpressionKind_Index: {
+                    AstVisit_PushExpression(&stack, expression->Index.Index);
+                    AstVisit_PushExpression(&stack, expression->Index.Operand);
+                } break;
 
-                    AstExpression* sizeOf = Allocate(sizeof(AstExpression));
-                    sizeOf->Kind = AstExpressionKind_Sizeof;
-                    sizeOf->SizeOf.Expression = expression;
-                    return sizeOf;
+                case AstExpressionKind_Sizeof: {
+                    AstVisit_PushExpression(&stack, expression->SizeOf.Expression);
                 } break;
 
-                case Keyword_Cast: {
-                    Parser_ExpectToken(parser, TokenKind_LParen);
-                    AstType* type = Parser_ParseType(parser, parentScope);
-                    Parser_ExpectToken(parser, TokenKind_RParen);
-                    AstExpression* expression = Parser_ParsePrimaryExpression(parser, parentScope);
+                case AstExpressionKind_Cast: {
+                    AstVisit_PushExpression(&stack, expression->Cast.Expression);
+                } break;
 
-                    AstExpression* result = Allocate(sizeof(AstExpression));
-                    result->Kind = AstExpressionKind_Cast;
-                    result->Cast.Type = type;
-                    result->Cast.Expression = expression;
-                    return result;
+                case AstExpressionKind_Run: {
+                    AstVisit_PushExpression(&stack, expression->Run.Expression);
                 } break;
 
                 default: {
-                    goto Default;
                 } break;
             }
-        } break;
-
-        case TokenKind_Integer:
-        case TokenKind_Float:
-        case TokenKind_String: {
-            Token literalToken = Parser_NextToken(parser);
-
-            AstExpression* expression = Allocate(sizeof(AstExpression));
-            expression->Kind = AstExpressionKind_Literal;
-            expression->Literal.Token = literalToken;
+        }
+    }
 
-            return expression;
-        } break;
+    DynamicArrayDestroy(stack);
+}
 
-        case TokenKind_LParen: {
-            Parser_ExpectToken(parser, TokenKind_LParen);
+// Ast cloning
 
-            if (parser->Current.Kind == TokenKind_RParen) {
-                return Parser_ParseProcedure(parser, NULL, parentScope);
-            }
+// Copies of an unchecked tree, instances of polymorphic procedures and structs are checked on their own copy. Scopes
+// of the copy have parentScope as their parent, like the parser would have made them.
+AstExpression* Ast_CloneExpression(AstExpression* expression, AstScope* parentScope);
+AstStatement* Ast_CloneStatement(AstStatement* statement, AstScope* parentScope);
 
-            AstExpression* expression = Parser_ParseExpression(parser, parentScope);
+AstType* Ast_CloneType(AstType* type, AstScope* parentScope) {
+    if (!type || type->Completion == AstTypeCompletion_Complete) {
+        return type;
+    }
 
-            if (parser->Current.Kind == TokenKind_Colon) { // Procedure
-                if (expression->Kind != AstExpressionKind_Name) {
-                    Error("Expected ':'"); // TODO: Better error
-                    return NULL;
+    AstType* result = Allocate(sizeof(AstType));
+    *result = *type;
+    switch (type->Kind) {
+        case AstTypeKind_Unknown: {
+            if (type->Unknown.TypeArguments) {
+                result->Unknown.TypeArguments = DynamicArrayCreate(AstType*);
+                for (u64 i = 0; i < DynamicArrayLength(type->Unknown.TypeArguments); i++) {
+                    DynamicArrayPush(result->Unknown.TypeArguments, Ast_CloneType(type->Unknown.TypeArguments[i], parentScope));
                 }
+            }
+        } break;
 
-                Parser_ExpectToken(parser, TokenKind_Colon);
-                AstType* type = Parser_ParseType(parser, parentScope);
+        case AstTypeKind_Pointer: {
+            result->Pointer.PointerTo = Ast_CloneType(type->Pointer.PointerTo, parentScope);
+        } break;
 
-                return Parser_ParseProcedure(parser, &(AstProcedureArgument){
-                    .Name = expression->Name.Name,
-                    .Type = type,
-                }, parentScope); // TODO: Pass global scope here
-            } else {
-                Parser_ExpectToken(parser, TokenKind_RParen);
-                return expression;
-            }
+        case AstTypeKind_Array:
+        case AstTypeKind_Vector: {
+            result->Array.Count = Ast_CloneExpression(type->Array.Count, parentScope);
+            result->Array.ArrayOf = Ast_CloneType(type->Array.ArrayOf, parentScope);
         } break;
 
-        default: Default: {
-            Error("Unexpected token '%s'", TokenKindNames[Parser_NextToken(parser).Kind]);
-            return NULL;
+        default: {
+            ASSERT(FALSE);
         } break;
     }
+    return result;
+}
 
-    ASSERT(FALSE);
-    return NULL;
+AstDeclaration Ast_CloneDeclaration(AstDeclaration* declaration, AstScope* parentScope) {
+    return (AstDeclaration){
+        .Name = declaration->Name,
+        .Type = Ast_CloneType(declaration->Type, parentScope),
+        .Value = Ast_CloneExpression(declaration->Value, parentScope),
+        .Constant = declaration->Constant,
+    };
 }
 
-AstExpression* Parser_ParseBinaryExpression(Parser* parser, u64 presedence, AstScope* parentScope) {
-    u64 unaryPresedence = Parser_GetUnaryPresedence(parser->Current);
-    AstExpression* left;
-    if (unaryPresedence != 0 && unaryPresedence > presedence) {
-        Token operator = Parser_NextToken(parser);
-        AstExpression* operand = Parser_ParseBinaryExpression(parser, unaryPresedence, parentScope);
-        
-        left = Allocate(sizeof(AstExpression));
-        left->Kind = AstExpressionKind_Unary;
-        left->Unary.Operator = operator;
-        left->Unary.Operand = operand;
-    } else {
-        left = Parser_ParsePrimaryExpression(parser, parentScope);
+AstScope* Ast_CloneScope(AstScope* scope, AstScope* parentScope) {
+    AstScope* result = Allocate(sizeof(AstScope));
+    result->Parent = parentScope;
+    result->NoBoundsCheck = scope->NoBoundsCheck;
+    result->Statements = DynamicArrayCreate(AstStatement*);
+    for (u64 i = 0; i < DynamicArrayLength(scope->Statements); i++) {
+        DynamicArrayPush(result->Statements, Ast_CloneStatement(scope->Statements[i], result));
     }
+    return result;
+}
 
-    while (TRUE) {
-        if (parser->Current.Kind == TokenKind_LParen) {
-            Parser_ExpectToken(parser, TokenKind_LParen);
-            AstExpression** arguments = DynamicArrayCreate(AstExpression*);
+AstExpression* Ast_CloneExpression(AstExpression* expression, AstScope* parentScope) {
+    if (!expression) {
+        return NULL;
+    }
 
-            b8 first = TRUE;
-            while (parser->Current.Kind != TokenKind_RParen) {
-                if (!first) {
-                    Parser_ExpectToken(parser, TokenKind_Comma);
-                } else {
-                    first = FALSE;
-                }
+    AstExpression* result = Allocate(sizeof(AstExpression));
+    result->Kind = expression->Kind;
+    switch (expression->Kind) {
+        case AstExpressionKind_True:
+        case AstExpressionKind_False:
+        case AstExpressionKind_Null: {
+        } break;
+
+        case AstExpressionKind_Literal: {
+            result->Literal = expression->Literal;
+        } break;
 
-                DynamicArrayPush(arguments, Parser_ParseExpression(parser, parentScope));
+        case AstExpressionKind_Name: {
+            result->Name.Name = expression->Name.Name;
+        } break;
+
+        case AstExpressionKind_Unary: {
+            result->Unary.Operator = expression->Unary.Operator;
+            result->Unary.Operand = Ast_CloneExpression(expression->Unary.Operand, parentScope);
+        } break;
+
+        case AstExpressionKind_Binary: {
+            // Binary chains nest to the left, the loop copies down them
+            AstExpression* to = result;
+            while (TRUE) {
+                to->Binary.Operator = expression->Binary.Operator;
+                to->Binary.Right = Ast_CloneExpression(expression->Binary.Right, parentScope);
+                expression = expression->Binary.Left;
+                if (expression->Kind != AstExpressionKind_Binary) {
+                    to->Binary.Left = Ast_CloneExpression(expression, parentScope);
+                    break;
+                }
+                to->Binary.Left = Allocate(sizeof(AstExpression));
+                to->Binary.Left->Kind = AstExpressionKind_Binary;
+                to = to->Binary.Left;
             }
-            Parser_ExpectToken(parser, TokenKind_RParen);
+        } break;
 
-            AstExpression* expression = Allocate(sizeof(AstExpression));
-            expression->Kind = AstExpressionKind_Call;
-            expression->Call.Operand = left;
-            expression->Call.Arguments = arguments;
-            left = expression;
-        } else if (parser->Current.Kind == TokenKind_LBracket) {
-            Parser_ExpectToken(parser, TokenKind_LBracket);
-            AstExpression* index = Parser_ParseExpression(parser, parentScope);
-            Parser_ExpectToken(parser, TokenKind_RBracket);
+        case AstExpressionKind_Field: {
+            result->Field.Expression = Ast_CloneExpression(expression->Field.Expression, parentScope);
+            result->Field.Name = expression->Field.Name;
+        } break;
 
-            AstExpression* expression = Allocate(sizeof(AstExpression));
-            expression->Kind = AstExpressionKind_Index;
-            expression->Index.Operand = left;
-            expression->Index.Index = index;
-            left = expression;
-        }
+        case AstExpressionKind_Struct: {
+            AstStruct* struct_ = &expression->Struct;
+            result->Struct.Declarations = DynamicArrayCreate(AstDeclaration);
+            for (u64 i = 0; i < DynamicArrayLength(struct_->Declarations); i++) {
+                DynamicArrayPush(result->Struct.Declarations, Ast_CloneDeclaration(&struct_->Declarations[i], parentScope));
+            }
+            result->Struct.Packed = struct_->Packed;
+            result->Struct.Reorder = struct_->Reorder;
+            result->Struct.TypeParameters = struct_->TypeParameters;
+            result->Struct.Instances = struct_->TypeParameters ? DynamicArrayCreate(AstPolymorph) : NULL;
+        } break;
 
-        u64 binaryPresedence = Parser_GetBinaryPresedence(parser->Current);
-        if (binaryPresedence == 0 || binaryPresedence <= presedence) {
-            break;
-        }
+        case AstExpressionKind_Procedure: {
+            AstProcedure* procedure = &expression->Procedure;
+            result->Procedure.Arguments = DynamicArrayCreate(AstProcedureArgument);
+            for (u64 i = 0; i < DynamicArrayLength(procedure->Arguments); i++) {
+                AstStatement* declaration = Allocate(sizeof(AstStatement));
+                declaration->Kind = AstStatementKind_Declaration;
+                declaration->Declaration.Name = procedure->Arguments[i].Name;
+                declaration->Declaration.Type = Ast_CloneType(procedure->Arguments[i].Type, parentScope);
+
+                DynamicArrayPush(result->Procedure.Arguments, ((AstProcedureArgument){
+                    .Name = procedure->Arguments[i].Name,
+                    .Type = declaration->Declaration.Type,
+                    .Declaration = declaration,
+                }));
+            }
+            result->Procedure.ReturnType = Ast_CloneType(procedure->ReturnType, parentScope);
+            result->Procedure.Body = Ast_CloneScope(procedure->Body, parentScope);
+            result->Procedure.Body->Procedure = &result->Procedure;
+            result->Procedure.Captures = DynamicArrayCreate(AstCapture);
+            result->Procedure.TypeParameters = procedure->TypeParameters;
+            result->Procedure.Instances = procedure->TypeParameters ? DynamicArrayCreate(AstPolymorph) : NULL;
+        } break;
 
-        Token operator = Parser_NextToken(parser);
+        case AstExpressionKind_Call: {
+            result->Call.Operand = Ast_CloneExpression(expression->Call.Operand, parentScope);
+            result->Call.Arguments = DynamicArrayCreate(AstExpression*);
+            for (u64 i = 0; i < DynamicArrayLength(expression->Call.Arguments); i++) {
+                DynamicArrayPush(result->Call.Arguments, Ast_CloneExpression(expression->Call.Arguments[i], parentScope));
+            }
+        } break;
 
-        switch (operator.Kind) {
-            case TokenKind_Period: {
-                Token nameToken = Parser_ExpectToken(parser, TokenKind_Name);
+        case AstExpressionKind_Index: {
+            result->Index.Operand = Ast_CloneExpression(expression->Index.Operand, parentScope);
+            result->Index.Index = Ast_CloneExpression(expression->Index.Index, parentScope);
+        } break;
 
-                AstExpression* newLeft = Allocate(sizeof(AstExpression));
-                newLeft->Kind = AstExpressionKind_Field;
-                newLeft->Field.Expression = left;
-                newLeft->Field.Name = nameToken;
+        case AstExpressionKind_Sizeof: {
+            result->SizeOf.Expression = Ast_CloneExpression(expression->SizeOf.Expression, parentScope);
+        } break;
 
-                left = newLeft;
-            } break;
+        case AstExpressionKind_Cast: {
+            result->Cast.Type = Ast_CloneType(expression->Cast.Type, parentScope);
+            result->Cast.Expression = Ast_CloneExpression(expression->Cast.Expression, parentScope);
+        } break;
 
-            default: {
-                AstExpression* right = Parser_ParseBinaryExpression(parser, binaryPresedence, parentScope);
+        case AstExpressionKind_Run: {
+            result->Run.Expression = Ast_CloneExpression(expression->Run.Expression, parentScope);
+        } break;
 
-                AstExpression* newLeft = Allocate(sizeof(AstExpression));
-                newLeft->Kind = AstExpressionKind_Binary;
-                newLeft->Binary.Left = left;
-                newLeft->Binary.Operator = operator;
-                newLeft->Binary.Right = right;
+        default: {
+            ASSERT(FALSE);
+        } break;
+    }
+    return result;
+}
 
-                left = newLeft;
-            } break;
-        }
+AstStatement* Ast_CloneStatement(AstStatement* statement, AstScope* parentScope) {
+    if (!statement) {
+        return NULL;
     }
 
-    return left;
-}
+    AstStatement* result = Allocate(sizeof(AstStatement));
+    result->Kind = statement->Kind;
+    switch (statement->Kind) {
+        case AstStatementKind_Expression: {
+            result->Expression = *Ast_CloneExpression(&statement->Expression, parentScope); // Memory leak
+        } break;
 
-AstType* Parser_ParseType(Parser* parser, AstScope* parentScope) {
-    switch (parser->Current.Kind) {
-        case TokenKind_Name: {
-            Token nameToken = Parser_ExpectToken(parser, TokenKind_Name);
-            AstType* type = Allocate(sizeof(AstType));
-            type->Kind = AstTypeKind_Unknown;
-            type->Unknown.Name = nameToken;
-            return type;
+        case AstStatementKind_Scope: {
+            result->Scope = *Ast_CloneScope(&statement->Scope, parentScope); // TODO: Memory leak
         } break;
 
-        case TokenKind_Caret: {
-            Parser_ExpectToken(parser, TokenKind_Caret);
-            AstType* type = Allocate(sizeof(AstType));
-            type->Kind = AstTypeKind_Pointer;
-            type->Pointer.PointerTo = Parser_ParseType(parser, parentScope);
-            return type;
+        case AstStatementKind_Declaration: {
+            result->Declaration = Ast_CloneDeclaration(&statement->Declaration, parentScope);
         } break;
 
-        case TokenKind_LParen: {
-            Parser_ExpectToken(parser, TokenKind_LParen);
-            AstType* type = Parser_ParseType(parser, parentScope);
-            Parser_ExpectToken(parser, TokenKind_RParen);
-            return type;
+        case AstStatementKind_Assignment: {
+            result->Assignment.Operand = Ast_CloneExpression(statement->Assignment.Operand, parentScope);
+            result->Assignment.Operator = statement->Assignment.Operator;
+            result->Assignment.Value = Ast_CloneExpression(statement->Assignment.Value, parentScope);
         } break;
 
-        case TokenKind_LBracket: {
-            Parser_ExpectToken(parser, TokenKind_LBracket);
-            b8 dynamic = FALSE;
-            AstExpression* count = NULL;
-            if (parser->Current.Kind == TokenKind_PeriodPeriod) {
-                dynamic = TRUE;
-            } else if (parser->Current.Kind != TokenKind_RBracket) {
-                count = Parser_ParseExpression(parser, parentScope);
+        case AstStatementKind_Return: {
+            result->Return.Expression = Ast_CloneExpression(statement->Return.Expression, parentScope);
+        } break;
+
+        case AstStatementKind_If: {
+            // 'else if' chains are copied in a loop
+            AstStatement* to = result;
+            while (TRUE) {
+                to->If.Condition = Ast_CloneExpression(statement->If.Condition, parentScope);
+                to->If.Then = Ast_CloneStatement(statement->If.Then, parentScope);
+                statement = statement->If.Else;
+                if (!statement || statement->Kind != AstStatementKind_If) {
+                    to->If.Else = Ast_CloneStatement(statement, parentScope);
+                    break;
+                }
+                to->If.Else = Allocate(sizeof(AstStatement));
+                to->If.Else->Kind = AstStatementKind_If;
+                to = to->If.Else;
             }
-            Parser_ExpectToken(parser, TokenKind_RBracket);
-            AstType* arrayOf = Parser_ParseType(parser, parentScope);
-            
-            AstType* type = Allocate(sizeof(AstType));
-            type->Kind = AstTypeKind_Array;
-            type->Array.Dynamic = dynamic;
-            type->Array.Count = count;
-            type->Array.ArrayOf = arrayOf;
-            return type;
+        } break;
+
+        case AstStatementKind_While: {
+            result->While.Condition = Ast_CloneExpression(statement->While.Condition, parentScope);
+            result->While.Body = Ast_CloneStatement(statement->While.Body, parentScope);
+        } break;
+
+        case AstStatementKind_For: {
+            result->For.Variable = Ast_CloneStatement(statement->For.Variable, parentScope);
+            result->For.End = Ast_CloneExpression(statement->For.End, parentScope);
+            result->For.Body = Ast_CloneScope(statement->For.Body, parentScope);
+            result->For.Body->Variable = result->For.Variable;
+        } break;
+
+        case AstStatementKind_Switch: {
+            result->Switch.Value = Ast_CloneExpression(statement->Switch.Value, parentScope);
+            result->Switch.Cases = DynamicArrayCreate(AstCase);
+            for (u64 i = 0; i < DynamicArrayLength(statement->Switch.Cases); i++) {
+                AstCase* case_ = &statement->Switch.Cases[i];
+                AstCase clone = {};
+                clone.Values = DynamicArrayCreate(AstExpression*);
+                for (u64 j = 0; j < DynamicArrayLength(case_->Values); j++) {
+                    DynamicArrayPush(clone.Values, Ast_CloneExpression(case_->Values[j], parentScope));
+                }
+                clone.Body = Ast_CloneStatement(case_->Body, parentScope);
+                DynamicArrayPush(result->Switch.Cases, clone);
+            }
+            result->Switch.Else = Ast_CloneStatement(statement->Switch.Else, parentScope);
         } break;
 
         default: {
             ASSERT(FALSE);
-            return NULL;
         } break;
     }
+    return result;
+}
 
-    ASSERT(FALSE);
-    return NULL;
+typedef struct Diagnostic {
+    SrcPos Pos;
+    u64 Length;
+    const char* Message;
+} Diagnostic;
+
+void Diagnostic_Print(Diagnostic* diagnostic) {
+    SrcPos pos = diagnostic->Pos;
+    printf("%s:%llu:%llu: error: %s\n", pos.Src->Path, pos.Line, pos.Column, diagnostic->Message);
+
+    const char* source = pos.Src->Source;
+    u64 lineStart = pos.Position - (pos.Column - 1);
+    u64 lineEnd = pos.Position;
+    while (lineEnd < pos.Src->Length && source[lineEnd] != '\n' && source[lineEnd] != '\r') {
+        lineEnd++;
+    }
+
+    printf("    %.*s\n    ", cast(int) (lineEnd - lineStart), source + lineStart);
+    for (u64 i = lineStart; i < pos.Position; i++) {
+        putchar(source[i] == '\t' ? '\t' : ' ');
+    }
+    putchar('^');
+    for (u64 i = 1; i < diagnostic->Length && pos.Position + i < lineEnd; i++) {
+        putchar('~');
+    }
+    putchar('\n');
 }
 
-AstStatement* Parser_ParseStatement(Parser* parser, AstScope* parentScope) {
-    if (parser->Current.Kind == TokenKind_Semicolon) {
-        Parser_ExpectToken(parser, TokenKind_Semicolon);
-        return Parser_ParseStatement(parser, parentScope);
-    } else if (parser->Current.Kind == TokenKind_LBrace) {
-        AstStatement* statement = Allocate(sizeof(AstStatement));
-        statement->Kind = AstStatementKind_Scope;
-        statement->Scope = *Parser_ParseScope(parser, parentScope); // TODO: Memory leak
-        return statement;
-    } else if (parser->Current.Kind == TokenKind_Keyword) {
-        switch (Parser_ExpectToken(parser, TokenKind_Keyword).Keyword) {
-            case Keyword_Return: {
-                AstStatement* statement = Allocate(sizeof(AstStatement));
-                statement->Kind = AstStatementKind_Return;
-                statement->Return.Expression = Parser_ParseExpression(parser, parentScope);
-                Parser_ExpectToken(parser, TokenKind_Semicolon);
-                return statement;
-            } break;
+// The expression parser keeps its own stack of unfinished expressions instead of recursing, so nesting only costs heap.
+// A frame is pushed whenever the parser needs a subexpression before it can build a node and popped when the
+// subexpression is done. The presedence is the one of the binary expression that is resumed afterwards.
+typedef enum ParserFrameKind {
+    ParserFrameKind_Unary,
+    ParserFrameKind_Binary,
+    ParserFrameKind_Paren,
+    ParserFrameKind_SizeOf,
+    ParserFrameKind_Cast,
+    ParserFrameKind_Run,
+    ParserFrameKind_CallArgument,
+    ParserFrameKind_Index,
+} ParserFrameKind;
+
+typedef struct ParserFrame {
+    ParserFrameKind Kind;
+    u64 Presedence;
+    Token Token; // The operator, or the token that opened the frame
+    AstExpression* Left; // Left side of a binary expression, operand of a call or index
+    u64 Height; // Nesting of the tallest node already parsed for this frame, see Parser_CheckHeight
+    AstExpression** Arguments;
+    AstType* Type;
+} ParserFrame;
 
-            case Keyword_If: {
-                AstExpression* condition = Parser_ParseExpression(parser, parentScope);
-                AstStatement* then = Parser_ParseStatement(parser, parentScope);
+typedef struct Parser {
+    Lexer Lexer;
+    Token Current;
+    Token Previous;
 
-                AstStatement* else_ = NULL;
-                if (parser->Current.Kind == TokenKind_Keyword && parser->Current.Keyword == Keyword_Else) {
-                    Parser_ExpectToken(parser, TokenKind_Keyword);
-                    else_ = Parser_ParseStatement(parser, parentScope);
-                }
+    // Syntax errors, the parser skips to the end of the statement after each one and carries on
+    Diagnostic* Diagnostics;
+    jmp_buf* Recovery;
 
-                AstStatement* statement = Allocate(sizeof(AstStatement));
-                statement->Kind = AstStatementKind_If;
-                statement->If.Condition = condition;
-                statement->If.Then = then;
-                statement->If.Else = else_;
-                return statement;
-            } break;
+    // When set the tokens are read from here instead of the lexer
+    Token* Tokens;
+    u64 TokenIndex;
 
-            default: {
-                ASSERT(FALSE);
-                return NULL;
-            } break;
-        }
-    } else {
-        AstExpression* expression = Parser_ParseExpression(parser, parentScope);
+    // Hash of every token consumed and the names among them, reset by the caller between declarations
+    u64 Hash;
+    const char** Names;
 
-        if (parser->Current.Kind == TokenKind_Colon) {
-            if (expression->Kind != AstExpressionKind_Name) {
-                Error("':' must be preceded by a name!");
-                return NULL;
-            }
+    u64 Depth; // Scopes and expressions around the current token, see Parser_MaxDepth
+    ParserFrame* Frames; // Shared by every expression being parsed, each one only looks at the frames it pushed
+} Parser;
 
-            Parser_ExpectToken(parser, TokenKind_Colon);
+// Everything after the parser recurses over the tree, this keeps deeply nested input from overflowing the stack. Binary
+// chains like 'a + b + c' and 'else if' chains are walked in loops instead, so they do not count.
+#define Parser_MaxDepth 256
 
-            AstType* type = NULL;
-            if (parser->Current.Kind != TokenKind_Equals && parser->Current.Kind != TokenKind_Colon) {
-                type = Parser_ParseType(parser, parentScope);
-            }
+void Parser_Init(Parser* parser, const char* path, const char* source) {
+    Lexer_Init(&parser->Lexer, path, source);
+    parser->Current = Lexer_NextToken(&parser->Lexer);
+    parser->Diagnostics = DynamicArrayCreate(Diagnostic);
+    parser->Hash = Hash_Initial;
+    parser->Names = DynamicArrayCreate(const char*);
+    parser->Depth = 0;
+    parser->Frames = DynamicArrayCreate(ParserFrame);
+}
 
-            b8 constant = FALSE;
-            AstExpression* value = NULL;
-            if (parser->Current.Kind == TokenKind_Equals || parser->Current.Kind == TokenKind_Colon) {
-                if (Parser_NextToken(parser).Kind == TokenKind_Colon) {
-                    constant = TRUE;
-                }
-                value = Parser_ParseExpression(parser, parentScope);
-            }
+// Parses an already lexed token stream starting at index, tokens must end with the end of file token
+void Parser_InitTokens(Parser* parser, Token* tokens, u64 index) {
+    parser->Tokens = tokens;
+    parser->TokenIndex = index;
+    parser->Current = tokens[index];
+    parser->Diagnostics = DynamicArrayCreate(Diagnostic);
+    parser->Hash = Hash_Initial;
+    parser->Names = DynamicArrayCreate(const char*);
+    parser->Depth = 0;
+    parser->Frames = DynamicArrayCreate(ParserFrame);
+}
 
-            if (!type && !value) {
-                Error("Declaration must have type or value!");
-                return NULL;
-            }
+u64 Token_Hash(u64 hash, Token token) {
+    hash = Hash_U64(hash, token.Kind);
+    switch (token.Kind) {
+        case TokenKind_Name: {
+            hash = Hash_String(hash, token.Name);
+        } break;
 
-            if (!value || (value && value->Kind != AstExpressionKind_Procedure && value->Kind != AstExpressionKind_Struct)) {
-                Parser_ExpectToken(parser, TokenKind_Semicolon);
-            }
+        case TokenKind_String: {
+            hash = Hash_Bytes(hash, token.String, token.StringLength);
+        } break;
 
-            AstStatement* declaration = Allocate(sizeof(AstStatement));
-            declaration->Kind = AstStatementKind_Declaration;
-            declaration->Declaration.Name = expression->Name.Name;
-            declaration->Declaration.Type = type;
-            declaration->Declaration.Value = value;
-            declaration->Declaration.Constant = constant;
-            return declaration;
-        } else if (TokenIsAssignment(parser->Current)) {
-            Token operator = Parser_NextToken(parser);
-            AstExpression* value = Parser_ParseExpression(parser, parentScope);
-            Parser_ExpectToken(parser, TokenKind_Semicolon);
+        case TokenKind_Directive: {
+            hash = Hash_String(hash, token.Directive);
+        } break;
 
-            AstStatement* assignment = Allocate(sizeof(AstStatement));
-            assignment->Kind = AstStatementKind_Assignment;
-            assignment->Assignment.Operand = expression;
-            assignment->Assignment.Operator = operator;
-            assignment->Assignment.Value = value;
-            return assignment;
-        } else {
-            Parser_ExpectToken(parser, TokenKind_Semicolon);
-            AstStatement* statement = Allocate(sizeof(AstStatement));
-            statement->Kind = AstStatementKind_Expression;
-            statement->Expression = *expression; // Memory leak
-            return statement;
-        }
-    }
+        case TokenKind_Invalid: {
+            hash = Hash_String(hash, token.Error);
+        } break;
 
-    ASSERT(FALSE);
-    return NULL;
+        case TokenKind_Integer: {
+            hash = Hash_U64(hash, token.Integer);
+        } break;
+
+        case TokenKind_Float: {
+            hash = Hash_Bytes(hash, &token.Float, sizeof(token.Float));
+        } break;
+
+        case TokenKind_Keyword: {
+            hash = Hash_U64(hash, token.Keyword);
+        } break;
+
+        default: {
+        } break;
+    }
+    return hash;
 }
 
-AstScope* Parser_ParseScope(Parser* parser, AstScope* parentScope) {
-    AstScope* scope = Allocate(sizeof(AstScope));
-    scope->Parent = parentScope;
+Token Parser_NextToken(Parser* parser) {
+    Token token = parser->Current;
+    parser->Previous = token;
+    parser->Hash = Token_Hash(parser->Hash, token);
+    if (token.Kind == TokenKind_Name) {
+        DynamicArrayPush(parser->Names, token.Name);
+    }
 
-    Parser_ExpectToken(parser, TokenKind_LBrace);
-    AstStatement** statements = DynamicArrayCreate(AstStatement*);
+    if (!parser->Tokens) {
+        parser->Current = Lexer_NextToken(&parser->Lexer);
+    } else if (token.Kind != TokenKind_EndOfFile) {
+        parser->Current = parser->Tokens[++parser->TokenIndex];
+    }
+    return token;
+}
 
-    while (parser->Current.Kind != TokenKind_RBrace) {
-        DynamicArrayPush(statements, Parser_ParseStatement(parser, scope));
+void Parser_Report(Parser* parser, Token token, const char* message) {
+    u64 count = DynamicArrayLength(parser->Diagnostics);
+    if (count > 0 && parser->Diagnostics[count - 1].Pos.Position == token.Pos.Position) {
+        return; // An invalid token is reported again when synchronizing skips over it
     }
 
-    Parser_ExpectToken(parser, TokenKind_RBrace);
+    DynamicArrayPush(parser->Diagnostics, ((Diagnostic){
+        .Pos = token.Pos,
+        .Length = token.Length,
+        .Message = token.Kind == TokenKind_Invalid ? token.Error : message,
+    }));
+}
 
-    scope->Statements = statements;
+// Records the error and abandons the current statement
+void Parser_Error(Parser* parser, Token token, const char* message, ...) {
+    __builtin_va_list args;
+    va_start(args, message);
+    int length = vsnprintf(NULL, 0, message, args);
+    va_end(args);
 
-    return scope;
+    char* formatted = Allocate(length + 1);
+    va_start(args, message);
+    vsnprintf(formatted, length + 1, message, args);
+    va_end(args);
+
+    Parser_Report(parser, token, formatted);
+    ASSERT(parser->Recovery);
+    longjmp(*parser->Recovery, 1);
 }
 
-AstStatement* FindDeclaration(const char* name, AstScope* scope, AstScope** scopeFoundIn) {
-    if (!scope) {
-        if (scopeFoundIn) {
-            *scopeFoundIn = NULL;
+// Skips past the next ';' or block at this nesting level, or up to the '}' that closes the enclosing scope
+void Parser_Synchronize(Parser* parser) {
+    u64 depth = 0;
+    while (parser->Current.Kind != TokenKind_EndOfFile) {
+        if (parser->Current.Kind == TokenKind_RBrace && depth == 0) {
+            return;
+        }
+
+        Token token = Parser_NextToken(parser);
+        if (token.Kind == TokenKind_Invalid) {
+            Parser_Report(parser, token, NULL);
+        } else if (token.Kind == TokenKind_LBrace) {
+            depth++;
+        } else if (token.Kind == TokenKind_RBrace) {
+            depth--;
+            if (depth == 0) {
+                return;
+            }
+        } else if (token.Kind == TokenKind_Semicolon && depth == 0) {
+            return;
         }
-        return NULL;
     }
+}
 
-    for (u64 i = 0; i < DynamicArrayLength(scope->Statements); i++) {
-        if (scope->Statements[i]->Kind == AstStatementKind_Declaration &&
-            strcmp(scope->Statements[i]->Declaration.Name.Name, name) == 0) {
-            if (scopeFoundIn) {
-                *scopeFoundIn = scope;
+Token Parser_ExpectToken(Parser* parser, TokenKind kind) {
+    if (kind == TokenKind_Semicolon && parser->Current.Kind != kind && parser->Current.Kind != TokenKind_Invalid) {
+        // Carry on as if it was there, skipping the statement that follows would hide its errors
+        Token missing = {
+            .Kind = TokenKind_Semicolon,
+            .Pos = parser->Previous.Pos,
+            .Length = 1,
+        };
+        missing.Pos.Position += parser->Previous.Length;
+        missing.Pos.Column += parser->Previous.Length;
+        Parser_Report(parser, missing, "Expected ';'");
+        return missing;
+    }
+
+    if (parser->Current.Kind != kind) {
+        Parser_Error(parser, parser->Current, "Expected '%s' got '%s'", TokenKindNames[kind], TokenKindNames[parser->Current.Kind]);
+    }
+    return Parser_NextToken(parser);
+}
+
+// Enters a scope, an else branch or a while body, the caller decrements the depth when it is done
+void Parser_Nest(Parser* parser, Token token) {
+    if (parser->Depth >= Parser_MaxDepth) {
+        Parser_Error(parser, token, "Statements are nested too deeply");
+    }
+    parser->Depth++;
+}
+
+AstExpression* Parser_ParseExpression(Parser* parser, AstScope* parentScope);
+AstExpression* Parser_ParsePrimaryExpression(Parser* parser, AstScope* parentScope);
+AstType* Parser_ParseType(Parser* parser, AstScope* parentScope);
+AstStatement* Parser_ParseStatement(Parser* parser, AstScope* parentScope);
+AstStatement* Parser_TryParseStatement(Parser* parser, AstScope* parentScope);
+AstScope* Parser_ParseScope(Parser* parser, AstScope* parentScope);
+
+u64 Parser_GetUnaryPresedence(Token token) {
+    switch (token.Kind) {
+        case TokenKind_Plus:
+        case TokenKind_Minus:
+        case TokenKind_Caret:
+        case TokenKind_Asterisk:
+        case TokenKind_ExclamationMark:
+            return 5;
+        default:
+            return 0;
+    }
+}
+
+u64 Parser_GetBinaryPresedence(Token token) {
+    switch (token.Kind) {
+        case TokenKind_Period:
+            return 6;
+        case TokenKind_Asterisk:
+        case TokenKind_Slash:
+        case TokenKind_Percent:
+        case TokenKind_Ampersand:
+        case TokenKind_Pipe:
+            return 4;
+        case TokenKind_Plus:
+        case TokenKind_Minus:
+            return 3;
+        case TokenKind_EqualsEquals:
+        case TokenKind_ExclamationMarkEquals:
+        case TokenKind_Less:
+        case TokenKind_LessEquals:
+        case TokenKind_Greater:
+        case TokenKind_GreaterEquals:
+            return 2;
+        case TokenKind_AmpersandAmpersand:
+        case TokenKind_PipePipe:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Adds the name of every '$T' in type that is not in parameters yet
+void Parser_CollectTypeParameters(Token** parameters, AstType* type) {
+    switch (type->Kind) {
+        case AstTypeKind_Unknown: {
+            if (type->Unknown.Polymorphic) {
+                for (u64 i = 0; i < DynamicArrayLength(*parameters); i++) {
+                    if (strcmp((*parameters)[i].Name, type->Unknown.Name.Name) == 0) {
+                        return;
+                    }
+                }
+                DynamicArrayPush(*parameters, type->Unknown.Name);
             }
-            return scope->Statements[i];
+            for (u64 i = 0; type->Unknown.TypeArguments && i < DynamicArrayLength(type->Unknown.TypeArguments); i++) {
+                Parser_CollectTypeParameters(parameters, type->Unknown.TypeArguments[i]);
+            }
+        } break;
+
+        case AstTypeKind_Pointer: {
+            Parser_CollectTypeParameters(parameters, type->Pointer.PointerTo);
+        } break;
+
+        case AstTypeKind_Array:
+        case AstTypeKind_Vector: {
+            Parser_CollectTypeParameters(parameters, type->Array.ArrayOf);
+        } break;
+
+        default: {
+        } break;
+    }
+}
+
+AstExpression* Parser_ParseProcedure(Parser* parser, AstProcedureArgument* firstArg, AstScope* parentScope) {
+    AstProcedureArgument* arguments = DynamicArrayCreate(AstProcedureArgument);
+    if (firstArg) {
+        DynamicArrayPush(arguments, *firstArg); // TODO: Memory leak
+    }
+
+    while (parser->Current.Kind != TokenKind_RParen) {
+        Parser_ExpectToken(parser, TokenKind_Comma);
+
+        Token nameToken = Parser_ExpectToken(parser, TokenKind_Name);
+
+        Parser_ExpectToken(parser, TokenKind_Colon);
+        AstType* type = Parser_ParseType(parser, parentScope);
+
+        DynamicArrayPush(arguments, ((AstProcedureArgument){
+            .Name = nameToken,
+            .Type = type,
+        }));
+    }
+
+    Parser_ExpectToken(parser, TokenKind_RParen);
+
+    Token* parameters = DynamicArrayCreate(Token);
+    for (u64 i = 0; i < DynamicArrayLength(arguments); i++) {
+        Parser_CollectTypeParameters(&parameters, arguments[i].Type);
+    }
+    u64 parameterCount = DynamicArrayLength(parameters);
+
+    AstType* returnType = NULL;
+    if (parser->Current.Kind == TokenKind_RightArrow) {
+        Token arrow = Parser_ExpectToken(parser, TokenKind_RightArrow);
+        returnType = Parser_ParseType(parser, parentScope);
+
+        // Only the arguments of a call can decide what a type parameter is
+        Parser_CollectTypeParameters(&parameters, returnType);
+        if (DynamicArrayLength(parameters) > parameterCount) {
+            Parser_Error(parser, arrow, "'$%s' must be declared by an argument type", parameters[parameterCount].Name);
         }
     }
+    if (parameterCount == 0) {
+        DynamicArrayDestroy(parameters);
+    }
 
-    if (scope->Parent) {
-        return FindDeclaration(name, scope->Parent, scopeFoundIn);
+    AstScope* body = Parser_ParseScope(parser, parentScope);
+
+    for (u64 i = 0; i < DynamicArrayLength(arguments); i++) {
+        AstStatement* declaration = Allocate(sizeof(AstStatement));
+        declaration->Kind = AstStatementKind_Declaration;
+        declaration->Declaration.Name = arguments[i].Name;
+        declaration->Declaration.Type = arguments[i].Type;
+        arguments[i].Declaration = declaration;
     }
 
-    if (scopeFoundIn) {
-        *scopeFoundIn = NULL;
+    AstExpression* expression = Allocate(sizeof(AstExpression));
+    expression->Kind = AstExpressionKind_Procedure;
+    expression->Procedure.Arguments = arguments;
+    expression->Procedure.ReturnType = returnType;
+    expression->Procedure.Body = body;
+    expression->Procedure.Captures = DynamicArrayCreate(AstCapture);
+    expression->Procedure.TypeParameters = parameters;
+    expression->Procedure.Instances = parameters ? DynamicArrayCreate(AstPolymorph) : NULL;
+    body->Procedure = &expression->Procedure;
+
+    return expression;
+}
+
+AstExpression* Parser_ParsePrimaryExpression(Parser* parser, AstScope* parentScope) {
+    switch (parser->Current.Kind) {
+        case TokenKind_Name: {
+            Token nameToken = Parser_ExpectToken(parser, TokenKind_Name);
+
+            AstExpression* expression = Allocate(sizeof(AstExpression));
+            expression->Kind = AstExpressionKind_Name;
+            expression->Name.Name = nameToken;
+
+            return expression;
+        } break;
+
+        case TokenKind_Keyword: {
+            Token keyword = Parser_ExpectToken(parser, TokenKind_Keyword);
+            switch (keyword.Keyword) {
+                case Keyword_True: {
+                    AstExpression* expression = Allocate(sizeof(AstExpression));
+                    expression->Kind = AstExpressionKind_True;
+                    return expression;
+                } break;
+
+                case Keyword_False: {
+                    AstExpression* expression = Allocate(sizeof(AstExpression));
+                    expression->Kind = AstExpressionKind_False;
+                    return expression;
+                } break;
+
+                case Keyword_Null: {
+                    AstExpression* expression = Allocate(sizeof(AstExpression));
+                    expression->Kind = AstExpressionKind_Null;
+                    return expression;
+                } break;
+
+                case Keyword_Struct: {
+                    Token* parameters = NULL;
+                    if (parser->Current.Kind == TokenKind_LParen) {
+                        Parser_ExpectToken(parser, TokenKind_LParen);
+                        parameters = DynamicArrayCreate(Token);
+                        while (parser->Current.Kind != TokenKind_RParen) {
+                            if (DynamicArrayLength(parameters) > 0) {
+                                Parser_ExpectToken(parser, TokenKind_Comma);
+                            }
+                            Parser_ExpectToken(parser, TokenKind_Dollar);
+                            DynamicArrayPush(parameters, Parser_ExpectToken(parser, TokenKind_Name));
+                        }
+                        Parser_ExpectToken(parser, TokenKind_RParen);
+                    }
+
+                    b8 packed = FALSE;
+                    b8 reorder = FALSE;
+                    while (parser->Current.Kind == TokenKind_Directive) {
+                        Token directive = Parser_NextToken(parser);
+                        if (strcmp(directive.Directive, "packed") == 0) {
+                            packed = TRUE;
+                        } else if (strcmp(directive.Directive, "reorder") == 0) {
+                            reorder = TRUE;
+                        } else {
+                            Parser_Error(parser, directive, "Unknown struct directive '#%s'", directive.Directive);
+                        }
+                    }
+
+                    AstScope* scope = Parser_ParseScope(parser, parentScope); // TODO: Memory leak
+
+                    AstDeclaration* declarations = DynamicArrayCreate(AstDeclaration);
+                    for (u64 i = 0; i < DynamicArrayLength(scope->Statements); i++) {
+                        if (scope->Statements[i]->Kind != AstStatementKind_Declaration) {
+                            Parser_Error(parser, keyword, "Expected only declarations in struct");
+                        }
+                        DynamicArrayPush(declarations, scope->Statements[i]->Declaration);
+                    }
+
+                    AstExpression* expression = Allocate(sizeof(AstExpression));
+                    expression->Kind = AstExpressionKind_Struct;
+                    expression->Struct.Declarations = declarations;
+                    expression->Struct.Packed = packed;
+                    expression->Struct.Reorder = reorder;
+                    expression->Struct.TypeParameters = parameters;
+                    expression->Struct.Instances = parameters ? DynamicArrayCreate(AstPolymorph) : NULL;
+                    return expression;
+                } break;
+
+                default: {
+                    goto Default;
+                } break;
+            }
+        } break;
+
+        case TokenKind_Integer:
+        case TokenKind_Float:
+        case TokenKind_String: {
+            Token literalToken = Parser_NextToken(parser);
+
+            AstExpression* expression = Allocate(sizeof(AstExpression));
+            expression->Kind = AstExpressionKind_Literal;
+            expression->Literal.Token = literalToken;
+
+            return expression;
+        } break;
+
+        default: Default: {
+            Parser_Error(parser, parser->Current, "Unexpected token '%s'", TokenKindNames[parser->Current.Kind]);
+            return NULL;
+        } break;
     }
+
+    ASSERT(FALSE);
     return NULL;
 }
 
-void Complete_Statement(AstStatement* statement, AstScope* parentScope) {
+typedef enum ParserState {
+    ParserState_Start, // Parse a unary or binary expression with the current presedence
+    ParserState_Primary,
+    ParserState_PrimaryDone, // result is a primary expression
+    ParserState_Postfix, // left is the operand of a possible call or index
+    ParserState_Binary, // left is the operand of a possible binary operator
+    ParserState_Return, // result finishes the top frame
+} ParserState;
+
+u64 Parser_Max(u64 a, u64 b) {
+    return a > b ? a : b;
+}
+
+// Height of a node whose operands are as tall as a and b
+u64 Parser_Above(u64 a, u64 b) {
+    return Parser_Max(a, b) + 1;
+}
+
+// Later passes recurse over the tree, so the height of an expression plus the scopes around it is limited. The left
+// operands of binary operators do not add to it, passes walk down binary chains in a loop.
+void Parser_CheckHeight(Parser* parser, Token token, u64 height) {
+    if (parser->Depth + height > Parser_MaxDepth) {
+        Parser_Error(parser, token, "Expression is nested too deeply");
+    }
+}
+
+AstExpression* Parser_ParseExpression(Parser* parser, AstScope* parentScope) {
+    u64 base = DynamicArrayLength(parser->Frames);
+    u64 presedence = 0;
+    AstExpression* left = NULL;
+    u64 leftHeight = 0;
+    AstExpression* result = NULL;
+    u64 resultHeight = 0;
+
+    // Anything parsed by a call that can recurse sits below the frames of this expression
+    u64 depth = parser->Depth;
+
+    ParserState state = ParserState_Start;
+    while (TRUE) {
+        switch (state) {
+            case ParserState_Start: {
+                u64 unaryPresedence = Parser_GetUnaryPresedence(parser->Current);
+                if (unaryPresedence != 0 && unaryPresedence > presedence) {
+                    DynamicArrayPush(parser->Frames, ((ParserFrame){
+                        .Kind = ParserFrameKind_Unary,
+                        .Presedence = presedence,
+                        .Token = Parser_NextToken(parser),
+                    }));
+                    presedence = unaryPresedence;
+                } else {
+                    state = ParserState_Primary;
+                }
+            } break;
+
+            case ParserState_Primary: {
+                Token token = parser->Current;
+                if (token.Kind == TokenKind_LParen) {
+                    Parser_ExpectToken(parser, TokenKind_LParen);
+                    if (parser->Current.Kind == TokenKind_RParen) {
+                        parser->Depth = depth + DynamicArrayLength(parser->Frames) - base;
+                        result = Parser_ParseProcedure(parser, NULL, parentScope);
+                        parser->Depth = depth;
+                        resultHeight = 1;
+                        state = ParserState_PrimaryDone;
+                    } else {
+                        DynamicArrayPush(parser->Frames, ((ParserFrame){
+                            .Kind = ParserFrameKind_Paren,
+                            .Presedence = presedence,
+                            .Token = token,
+                        }));
+                        presedence = 0;
+                        state = ParserState_Start;
+                    }
+                } else if (token.Kind == TokenKind_Keyword && token.Keyword == Keyword_SizeOf) {
+                    Parser_NextToken(parser);
+                    Parser_ExpectToken(parser, TokenKind_LParen);
+                    DynamicArrayPush(parser->Frames, ((ParserFrame){
+                        .Kind = ParserFrameKind_SizeOf,
+                        .Presedence = presedence,
+                        .Token = token,
+                    }));
+                    presedence = 0;
+                    state = ParserState_Start;
+                } else if (token.Kind == TokenKind_Keyword && token.Keyword == Keyword_Cast) {
+                    Parser_NextToken(parser);
+                    Parser_ExpectToken(parser, TokenKind_LParen);
+                    parser->Depth = depth + DynamicArrayLength(parser->Frames) - base;
+                    AstType* type = Parser_ParseType(parser, parentScope);
+                    parser->Depth = depth;
+                    Parser_ExpectToken(parser, TokenKind_RParen);
+
+                    // The operand of a cast is a primary expression, not a unary one
+                    DynamicArrayPush(parser->Frames, ((ParserFrame){
+                        .Kind = ParserFrameKind_Cast,
+                        .Presedence = presedence,
+                        .Token = token,
+                        .Type = type,
+                    }));
+                } else if (token.Kind == TokenKind_Directive && strcmp(token.Directive, "run") == 0) {
+                    // Binds like a unary operator, '#run f(x) + 1' runs the call only
+                    Parser_NextToken(parser);
+                    DynamicArrayPush(parser->Frames, ((ParserFrame){
+                        .Kind = ParserFrameKind_Run,
+                        .Presedence = presedence,
+                        .Token = token,
+                    }));
+                    presedence = Parser_GetUnaryPresedence((Token){ .Kind = TokenKind_Minus });
+                    state = ParserState_Start;
+                } else {
+                    parser->Depth = depth + DynamicArrayLength(parser->Frames) - base;
+                    result = Parser_ParsePrimaryExpression(parser, parentScope);
+                    parser->Depth = depth;
+                    resultHeight = 1;
+                    state = ParserState_PrimaryDone;
+                }
+            } break;
+
+            case ParserState_PrimaryDone: {
+                u64 length = DynamicArrayLength(parser->Frames);
+                if (length > base && parser->Frames[length - 1].Kind == ParserFrameKind_Cast) {
+                    ParserFrame frame;
+                    DynamicArrayPop(parser->Frames, &frame);
+                    Parser_CheckHeight(parser, frame.Token, Parser_Above(resultHeight, resultHeight));
+
+                    AstExpression* expression = Allocate(sizeof(AstExpression));
+                    expression->Kind = AstExpressionKind_Cast;
+                    expression->Cast.Type = frame.Type;
+                    expression->Cast.Expression = result;
+                    result = expression;
+                    resultHeight = Parser_Above(resultHeight, resultHeight);
+                    presedence = frame.Presedence;
+                } else {
+                    left = result;
+                    leftHeight = resultHeight;
+                    state = ParserState_Postfix;
+                }
+            } break;
+
+            case ParserState_Postfix: {
+                Token token = parser->Current;
+                if (token.Kind == TokenKind_LParen) {
+                    Parser_ExpectToken(parser, TokenKind_LParen);
+                    AstExpression** arguments = DynamicArrayCreate(AstExpression*);
+                    if (parser->Current.Kind != TokenKind_RParen) {
+                        DynamicArrayPush(parser->Frames, ((ParserFrame){
+                            .Kind = ParserFrameKind_CallArgument,
+                            .Presedence = presedence,
+                            .Token = token,
+                            .Left = left,
+                            .Height = leftHeight,
+                            .Arguments = arguments,
+                        }));
+                        presedence = 0;
+                        state = ParserState_Start;
+                    } else {
+                        Parser_ExpectToken(parser, TokenKind_RParen);
+                        Parser_CheckHeight(parser, token, Parser_Above(leftHeight, leftHeight));
+
+                        AstExpression* expression = Allocate(sizeof(AstExpression));
+                        expression->Kind = AstExpressionKind_Call;
+                        expression->Call.Operand = left;
+                        expression->Call.Arguments = arguments;
+                        left = expression;
+                        leftHeight = Parser_Above(leftHeight, leftHeight);
+                        state = ParserState_Binary;
+                    }
+                } else if (token.Kind == TokenKind_LBracket) {
+                    Parser_ExpectToken(parser, TokenKind_LBracket);
+                    DynamicArrayPush(parser->Frames, ((ParserFrame){
+                        .Kind = ParserFrameKind_Index,
+                        .Presedence = presedence,
+                        .Token = token,
+                        .Left = left,
+                        .Height = leftHeight,
+                    }));
+                    presedence = 0;
+                    state = ParserState_Start;
+                } else {
+                    state = ParserState_Binary;
+                }
+            } break;
+
+            case ParserState_Binary: {
+                u64 binaryPresedence = Parser_GetBinaryPresedence(parser->Current);
+                if (binaryPresedence == 0 || binaryPresedence <= presedence) {
+                    result = left;
+                    resultHeight = leftHeight;
+                    state = ParserState_Return;
+                    break;
+                }
+
+                Token operator = Parser_NextToken(parser);
+                if (operator.Kind == TokenKind_Period) {
+                    Token nameToken = Parser_ExpectToken(parser, TokenKind_Name);
+                    Parser_CheckHeight(parser, operator, Parser_Above(leftHeight, leftHeight));
+
+                    AstExpression* expression = Allocate(sizeof(AstExpression));
+                    expression->Kind = AstExpressionKind_Field;
+                    expression->Field.Expression = left;
+                    expression->Field.Name = nameToken;
+                    left = expression;
+                    leftHeight = Parser_Above(leftHeight, leftHeight);
+                    state = ParserState_Postfix;
+                } else {
+                    DynamicArrayPush(parser->Frames, ((ParserFrame){
+                        .Kind = ParserFrameKind_Binary,
+                        .Presedence = presedence,
+                        .Token = operator,
+                        .Left = left,
+                        .Height = leftHeight,
+                    }));
+                    presedence = binaryPresedence;
+                    state = ParserState_Start;
+                }
+            } break;
+
+            case ParserState_Return: {
+                if (DynamicArrayLength(parser->Frames) == base) {
+                    return result;
+                }
+
+                ParserFrame frame;
+                DynamicArrayPop(parser->Frames, &frame);
+                presedence = frame.Presedence;
+                u64 height = Parser_Above(frame.Height, resultHeight);
+
+                switch (frame.Kind) {
+                    case ParserFrameKind_Unary: {
+                        Parser_CheckHeight(parser, frame.Token, height);
+                        left = Allocate(sizeof(AstExpression));
+                        left->Kind = AstExpressionKind_Unary;
+                        left->Unary.Operator = frame.Token;
+                        left->Unary.Operand = result;
+                        leftHeight = height;
+                        state = ParserState_Postfix;
+                    } break;
+
+                    case ParserFrameKind_Binary: {
+                        height = Parser_Max(frame.Height, resultHeight + 1);
+                        Parser_CheckHeight(parser, frame.Token, height);
+                        left = Allocate(sizeof(AstExpression));
+                        left->Kind = AstExpressionKind_Binary;
+                        left->Binary.Left = frame.Left;
+                        left->Binary.Operator = frame.Token;
+                        left->Binary.Right = result;
+                        leftHeight = height;
+                        state = ParserState_Postfix;
+                    } break;
+
+                    case ParserFrameKind_Paren: {
+                        if (parser->Current.Kind == TokenKind_Colon) { // Procedure
+                            if (result->Kind != AstExpressionKind_Name) {
+                                Parser_Error(parser, parser->Current, "Expected a name before ':' in procedure arguments");
+                            }
+
+                            Parser_ExpectToken(parser, TokenKind_Colon);
+                            parser->Depth = depth + DynamicArrayLength(parser->Frames) - base;
+                            AstType* type = Parser_ParseType(parser, parentScope);
+                            result = Parser_ParseProcedure(parser, &(AstProcedureArgument){
+                                .Name = result->Name.Name,
+                                .Type = type,
+                            }, parentScope); // TODO: Pass global scope here
+                            parser->Depth = depth;
+                            resultHeight = 1;
+                        } else {
+                            Parser_ExpectToken(parser, TokenKind_RParen);
+                        }
+                        state = ParserState_PrimaryDone;
+                    } break;
+
+                    case ParserFrameKind_Run: {
+                        Parser_CheckHeight(parser, frame.Token, height);
+                        left = Allocate(sizeof(AstExpression));
+                        left->Kind = AstExpressionKind_Run;
+                        left->Run.Expression = result;
+                        leftHeight = height;
+                        state = ParserState_Binary;
+                    } break;
+
+                    case ParserFrameKind_SizeOf: {
+                        Parser_ExpectToken(parser, TokenKind_RParen);
+                        Parser_CheckHeight(parser, frame.Token, height);
+
+                        AstExpression* sizeOf = Allocate(sizeof(AstExpression));
+                        sizeOf->Kind = AstExpressionKind_Sizeof;
+                        sizeOf->SizeOf.Expression = result;
+                        result = sizeOf;
+                        resultHeight = height;
+                        state = ParserState_PrimaryDone;
+                    } break;
+
+                    case ParserFrameKind_CallArgument: {
+                        DynamicArrayPush(frame.Arguments, result);
+                        if (parser->Current.Kind != TokenKind_RParen) {
+                            Parser_ExpectToken(parser, TokenKind_Comma);
+                            frame.Height = Parser_Max(frame.Height, resultHeight);
+                            DynamicArrayPush(parser->Frames, frame);
+                            presedence = 0;
+                            state = ParserState_Start;
+                            break;
+                        }
+
+                        Parser_ExpectToken(parser, TokenKind_RParen);
+                        Parser_CheckHeight(parser, frame.Token, height);
+                        left = Allocate(sizeof(AstExpression));
+                        left->Kind = AstExpressionKind_Call;
+                        left->Call.Operand = frame.Left;
+                        left->Call.Arguments = frame.Arguments;
+                        leftHeight = height;
+                        state = ParserState_Binary;
+                    } break;
+
+                    case ParserFrameKind_Index: {
+                        Parser_ExpectToken(parser, TokenKind_RBracket);
+                        Parser_CheckHeight(parser, frame.Token, height);
+                        left = Allocate(sizeof(AstExpression));
+                        left->Kind = AstExpressionKind_Index;
+                        left->Index.Operand = frame.Left;
+                        left->Index.Index = result;
+                        leftHeight = height;
+                        state = ParserState_Binary;
+                    } break;
+
+                    default: {
+                        ASSERT(FALSE);
+                    } break;
+                }
+            } break;
+        }
+    }
+}
+
+AstType* Parser_ParseType(Parser* parser, AstScope* parentScope) {
+    switch (parser->Current.Kind) {
+        case TokenKind_Name: {
+            Token nameToken = Parser_ExpectToken(parser, TokenKind_Name);
+            AstType* type = Allocate(sizeof(AstType));
+            type->Kind = AstTypeKind_Unknown;
+            type->Unknown.Name = nameToken;
+
+            if (parser->Current.Kind == TokenKind_LParen) {
+                Token open = Parser_ExpectToken(parser, TokenKind_LParen);
+                Parser_Nest(parser, open);
+                type->Unknown.TypeArguments = DynamicArrayCreate(AstType*);
+                while (parser->Current.Kind != TokenKind_RParen) {
+                    if (DynamicArrayLength(type->Unknown.TypeArguments) > 0) {
+                        Parser_ExpectToken(parser, TokenKind_Comma);
+                    }
+                    DynamicArrayPush(type->Unknown.TypeArguments, Parser_ParseType(parser, parentScope));
+                }
+                Parser_ExpectToken(parser, TokenKind_RParen);
+                parser->Depth--;
+            }
+            return type;
+        } break;
+
+        case TokenKind_Dollar: {
+            Parser_ExpectToken(parser, TokenKind_Dollar);
+            Token nameToken = Parser_ExpectToken(parser, TokenKind_Name);
+            AstType* type = Allocate(sizeof(AstType));
+            type->Kind = AstTypeKind_Unknown;
+            type->Unknown.Name = nameToken;
+            type->Unknown.Polymorphic = TRUE;
+            return type;
+        } break;
+
+        case TokenKind_Caret: {
+            Parser_ExpectToken(parser, TokenKind_Caret);
+            AstType* type = Allocate(sizeof(AstType));
+            type->Kind = AstTypeKind_Pointer;
+            type->Pointer.PointerTo = Parser_ParseType(parser, parentScope);
+            return type;
+        } break;
+
+        case TokenKind_LParen: {
+            Parser_ExpectToken(parser, TokenKind_LParen);
+            AstType* type = Parser_ParseType(parser, parentScope);
+            Parser_ExpectToken(parser, TokenKind_RParen);
+            return type;
+        } break;
+
+        case TokenKind_LBracket: {
+            Parser_ExpectToken(parser, TokenKind_LBracket);
+            b8 dynamic = FALSE;
+            AstExpression* count = NULL;
+            if (parser->Current.Kind == TokenKind_PeriodPeriod) {
+                Parser_ExpectToken(parser, TokenKind_PeriodPeriod);
+                dynamic = TRUE;
+            } else if (parser->Current.Kind != TokenKind_RBracket) {
+                count = Parser_ParseExpression(parser, parentScope);
+            }
+            Parser_ExpectToken(parser, TokenKind_RBracket);
+            AstType* arrayOf = Parser_ParseType(parser, parentScope);
+            
+            AstType* type = Allocate(sizeof(AstType));
+            type->Kind = AstTypeKind_Array;
+            type->Array.Dynamic = dynamic;
+            type->Array.Count = count;
+            type->Array.ArrayOf = arrayOf;
+            return type;
+        } break;
+
+        case TokenKind_Directive: {
+            Token directive = Parser_NextToken(parser);
+            if (strcmp(directive.Directive, "soa") == 0) {
+                AstType* type = Parser_ParseType(parser, parentScope);
+                if (type->Kind != AstTypeKind_Array) {
+                    Parser_Error(parser, directive, "'#soa' must be followed by an array type");
+                    return NULL;
+                }
+                type->Array.Soa = TRUE;
+                return type;
+            } else if (strcmp(directive.Directive, "vector") != 0) {
+                Parser_Error(parser, directive, "Unknown type directive '#%s'", directive.Directive);
+                return NULL;
+            }
+
+            Parser_ExpectToken(parser, TokenKind_LParen);
+            AstExpression* count = Parser_ParseExpression(parser, parentScope);
+            Parser_ExpectToken(parser, TokenKind_RParen);
+
+            AstType* type = Allocate(sizeof(AstType));
+            type->Kind = AstTypeKind_Vector;
+            type->Array.Count = count;
+            type->Array.ArrayOf = Parser_ParseType(parser, parentScope);
+            return type;
+        } break;
+
+        default: {
+            Parser_Error(parser, parser->Current, "Expected a type got '%s'", TokenKindNames[parser->Current.Kind]);
+            return NULL;
+        } break;
+    }
+
+    ASSERT(FALSE);
+    return NULL;
+}
+
+AstStatement* Parser_ParseStatement(Parser* parser, AstScope* parentScope) {
+    while (parser->Current.Kind == TokenKind_Semicolon) {
+        Parser_ExpectToken(parser, TokenKind_Semicolon);
+    }
+
+    if (parser->Current.Kind == TokenKind_LBrace) {
+        AstStatement* statement = Allocate(sizeof(AstStatement));
+        statement->Kind = AstStatementKind_Scope;
+        statement->Scope = *Parser_ParseScope(parser, parentScope); // TODO: Memory leak
+        return statement;
+    } else if (parser->Current.Kind == TokenKind_Directive) {
+        Token directive = Parser_NextToken(parser);
+        if (strcmp(directive.Directive, "no_bounds_check") != 0) {
+            Parser_Error(parser, directive, "Unknown statement directive '#%s'", directive.Directive);
+        }
+
+        AstStatement* statement = Allocate(sizeof(AstStatement));
+        statement->Kind = AstStatementKind_Scope;
+        statement->Scope = *Parser_ParseScope(parser, parentScope); // TODO: Memory leak
+        statement->Scope.NoBoundsCheck = TRUE;
+        return statement;
+    } else if (parser->Current.Kind == TokenKind_Keyword) {
+        Token keyword = Parser_ExpectToken(parser, TokenKind_Keyword);
+        switch (keyword.Keyword) {
+            case Keyword_Return: {
+                AstStatement* statement = Allocate(sizeof(AstStatement));
+                statement->Kind = AstStatementKind_Return;
+                statement->Return.Expression = Parser_ParseExpression(parser, parentScope);
+                Parser_ExpectToken(parser, TokenKind_Semicolon);
+                return statement;
+            } break;
+
+            case Keyword_If: {
+                // Each 'else if' is parsed by the loop and does not nest, only the last plain 'else' does
+                AstStatement* first = NULL;
+                AstStatement** link = &first;
+                while (TRUE) {
+                    AstStatement* statement = Allocate(sizeof(AstStatement));
+                    statement->Kind = AstStatementKind_If;
+                    statement->If.Condition = Parser_ParseExpression(parser, parentScope);
+                    statement->If.Then = Parser_ParseStatement(parser, parentScope);
+                    *link = statement;
+                    link = &statement->If.Else;
+
+                    if (parser->Current.Kind != TokenKind_Keyword || parser->Current.Keyword != Keyword_Else) {
+                        break;
+                    }
+                    Token elseToken = Parser_ExpectToken(parser, TokenKind_Keyword);
+                    if (parser->Current.Kind == TokenKind_Keyword && parser->Current.Keyword == Keyword_If) {
+                        Parser_ExpectToken(parser, TokenKind_Keyword);
+                        continue;
+                    }
+
+                    Parser_Nest(parser, elseToken);
+                    *link = Parser_ParseStatement(parser, parentScope);
+                    parser->Depth--;
+                    break;
+                }
+                return first;
+            } break;
+
+            case Keyword_While: {
+                AstExpression* condition = Parser_ParseExpression(parser, parentScope);
+                Parser_Nest(parser, keyword);
+                AstStatement* body = Parser_ParseStatement(parser, parentScope);
+                parser->Depth--;
+
+                AstStatement* statement = Allocate(sizeof(AstStatement));
+                statement->Kind = AstStatementKind_While;
+                statement->While.Condition = condition;
+                statement->While.Body = body;
+                return statement;
+            } break;
+
+            case Keyword_For: {
+                Token name = Parser_ExpectToken(parser, TokenKind_Name);
+
+                Token in = Parser_ExpectToken(parser, TokenKind_Keyword);
+                if (in.Keyword != Keyword_In) {
+                    Parser_Error(parser, in, "Expected 'in' got '%s'", KeywordNames[in.Keyword]);
+                }
+
+                AstExpression* start = Parser_ParseExpression(parser, parentScope);
+                Parser_ExpectToken(parser, TokenKind_PeriodPeriod);
+                AstExpression* end = Parser_ParseExpression(parser, parentScope);
+
+                AstStatement* variable = Allocate(sizeof(AstStatement));
+                variable->Kind = AstStatementKind_Declaration;
+                variable->Declaration.Name = name;
+                variable->Declaration.Value = start;
+
+                AstScope* body = Parser_ParseScope(parser, parentScope);
+                body->Variable = variable;
+
+                AstStatement* statement = Allocate(sizeof(AstStatement));
+                statement->Kind = AstStatementKind_For;
+                statement->For.Variable = variable;
+                statement->For.End = end;
+                statement->For.Body = body;
+                return statement;
+            } break;
+
+            case Keyword_Switch: {
+                AstExpression* value = Parser_ParseExpression(parser, parentScope);
+                Token open = Parser_ExpectToken(parser, TokenKind_LBrace);
+                Parser_Nest(parser, open);
+
+                AstCase* cases = DynamicArrayCreate(AstCase);
+                AstStatement* else_ = NULL;
+                while (parser->Current.Kind != TokenKind_RBrace && parser->Current.Kind != TokenKind_EndOfFile) {
+                    Token token = Parser_ExpectToken(parser, TokenKind_Keyword);
+                    if (token.Keyword == Keyword_Case) {
+                        AstCase case_ = {};
+                        case_.Values = DynamicArrayCreate(AstExpression*);
+                        DynamicArrayPush(case_.Values, Parser_ParseExpression(parser, parentScope));
+                        while (parser->Current.Kind == TokenKind_Comma) {
+                            Parser_ExpectToken(parser, TokenKind_Comma);
+                            DynamicArrayPush(case_.Values, Parser_ParseExpression(parser, parentScope));
+                        }
+
+                        case_.Body = Allocate(sizeof(AstStatement));
+                        case_.Body->Kind = AstStatementKind_Scope;
+                        case_.Body->Scope = *Parser_ParseScope(parser, parentScope); // TODO: Memory leak
+                        DynamicArrayPush(cases, case_);
+                    } else if (token.Keyword == Keyword_Else) {
+                        if (else_) {
+                            Parser_Error(parser, token, "A switch can only have one 'else'");
+                        }
+                        else_ = Allocate(sizeof(AstStatement));
+                        else_->Kind = AstStatementKind_Scope;
+                        else_->Scope = *Parser_ParseScope(parser, parentScope); // TODO: Memory leak
+                    } else {
+                        Parser_Error(parser, token, "Expected 'case' or 'else' got '%s'", KeywordNames[token.Keyword]);
+                        return NULL;
+                    }
+                }
+
+                Parser_ExpectToken(parser, TokenKind_RBrace);
+                parser->Depth--;
+
+                AstStatement* statement = Allocate(sizeof(AstStatement));
+                statement->Kind = AstStatementKind_Switch;
+                statement->Switch.Value = value;
+                statement->Switch.Cases = cases;
+                statement->Switch.Else = else_;
+                return statement;
+            } break;
+
+            default: {
+                Parser_Error(parser, keyword, "Unexpected keyword '%s'", KeywordNames[keyword.Keyword]);
+                return NULL;
+            } break;
+        }
+    } else {
+        AstExpression* expression = Parser_ParseExpression(parser, parentScope);
+
+        if (parser->Current.Kind == TokenKind_Colon) {
+            if (expression->Kind != AstExpressionKind_Name) {
+                Parser_Error(parser, parser->Current, "':' must be preceded by a name");
+            }
+
+            Parser_ExpectToken(parser, TokenKind_Colon);
+
+            AstType* type = NULL;
+            if (parser->Current.Kind != TokenKind_Equals && parser->Current.Kind != TokenKind_Colon) {
+                type = Parser_ParseType(parser, parentScope);
+            }
+
+            b8 constant = FALSE;
+            AstExpression* value = NULL;
+            if (parser->Current.Kind == TokenKind_Equals || parser->Current.Kind == TokenKind_Colon) {
+                if (Parser_NextToken(parser).Kind == TokenKind_Colon) {
+                    constant = TRUE;
+                }
+                value = Parser_ParseExpression(parser, parentScope);
+            }
+
+            if (!type && !value) {
+                Parser_Error(parser, parser->Current, "Declaration must have type or value");
+            }
+
+            if (!value || (value && value->Kind != AstExpressionKind_Procedure && value->Kind != AstExpressionKind_Struct)) {
+                Parser_ExpectToken(parser, TokenKind_Semicolon);
+            }
+
+            AstStatement* declaration = Allocate(sizeof(AstStatement));
+            declaration->Kind = AstStatementKind_Declaration;
+            declaration->Declaration.Name = expression->Name.Name;
+            declaration->Declaration.Type = type;
+            declaration->Declaration.Value = value;
+            declaration->Declaration.Constant = constant;
+            return declaration;
+        } else if (TokenIsAssignment(parser->Current)) {
+            Token operator = Parser_NextToken(parser);
+            AstExpression* value = Parser_ParseExpression(parser, parentScope);
+            Parser_ExpectToken(parser, TokenKind_Semicolon);
+
+            AstStatement* assignment = Allocate(sizeof(AstStatement));
+            assignment->Kind = AstStatementKind_Assignment;
+            assignment->Assignment.Operand = expression;
+            assignment->Assignment.Operator = operator;
+            assignment->Assignment.Value = value;
+            return assignment;
+        } else {
+            Parser_ExpectToken(parser, TokenKind_Semicolon);
+            AstStatement* statement = Allocate(sizeof(AstStatement));
+            statement->Kind = AstStatementKind_Expression;
+            statement->Expression = *expression; // Memory leak
+            return statement;
+        }
+    }
+
+    ASSERT(FALSE);
+    return NULL;
+}
+
+// Parses a statement, or reports the syntax error, skips the rest of the statement and returns NULL
+AstStatement* Parser_TryParseStatement(Parser* parser, AstScope* parentScope) {
+    jmp_buf* outer = parser->Recovery;
+    u64 start = parser->Current.Pos.Position;
+    u64 depth = parser->Depth;
+    u64 frameCount = DynamicArrayLength(parser->Frames);
+
+    jmp_buf recovery;
+    if (setjmp(recovery) != 0) {
+        parser->Recovery = outer;
+        parser->Depth = depth;
+        DynamicArrayLength(parser->Frames) = frameCount;
+        Parser_Synchronize(parser);
+        if (parser->Current.Pos.Position == start && parser->Current.Kind != TokenKind_EndOfFile) {
+            Parser_NextToken(parser); // A stray '}' at the top level
+        }
+        return NULL;
+    }
+
+    parser->Recovery = &recovery;
+    AstStatement* statement = Parser_ParseStatement(parser, parentScope);
+    parser->Recovery = outer;
+    return statement;
+}
+
+AstScope* Parser_ParseScope(Parser* parser, AstScope* parentScope) {
+    AstScope* scope = Allocate(sizeof(AstScope));
+    scope->Parent = parentScope;
+
+    Token open = Parser_ExpectToken(parser, TokenKind_LBrace);
+    Parser_Nest(parser, open);
+    AstStatement** statements = DynamicArrayCreate(AstStatement*);
+
+    while (parser->Current.Kind != TokenKind_RBrace && parser->Current.Kind != TokenKind_EndOfFile) {
+        AstStatement* statement = Parser_TryParseStatement(parser, scope);
+        if (statement) {
+            DynamicArrayPush(statements, statement);
+        }
+    }
+
+    Parser_ExpectToken(parser, TokenKind_RBrace);
+    parser->Depth--;
+
+    scope->Statements = statements;
+
+    return scope;
+}
+
+AstStatement* FindDeclaration(const char* name, AstScope* scope, AstScope** scopeFoundIn) {
+    for (; scope; scope = scope->Parent) {
+        for (u64 i = 0; i < DynamicArrayLength(scope->Statements); i++) {
+            if (scope->Statements[i]->Kind == AstStatementKind_Declaration &&
+                strcmp(scope->Statements[i]->Declaration.Name.Name, name) == 0) {
+                if (scopeFoundIn) {
+                    *scopeFoundIn = scope;
+                }
+                return scope->Statements[i];
+            }
+        }
+
+        if (scope->Variable && strcmp(scope->Variable->Declaration.Name.Name, name) == 0) {
+            if (scopeFoundIn) {
+                *scopeFoundIn = scope;
+            }
+            return scope->Variable;
+        }
+
+        if (scope->Procedure) {
+            AstProcedureArgument* arguments = scope->Procedure->Arguments;
+            for (u64 i = 0; i < DynamicArrayLength(arguments); i++) {
+                if (strcmp(arguments[i].Name.Name, name) == 0) {
+                    if (scopeFoundIn) {
+                        *scopeFoundIn = scope;
+                    }
+                    return arguments[i].Declaration;
+                }
+            }
+        }
+    }
+
+    if (scopeFoundIn) {
+        *scopeFoundIn = NULL;
+    }
+    return NULL;
+}
+
+AstProcedure* Scope_GetProcedure(AstScope* scope) {
+    while (scope) {
+        if (scope->Procedure) {
+            return scope->Procedure;
+        }
+        scope = scope->Parent;
+    }
+    return NULL;
+}
+
+// Adds the capture to procedure and every procedure around it up to the owner, they all pass it on to the ones inside
+void Scope_Capture(AstProcedure* procedure, AstCapture capture) {
+    while (procedure && procedure != capture.Owner) {
+        b8 found = FALSE;
+        for (u64 i = 0; i < DynamicArrayLength(procedure->Captures) && !found; i++) {
+            found = procedure->Captures[i].Declaration == capture.Declaration;
+        }
+        if (found) {
+            return;
+        }
+
+        DynamicArrayPush(procedure->Captures, capture);
+        procedure = Scope_GetProcedure(procedure->Body->Parent);
+    }
+}
+
+AstType Type_Void = {
+    .Kind = AstTypeKind_Void,
+    .Completion = AstTypeCompletion_Complete,
+};
+
+AstType Type_Type = {
+    .Kind = AstTypeKind_Type,
+    .Completion = AstTypeCompletion_Complete,
+};
+
+AstType Type_Bool = {
+    .Kind = AstTypeKind_Bool,
+    .Completion = AstTypeCompletion_Complete,
+    .Size = 1,
+};
+
+AstType Type_Int = {
+    .Kind = AstTypeKind_Integer,
+    .Completion = AstTypeCompletion_Complete,
+    .Size = 8,
+    .Signed = TRUE,
+};
+
+AstType Type_Usize = {
+    .Kind = AstTypeKind_Integer,
+    .Completion = AstTypeCompletion_Complete,
+    .Size = 8,
+    .Signed = FALSE,
+};
+
+AstType Type_Float = {
+    .Kind = AstTypeKind_Float,
+    .Completion = AstTypeCompletion_Complete,
+    .Size = 8,
+};
+
+// A read only (data, length) slice, laid out like the first fields of a '[..]T'
+AstType Type_String = {
+    .Kind = AstTypeKind_String,
+    .Completion = AstTypeCompletion_Complete,
+    .Size = sizeof(u8*) + sizeof(u64),
+};
+
+#define SIZED_TYPE(name, kind, size, signed) \
+    AstType name = { \
+        .Kind = kind, \
+        .Completion = AstTypeCompletion_Complete, \
+        .Size = size, \
+        .Signed = signed, \
+    }
+
+SIZED_TYPE(Type_S8, AstTypeKind_Integer, 1, TRUE);
+SIZED_TYPE(Type_S16, AstTypeKind_Integer, 2, TRUE);
+SIZED_TYPE(Type_S32, AstTypeKind_Integer, 4, TRUE);
+SIZED_TYPE(Type_S64, AstTypeKind_Integer, 8, TRUE);
+SIZED_TYPE(Type_U8, AstTypeKind_Integer, 1, FALSE);
+SIZED_TYPE(Type_U16, AstTypeKind_Integer, 2, FALSE);
+SIZED_TYPE(Type_U32, AstTypeKind_Integer, 4, FALSE);
+SIZED_TYPE(Type_U64, AstTypeKind_Integer, 8, FALSE);
+SIZED_TYPE(Type_F32, AstTypeKind_Float, 4, TRUE);
+SIZED_TYPE(Type_F64, AstTypeKind_Float, 8, TRUE);
+
+#undef SIZED_TYPE
+
+AstType Type_UntypedInteger = {
+    .Kind = AstTypeKind_Integer,
+    .Completion = AstTypeCompletion_Complete,
+    .Size = 0,
+    .Signed = TRUE,
+};
+
+AstType Type_UntypedFloat = {
+    .Kind = AstTypeKind_Float,
+    .Completion = AstTypeCompletion_Complete,
+    .Size = 0,
+};
+
+AstType Type_Null = {
+    .Kind = AstTypeKind_Pointer,
+    .Completion = AstTypeCompletion_Complete,
+    .Size = 8,
+    .Pointer.PointerTo = &Type_Void,
+};
+
+typedef struct BuiltinType {
+    const char* Name;
+    AstType* Type;
+} BuiltinType;
+
+BuiltinType BuiltinTypes[] = {
+    { "void", &Type_Void },
+    { "Type", &Type_Type },
+    { "bool", &Type_Bool },
+    { "int", &Type_Int },
+    { "usize", &Type_Usize },
+    { "float", &Type_Float },
+    { "string", &Type_String },
+
+    // Sized types, 'int', 'usize' and 'float' are aliases of s64, u64 and f64
+    // Integer arithmetic wraps around in two's complement
+    { "s8", &Type_S8 },
+    { "s16", &Type_S16 },
+    { "s32", &Type_S32 },
+    { "s64", &Type_S64 },
+    { "u8", &Type_U8 },
+    { "u16", &Type_U16 },
+    { "u32", &Type_U32 },
+    { "u64", &Type_U64 },
+    { "f32", &Type_F32 },
+    { "f64", &Type_F64 },
+};
+
+AstType* FindBuiltinType(const char* name) {
+    for (u64 i = 0; i < sizeof(BuiltinTypes) / sizeof(BuiltinTypes[0]); i++) {
+        if (MatchStrings(BuiltinTypes[i].Name, name)) {
+            return BuiltinTypes[i].Type;
+        }
+    }
+    return NULL;
+}
+
+b8 Type_IsUntyped(AstType* type) {
+    return (type->Kind == AstTypeKind_Integer || type->Kind == AstTypeKind_Float) && type->Size == 0;
+}
+
+b8 Type_IsNumeric(AstType* type) {
+    return type->Kind == AstTypeKind_Integer || type->Kind == AstTypeKind_Float;
+}
+
+// '[..]T' is laid out as the fields before ArrayField_Push, each 8 bytes, the rest are methods lowered inline
+typedef enum ArrayField {
+    ArrayField_Data,
+    ArrayField_Length,
+    ArrayField_Capacity,
+    ArrayField_Allocator, // Reallocates like '(data: ^void, old_size: usize, new_size: usize) -> ^void', the runtime default when null
+
+    ArrayField_Push,
+    ArrayField_Reserve,
+    ArrayField_Append,
+
+    ArrayField_Count,
+} ArrayField;
+
+const char* ArrayFieldNames[ArrayField_Count] = {
+    [ArrayField_Data] = "data",
+    [ArrayField_Length] = "length",
+    [ArrayField_Capacity] = "capacity",
+    [ArrayField_Allocator] = "allocator",
+
+    [ArrayField_Push] = "push",
+    [ArrayField_Reserve] = "reserve",
+    [ArrayField_Append] = "append",
+};
+
+// Methods of '#vector(N) T', each is a single instruction. 'shuffle' takes a constant lane of the vector for every lane.
+typedef enum VectorMethod {
+    VectorMethod_Sum,
+    VectorMethod_Min,
+    VectorMethod_Max,
+    VectorMethod_Shuffle,
+
+    VectorMethod_Count,
+} VectorMethod;
+
+const char* VectorMethodNames[VectorMethod_Count] = {
+    [VectorMethod_Sum] = "sum",
+    [VectorMethod_Min] = "min",
+    [VectorMethod_Max] = "max",
+    [VectorMethod_Shuffle] = "shuffle",
+};
+
+b8 Type_IsAggregate(AstType* type) {
+    return type->Kind == AstTypeKind_Struct || type->Kind == AstTypeKind_Array || type->Kind == AstTypeKind_String;
+}
+
+b8 Type_Equal(AstType* a, AstType* b) {
+    if (a == b) {
+        return TRUE;
+    }
+
+    if (a->Kind != b->Kind) {
+        return FALSE;
+    }
+
+    switch (a->Kind) {
+        case AstTypeKind_Integer: {
+            return a->Size == b->Size && a->Signed == b->Signed;
+        } break;
+
+        case AstTypeKind_Float: {
+            return a->Size == b->Size;
+        } break;
+
+        case AstTypeKind_Pointer: {
+            return Type_Equal(a->Pointer.PointerTo, b->Pointer.PointerTo);
+        } break;
+
+        case AstTypeKind_Array: {
+            return
+                a->Array.Dynamic == b->Array.Dynamic &&
+                a->Array.Soa == b->Array.Soa &&
+                a->Array.ElementCount == b->Array.ElementCount &&
+                Type_Equal(a->Array.ArrayOf, b->Array.ArrayOf);
+        } break;
+
+        case AstTypeKind_Vector: {
+            return a->Array.ElementCount == b->Array.ElementCount && Type_Equal(a->Array.ArrayOf, b->Array.ArrayOf);
+        } break;
+
+        case AstTypeKind_Procedure: {
+            u64 count = DynamicArrayLength(a->Procedure.Arguments);
+            if (count != DynamicArrayLength(b->Procedure.Arguments)) {
+                return FALSE;
+            }
+            for (u64 i = 0; i < count; i++) {
+                if (!Type_Equal(a->Procedure.Arguments[i].Type, b->Procedure.Arguments[i].Type)) {
+                    return FALSE;
+                }
+            }
+            AstType* aReturn = a->Procedure.ReturnType ? a->Procedure.ReturnType : &Type_Void;
+            AstType* bReturn = b->Procedure.ReturnType ? b->Procedure.ReturnType : &Type_Void;
+            return Type_Equal(aReturn, bReturn);
+        } break;
+
+        case AstTypeKind_Struct: {
+            return a->Struct.Declarations == b->Struct.Declarations;
+        } break;
+
+        default: {
+            return TRUE;
+        } break;
+    }
+}
+
+// Types that are equal by Type_Equal hash the same
+u64 Type_Hash(u64 hash, AstType* type) {
+    hash = Hash_U64(hash, type->Kind);
+    switch (type->Kind) {
+        case AstTypeKind_Integer: {
+            hash = Hash_U64(hash, type->Size);
+            hash = Hash_U64(hash, type->Signed);
+        } break;
+
+        case AstTypeKind_Float: {
+            hash = Hash_U64(hash, type->Size);
+        } break;
+
+        case AstTypeKind_Pointer: {
+            hash = Type_Hash(hash, type->Pointer.PointerTo);
+        } break;
+
+        case AstTypeKind_Array:
+        case AstTypeKind_Vector: {
+            hash = Hash_U64(hash, type->Array.Dynamic);
+            hash = Hash_U64(hash, type->Array.Soa);
+            hash = Hash_U64(hash, type->Array.ElementCount);
+            hash = Type_Hash(hash, type->Array.ArrayOf);
+        } break;
+
+        case AstTypeKind_Procedure: {
+            hash = Hash_U64(hash, DynamicArrayLength(type->Procedure.Arguments));
+            for (u64 i = 0; i < DynamicArrayLength(type->Procedure.Arguments); i++) {
+                hash = Type_Hash(hash, type->Procedure.Arguments[i].Type);
+            }
+            hash = Type_Hash(hash, type->Procedure.ReturnType ? type->Procedure.ReturnType : &Type_Void);
+        } break;
+
+        case AstTypeKind_Struct: {
+            hash = Hash_U64(hash, cast(u64) type->Struct.Declarations);
+        } break;
+
+        default: {
+        } break;
+    }
+    return hash;
+}
+
+void Type_AppendString(char** buffer, const char* string) {
+    while (*string) {
+        DynamicArrayPush(*buffer, *string++);
+    }
+}
+
+void Type_Format(AstType* type, char** buffer) {
+    switch (type->Kind) {
+        case AstTypeKind_Unknown: {
+            if (type->Unknown.Polymorphic) {
+                Type_AppendString(buffer, "$");
+            }
+            Type_AppendString(buffer, type->Unknown.Name.Name);
+            if (type->Unknown.TypeArguments) {
+                Type_AppendString(buffer, "(");
+                for (u64 i = 0; i < DynamicArrayLength(type->Unknown.TypeArguments); i++) {
+                    if (i > 0) {
+                        Type_AppendString(buffer, ", ");
+                    }
+                    Type_Format(type->Unknown.TypeArguments[i], buffer);
+                }
+                Type_AppendString(buffer, ")");
+            }
+        } break;
+
+        case AstTypeKind_Integer:
+        case AstTypeKind_Float: {
+            if (Type_IsUntyped(type)) {
+                Type_AppendString(buffer, type->Kind == AstTypeKind_Integer ? "untyped integer" : "untyped float");
+                break;
+            }
+
+            // Aliases like 'int' and 'usize' print as the sized type they stand for
+            char name[32];
+            snprintf(name, sizeof(name), "%c%llu", type->Kind == AstTypeKind_Float ? 'f' : type->Signed ? 's' : 'u', type->Size * 8);
+            Type_AppendString(buffer, name);
+        } break;
+
+        case AstTypeKind_Pointer: {
+            Type_AppendString(buffer, "^");
+            Type_Format(type->Pointer.PointerTo, buffer);
+        } break;
+
+        case AstTypeKind_Procedure: {
+            Type_AppendString(buffer, "(");
+            for (u64 i = 0; i < DynamicArrayLength(type->Procedure.Arguments); i++) {
+                if (i > 0) {
+                    Type_AppendString(buffer, ", ");
+                }
+                Type_Format(type->Procedure.Arguments[i].Type, buffer);
+            }
+            Type_AppendString(buffer, ") -> ");
+            Type_Format(type->Procedure.ReturnType ? type->Procedure.ReturnType : &Type_Void, buffer);
+        } break;
+
+        case AstTypeKind_Struct: {
+            Type_AppendString(buffer, type->Struct.Name ? type->Struct.Name : "struct");
+        } break;
+
+        case AstTypeKind_Array: {
+            if (type->Array.Soa) {
+                Type_AppendString(buffer, "#soa ");
+            }
+            if (type->Array.Dynamic) {
+                Type_AppendString(buffer, "[..]");
+            } else {
+                char count[32];
+                snprintf(count, sizeof(count), "[%llu]", type->Array.ElementCount);
+                Type_AppendString(buffer, count);
+            }
+            Type_Format(type->Array.ArrayOf, buffer);
+        } break;
+
+        case AstTypeKind_Vector: {
+            char count[32];
+            snprintf(count, sizeof(count), "#vector(%llu) ", type->Array.ElementCount);
+            Type_AppendString(buffer, count);
+            Type_Format(type->Array.ArrayOf, buffer);
+        } break;
+
+        default: {
+            for (u64 i = 0; i < sizeof(BuiltinTypes) / sizeof(BuiltinTypes[0]); i++) {
+                if (BuiltinTypes[i].Type->Kind == type->Kind) {
+                    Type_AppendString(buffer, BuiltinTypes[i].Name);
+                    return;
+                }
+            }
+            ASSERT(FALSE);
+        } break;
+    }
+}
+
+const char* Type_Name(AstType* type) {
+    char* buffer = DynamicArrayCreate(char);
+    Type_Format(type, &buffer);
+    DynamicArrayPush(buffer, '\0');
+
+    char* name = Allocate(DynamicArraySize(buffer));
+    memcpy(name, buffer, DynamicArraySize(buffer));
+    DynamicArrayDestroy(buffer);
+    return name;
+}
+
+u64 Type_Align(AstType* type);
+u64 Type_SoaColumn(AstType* type, u64 field);
+
+u64 Type_Size(AstType* type) {
+    switch (type->Kind) {
+        case AstTypeKind_Integer:
+        case AstTypeKind_Float: {
+            return type->Size != 0 ? type->Size : 8;
+        } break;
+
+        case AstTypeKind_Bool:
+        case AstTypeKind_String: {
+            return type->Size;
+        } break;
+
+        case AstTypeKind_Pointer:
+        case AstTypeKind_Procedure: {
+            return sizeof(void*);
+        } break;
+
+        case AstTypeKind_Struct: {
+            ASSERT(type->Struct.Offsets);
+            return type->Size;
+        } break;
+
+        case AstTypeKind_Array: {
+            if (type->Array.Dynamic) {
+                return ArrayField_Push * sizeof(u64);
+            } else if (type->Array.Soa) {
+                u64 align = Type_Align(type);
+                return (Type_SoaColumn(type, DynamicArrayLength(type->Array.ArrayOf->Struct.Declarations)) + align - 1) & ~(align - 1);
+            }
+            return type->Array.ElementCount * Type_Size(type->Array.ArrayOf);
+        } break;
+
+        case AstTypeKind_Vector: {
+            return type->Array.ElementCount * Type_Size(type->Array.ArrayOf);
+        } break;
+
+        default: {
+            return 0;
+        } break;
+    }
+}
+
+u64 Type_Align(AstType* type) {
+    switch (type->Kind) {
+        case AstTypeKind_Integer:
+        case AstTypeKind_Float:
+        case AstTypeKind_Bool: {
+            return Type_Size(type);
+        } break;
+
+        case AstTypeKind_String:
+        case AstTypeKind_Pointer:
+        case AstTypeKind_Procedure: {
+            return sizeof(void*);
+        } break;
+
+        case AstTypeKind_Struct: {
+            ASSERT(type->Struct.Offsets);
+            return type->Align;
+        } break;
+
+        case AstTypeKind_Array: {
+            if (type->Array.Dynamic) {
+                return sizeof(void*);
+            } else if (type->Array.Soa) { // Columns are aligned for their own field even in packed structs
+                u64 align = 1;
+                AstDeclaration* fields = type->Array.ArrayOf->Struct.Declarations;
+                for (u64 i = 0; i < DynamicArrayLength(fields); i++) {
+                    if (Type_Align(fields[i].Type) > align) {
+                        align = Type_Align(fields[i].Type);
+                    }
+                }
+                return align;
+            }
+            return Type_Align(type->Array.ArrayOf);
+        } break;
+
+        case AstTypeKind_Vector: { // Aligned like the register, so whole vectors load with aligned moves
+            return Type_Size(type);
+        } break;
+
+        default: {
+            return 1;
+        } break;
+    }
+}
+
+u64 Type_FieldOffset(AstType* type, u64 index) {
+    if (type->Kind == AstTypeKind_Array || type->Kind == AstTypeKind_String) {
+        ASSERT(type->Kind == AstTypeKind_String ? index <= ArrayField_Length : type->Array.Dynamic && index < ArrayField_Push);
+        return index * sizeof(u64);
+    }
+
+    ASSERT(type->Kind == AstTypeKind_Struct && type->Struct.Offsets);
+    return type->Struct.Offsets[index];
+}
+
+// '#soa [N]T' stores the N values of each field of T one after another, in declaration order.
+// A field past the last one gives the end of the last column.
+u64 Type_SoaColumn(AstType* type, u64 field) {
+    ASSERT(type->Kind == AstTypeKind_Array && type->Array.Soa);
+    AstDeclaration* fields = type->Array.ArrayOf->Struct.Declarations;
+    u64 offset = 0;
+    for (u64 i = 0; i < DynamicArrayLength(fields); i++) {
+        u64 align = Type_Align(fields[i].Type);
+        offset = (offset + align - 1) & ~(align - 1);
+        if (i == field) {
+            return offset;
+        }
+        offset += type->Array.ElementCount * Type_Size(fields[i].Type);
+    }
+    return offset;
+}
+
+AstType* Type_PointerTo(AstType* pointerTo) {
+    AstType* type = Allocate(sizeof(AstType));
+    type->Kind = AstTypeKind_Pointer;
+    type->Completion = AstTypeCompletion_Complete;
+    type->Size = sizeof(void*);
+    type->Pointer.PointerTo = pointerTo;
+    return type;
+}
+
+// A procedure type with one argument of every type in arguments, ending with NULL
+AstType* Type_ProcedureOf(AstType* returnType, AstType** arguments) {
+    AstType* type = Allocate(sizeof(AstType));
+    type->Kind = AstTypeKind_Procedure;
+    type->Completion = AstTypeCompletion_Complete;
+    type->Size = sizeof(void*);
+    type->Procedure.Arguments = DynamicArrayCreate(AstProcedureArgument);
+    type->Procedure.ReturnType = returnType;
+    for (u64 i = 0; arguments[i]; i++) {
+        DynamicArrayPush(type->Procedure.Arguments, ((AstProcedureArgument){ .Type = arguments[i] }));
+    }
+    return type;
+}
+
+b8 Ast_IsSoaElement(AstExpression* expression) {
+    if (expression->Kind != AstExpressionKind_Index) {
+        return FALSE;
+    }
+    AstType* type = expression->Index.Operand->Type;
+    return type->Kind == AstTypeKind_Array && type->Array.Soa;
+}
+
+// Polymorphic procedures and structs are never checked themselves, only their instances are
+b8 Ast_IsPolymorphic(AstExpression* expression) {
+    if (!expression) {
+        return FALSE;
+    } else if (expression->Kind == AstExpressionKind_Procedure) {
+        return expression->Procedure.TypeParameters != NULL;
+    } else if (expression->Kind == AstExpressionKind_Struct) {
+        return expression->Struct.TypeParameters != NULL;
+    }
+    return FALSE;
+}
+
+b8 Ast_IsArrayMethod(AstExpression* expression) {
+    if (expression->Kind != AstExpressionKind_Field) {
+        return FALSE;
+    }
+
+    AstType* type = expression->Field.Expression->Type;
+    if (type->Kind == AstTypeKind_Pointer) {
+        type = type->Pointer.PointerTo;
+    }
+    return type->Kind == AstTypeKind_Array && expression->Field.Index >= ArrayField_Push;
+}
+
+AstType* Type_ArrayField(AstType* array, ArrayField field) {
+    switch (field) {
+        case ArrayField_Data: {
+            return Type_PointerTo(array->Array.ArrayOf);
+        } break;
+
+        case ArrayField_Length:
+        case ArrayField_Capacity: {
+            return &Type_Usize;
+        } break;
+
+        case ArrayField_Allocator: {
+            return Type_ProcedureOf(&Type_Null, (AstType*[]){ &Type_Null, &Type_Usize, &Type_Usize, NULL });
+        } break;
+
+        case ArrayField_Push: {
+            return Type_ProcedureOf(NULL, (AstType*[]){ array->Array.ArrayOf, NULL });
+        } break;
+
+        case ArrayField_Reserve: {
+            return Type_ProcedureOf(NULL, (AstType*[]){ &Type_Usize, NULL });
+        } break;
+
+        case ArrayField_Append: {
+            return Type_ProcedureOf(NULL, (AstType*[]){ array, NULL });
+        } break;
+
+        default: {
+            ASSERT(FALSE);
+            return NULL;
+        } break;
+    }
+}
+
+b8 Ast_IsVectorMethod(AstExpression* expression) {
+    if (expression->Kind != AstExpressionKind_Field) {
+        return FALSE;
+    }
+
+    AstType* type = expression->Field.Expression->Type;
+    if (type->Kind == AstTypeKind_Pointer) {
+        type = type->Pointer.PointerTo;
+    }
+    return type->Kind == AstTypeKind_Vector;
+}
+
+AstType* Type_VectorMethod(AstType* vector, VectorMethod method) {
+    if (method != VectorMethod_Shuffle) {
+        return Type_ProcedureOf(vector->Array.ArrayOf, (AstType*[]){ NULL });
+    }
+
+    u64 lanes = vector->Array.ElementCount;
+    AstType** arguments = Allocate((lanes + 1) * sizeof(AstType*));
+    for (u64 i = 0; i < lanes; i++) {
+        arguments[i] = &Type_Usize;
+    }
+    AstType* type = Type_ProcedureOf(vector, arguments);
+    free(arguments);
+    return type;
+}
+
+// Computes the size, alignment and field offsets of a struct once, the fields must already be complete
+void Layout_Struct(AstType* type) {
+    AstStruct* struct_ = &type->Struct;
+    u64 count = DynamicArrayLength(struct_->Declarations);
+
+    u64* order = Allocate((count + 1) * sizeof(u64));
+    for (u64 i = 0; i < count; i++) {
+        order[i] = i;
+    }
+
+    if (struct_->Reorder && !struct_->Packed) {
+        // Insertion sort keeps fields with the same alignment in declaration order
+        for (u64 i = 1; i < count; i++) {
+            u64 index = order[i];
+            u64 align = Type_Align(struct_->Declarations[index].Type);
+
+            u64 j = i;
+            while (j > 0 && Type_Align(struct_->Declarations[order[j - 1]].Type) < align) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = index;
+        }
+    }
+
+    struct_->Offsets = Allocate((count + 1) * sizeof(u64));
+    u64 size = 0;
+    u64 structAlign = 1;
+    for (u64 i = 0; i < count; i++) {
+        AstType* fieldType = struct_->Declarations[order[i]].Type;
+        u64 align = struct_->Packed ? 1 : Type_Align(fieldType);
+
+        size = (size + align - 1) & ~(align - 1);
+        struct_->Offsets[order[i]] = size;
+        size += Type_Size(fieldType);
+
+        if (align > structAlign) {
+            structAlign = align;
+        }
+    }
+
+    type->Align = structAlign;
+    type->Size = (size + structAlign - 1) & ~(structAlign - 1);
+    free(order);
+}
+
+b8 Type_ContainsIncomplete(AstType* type) {
+    while (type->Kind == AstTypeKind_Array && !type->Array.Dynamic) {
+        type = type->Array.ArrayOf;
+    }
+    return type->Kind == AstTypeKind_Struct && type->Completion != AstTypeCompletion_Complete;
+}
+
+void Complete_Statement(AstStatement* statement, AstScope* parentScope);
+void Complete_Expression(AstExpression* expression, AstScope* parentScope);
+AstType* Complete_InstantiateStruct(AstExpression* polymorph, AstType** types, AstScope* parentScope);
+u64 Lower_Run(AstExpression* expression);
+
+u64 Evaluate_Constant(AstExpression* expression, b8* negative);
+
+// Applies a binary operator to constants, negative is set when the result is below zero
+u64 Evaluate_Binary(Token operator, u64 left, b8 leftNegative, u64 right, b8 rightNegative, b8* negative) {
+    switch (operator.Kind) {
+        case TokenKind_Plus:
+        case TokenKind_Minus: {
+            u64 value = operator.Kind == TokenKind_Plus ? left + right : left - right;
+            if (operator.Kind == TokenKind_Minus) {
+                rightNegative = !rightNegative && right != 0;
+                right = 0 - right;
+            }
+            if (leftNegative == rightNegative) {
+                *negative = leftNegative;
+            } else {
+                *negative = leftNegative ? right < 0 - left : left < 0 - right;
+            }
+            return value;
+        } break;
+
+        case TokenKind_Asterisk: {
+            u64 value = left * right;
+            *negative = leftNegative != rightNegative && value != 0;
+            return value;
+        } break;
+
+        case TokenKind_Ampersand: {
+            *negative = leftNegative && rightNegative;
+            return left & right;
+        } break;
+
+        case TokenKind_Pipe: {
+            *negative = leftNegative || rightNegative;
+            return left | right;
+        } break;
+
+        case TokenKind_Slash:
+        case TokenKind_Percent: {
+            if (right == 0) {
+                Error("Division by zero in constant expression");
+                return 0;
+            }
+
+            b8 isSlash = operator.Kind == TokenKind_Slash;
+            u64 value;
+            if (leftNegative || rightNegative) {
+                if (cast(s64) right == -1) { // Avoids overflowing on the smallest value
+                    value = isSlash ? 0 - left : 0;
+                } else {
+                    value = cast(u64) (isSlash ? cast(s64) left / cast(s64) right : cast(s64) left % cast(s64) right);
+                }
+            } else {
+                value = isSlash ? left / right : left % right;
+            }
+            // The remainder takes the sign of the left side
+            *negative = (isSlash ? leftNegative != rightNegative : leftNegative) && value != 0;
+            return value;
+        } break;
+
+        default: {
+        } break;
+    }
+
+    Error("Expected a constant integer expression");
+    return 0;
+}
+
+// The value of a constant integer expression, negative tells values below zero apart from large unsigned ones
+u64 Evaluate_Constant(AstExpression* expression, b8* negative) {
+    *negative = FALSE;
+    switch (expression->Kind) {
+        case AstExpressionKind_Literal: {
+            if (expression->Literal.Token.Kind == TokenKind_Integer) {
+                return expression->Literal.Token.Integer;
+            }
+        } break;
+
+        case AstExpressionKind_Name: {
+            AstDeclaration* declaration = expression->Name.Declaration;
+            if (declaration && declaration->Constant && declaration->Value) {
+                return Evaluate_Constant(declaration->Value, negative);
+            }
+        } break;
+
+        case AstExpressionKind_Unary: {
+            switch (expression->Unary.Operator.Kind) {
+                case TokenKind_Plus: return Evaluate_Constant(expression->Unary.Operand, negative);
+
+                case TokenKind_Minus: {
+                    b8 operandNegative;
+                    u64 value = Evaluate_Constant(expression->Unary.Operand, &operandNegative);
+                    *negative = !operandNegative && value != 0;
+                    return 0 - value;
+                } break;
+
+                default: break;
+            }
+        } break;
+
+        case AstExpressionKind_Binary: {
+            // Binary chains nest to the left, the loop evaluates them from the leftmost operand up
+            AstExpression** chain = DynamicArrayCreate(AstExpression*);
+            AstExpression* left = expression;
+            while (left->Kind == AstExpressionKind_Binary) {
+                DynamicArrayPush(chain, left);
+                left = left->Binary.Left;
+            }
+
+            u64 value = Evaluate_Constant(left, negative);
+            for (u64 i = DynamicArrayLength(chain); i > 0; i--) {
+                b8 rightNegative;
+                u64 right = Evaluate_Constant(chain[i - 1]->Binary.Right, &rightNegative);
+                value = Evaluate_Binary(chain[i - 1]->Binary.Operator, value, *negative, right, rightNegative, negative);
+            }
+            DynamicArrayDestroy(chain);
+            return value;
+        } break;
+
+        case AstExpressionKind_Sizeof: {
+            AstExpression* operand = expression->SizeOf.Expression;
+            return Type_Size(operand->Type->Kind == AstTypeKind_Type ? operand->TypeValue : operand->Type);
+        } break;
+
+        case AstExpressionKind_Cast: {
+            b8 operandNegative;
+            u64 value = Evaluate_Constant(expression->Cast.Expression, &operandNegative);
+            *negative = expression->Type->Signed && cast(s64) value < 0;
+            return value;
+        } break;
+
+        case AstExpressionKind_Run: {
+            *negative = expression->Type->Signed && cast(s64) expression->Run.Value < 0;
+            return expression->Run.Value;
+        } break;
+
+        default: {
+        } break;
+    }
+
+    Error("Expected a constant integer expression");
+    return 0;
+}
+
+u64 Evaluate_Integer(AstExpression* expression) {
+    b8 negative;
+    return Evaluate_Constant(expression, &negative);
+}
+
+// Wraps a constant to an integer type, signed types are sign extended like integer constants in the IR
+u64 Evaluate_Wrap(AstType* type, u64 value) {
+    u64 bits = Type_Size(type) * 8;
+    if (bits >= 64) {
+        return value;
+    }
+
+    u64 mask = (1ull << bits) - 1;
+    value &= mask;
+    if (type->Signed && (value & (1ull << (bits - 1)))) {
+        value |= ~mask;
+    }
+    return value;
+}
+
+// The literal of a constant string, NULL when it is not a literal or a constant declared as one
+Token* Evaluate_String(AstExpression* expression) {
+    while (expression->Kind == AstExpressionKind_Name) {
+        AstDeclaration* declaration = expression->Name.Declaration;
+        if (!declaration || !declaration->Constant || !declaration->Value) {
+            return NULL;
+        }
+        expression = declaration->Value;
+    }
+
+    if (expression->Kind != AstExpressionKind_Literal || expression->Literal.Token.Kind != TokenKind_String) {
+        return NULL;
+    }
+    return &expression->Literal.Token;
+}
+
+AstType* Complete_Type(AstType* type, AstScope* parentScope) {
+    if (type->Completion == AstTypeCompletion_Complete) {
+        return type;
+    }
+
+    switch (type->Kind) {
+        case AstTypeKind_Unknown: {
+            const char* name = type->Unknown.Name.Name;
+            AstType* builtin = FindBuiltinType(name);
+            if (builtin) {
+                if (type->Unknown.TypeArguments) {
+                    Error("'%s' does not take type arguments", name);
+                }
+                return builtin;
+            }
+
+            AstScope* foundScope = NULL;
+            AstStatement* statement = FindDeclaration(name, parentScope, &foundScope);
+            if (!statement) {
+                Error("Unable to find type '%s'", name);
+                return &Type_Void;
+            }
+
+            AstDeclaration* declaration = &statement->Declaration;
+            AstExpression* value = declaration->Value;
+            if (type->Unknown.TypeArguments || Ast_IsPolymorphic(value)) {
+                if (!declaration->Constant || !value || value->Kind != AstExpressionKind_Struct || !value->Struct.TypeParameters) {
+                    Error("'%s' does not take type arguments", name);
+                    return &Type_Void;
+                }
+
+                u64 count = DynamicArrayLength(value->Struct.TypeParameters);
+                u64 given = type->Unknown.TypeArguments ? DynamicArrayLength(type->Unknown.TypeArguments) : 0;
+                if (given != count) {
+                    Error("'%s' takes %llu type arguments but got %llu", name, count, given);
+                    return &Type_Void;
+                }
+
+                Complete_Statement(statement, foundScope);
+                AstType** types = Allocate(count * sizeof(AstType*));
+                for (u64 i = 0; i < count; i++) {
+                    types[i] = Complete_Type(type->Unknown.TypeArguments[i], parentScope);
+                }
+                return Complete_InstantiateStruct(value, types, foundScope);
+            }
+
+            if (declaration->Constant && value && value->Kind == AstExpressionKind_Struct && value->TypeValue) {
+                return value->TypeValue; // The struct may still be completing, so pointers to it can be formed
+            }
+
+            Complete_Statement(statement, foundScope);
+            if (!declaration->Constant || !value || value->Type->Kind != AstTypeKind_Type) {
+                Error("'%s' is not a type", name);
+                return &Type_Void;
+            }
+            return value->TypeValue;
+        } break;
+
+        case AstTypeKind_Pointer: {
+            type->Pointer.PointerTo = Complete_Type(type->Pointer.PointerTo, parentScope);
+            type->Size = sizeof(void*);
+        } break;
+
+        case AstTypeKind_Array: {
+            type->Array.ArrayOf = Complete_Type(type->Array.ArrayOf, parentScope);
+            if (type->Array.Count) {
+                Complete_Expression(type->Array.Count, parentScope);
+                if (!type->Array.Count->Constant || type->Array.Count->Type->Kind != AstTypeKind_Integer) {
+                    Error("Array count must be a constant integer");
+                }
+                type->Array.ElementCount = Evaluate_Integer(type->Array.Count);
+            }
+
+            if (type->Array.Soa && (type->Array.Dynamic || !type->Array.Count)) {
+                Error("'#soa' arrays need a constant count, their columns cannot grow");
+            } else if (type->Array.Soa && type->Array.ArrayOf->Kind != AstTypeKind_Struct) {
+                Error("'#soa' splits arrays of structs by field, '%s' is not a struct", Type_Name(type->Array.ArrayOf));
+            }
+        } break;
+
+        case AstTypeKind_Vector: {
+            AstType* lane = Complete_Type(type->Array.ArrayOf, parentScope);
+            type->Array.ArrayOf = lane;
+            Complete_Expression(type->Array.Count, parentScope);
+            if (!type->Array.Count->Constant || type->Array.Count->Type->Kind != AstTypeKind_Integer) {
+                Error("Vector lane count must be a constant integer");
+            }
+
+            u64 lanes = Evaluate_Integer(type->Array.Count);
+            type->Array.ElementCount = lanes;
+            if (!Type_IsNumeric(lane)) {
+                Error("Vector lanes must be integers or floats, not '%s'", Type_Name(lane));
+            } else if (lanes < 2 || (lanes & (lanes - 1)) != 0) {
+                Error("Vector lane count must be a power of two of at least 2, got %llu", lanes);
+            } else if (lanes * Type_Size(lane) > 32) {
+                Error("'%s' is %llu bytes, vectors must fit in a 32 byte register", Type_Name(type), lanes * Type_Size(lane));
+            }
+        } break;
+
+        case AstTypeKind_Procedure: {
+            for (u64 i = 0; i < DynamicArrayLength(type->Procedure.Arguments); i++) {
+                type->Procedure.Arguments[i].Type = Complete_Type(type->Procedure.Arguments[i].Type, parentScope);
+            }
+            if (type->Procedure.ReturnType) {
+                type->Procedure.ReturnType = Complete_Type(type->Procedure.ReturnType, parentScope);
+            }
+        } break;
+
+        default: {
+        } break;
+    }
+
+    type->Completion = AstTypeCompletion_Complete;
+    return type;
+}
+
+AstType* Type_Default(AstType* type) {
+    if (type == &Type_UntypedInteger || (type->Kind == AstTypeKind_Integer && type->Size == 0)) {
+        return &Type_Int;
+    } else if (type->Kind == AstTypeKind_Float && type->Size == 0) {
+        return &Type_Float;
+    }
+    return type;
+}
+
+void Complete_SetUntypedType(AstExpression* expression, AstType* type) {
+    // Left operands are followed by the loop, binary chains nest to the left
+    while (expression) {
+        expression->Type = type;
+
+        AstExpression* next = NULL;
+        switch (expression->Kind) {
+            case AstExpressionKind_Unary: {
+                if (Type_IsUntyped(expression->Unary.Operand->Type)) {
+                    next = expression->Unary.Operand;
+                }
+            } break;
+
+            case AstExpressionKind_Binary: {
+                if (Type_IsUntyped(expression->Binary.Right->Type)) {
+                    Complete_SetUntypedType(expression->Binary.Right, type);
+                }
+                if (Type_IsUntyped(expression->Binary.Left->Type)) {
+                    next = expression->Binary.Left;
+                }
+            } break;
+
+            default: {
+            } break;
+        }
+        expression = next;
+    }
+}
+
+// Implicit conversions never lose information, every value of 'from' is representable in 'to'
+b8 Type_CanWiden(AstType* from, AstType* to) {
+    if (from->Kind == AstTypeKind_Integer && to->Kind == AstTypeKind_Integer) {
+        if (from->Signed == to->Signed) {
+            return to->Size >= from->Size;
+        }
+        return !from->Signed && to->Size > from->Size;
+    } else if (from->Kind == AstTypeKind_Float && to->Kind == AstTypeKind_Float) {
+        return to->Size >= from->Size;
+    }
+    return FALSE;
+}
+
+// A negative value is the s64 in its bits, any other value is the u64 in them
+b8 Type_FitsInteger(AstType* type, u64 value, b8 negative) {
+    u64 bits = Type_Size(type) * 8;
+    if (type->Signed) {
+        s64 min = bits == 64 ? cast(s64) 0x8000000000000000ull : -(cast(s64) 1 << (bits - 1));
+        u64 max = bits == 64 ? 0x7FFFFFFFFFFFFFFFull : (1ull << (bits - 1)) - 1;
+        return negative ? cast(s64) value >= min : value <= max;
+    }
+    return !negative && (bits == 64 || value < (1ull << bits));
+}
+
+// Turns the expression into an implicit cast of a copy of itself
+void Complete_InsertCast(AstExpression* expression, AstType* type) {
+    AstExpression* operand = Allocate(sizeof(AstExpression));
+    *operand = *expression;
+
+    AstExpression cast = {
+        .Kind = AstExpressionKind_Cast,
+        .Type = type,
+        .Constant = operand->Constant,
+        .Cast.Type = type,
+        .Cast.Expression = operand,
+    };
+    *expression = cast;
+}
+
+void Complete_Convert(AstExpression* expression, AstType* type) {
+    AstType* from = expression->Type;
+    if (from->Kind == AstTypeKind_Procedure && from->Procedure.Polymorph) {
+        Error("'%s' is polymorphic and can only be called", from->Procedure.Polymorph->Name);
+    }
+
+    if (Type_Equal(from, type)) {
+        return;
+    }
+
+    if (Type_IsUntyped(from)) {
+        if (from->Kind == AstTypeKind_Integer && type->Kind == AstTypeKind_Integer) {
+            b8 negative;
+            u64 value = Evaluate_Constant(expression, &negative);
+            if (!Type_FitsInteger(type, value, negative)) {
+                if (negative) {
+                    Error("Constant %lld does not fit in '%s'", cast(s64) value, Type_Name(type));
+                } else {
+                    Error("Constant %llu does not fit in '%s'", value, Type_Name(type));
+                }
+            }
+        }
+
+        if ((from->Kind == AstTypeKind_Integer && Type_IsNumeric(type)) ||
+            (from->Kind == AstTypeKind_Float && type->Kind == AstTypeKind_Float)) {
+            Complete_SetUntypedType(expression, type);
+            return;
+        }
+    } else if (from == &Type_Null && type->Kind == AstTypeKind_Pointer) {
+        expression->Type = type;
+        return;
+    } else if (Type_CanWiden(from, type)) {
+        Complete_InsertCast(expression, type);
+        return;
+    }
+
+    // Scalars are broadcast to every lane
+    if (type->Kind == AstTypeKind_Vector && Type_IsNumeric(from)) {
+        Complete_Convert(expression, type->Array.ArrayOf);
+        Complete_InsertCast(expression, type);
+        return;
+    }
+
+    Error("Cannot convert '%s' to '%s'", Type_Name(from), Type_Name(type));
+}
+
+AstType* Complete_Unify(AstExpression* left, AstExpression* right) {
+    if (Type_Equal(left->Type, right->Type)) {
+        return left->Type;
+    }
+
+    if (Type_IsUntyped(left->Type) && Type_IsUntyped(right->Type)) {
+        Complete_SetUntypedType(left, &Type_UntypedFloat);
+        Complete_SetUntypedType(right, &Type_UntypedFloat);
+        return &Type_UntypedFloat;
+    } else if (Type_IsUntyped(left->Type) || left->Type == &Type_Null || Type_CanWiden(left->Type, right->Type) ||
+               (right->Type->Kind == AstTypeKind_Vector && left->Type->Kind != AstTypeKind_Vector)) {
+        Complete_Convert(left, right->Type);
+        return right->Type;
+    } else {
+        Complete_Convert(right, left->Type);
+        return left->Type;
+    }
+}
+
+b8 Complete_FallsThrough(AstStatement* statement);
+
+b8 Complete_ScopeFallsThrough(AstScope* scope) {
+    for (u64 i = 0; i < DynamicArrayLength(scope->Statements); i++) {
+        if (!Complete_FallsThrough(scope->Statements[i])) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// Whether running the statement can continue after it, there is no 'break' so only 'while true' never ends
+b8 Complete_FallsThrough(AstStatement* statement) {
+    switch (statement->Kind) {
+        case AstStatementKind_Return: {
+            return FALSE;
+        } break;
+
+        case AstStatementKind_Scope: {
+            return Complete_ScopeFallsThrough(&statement->Scope);
+        } break;
+
+        case AstStatementKind_If: {
+            // Walked in a loop, 'else if' chains can be long
+            while (statement && statement->Kind == AstStatementKind_If) {
+                if (Complete_FallsThrough(statement->If.Then)) {
+                    return TRUE;
+                }
+                statement = statement->If.Else;
+            }
+            return !statement || Complete_FallsThrough(statement);
+        } break;
+
+        case AstStatementKind_While: {
+            return statement->While.Condition->Kind != AstExpressionKind_True;
+        } break;
+
+        case AstStatementKind_Switch: {
+            for (u64 i = 0; i < DynamicArrayLength(statement->Switch.Cases); i++) {
+                if (Complete_FallsThrough(statement->Switch.Cases[i].Body)) {
+                    return TRUE;
+                }
+            }
+            return !statement->Switch.Else || Complete_FallsThrough(statement->Switch.Else);
+        } break;
+
+        default: {
+            return TRUE;
+        } break;
+    }
+}
+
+void Complete_ProcedureBody(AstProcedure* procedure) {
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Body->Statements); i++) {
+        Complete_Statement(procedure->Body->Statements[i], procedure->Body);
+    }
+
+    if (procedure->ReturnType && procedure->ReturnType->Kind != AstTypeKind_Void && Complete_ScopeFallsThrough(procedure->Body)) {
+        Error("'%s' can reach the end of its body without returning a value", procedure->Name);
+    }
+    procedure->Checked = TRUE;
+}
+
+// Polymorphism
+//
+// Every set of types a polymorphic procedure or struct is used with gets its own copy of the tree, checked and lowered
+// like any other. Copies are cached on the polymorph by their types, so each set of types is only instantiated once.
+
+#define Complete_MaxInstanceDepth 64
+
+u64 Complete_InstanceDepth = 0; // Instances being checked, checking one can instantiate others
+
+// Binds each '$T' in pattern to the part of type in the same place, types is parallel to parameters. Parts that do not
+// line up are left for Complete_Convert to report once the instance is checked. The types of untyped constants only
+// bind parameters that nothing else did, so 'max(x, 1)' takes the type of x.
+void Polymorph_Match(AstType* pattern, AstType* type, b8 untyped, Token* parameters, AstType** types, AstScope* scope) {
+    switch (pattern->Kind) {
+        case AstTypeKind_Unknown: {
+            const char* name = pattern->Unknown.Name.Name;
+            if (pattern->Unknown.Polymorphic) {
+                u64 index = 0;
+                while (strcmp(parameters[index].Name, name) != 0) {
+                    index++;
+                }
+
+                if (!types[index]) {
+                    types[index] = type;
+                } else if (!untyped && !Type_Equal(types[index], type)) {
+                    Error("'$%s' cannot be both '%s' and '%s'", name, Type_Name(types[index]), Type_Name(type));
+                }
+            } else if (pattern->Unknown.TypeArguments && type->Kind == AstTypeKind_Struct && type->Struct.Polymorph) {
+                AstStatement* statement = FindDeclaration(name, scope, NULL);
+                AstExpression* value = statement ? statement->Declaration.Value : NULL;
+                if (value && value->Kind == AstExpressionKind_Struct && &value->Struct == type->Struct.Polymorph) {
+                    for (u64 i = 0; i < DynamicArrayLength(pattern->Unknown.TypeArguments); i++) {
+                        Polymorph_Match(pattern->Unknown.TypeArguments[i], type->Struct.TypeArguments[i], untyped, parameters, types, scope);
+                    }
+                }
+            }
+        } break;
+
+        case AstTypeKind_Pointer: {
+            if (type->Kind == AstTypeKind_Pointer && type != &Type_Null) {
+                Polymorph_Match(pattern->Pointer.PointerTo, type->Pointer.PointerTo, untyped, parameters, types, scope);
+            }
+        } break;
+
+        case AstTypeKind_Array:
+        case AstTypeKind_Vector: {
+            if (type->Kind == pattern->Kind && type->Array.Dynamic == pattern->Array.Dynamic && type->Array.Soa == pattern->Array.Soa) {
+                Polymorph_Match(pattern->Array.ArrayOf, type->Array.ArrayOf, untyped, parameters, types, scope);
+            }
+        } break;
+
+        default: {
+        } break;
+    }
+}
+
+// A scope with a constant for every type parameter, instances are checked inside it so their types can be named
+AstScope* Polymorph_Scope(Token* parameters, AstType** types, AstScope* parentScope) {
+    AstScope* scope = Allocate(sizeof(AstScope));
+    scope->Parent = parentScope;
+    scope->Statements = DynamicArrayCreate(AstStatement*);
+
+    for (u64 i = 0; i < DynamicArrayLength(parameters); i++) {
+        AstExpression* value = Allocate(sizeof(AstExpression));
+        value->Kind = AstExpressionKind_Name;
+        value->Name.Name = parameters[i];
+        value->Type = &Type_Type;
+        value->Constant = TRUE;
+        value->TypeValue = types[i];
+
+        AstStatement* statement = Allocate(sizeof(AstStatement));
+        statement->Kind = AstStatementKind_Declaration;
+        statement->Declaration.Name = parameters[i];
+        statement->Declaration.Type = &Type_Type;
+        statement->Declaration.Value = value;
+        statement->Declaration.Constant = TRUE;
+        statement->Declaration.Completion = AstTypeCompletion_Complete;
+        DynamicArrayPush(scope->Statements, statement);
+    }
+    return scope;
+}
+
+// Instances are named after what they were instantiated with, 'max(s64)'
+const char* Polymorph_Name(const char* name, AstType** types, u64 count) {
+    char* buffer = DynamicArrayCreate(char);
+    Type_AppendString(&buffer, name);
+    Type_AppendString(&buffer, "(");
+    for (u64 i = 0; i < count; i++) {
+        if (i > 0) {
+            Type_AppendString(&buffer, ", ");
+        }
+        Type_Format(types[i], &buffer);
+    }
+    Type_AppendString(&buffer, ")");
+    DynamicArrayPush(buffer, '\0');
+
+    char* result = Allocate(DynamicArraySize(buffer));
+    memcpy(result, buffer, DynamicArraySize(buffer));
+    DynamicArrayDestroy(buffer);
+    return result;
+}
+
+// The instance made earlier for the same types, or NULL
+AstExpression* Polymorph_Find(AstPolymorph* instances, AstType** types, u64 count, u64 hash) {
+    for (u64 i = 0; i < DynamicArrayLength(instances); i++) {
+        if (instances[i].Hash != hash) {
+            continue;
+        }
+
+        b8 equal = TRUE;
+        for (u64 j = 0; j < count && equal; j++) {
+            equal = Type_Equal(instances[i].Types[j], types[j]);
+        }
+        if (equal) {
+            return instances[i].Instance;
+        }
+    }
+    return NULL;
+}
+
+u64 Polymorph_Hash(AstType** types, u64 count) {
+    u64 hash = Hash_Initial;
+    for (u64 i = 0; i < count; i++) {
+        hash = Type_Hash(hash, types[i]);
+    }
+    return hash;
+}
+
+void Polymorph_EnterInstance(const char* name) {
+    if (Complete_InstanceDepth >= Complete_MaxInstanceDepth) {
+        Error("Instances of '%s' nest too deeply, it may instantiate itself with ever larger types", name);
+    }
+    Complete_InstanceDepth++;
+}
+
+AstProcedure* Complete_InstantiateProcedure(AstProcedure* polymorph, AstType** types) {
+    u64 count = DynamicArrayLength(polymorph->TypeParameters);
+    u64 hash = Polymorph_Hash(types, count);
+    AstExpression* existing = Polymorph_Find(polymorph->Instances, types, count, hash);
+    if (existing) {
+        free(types);
+        return &existing->Procedure;
+    }
+
+    AstScope* scope = Polymorph_Scope(polymorph->TypeParameters, types, polymorph->Body->Parent);
+    AstExpression* instance = Ast_CloneExpression(&(AstExpression){
+        .Kind = AstExpressionKind_Procedure,
+        .Procedure = *polymorph,
+    }, scope);
+    instance->Procedure.Name = Polymorph_Name(polymorph->Name, types, count);
+    instance->Procedure.TypeParameters = NULL;
+    instance->Procedure.Instances = NULL;
+
+    // Added before checking, so recursive calls find the instance they are in
+    DynamicArrayPush(polymorph->Instances, ((AstPolymorph){ .Types = types, .Hash = hash, .Instance = instance }));
+
+    Polymorph_EnterInstance(polymorph->Name);
+    Complete_Expression(instance, scope);
+    Complete_ProcedureBody(&instance->Procedure);
+    Complete_InstanceDepth--;
+    return &instance->Procedure;
+}
+
+AstType* Complete_InstantiateStruct(AstExpression* polymorph, AstType** types, AstScope* parentScope) {
+    AstStruct* struct_ = &polymorph->Struct;
+    u64 count = DynamicArrayLength(struct_->TypeParameters);
+    u64 hash = Polymorph_Hash(types, count);
+    AstExpression* existing = Polymorph_Find(struct_->Instances, types, count, hash);
+    if (existing) {
+        free(types);
+        return existing->TypeValue;
+    }
+
+    AstScope* scope = Polymorph_Scope(struct_->TypeParameters, types, parentScope);
+    AstExpression* instance = Ast_CloneExpression(polymorph, scope);
+    instance->Struct.Name = Polymorph_Name(struct_->Name, types, count);
+    instance->Struct.TypeParameters = NULL;
+    instance->Struct.Instances = NULL;
+    instance->Struct.Polymorph = struct_;
+    instance->Struct.TypeArguments = types;
+
+    // Added before checking, so fields can point at the instance they are in
+    DynamicArrayPush(struct_->Instances, ((AstPolymorph){ .Types = types, .Hash = hash, .Instance = instance }));
+
+    Polymorph_EnterInstance(struct_->Name);
+    Complete_Expression(instance, scope);
+    Complete_InstanceDepth--;
+    return instance->TypeValue;
+}
+
+// Decides the type parameters of polymorph from the completed arguments of a call
+AstProcedure* Complete_InstantiateCall(AstProcedure* polymorph, AstExpression** arguments) {
+    Token* parameters = polymorph->TypeParameters;
+    u64 count = DynamicArrayLength(parameters);
+    AstType** types = Allocate(count * sizeof(AstType*));
+
+    for (u64 pass = 0; pass < 2; pass++) {
+        for (u64 i = 0; i < DynamicArrayLength(arguments); i++) {
+            AstType* type = arguments[i]->Type;
+            b8 untyped = Type_IsUntyped(type) || type == &Type_Null;
+            if (untyped == (pass == 1) && type != &Type_Null) {
+                Polymorph_Match(polymorph->Arguments[i].Type, Type_Default(type), untyped, parameters, types, polymorph->Body->Parent);
+            }
+        }
+    }
+
+    for (u64 i = 0; i < count; i++) {
+        if (!types[i]) {
+            Error("Cannot infer '$%s' of '%s' from the arguments", parameters[i].Name, polymorph->Name);
+        }
+    }
+    return Complete_InstantiateProcedure(polymorph, types);
+}
+
+void Complete_Declaration(AstDeclaration* declaration, AstScope* parentScope) {
+    if (declaration->Completion == AstTypeCompletion_Complete) {
+        return;
+    } else if (declaration->Completion == AstTypeCompletion_Completing) {
+        Error("Cyclic dependency detected!");
+        return;
+    }
+
+    declaration->Completion = AstTypeCompletion_Completing;
+
+    const char* name = declaration->Name.Name;
+    if (declaration->Type) {
+        declaration->Type = Complete_Type(declaration->Type, parentScope);
+    }
+
+    AstExpression* value = declaration->Value;
+    if (value) {
+        if (value->Kind == AstExpressionKind_Procedure) {
+            AstProcedure* enclosing = Scope_GetProcedure(parentScope);
+            if (enclosing && enclosing->Name) {
+                char* qualifiedName = Allocate(strlen(enclosing->Name) + strlen(name) + 2);
+                sprintf(qualifiedName, "%s.%s", enclosing->Name, name);
+                value->Procedure.Name = qualifiedName;
+            } else {
+                value->Procedure.Name = name;
+            }
+        } else if (value->Kind == AstExpressionKind_Struct) {
+            value->Struct.Name = name;
+        }
+
+        Complete_Expression(value, parentScope);
+
+        if (declaration->Constant && !value->Constant) {
+            Error("Constant '%s' must have a constant value", name);
+        }
+
+        if (declaration->Type) {
+            Complete_Convert(value, declaration->Type);
+        } else if (declaration->Constant) {
+            declaration->Type = value->Type;
+        } else {
+            declaration->Type = Type_Default(value->Type);
+            Complete_Convert(value, declaration->Type);
+        }
+    }
+
+    declaration->Completion = AstTypeCompletion_Complete;
+
+    if (value && value->Kind == AstExpressionKind_Procedure && !Ast_IsPolymorphic(value)) {
+        Complete_ProcedureBody(&value->Procedure);
+    }
+}
+
+void Complete_Statement(AstStatement* statement, AstScope* parentScope) {
+    switch (statement->Kind) {
+        case AstStatementKind_Expression: {
+            Complete_Expression(&statement->Expression, parentScope);
+        } break;
+
+        case AstStatementKind_Scope: {
+            for (u64 i = 0; i < DynamicArrayLength(statement->Scope.Statements); i++) {
+                Complete_Statement(statement->Scope.Statements[i], &statement->Scope);
+            }
+        } break;
+
+        case AstStatementKind_Declaration: {
+            Complete_Declaration(&statement->Declaration, parentScope);
+        } break;
+
+        case AstStatementKind_Assignment: {
+            AstExpression* operand = statement->Assignment.Operand;
+            AstExpression* value = statement->Assignment.Value;
+            Complete_Expression(operand, parentScope);
+            Complete_Expression(value, parentScope);
+
+            if (!operand->IsLValue) {
+                Error("Cannot assign to this expression");
+            }
+
+            TokenKind operator = statement->Assignment.Operator.Kind;
+            b8 lanewise = operand->Type->Kind == AstTypeKind_Vector && operator != TokenKind_PercentEquals;
+            if (operator != TokenKind_Equals && !Type_IsNumeric(operand->Type) && !lanewise) {
+                Error("Operator '%s' cannot be used on '%s'", TokenKindNames[operator], Type_Name(operand->Type));
+            }
+
+            Complete_Convert(value, operand->Type);
+        } break;
+
+        case AstStatementKind_Return: {
+            AstProcedure* procedure = Scope_GetProcedure(parentScope);
+            if (!procedure) {
+                Error("Cannot return outside of a procedure");
+                return;
+            }
+
+            AstType* returnType = procedure->ReturnType ? procedure->ReturnType : &Type_Void;
+            if (statement->Return.Expression) {
+                Complete_Expression(statement->Return.Expression, parentScope);
+                Complete_Convert(statement->Return.Expression, returnType);
+            } else if (returnType->Kind != AstTypeKind_Void) {
+                Error("Expected a return value");
+            }
+        } break;
+
+        case AstStatementKind_If: {
+            // 'else if' chains are completed in a loop
+            while (TRUE) {
+                Complete_Expression(statement->If.Condition, parentScope);
+                Complete_Convert(statement->If.Condition, &Type_Bool);
+                Complete_Statement(statement->If.Then, parentScope);
+                statement = statement->If.Else;
+                if (!statement || statement->Kind != AstStatementKind_If) {
+                    break;
+                }
+            }
+            if (statement) {
+                Complete_Statement(statement, parentScope);
+            }
+        } break;
+
+        case AstStatementKind_While: {
+            Complete_Expression(statement->While.Condition, parentScope);
+            Complete_Convert(statement->While.Condition, &Type_Bool);
+            Complete_Statement(statement->While.Body, parentScope);
+        } break;
+
+        case AstStatementKind_For: {
+            AstDeclaration* variable = &statement->For.Variable->Declaration;
+            AstExpression* start = variable->Value;
+            AstExpression* end = statement->For.End;
+
+            // Both bounds decide the type of the variable, so it is completed here instead of by Complete_Declaration
+            variable->Completion = AstTypeCompletion_Completing;
+            Complete_Expression(start, parentScope);
+            Complete_Expression(end, parentScope);
+
+            AstType* type = Type_Default(Complete_Unify(start, end));
+            if (type->Kind != AstTypeKind_Integer) {
+                Error("Range bounds must be integers, got '%s'", Type_Name(type));
+            }
+            Complete_Convert(start, type);
+            Complete_Convert(end, type);
+
+            variable->Type = type;
+            variable->Completion = AstTypeCompletion_Complete;
+
+            AstScope* body = statement->For.Body;
+            for (u64 i = 0; i < DynamicArrayLength(body->Statements); i++) {
+                Complete_Statement(body->Statements[i], body);
+            }
+        } break;
+
+        case AstStatementKind_Switch: {
+            AstSwitch* switch_ = &statement->Switch;
+            Complete_Expression(switch_->Value, parentScope);
+            AstType* type = Type_Default(switch_->Value->Type);
+            if (type->Kind != AstTypeKind_Integer && type->Kind != AstTypeKind_String) {
+                Error("Cannot switch on '%s', only on integers and strings", Type_Name(type));
+            }
+            Complete_Convert(switch_->Value, type);
+
+            AstExpression** seen = DynamicArrayCreate(AstExpression*);
+            for (u64 i = 0; i < DynamicArrayLength(switch_->Cases); i++) {
+                AstCase* case_ = &switch_->Cases[i];
+                for (u64 j = 0; j < DynamicArrayLength(case_->Values); j++) {
+                    AstExpression* value = case_->Values[j];
+                    Complete_Expression(value, parentScope);
+                    Complete_Convert(value, type);
+
+                    if (type->Kind == AstTypeKind_String) {
+                        Token* string = Evaluate_String(value);
+                        if (!string) {
+                            Error("String cases must be literals or constants declared as one");
+                        }
+                        for (u64 k = 0; k < DynamicArrayLength(seen); k++) {
+                            Token* other = Evaluate_String(seen[k]);
+                            if (other->StringLength == string->StringLength && memcmp(other->String, string->String, string->StringLength) == 0) {
+                                Error("Case \"%.*s\" is already handled by an earlier case", cast(int) string->StringLength, string->String);
+                            }
+                        }
+                    } else {
+                        if (!value->Constant) {
+                            Error("Case values must be constant integers");
+                        }
+                        u64 integer = Evaluate_Wrap(type, Evaluate_Integer(value));
+                        for (u64 k = 0; k < DynamicArrayLength(seen); k++) {
+                            if (Evaluate_Wrap(type, Evaluate_Integer(seen[k])) == integer) {
+                                Error("Case %lld is already handled by an earlier case", cast(s64) integer);
+                            }
+                        }
+                    }
+                    DynamicArrayPush(seen, value);
+                }
+                Complete_Statement(case_->Body, parentScope);
+            }
+            DynamicArrayDestroy(seen);
+
+            if (switch_->Else) {
+                Complete_Statement(switch_->Else, parentScope);
+            }
+        } break;
+
+        default: {
+            ASSERT(FALSE);
+        } break;
+    }
+}
+
+void Complete_Expression(AstExpression* expression, AstScope* parentScope) {
+    if (!expression->Type) {
+        expression->Type = Allocate(sizeof(AstType));
+    } else if (expression->Type->Completion == AstTypeCompletion_Complete) {
+        return;
+    } else if (expression->Type->Completion == AstTypeCompletion_Completing) {
+        Error("Cyclic dependency detected!");
+        return;
+    }
+
+    AstType* placeholder = expression->Type;
+    placeholder->Completion = AstTypeCompletion_Completing;
+
+    switch (expression->Kind) {
+        case AstExpressionKind_Literal: {
+            expression->Constant = TRUE;
+            switch (expression->Literal.Token.Kind) {
+                case TokenKind_Integer: {
+                    expression->Type->Kind = AstTypeKind_Integer;
+                    expression->Type->Size = 0;
+                    expression->Type->Signed = TRUE;
+                } break;
+
+                case TokenKind_Float: {
+                    expression->Type->Kind = AstTypeKind_Float;
+                    expression->Type->Size = 0;
+                } break;
+
+                case TokenKind_String: {
+                    expression->Type = &Type_String;
+                } break;
+
+                default: {
+                    ASSERT(FALSE);
+                } break;
+            }
+        } break;
+
+        case AstExpressionKind_True:
+        case AstExpressionKind_False: {
+            expression->Constant = TRUE;
+            expression->Type = &Type_Bool;
+        } break;
+
+        case AstExpressionKind_Null: {
+            expression->Constant = TRUE;
+            expression->Type = &Type_Null;
+        } break;
+
+        case AstExpressionKind_Name: {
+            const char* name = expression->Name.Name.Name;
+
+            AstScope* foundScope = NULL;
+            AstStatement* statement = FindDeclaration(name, parentScope, &foundScope);
+            if (!statement) {
+                AstType* builtin = FindBuiltinType(name);
+                if (builtin) {
+                    expression->Constant = TRUE;
+                    expression->Type = &Type_Type;
+                    expression->TypeValue = builtin;
+                    break;
+                }
+
+                expression->Type->Completion = AstTypeCompletion_Incomplete;
+                Error("Unable to find '%s'", name);
+                return;
+            }
+            Complete_Statement(statement, foundScope);
+
+            AstDeclaration* declaration = &statement->Declaration;
+            AstProcedure* procedure = Scope_GetProcedure(parentScope);
+            if (!declaration->Constant) {
+                AstProcedure* owner = Scope_GetProcedure(foundScope);
+                if (owner != procedure) {
+                    if (!owner) {
+                        Error("Referencing the global variable '%s' is not supported yet", name);
+                    }
+
+                    // Captured variables live in memory so the environment can point at them
+                    declaration->AddressTaken = TRUE;
+                    Scope_Capture(procedure, (AstCapture){ .Declaration = declaration, .Owner = owner });
+                }
+            } else if (declaration->Value && declaration->Value->Kind == AstExpressionKind_Procedure) {
+                // Calling a procedure means passing on what it captures. A body that is still being completed, through
+                // mutual recursion, may capture more later, Lower_Environment reports that.
+                AstProcedure* callee = &declaration->Value->Procedure;
+                for (u64 i = 0; i < DynamicArrayLength(callee->Captures); i++) {
+                    Scope_Capture(procedure, callee->Captures[i]);
+                }
+            }
+
+            if (declaration->Value && declaration->Value->Kind == AstExpressionKind_Struct && Ast_IsPolymorphic(declaration->Value)) {
+                Error("'%s' is polymorphic, only its instances are types", name);
+            }
+
+            expression->Name.Declaration = declaration;
+            expression->Type = declaration->Type;
+            expression->IsLValue = !declaration->Constant;
+            expression->Constant = declaration->Constant;
+            if (declaration->Value && declaration->Value->Type->Kind == AstTypeKind_Type) {
+                expression->TypeValue = declaration->Value->TypeValue;
+            }
+        } break;
+
+        case AstExpressionKind_Unary: {
+            AstExpression* operand = expression->Unary.Operand;
+            Complete_Expression(operand, parentScope);
+
+            switch (expression->Unary.Operator.Kind) {
+                case TokenKind_Plus:
+                case TokenKind_Minus: {
+                    if (!Type_IsNumeric(operand->Type) && operand->Type->Kind != AstTypeKind_Vector) {
+                        Error("Operator '%s' cannot be used on '%s'", TokenKindNames[expression->Unary.Operator.Kind], Type_Name(operand->Type));
+                    }
+                    expression->Type = operand->Type;
+                    expression->Constant = operand->Constant;
+                } break;
+
+                case TokenKind_ExclamationMark: {
+                    Complete_Convert(operand, &Type_Bool);
+                    expression->Type = &Type_Bool;
+                    expression->Constant = operand->Constant;
+                } break;
+
+                case TokenKind_Caret: {
+                    if (!operand->IsLValue) {
+                        Error("Cannot take the address of this expression");
+                    } else if (Ast_IsSoaElement(operand)) {
+                        Error("Elements of '%s' are split across its columns, only the address of one of their fields can be taken", Type_Name(operand->Index.Operand->Type));
+                    }
+                    // Vectors are kept in registers unless the address of one of their lanes is taken too
+                    AstExpression* variable = operand;
+                    while (variable->Kind == AstExpressionKind_Index && variable->Index.Operand->Type->Kind == AstTypeKind_Vector) {
+                        variable = variable->Index.Operand;
+                    }
+                    if (variable->Kind == AstExpressionKind_Name) {
+                        variable->Name.Declaration->AddressTaken = TRUE;
+                    }
+
+                    AstType* type = Allocate(sizeof(AstType));
+                    type->Kind = AstTypeKind_Pointer;
+                    type->Completion = AstTypeCompletion_Complete;
+                    type->Size = sizeof(void*);
+                    type->Pointer.PointerTo = operand->Type;
+                    expression->Type = type;
+                } break;
+
+                case TokenKind_Asterisk: {
+                    if (operand->Type->Kind != AstTypeKind_Pointer || operand->Type == &Type_Null) {
+                        Error("Cannot dereference '%s'", Type_Name(operand->Type));
+                    }
+                    expression->Type = operand->Type->Pointer.PointerTo;
+                    expression->IsLValue = TRUE;
+                } break;
+
+                default: {
+                    ASSERT(FALSE);
+                } break;
+            }
+        } break;
+
+        case AstExpressionKind_Binary: {
+            // Binary chains nest to the left, the binary left operands are completed first from the bottom up so
+            // completing each of them finds its own left operand done
+            AstExpression** chain = DynamicArrayCreate(AstExpression*);
+            for (AstExpression* left = expression->Binary.Left; left->Kind == AstExpressionKind_Binary && !left->Type; left = left->Binary.Left) {
+                DynamicArrayPush(chain, left);
+            }
+            for (u64 i = DynamicArrayLength(chain); i > 0; i--) {
+                Complete_Expression(chain[i - 1], parentScope);
+            }
+            DynamicArrayDestroy(chain);
+
+            AstExpression* left = expression->Binary.Left;
+            AstExpression* right = expression->Binary.Right;
+            Complete_Expression(left, parentScope);
+            Complete_Expression(right, parentScope);
+
+            TokenKind operator = expression->Binary.Operator.Kind;
+            switch (operator) {
+                case TokenKind_Plus:
+                case TokenKind_Minus:
+                case TokenKind_Asterisk:
+                case TokenKind_Slash: {
+                    expression->Type = Complete_Unify(left, right);
+                    if (!Type_IsNumeric(expression->Type) && expression->Type->Kind != AstTypeKind_Vector) {
+                        Error("Operator '%s' cannot be used on '%s'", TokenKindNames[operator], Type_Name(expression->Type));
+                    }
+                } break;
+
+                case TokenKind_Percent:
+                case TokenKind_Ampersand:
+                case TokenKind_Pipe: {
+                    expression->Type = Complete_Unify(left, right);
+                    AstType* type = expression->Type;
+                    if (type->Kind == AstTypeKind_Vector && operator != TokenKind_Percent) { // Bitwise on integer lanes
+                        type = type->Array.ArrayOf;
+                    }
+                    if (type->Kind != AstTypeKind_Integer) {
+                        Error("Operator '%s' cannot be used on '%s'", TokenKindNames[operator], Type_Name(expression->Type));
+                    }
+                } break;
+
+                case TokenKind_EqualsEquals:
+                case TokenKind_ExclamationMarkEquals: {
+                    AstType* type = Complete_Unify(left, right);
+                    if (type->Kind == AstTypeKind_Vector) {
+                        Error("Operator '%s' cannot be used on '%s', compare its lanes instead", TokenKindNames[operator], Type_Name(type));
+                    }
+                    expression->Type = &Type_Bool;
+                } break;
+
+                case TokenKind_Less:
+                case TokenKind_LessEquals:
+                case TokenKind_Greater:
+                case TokenKind_GreaterEquals: {
+                    AstType* type = Complete_Unify(left, right);
+                    if (!Type_IsNumeric(type)) {
+                        Error("Operator '%s' cannot be used on '%s'", TokenKindNames[operator], Type_Name(type));
+                    }
+                    expression->Type = &Type_Bool;
+                } break;
+
+                case TokenKind_AmpersandAmpersand:
+                case TokenKind_PipePipe: {
+                    Complete_Convert(left, &Type_Bool);
+                    Complete_Convert(right, &Type_Bool);
+                    expression->Type = &Type_Bool;
+                } break;
+
+                default: {
+                    ASSERT(FALSE);
+                } break;
+            }
+
+            expression->Constant = left->Constant && right->Constant;
+        } break;
+
+        case AstExpressionKind_Field: {
+            AstExpression* operand = expression->Field.Expression;
+            Complete_Expression(operand, parentScope);
+
+            AstType* type = operand->Type;
+            b8 isLValue = operand->IsLValue;
+            if (type->Kind == AstTypeKind_Pointer) {
+                type = type->Pointer.PointerTo;
+                isLValue = TRUE;
+            }
+
+            const char* name = expression->Field.Name.Name;
+            if (type->Kind == AstTypeKind_Array && type->Array.Dynamic) {
+                u64 field = 0;
+                while (field < ArrayField_Count && !MatchStrings(ArrayFieldNames[field], name)) {
+                    field++;
+                }
+                if (field == ArrayField_Count) {
+                    Error("'%s' has no field '%s'", Type_Name(type), name);
+                    return;
+                }
+
+                if (field >= ArrayField_Push) {
+                    if (!expression->Field.Called) {
+                        Error("'%s' of '%s' can only be called", name, Type_Name(type));
+                    } else if (!isLValue) {
+                        Error("Cannot call '%s' on a '%s' that cannot be assigned", name, Type_Name(type));
+                    }
+                }
+
+                expression->Field.Index = field;
+                expression->Type = Type_ArrayField(type, field);
+                expression->IsLValue = isLValue && field < ArrayField_Push;
+                break;
+            }
+
+            if (type->Kind == AstTypeKind_Vector) {
+                u64 method = 0;
+                while (method < VectorMethod_Count && !MatchStrings(VectorMethodNames[method], name)) {
+                    method++;
+                }
+                if (method == VectorMethod_Count) {
+                    Error("'%s' has no method '%s', its lanes are indexed like 'v[0]'", Type_Name(type), name);
+                    return;
+                } else if (!expression->Field.Called) {
+                    Error("'%s' of '%s' can only be called", name, Type_Name(type));
+                }
+
+                expression->Field.Index = method;
+                expression->Type = Type_VectorMethod(type, method);
+                break;
+            }
+
+            if (type->Kind == AstTypeKind_String) {
+                if (MatchStrings(name, ArrayFieldNames[ArrayField_Data])) {
+                    expression->Field.Index = ArrayField_Data;
+                    expression->Type = Type_PointerTo(&Type_U8);
+                } else if (MatchStrings(name, ArrayFieldNames[ArrayField_Length])) {
+                    expression->Field.Index = ArrayField_Length;
+                    expression->Type = &Type_Usize;
+                } else {
+                    Error("'%s' has no field '%s'", Type_Name(type), name);
+                    return;
+                }
+                expression->IsLValue = FALSE; // The slice points at read only data
+                break;
+            }
+
+            if (type->Kind != AstTypeKind_Struct) {
+                Error("Cannot access field '%s' of '%s'", name, Type_Name(type));
+                return;
+            }
+
+            AstDeclaration* declarations = type->Struct.Declarations;
+            u64 index = 0;
+            while (index < DynamicArrayLength(declarations) && !MatchStrings(declarations[index].Name.Name, name)) {
+                index++;
+            }
+            if (index == DynamicArrayLength(declarations)) {
+                Error("'%s' has no field '%s'", Type_Name(type), name);
+                return;
+            }
+
+            expression->Field.Index = index;
+            expression->Type = declarations[index].Type;
+            expression->IsLValue = isLValue;
+        } break;
+
+        case AstExpressionKind_Struct: {
+            if (Ast_IsPolymorphic(expression)) { // Its fields are checked by each instance, see Complete_InstantiateStruct
+                expression->Type = &Type_Type;
+                expression->Constant = TRUE;
+                break;
+            }
+
+            AstType* type = Allocate(sizeof(AstType));
+            type->Kind = AstTypeKind_Struct;
+            type->Completion = AstTypeCompletion_Completing;
+            type->Struct = expression->Struct;
+            expression->TypeValue = type;
+
+            for (u64 i = 0; i < DynamicArrayLength(expression->Struct.Declarations); i++) {
+                AstDeclaration* field = &expression->Struct.Declarations[i];
+                if (!field->Type) {
+                    Error("Field '%s' must have a type", field->Name.Name);
+                    return;
+                }
+
+                field->Type = Complete_Type(field->Type, parentScope);
+                field->Completion = AstTypeCompletion_Complete;
+                if (Type_ContainsIncomplete(field->Type)) {
+                    Error("Field '%s' makes '%s' contain itself", field->Name.Name, Type_Name(type));
+                }
+            }
+
+            Layout_Struct(type);
+            type->Completion = AstTypeCompletion_Complete;
+            expression->Type = &Type_Type;
+            expression->Constant = TRUE;
+        } break;
+
+        case AstExpressionKind_Procedure: {
+            // Polymorphic procedures keep their types as written, each call checks an instance of its own
+            AstProcedure* procedure = &expression->Procedure;
+            b8 polymorphic = Ast_IsPolymorphic(expression);
+            for (u64 i = 0; i < DynamicArrayLength(procedure->Arguments) && !polymorphic; i++) {
+                AstProcedureArgument* argument = &procedure->Arguments[i];
+                argument->Type = Complete_Type(argument->Type, parentScope);
+                argument->Declaration->Declaration.Type = argument->Type;
+                argument->Declaration->Declaration.Completion = AstTypeCompletion_Complete;
+            }
+            if (procedure->ReturnType && !polymorphic) {
+                procedure->ReturnType = Complete_Type(procedure->ReturnType, parentScope);
+            }
+
+            AstType* type = Allocate(sizeof(AstType));
+            type->Kind = AstTypeKind_Procedure;
+            type->Completion = AstTypeCompletion_Complete;
+            type->Size = sizeof(void*);
+            type->Procedure.Arguments = procedure->Arguments;
+            type->Procedure.ReturnType = procedure->ReturnType;
+            type->Procedure.Polymorph = polymorphic ? procedure : NULL;
+            expression->Type = type;
+            expression->Constant = TRUE;
+
+            if (!procedure->Name) { // Declared procedures complete their body once the declaration is complete
+                AstProcedure* enclosing = Scope_GetProcedure(parentScope);
+                if (enclosing && enclosing->Name) {
+                    char* qualifiedName = Allocate(strlen(enclosing->Name) + sizeof(".anonymous"));
+                    sprintf(qualifiedName, "%s.anonymous", enclosing->Name);
+                    procedure->Name = qualifiedName;
+                } else {
+                    procedure->Name = "anonymous";
+                }
+                if (!polymorphic) {
+                    Complete_ProcedureBody(procedure);
+                }
+            }
+        } break;
+
+        case AstExpressionKind_Call: {
+            AstExpression* operand = expression->Call.Operand;
+            if (operand->Kind == AstExpressionKind_Field) {
+                operand->Field.Called = TRUE;
+            }
+            Complete_Expression(operand, parentScope);
+            if (operand->Type->Kind != AstTypeKind_Procedure) {
+                Error("Cannot call '%s'", Type_Name(operand->Type));
+                return;
+            }
+
+            AstProcedureArgument* parameters = operand->Type->Procedure.Arguments;
+            AstExpression** arguments = expression->Call.Arguments;
+            if (DynamicArrayLength(arguments) != DynamicArrayLength(parameters)) {
+                Error("Expected %llu arguments but got %llu", DynamicArrayLength(parameters), DynamicArrayLength(arguments));
+                return;
+            }
+
+            AstType* returnType = operand->Type->Procedure.ReturnType;
+            AstProcedure* polymorph = operand->Type->Procedure.Polymorph;
+            if (polymorph) {
+                for (u64 i = 0; i < DynamicArrayLength(arguments); i++) {
+                    Complete_Expression(arguments[i], parentScope);
+                }
+
+                AstProcedure* instance = Complete_InstantiateCall(polymorph, arguments);
+                expression->Call.Instance = instance;
+                parameters = instance->Arguments;
+                returnType = instance->ReturnType;
+
+                for (u64 i = 0; i < DynamicArrayLength(instance->Captures); i++) {
+                    Scope_Capture(Scope_GetProcedure(parentScope), instance->Captures[i]);
+                }
+            }
+
+            for (u64 i = 0; i < DynamicArrayLength(arguments); i++) {
+                Complete_Expression(arguments[i], parentScope);
+                Complete_Convert(arguments[i], parameters[i].Type);
+            }
+
+            if (Ast_IsVectorMethod(operand) && operand->Field.Index == VectorMethod_Shuffle) {
+                for (u64 i = 0; i < DynamicArrayLength(arguments); i++) {
+                    if (!arguments[i]->Constant) {
+                        Error("The lanes given to 'shuffle' must be constants");
+                    } else if (Evaluate_Integer(arguments[i]) >= DynamicArrayLength(arguments)) {
+                        Error("'shuffle' takes lane %llu of a vector with %llu lanes", Evaluate_Integer(arguments[i]), DynamicArrayLength(arguments));
+                    }
+                }
+            }
+
+            expression->Type = returnType ? returnType : &Type_Void;
+        } break;
+
+        case AstExpressionKind_Index: {
+            AstExpression* operand = expression->Index.Operand;
+            AstExpression* index = expression->Index.Index;
+            Complete_Expression(operand, parentScope);
+            Complete_Expression(index, parentScope);
+
+            if (operand->Type->Kind == AstTypeKind_Vector && !index->Constant) {
+                Error("The lanes of '%s' can only be indexed with constants", Type_Name(operand->Type));
+            } else if (operand->Type->Kind != AstTypeKind_Array && operand->Type->Kind != AstTypeKind_Vector) {
+                Error("Cannot index '%s'", Type_Name(operand->Type));
+                return;
+            }
+
+            if (Type_IsUntyped(index->Type)) {
+                Complete_Convert(index, &Type_Int);
+            } else if (index->Type->Kind != AstTypeKind_Integer) {
+                Error("Index must be an integer, got '%s'", Type_Name(index->Type));
+            }
+
+            AstTypeArray* array = &operand->Type->Array;
+            if (index->Constant && array->Count && !array->Dynamic) {
+                u64 value = Evaluate_Integer(index);
+                if (value >= array->ElementCount) {
+                    Error("Index %lld is out of bounds for '%s'", cast(s64) value, Type_Name(operand->Type));
+                }
+            }
+
+            expression->Type = operand->Type->Array.ArrayOf;
+            expression->IsLValue = operand->IsLValue || array->Dynamic; // Elements of '[..]T' are behind its data pointer
+        } break;
+
+        case AstExpressionKind_Sizeof: {
+            Complete_Expression(expression->SizeOf.Expression, parentScope);
+            expression->Type = &Type_Usize;
+            expression->Constant = TRUE;
+        } break;
+
+        case AstExpressionKind_Cast: {
+            AstType* type = Complete_Type(expression->Cast.Type, parentScope);
+            AstExpression* operand = expression->Cast.Expression;
+            Complete_Expression(operand, parentScope);
+            expression->Cast.Type = type;
+
+            // Vectors cast lane by lane, a scalar is cast to the lane type and broadcast
+            AstType* from = operand->Type;
+            AstType* to = type;
+            if (type->Kind == AstTypeKind_Vector) {
+                if (from->Kind == AstTypeKind_Vector && from->Array.ElementCount == type->Array.ElementCount) {
+                    from = from->Array.ArrayOf;
+                }
+                to = type->Array.ArrayOf;
+            }
+
+            if (Type_IsUntyped(from) && Type_IsNumeric(to)) {
+                Complete_SetUntypedType(operand, from->Kind == AstTypeKind_Float && to->Kind == AstTypeKind_Integer ? &Type_Float : to);
+            } else if (!Type_Equal(from, to) &&
+                       !(Type_IsNumeric(from) && Type_IsNumeric(to)) &&
+                       !(from->Kind == AstTypeKind_Pointer && to->Kind == AstTypeKind_Pointer) &&
+                       !(from->Kind == AstTypeKind_Bool && to->Kind == AstTypeKind_Integer) &&
+                       !(from->Kind == AstTypeKind_Integer && to->Kind == AstTypeKind_Bool)) {
+                Error("Cannot cast '%s' to '%s'", Type_Name(operand->Type), Type_Name(type));
+            }
+
+            expression->Type = type;
+            expression->Constant = operand->Constant;
+        } break;
+
+        case AstExpressionKind_Run: {
+            AstExpression* operand = expression->Run.Expression;
+            Complete_Expression(operand, parentScope);
+
+            AstType* type = Type_Default(operand->Type);
+            if (type->Kind != AstTypeKind_Integer && type->Kind != AstTypeKind_Float && type->Kind != AstTypeKind_Bool) {
+                Error("'#run' must produce an integer, a float or a bool, not '%s'", Type_Name(type));
+                break;
+            }
+            Complete_Convert(operand, type);
+
+            expression->Type = type;
+            expression->Constant = TRUE;
+            expression->Run.Value = Lower_Run(operand);
+        } break;
+
+        default: {
+            ASSERT(FALSE);
+        } break;
+    }
+
+    placeholder->Completion = AstTypeCompletion_Complete;
+}
+
+typedef struct IrBuilder {
+    IrModule* Module;
+    IrProcedure* Procedure;
+    IrBlock* Entry;
+    IrBlock* Block;
+    b8 NoBoundsCheck;
+    AstProcedure* Source;
+    IrInstruction** Captures; // Addresses loaded from the environment, parallel to Source->Captures
+    IrInstruction* Result; // Slot the caller passed for an aggregate result, return copies into it
+    b8 Run; // Lowering the operand of '#run', which has no variables
+} IrBuilder;
+
+IrType Lower_Type(AstType* type) {
+    switch (type->Kind) {
+        case AstTypeKind_Void: {
+            return IrType_Void();
+        } break;
+
+        case AstTypeKind_Bool: {
+            return IrType_Bool();
+        } break;
+
+        case AstTypeKind_Integer: {
+            return IrType_Make(IrTypeKind_Integer, type->Size != 0 ? type->Size : 8, type->Signed);
+        } break;
+
+        case AstTypeKind_Float: {
+            return IrType_Make(IrTypeKind_Float, type->Size != 0 ? type->Size : 8, TRUE);
+        } break;
+
+        case AstTypeKind_Vector: {
+            return IrType_MakeVector(Lower_Type(type->Array.ArrayOf), type->Array.ElementCount);
+        } break;
+
+        default: { // Aggregates are represented by their address
+            return IrType_Pointer();
+        } break;
+    }
+}
+
+b8 Lower_IsInMemory(AstDeclaration* declaration) {
+    return declaration->AddressTaken || Type_IsAggregate(declaration->Type);
+}
+
+IrProcedure* Lower_Procedure(IrModule* module, AstProcedure* procedure);
+IrInstruction* Lower_Expression(IrBuilder* builder, AstExpression* expression);
+void Lower_Statement(IrBuilder* builder, AstStatement* statement);
+IrInstruction* Lower_Address(IrBuilder* builder, AstExpression* expression);
+IrInstruction* Lower_Load(IrBuilder* builder, AstType* type, IrInstruction* address);
+void Lower_Store(IrBuilder* builder, AstType* type, IrInstruction* address, IrInstruction* value);
+
+IrInstruction* Lower_Local(IrBuilder* builder, AstType* type) {
+    IrInstruction* local = IrInstruction_Create(builder->Procedure, IrOp_Local, IrType_Pointer());
+    local->Block = builder->Entry;
+    local->Memory.Size = Type_Size(type);
+    local->Memory.Align = Type_Align(type);
+    DynamicArrayInsert(builder->Entry->Instructions, 0, local);
+    return local;
+}
+
+IrInstruction* Lower_Convert(IrBuilder* builder, IrInstruction* value, IrType type) {
+    if (IrType_Equal(value->Type, type)) {
+        return value;
+    } else if (type.Kind == IrTypeKind_Vector && value->Type.Kind != IrTypeKind_Vector) {
+        return IrBlock_AppendUnary(builder->Block, IrOp_Splat, type, Lower_Convert(builder, value, IrType_Lane(type)));
+    }
+    return IrBlock_AppendUnary(builder->Block, IrOp_Convert, type, value);
+}
+
+// Every lane zero, vectors have no constants of their own
+IrInstruction* Lower_Zero(IrBuilder* builder, IrType type) {
+    if (type.Kind == IrTypeKind_Vector) {
+        return IrBlock_AppendUnary(builder->Block, IrOp_Splat, type, Lower_Zero(builder, IrType_Lane(type)));
+    } else if (type.Kind == IrTypeKind_Float) {
+        return IrBlock_AppendFloat(builder->Block, type, 0.0);
+    }
+    return IrBlock_AppendInteger(builder->Block, type, 0);
+}
+
+IrInstruction* Lower_ArrayField(IrBuilder* builder, IrInstruction* array, ArrayField field) {
+    if (field == ArrayField_Data) {
+        return array;
+    }
+    IrInstruction* offset = IrBlock_AppendInteger(builder->Block, Lower_Type(&Type_Usize), field * sizeof(u64));
+    return IrBlock_AppendBinary(builder->Block, IrOp_Offset, IrType_Pointer(), array, offset);
+}
+
+// Captured variables are reached through the environment, NULL for variables that are not in memory
+IrInstruction* Lower_VariableAddress(IrBuilder* builder, AstDeclaration* declaration) {
+    if (builder->Run) {
+        Error("'#run' cannot use the variable '%s', it only exists once the program runs", declaration->Name.Name);
+    }
+    if (builder->Source) {
+        for (u64 i = 0; i < DynamicArrayLength(builder->Source->Captures); i++) {
+            if (builder->Source->Captures[i].Declaration == declaration) {
+                return builder->Captures[i];
+            }
+        }
+    }
+    return declaration->Address;
+}
+
+// The environment of a procedure that captures is an array of the addresses of its captures in the caller's frame.
+// Its size is known at every call, so it is a local of the caller and never outlives it.
+IrInstruction* Lower_Environment(IrBuilder* builder, AstProcedure* procedure) {
+    u64 count = DynamicArrayLength(procedure->Captures);
+    IrInstruction* environment = IrInstruction_Create(builder->Procedure, IrOp_Local, IrType_Pointer());
+    environment->Block = builder->Entry;
+    environment->Memory.Size = count * sizeof(u64);
+    environment->Memory.Align = sizeof(u64);
+    DynamicArrayInsert(builder->Entry->Instructions, 0, environment);
+
+    for (u64 i = 0; i < count; i++) {
+        AstDeclaration* declaration = procedure->Captures[i].Declaration;
+        IrInstruction* address = Lower_VariableAddress(builder, declaration);
+        if (!address || address->Block->Procedure != builder->Procedure) {
+            Error("'%s' is called where '%s' is not available, captured variables must be declared before the call", procedure->Name, declaration->Name.Name);
+        }
+
+        IrInstruction* slot = environment;
+        if (i > 0) {
+            IrInstruction* offset = IrBlock_AppendInteger(builder->Block, Lower_Type(&Type_Usize), i * sizeof(u64));
+            slot = IrBlock_AppendBinary(builder->Block, IrOp_Offset, IrType_Pointer(), environment, offset);
+        }
+        IrBlock_AppendBinary(builder->Block, IrOp_Store, IrType_Void(), slot, address);
+    }
+    return environment;
+}
+
+IrInstruction* Lower_Offset(IrBuilder* builder, IrInstruction* base, u64 offset) {
+    if (offset == 0) {
+        return base;
+    }
+    IrInstruction* offsetValue = IrBlock_AppendInteger(builder->Block, Lower_Type(&Type_Usize), offset);
+    return IrBlock_AppendBinary(builder->Block, IrOp_Offset, IrType_Pointer(), base, offsetValue);
+}
+
+// The array and index of an element of a '#soa' array are evaluated once, each of its fields is then found in its column
+IrInstruction* Lower_SoaIndex(IrBuilder* builder, AstExpression* element, IrInstruction** base) {
+    AstExpression* operand = element->Index.Operand;
+    *base = Lower_Address(builder, operand);
+    IrInstruction* index = Lower_Convert(builder, Lower_Expression(builder, element->Index.Index), Lower_Type(&Type_Usize));
+    if (!builder->NoBoundsCheck) {
+        IrInstruction* count = IrBlock_AppendInteger(builder->Block, index->Type, operand->Type->Array.ElementCount);
+        IrBlock_AppendBinary(builder->Block, IrOp_BoundsCheck, IrType_Void(), index, count);
+    }
+    return index;
+}
+
+IrInstruction* Lower_SoaField(IrBuilder* builder, AstType* type, IrInstruction* base, IrInstruction* index, u64 field) {
+    AstType* fieldType = type->Array.ArrayOf->Struct.Declarations[field].Type;
+    IrInstruction* stride = IrBlock_AppendInteger(builder->Block, index->Type, Type_Size(fieldType));
+    IrInstruction* offset = IrBlock_AppendBinary(builder->Block, IrOp_Multiply, index->Type, index, stride);
+    return Lower_Offset(builder, IrBlock_AppendBinary(builder->Block, IrOp_Offset, IrType_Pointer(), base, offset), Type_SoaColumn(type, field));
+}
+
+IrInstruction* Lower_Address(IrBuilder* builder, AstExpression* expression) {
+    switch (expression->Kind) {
+        case AstExpressionKind_Name: {
+            IrInstruction* address = Lower_VariableAddress(builder, expression->Name.Declaration);
+            ASSERT(address);
+            return address;
+        } break;
+
+        case AstExpressionKind_Field: {
+            AstExpression* operand = expression->Field.Expression;
+            if (Ast_IsSoaElement(operand)) {
+                IrInstruction* base;
+                IrInstruction* index = Lower_SoaIndex(builder, operand, &base);
+                return Lower_SoaField(builder, operand->Index.Operand->Type, base, index, expression->Field.Index);
+            }
+
+            IrInstruction* base;
+            AstType* type = operand->Type;
+            if (type->Kind == AstTypeKind_Pointer) {
+                base = Lower_Expression(builder, operand);
+                type = type->Pointer.PointerTo;
+            } else {
+                base = Lower_Address(builder, operand);
+            }
+
+            return Lower_Offset(builder, base, Type_FieldOffset(type, expression->Field.Index));
+        } break;
+
+        case AstExpressionKind_Index: {
+            AstExpression* operand = expression->Index.Operand;
+            if (Ast_IsSoaElement(expression)) { // Gathered into a copy, assignments scatter it back themselves
+                IrInstruction* base;
+                IrInstruction* index = Lower_SoaIndex(builder, expression, &base);
+                IrInstruction* element = Lower_Local(builder, expression->Type);
+                AstDeclaration* fields = expression->Type->Struct.Declarations;
+                for (u64 i = 0; i < DynamicArrayLength(fields); i++) {
+                    IrInstruction* field = Lower_Load(builder, fields[i].Type, Lower_SoaField(builder, operand->Type, base, index, i));
+                    Lower_Store(builder, fields[i].Type, Lower_Offset(builder, element, Type_FieldOffset(expression->Type, i)), field);
+                }
+                return element;
+            }
+
+            IrInstruction* base = Lower_Address(builder, operand);
+            if (operand->Type->Kind == AstTypeKind_Vector) { // Lanes are constant and checked already
+                return Lower_Offset(builder, base, Evaluate_Integer(expression->Index.Index) * Type_Size(expression->Type));
+            }
+
+            IrInstruction* index = Lower_Convert(builder, Lower_Expression(builder, expression->Index.Index), Lower_Type(&Type_Usize));
+            AstTypeArray* array = &operand->Type->Array;
+            if (array->Dynamic) {
+                if (!builder->NoBoundsCheck) {
+                    IrInstruction* length = IrBlock_AppendUnary(builder->Block, IrOp_Load, index->Type, Lower_ArrayField(builder, base, ArrayField_Length));
+                    IrBlock_AppendBinary(builder->Block, IrOp_BoundsCheck, IrType_Void(), index, length);
+                }
+                base = IrBlock_AppendUnary(builder->Block, IrOp_Load, IrType_Pointer(), base);
+            } else if (array->Count && !builder->NoBoundsCheck) {
+                IrInstruction* count = IrBlock_AppendInteger(builder->Block, index->Type, array->ElementCount);
+                IrBlock_AppendBinary(builder->Block, IrOp_BoundsCheck, IrType_Void(), index, count);
+            }
+            IrInstruction* stride = IrBlock_AppendInteger(builder->Block, index->Type, Type_Size(operand->Type->Array.ArrayOf));
+            IrInstruction* offset = IrBlock_AppendBinary(builder->Block, IrOp_Multiply, index->Type, index, stride);
+            return IrBlock_AppendBinary(builder->Block, IrOp_Offset, IrType_Pointer(), base, offset);
+        } break;
+
+        case AstExpressionKind_Unary: {
+            ASSERT(expression->Unary.Operator.Kind == TokenKind_Asterisk);
+            return Lower_Expression(builder, expression->Unary.Operand);
+        } break;
+
+        default: { // Aggregates that are not lvalues, like literals and call results, are already addresses
+            ASSERT(Type_IsAggregate(expression->Type));
+            return Lower_Expression(builder, expression);
+        } break;
+    }
+}
+
+IrInstruction* Lower_Load(IrBuilder* builder, AstType* type, IrInstruction* address) {
+    if (Type_IsAggregate(type)) {
+        return address;
+    }
+    return IrBlock_AppendUnary(builder->Block, IrOp_Load, Lower_Type(type), address);
+}
+
+void Lower_Store(IrBuilder* builder, AstType* type, IrInstruction* address, IrInstruction* value) {
+    if (Type_IsAggregate(type)) {
+        IrInstruction* copy = IrBlock_AppendBinary(builder->Block, IrOp_Copy, IrType_Void(), address, value);
+        copy->Memory.Size = Type_Size(type);
+    } else {
+        IrBlock_AppendBinary(builder->Block, IrOp_Store, IrType_Void(), address, Lower_Convert(builder, value, Lower_Type(type)));
+    }
+}
+
+IrInstruction* Lower_ReadVariable(IrBuilder* builder, AstDeclaration* declaration) {
+    IrInstruction* address = Lower_VariableAddress(builder, declaration);
+    if (address) {
+        return Lower_Load(builder, declaration->Type, address);
+    }
+    return IrBlock_ReadVariable(builder->Block, declaration, Lower_Type(declaration->Type));
+}
+
+void Lower_WriteVariable(IrBuilder* builder, AstDeclaration* declaration, IrInstruction* value) {
+    IrInstruction* address = Lower_VariableAddress(builder, declaration);
+    if (address) {
+        Lower_Store(builder, declaration->Type, address, value);
+    } else {
+        IrBlock_WriteVariable(builder->Block, declaration, value);
+    }
+}
+
+// Runtime support for '[..]T'
+//
+// Only growing leaves the procedure, the rest of every method is lowered inline at its call. Growth at least doubles
+// the capacity, like DynamicArray.c, and goes through the array's allocator.
+
+IrProcedure* Lower_Reallocate(IrModule* module) {
+    if (!module->Reallocate) {
+        module->Reallocate = IrProcedure_Create(module, "runtime.reallocate", IrType_Pointer());
+        DynamicArrayPush(module->Reallocate->Parameters, IrType_Pointer());
+        DynamicArrayPush(module->Reallocate->Parameters, Lower_Type(&Type_Usize));
+        DynamicArrayPush(module->Reallocate->Parameters, Lower_Type(&Type_Usize));
+    }
+    return module->Reallocate;
+}
+
+// grow_array(array: ptr, minimum: u64, size: u64) makes room for at least minimum elements of size bytes
+IrProcedure* Lower_GrowArray(IrModule* module) {
+    if (module->GrowArray) {
+        return module->GrowArray;
+    }
+
+    IrType usize = Lower_Type(&Type_Usize);
+    IrProcedure* procedure = IrProcedure_Create(module, "runtime.grow_array", IrType_Void());
+    procedure->NoInline = TRUE;
+    DynamicArrayPush(procedure->Parameters, IrType_Pointer());
+    DynamicArrayPush(procedure->Parameters, usize);
+    DynamicArrayPush(procedure->Parameters, usize);
+    module->GrowArray = procedure;
+
+    IrBuilder builder = {
+        .Module = module,
+        .Procedure = procedure,
+        .Entry = IrBlock_Create(procedure),
+    };
+    builder.Block = builder.Entry;
+    IrBlock_Seal(builder.Entry);
+
+    IrInstruction* parameters[3];
+    for (u64 i = 0; i < 3; i++) {
+        parameters[i] = IrBlock_Append(builder.Entry, IrOp_Parameter, procedure->Parameters[i]);
+        parameters[i]->Index = i;
+    }
+    IrInstruction* array = parameters[0];
+    IrInstruction* minimum = parameters[1];
+    IrInstruction* size = parameters[2];
+
+    // capacity = max(capacity * 2, minimum)
+    IrInstruction* capacityAddress = Lower_ArrayField(&builder, array, ArrayField_Capacity);
+    IrInstruction* capacity = IrBlock_AppendUnary(builder.Block, IrOp_Load, usize, capacityAddress);
+    IrInstruction* doubled = IrBlock_AppendBinary(builder.Block, IrOp_Multiply, usize, capacity, IrBlock_AppendInteger(builder.Block, usize, 2));
+    IrBlock_WriteVariable(builder.Block, &capacity, doubled);
+
+    IrBlock* useMinimum = IrBlock_Create(procedure);
+    IrBlock* allocate = IrBlock_Create(procedure);
+    IrBlock_AppendBranch(builder.Block, IrBlock_AppendBinary(builder.Block, IrOp_Less, IrType_Bool(), doubled, minimum), useMinimum, allocate);
+
+    IrBlock_Seal(useMinimum);
+    IrBlock_WriteVariable(useMinimum, &capacity, minimum);
+    IrBlock_AppendJump(useMinimum, allocate);
+
+    // A null allocator is the default one
+    IrBlock_Seal(allocate);
+    builder.Block = allocate;
+    IrInstruction* newCapacity = IrBlock_ReadVariable(allocate, &capacity, usize);
+    IrInstruction* allocator = IrBlock_AppendUnary(allocate, IrOp_Load, IrType_Pointer(), Lower_ArrayField(&builder, array, ArrayField_Allocator));
+    IrBlock_WriteVariable(allocate, &allocator, allocator);
+
+    IrBlock* useDefault = IrBlock_Create(procedure);
+    IrBlock* call = IrBlock_Create(procedure);
+    IrInstruction* null = IrBlock_AppendInteger(allocate, IrType_Pointer(), 0);
+    IrBlock_AppendBranch(allocate, IrBlock_AppendBinary(allocate, IrOp_Equal, IrType_Bool(), allocator, null), useDefault, call);
+
+    IrBlock_Seal(useDefault);
+    IrInstruction* reallocate = IrBlock_Append(useDefault, IrOp_ProcedureAddress, IrType_Pointer());
+    reallocate->Procedure = Lower_Reallocate(module);
+    IrBlock_WriteVariable(useDefault, &allocator, reallocate);
+    IrBlock_AppendJump(useDefault, call);
+
+    IrBlock_Seal(call);
+    builder.Block = call;
+    IrInstruction* data = IrBlock_AppendUnary(call, IrOp_Load, IrType_Pointer(), array);
+    IrInstruction* oldSize = IrBlock_AppendBinary(call, IrOp_Multiply, usize, capacity, size);
+    IrInstruction* newSize = IrBlock_AppendBinary(call, IrOp_Multiply, usize, newCapacity, size);
+
+    IrInstruction* newData = IrBlock_Append(call, IrOp_Call, IrType_Pointer());
+    DynamicArrayPush(newData->Operands, IrBlock_ReadVariable(call, &allocator, IrType_Pointer()));
+    DynamicArrayPush(newData->Operands, data);
+    DynamicArrayPush(newData->Operands, oldSize);
+    DynamicArrayPush(newData->Operands, newSize);
+
+    IrBlock_AppendBinary(call, IrOp_Store, IrType_Void(), array, newData);
+    IrBlock_AppendBinary(call, IrOp_Store, IrType_Void(), capacityAddress, newCapacity);
+    IrBlock_AppendReturn(call, NULL);
+
+    IrProcedure_ApplyReplacements(procedure);
+    return procedure;
+}
+
+// Calls grow_array when capacity is below minimum
+void Lower_ArrayReserve(IrBuilder* builder, IrInstruction* array, IrInstruction* capacity, IrInstruction* minimum, u64 size) {
+    IrBlock* grow = IrBlock_Create(builder->Procedure);
+    IrBlock* done = IrBlock_Create(builder->Procedure);
+    IrInstruction* full = IrBlock_AppendBinary(builder->Block, IrOp_Less, IrType_Bool(), capacity, minimum);
+    IrBlock_AppendBranch(builder->Block, full, grow, done);
+
+    IrBlock_Seal(grow);
+    IrInstruction* elementSize = IrBlock_AppendInteger(grow, minimum->Type, size);
+    IrInstruction* call = IrBlock_Append(grow, IrOp_Call, IrType_Void());
+    call->Procedure = Lower_GrowArray(builder->Module);
+    DynamicArrayPush(call->Operands, array);
+    DynamicArrayPush(call->Operands, minimum);
+    DynamicArrayPush(call->Operands, elementSize);
+    IrBlock_AppendJump(grow, done);
+
+    IrBlock_Seal(done);
+    builder->Block = done;
+}
+
+// push(value), reserve(capacity) and append(values) on a '[..]T'
+void Lower_ArrayMethod(IrBuilder* builder, AstExpression* expression) {
+    AstField* method = &expression->Call.Operand->Field;
+    AstExpression* argument = expression->Call.Arguments[0];
+
+    IrInstruction* array;
+    AstType* type = method->Expression->Type;
+    if (type->Kind == AstTypeKind_Pointer) {
+        array = Lower_Expression(builder, method->Expression);
+        type = type->Pointer.PointerTo;
+    } else {
+        array = Lower_Address(builder, method->Expression);
+    }
+
+    IrType usize = Lower_Type(&Type_Usize);
+    AstType* element = type->Array.ArrayOf;
+    u64 size = Type_Size(element);
+    IrInstruction* stride = IrBlock_AppendInteger(builder->Block, usize, size);
+
+    IrInstruction* lengthAddress = Lower_ArrayField(builder, array, ArrayField_Length);
+    IrInstruction* length = IrBlock_AppendUnary(builder->Block, IrOp_Load, usize, lengthAddress);
+    IrInstruction* capacity = IrBlock_AppendUnary(builder->Block, IrOp_Load, usize, Lower_ArrayField(builder, array, ArrayField_Capacity));
+
+    switch (method->Index) {
+        case ArrayField_Push: {
+            // Aggregates are copied out first, they may live in the buffer that growing frees
+            IrInstruction* value = Lower_Expression(builder, argument);
+            if (Type_IsAggregate(element)) {
+                IrInstruction* copy = Lower_Local(builder, element);
+                Lower_Store(builder, element, copy, value);
+                value = copy;
+            }
+
+            IrInstruction* next = IrBlock_AppendBinary(builder->Block, IrOp_Add, usize, length, IrBlock_AppendInteger(builder->Block, usize, 1));
+            Lower_ArrayReserve(builder, array, capacity, next, size);
+
+            IrInstruction* data = IrBlock_AppendUnary(builder->Block, IrOp_Load, IrType_Pointer(), array);
+            IrInstruction* offset = IrBlock_AppendBinary(builder->Block, IrOp_Multiply, usize, length, stride);
+            Lower_Store(builder, element, IrBlock_AppendBinary(builder->Block, IrOp_Offset, IrType_Pointer(), data, offset), value);
+            IrBlock_AppendBinary(builder->Block, IrOp_Store, IrType_Void(), lengthAddress, next);
+        } break;
+
+        case ArrayField_Reserve: {
+            IrInstruction* minimum = Lower_Convert(builder, Lower_Expression(builder, argument), usize);
+            Lower_ArrayReserve(builder, array, capacity, minimum, size);
+        } break;
+
+        // Copies element by element, the data of values is loaded after growing in case it is the same array
+        case ArrayField_Append: {
+            IrInstruction* values = Lower_Expression(builder, argument);
+            IrInstruction* count = IrBlock_AppendUnary(builder->Block, IrOp_Load, usize, Lower_ArrayField(builder, values, ArrayField_Length));
+            IrInstruction* total = IrBlock_AppendBinary(builder->Block, IrOp_Add, usize, length, count);
+            Lower_ArrayReserve(builder, array, capacity, total, size);
+
+            IrInstruction* source = IrBlock_AppendUnary(builder->Block, IrOp_Load, IrType_Pointer(), values);
+            IrInstruction* data = IrBlock_AppendUnary(builder->Block, IrOp_Load, IrType_Pointer(), array);
+            IrInstruction* destination = IrBlock_AppendBinary(builder->Block, IrOp_Offset, IrType_Pointer(), data, IrBlock_AppendBinary(builder->Block, IrOp_Multiply, usize, length, stride));
+            IrBlock_WriteVariable(builder->Block, expression, IrBlock_AppendInteger(builder->Block, usize, 0));
+
+            IrBlock* header = IrBlock_Create(builder->Procedure);
+            IrBlock* body = IrBlock_Create(builder->Procedure);
+            IrBlock* exit = IrBlock_Create(builder->Procedure);
+            IrBlock_AppendJump(builder->Block, header);
+
+            IrInstruction* index = IrBlock_ReadVariable(header, expression, usize);
+            IrBlock_AppendBranch(header, IrBlock_AppendBinary(header, IrOp_Less, IrType_Bool(), index, count), body, exit);
+
+            IrBlock_Seal(body);
+            builder->Block = body;
+            IrInstruction* offset = IrBlock_AppendBinary(body, IrOp_Multiply, usize, index, stride);
+            IrInstruction* from = IrBlock_AppendBinary(body, IrOp_Offset, IrType_Pointer(), source, offset);
+            IrInstruction* to = IrBlock_AppendBinary(body, IrOp_Offset, IrType_Pointer(), destination, offset);
+            Lower_Store(builder, element, to, Lower_Load(builder, element, from));
+            IrBlock_WriteVariable(body, expression, IrBlock_AppendBinary(body, IrOp_Add, usize, index, IrBlock_AppendInteger(body, usize, 1)));
+            IrBlock_AppendJump(body, header);
+
+            IrBlock_Seal(header);
+            IrBlock_Seal(exit);
+            builder->Block = exit;
+            IrBlock_AppendBinary(exit, IrOp_Store, IrType_Void(), lengthAddress, total);
+        } break;
+
+        default: {
+            ASSERT(FALSE);
+        } break;
+    }
+}
+
+IrInstruction* Lower_VectorMethod(IrBuilder* builder, AstExpression* expression) {
+    AstField* method = &expression->Call.Operand->Field;
+    IrInstruction* vector = Lower_Expression(builder, method->Expression);
+    AstType* type = method->Expression->Type;
+    if (type->Kind == AstTypeKind_Pointer) {
+        type = type->Pointer.PointerTo;
+        vector = Lower_Load(builder, type, vector);
+    }
+
+    IrType lane = Lower_Type(type->Array.ArrayOf);
+    switch (method->Index) {
+        case VectorMethod_Sum: {
+            return IrBlock_AppendUnary(builder->Block, IrOp_ReduceAdd, lane, vector);
+        } break;
+
+        case VectorMethod_Min: {
+            return IrBlock_AppendUnary(builder->Block, IrOp_ReduceMin, lane, vector);
+        } break;
+
+        case VectorMethod_Max: {
+            return IrBlock_AppendUnary(builder->Block, IrOp_ReduceMax, lane, vector);
+        } break;
+
+        case VectorMethod_Shuffle: {
+            u64 lanes = type->Array.ElementCount;
+            IrInstruction* shuffle = IrBlock_AppendUnary(builder->Block, IrOp_Shuffle, Lower_Type(type), vector);
+            shuffle->Shuffle = Allocate(lanes);
+            for (u64 i = 0; i < lanes; i++) {
+                shuffle->Shuffle[i] = Evaluate_Integer(expression->Call.Arguments[i]);
+            }
+            return shuffle;
+        } break;
+
+        default: {
+            ASSERT(FALSE);
+            return NULL;
+        } break;
+    }
+}
+
+IrOp Lower_BinaryOp(TokenKind kind) {
+    switch (kind) {
+        case TokenKind_Plus: case TokenKind_PlusEquals: return IrOp_Add;
+        case TokenKind_Minus: case TokenKind_MinusEquals: return IrOp_Subtract;
+        case TokenKind_Asterisk: case TokenKind_AsteriskEquals: return IrOp_Multiply;
+        case TokenKind_Slash: case TokenKind_SlashEquals: return IrOp_Divide;
+        case TokenKind_Percent: case TokenKind_PercentEquals: return IrOp_Modulo;
+        case TokenKind_Ampersand: return IrOp_And;
+        case TokenKind_Pipe: return IrOp_Or;
+        case TokenKind_EqualsEquals: return IrOp_Equal;
+        case TokenKind_ExclamationMarkEquals: return IrOp_NotEqual;
+        case TokenKind_Less: return IrOp_Less;
+        case TokenKind_LessEquals: return IrOp_LessEqual;
+        default: {
+            ASSERT(FALSE);
+            return IrOp_None;
+        }
+    }
+}
+
+typedef struct LowerConditionLink {
+    AstExpression* Right;
+    IrBlock* Block; // Where the right operand is tested
+    IrBlock* Then;
+    IrBlock* Else;
+} LowerConditionLink;
+
+b8 Lower_IsShortCircuit(AstExpression* expression) {
+    return expression->Kind == AstExpressionKind_Binary &&
+        (expression->Binary.Operator.Kind == TokenKind_AmpersandAmpersand || expression->Binary.Operator.Kind == TokenKind_PipePipe);
+}
+
+void Lower_Condition(IrBuilder* builder, AstExpression* expression, IrBlock* then, IrBlock* else_) {
+    if (Lower_IsShortCircuit(expression)) {
+        // Chains like 'a && b && c' nest to the left, the targets of each left operand are found walking down the
+        // chain and the operands are then tested from the leftmost one
+        LowerConditionLink* chain = DynamicArrayCreate(LowerConditionLink);
+        while (Lower_IsShortCircuit(expression)) {
+            IrBlock* right = IrBlock_Create(builder->Procedure);
+            DynamicArrayPush(chain, ((LowerConditionLink){ .Right = expression->Binary.Right, .Block = right, .Then = then, .Else = else_ }));
+            if (expression->Binary.Operator.Kind == TokenKind_AmpersandAmpersand) {
+                then = right;
+            } else {
+                else_ = right;
+            }
+            expression = expression->Binary.Left;
+        }
+
+        Lower_Condition(builder, expression, then, else_);
+        for (u64 i = DynamicArrayLength(chain); i > 0; i--) {
+            LowerConditionLink link = chain[i - 1];
+            IrBlock_Seal(link.Block);
+            builder->Block = link.Block;
+            Lower_Condition(builder, link.Right, link.Then, link.Else);
+        }
+        DynamicArrayDestroy(chain);
+    } else if (expression->Kind == AstExpressionKind_Unary && expression->Unary.Operator.Kind == TokenKind_ExclamationMark) {
+        Lower_Condition(builder, expression->Unary.Operand, else_, then);
+    } else if (expression->Kind == AstExpressionKind_True || expression->Kind == AstExpressionKind_False) {
+        IrBlock_AppendJump(builder->Block, expression->Kind == AstExpressionKind_True ? then : else_);
+    } else {
+        IrBlock_AppendBranch(builder->Block, Lower_Expression(builder, expression), then, else_);
+    }
+}
+
+IrInstruction* Lower_Expression(IrBuilder* builder, AstExpression* expression) {
+    IrType type = Lower_Type(expression->Type);
+
+    switch (expression->Kind) {
+        case AstExpressionKind_Literal: {
+            Token token = expression->Literal.Token;
+            switch (token.Kind) {
+                case TokenKind_Integer: {
+                    if (type.Kind == IrTypeKind_Float) {
+                        return IrBlock_AppendFloat(builder->Block, type, cast(f64) token.Integer);
+                    }
+                    return IrBlock_AppendInteger(builder->Block, type, token.Integer);
+                } break;
+
+                case TokenKind_Float: {
+                    return IrBlock_AppendFloat(builder->Block, type, token.Float);
+                } break;
+
+                case TokenKind_String: {
+                    IrInstruction* string = IrBlock_Append(builder->Block, IrOp_String, IrType_Pointer());
+                    string->Index = IrModule_InternString(builder->Module, token.String, token.StringLength);
+                    return string;
+                } break;
+
+                default: {
+                    ASSERT(FALSE);
+                } break;
+            }
+        } break;
+
+        case AstExpressionKind_True:
+        case AstExpressionKind_False: {
+            return IrBlock_AppendInteger(builder->Block, type, expression->Kind == AstExpressionKind_True);
+        } break;
+
+        case AstExpressionKind_Null: {
+            return IrBlock_AppendInteger(builder->Block, type, 0);
+        } break;
+
+        case AstExpressionKind_Name: {
+            AstDeclaration* declaration = expression->Name.Declaration;
+            if (declaration->Constant) {
+                AstExpression* value = declaration->Value;
+                if (value->Kind == AstExpressionKind_Procedure) {
+                    if (DynamicArrayLength(value->Procedure.Captures) > 0) {
+                        Error("'%s' captures variables and can only be called directly", declaration->Name.Name);
+                    }
+                    IrInstruction* address = IrBlock_Append(builder->Block, IrOp_ProcedureAddress, IrType_Pointer());
+                    address->Procedure = Lower_Procedure(builder->Module, &value->Procedure);
+                    return address;
+                }
+                return Lower_Convert(builder, Lower_Expression(builder, value), type);
+            }
+
+            return Lower_ReadVariable(builder, declaration);
+        } break;
+
+        case AstExpressionKind_Unary: {
+            AstExpression* operand = expression->Unary.Operand;
+            switch (expression->Unary.Operator.Kind) {
+                case TokenKind_Plus: {
+                    return Lower_Expression(builder, operand);
+                } break;
+
+                case TokenKind_Minus: {
+                    return IrBlock_AppendUnary(builder->Block, IrOp_Negate, type, Lower_Expression(builder, operand));
+                } break;
+
+                case TokenKind_ExclamationMark: {
+                    return IrBlock_AppendUnary(builder->Block, IrOp_Not, type, Lower_Expression(builder, operand));
+                } break;
+
+                case TokenKind_Caret: {
+                    return Lower_Address(builder, operand);
+                } break;
+
+                case TokenKind_Asterisk: {
+                    return Lower_Load(builder, expression->Type, Lower_Expression(builder, operand));
+                } break;
+
+                default: {
+                    ASSERT(FALSE);
+                } break;
+            }
+        } break;
+
+        case AstExpressionKind_Binary: {
+            TokenKind operator = expression->Binary.Operator.Kind;
+            if (operator == TokenKind_AmpersandAmpersand || operator == TokenKind_PipePipe) {
+                IrBlock* then = IrBlock_Create(builder->Procedure);
+                IrBlock* else_ = IrBlock_Create(builder->Procedure);
+                IrBlock* merge = IrBlock_Create(builder->Procedure);
+                Lower_Condition(builder, expression, then, else_);
+                IrBlock_Seal(then);
+                IrBlock_Seal(else_);
+
+                IrInstruction* trueValue = IrBlock_AppendInteger(then, type, TRUE);
+                IrBlock_AppendJump(then, merge);
+                IrInstruction* falseValue = IrBlock_AppendInteger(else_, type, FALSE);
+                IrBlock_AppendJump(else_, merge);
+                IrBlock_Seal(merge);
+
+                IrInstruction* phi = IrInstruction_Create(builder->Procedure, IrOp_Phi, type);
+                phi->Block = merge;
+                DynamicArrayPush(phi->Operands, trueValue);
+                DynamicArrayPush(phi->Operands, falseValue);
+                DynamicArrayPush(merge->Instructions, phi);
+
+                builder->Block = merge;
+                return phi;
+            }
+
+            // Binary chains nest to the left, the loop lowers them from the leftmost operand up
+            AstExpression** chain = DynamicArrayCreate(AstExpression*);
+            AstExpression* operand = expression;
+            while (operand->Kind == AstExpressionKind_Binary && !Lower_IsShortCircuit(operand)) {
+                DynamicArrayPush(chain, operand);
+                operand = operand->Binary.Left;
+            }
+
+            IrInstruction* left = Lower_Expression(builder, operand);
+            for (u64 i = DynamicArrayLength(chain); i > 0; i--) {
+                AstExpression* binary = chain[i - 1];
+                IrInstruction* right = Lower_Expression(builder, binary->Binary.Right);
+                operator = binary->Binary.Operator.Kind;
+                type = Lower_Type(binary->Type);
+                if (operator == TokenKind_Greater || operator == TokenKind_GreaterEquals) { // Mirrored so the ir only needs less than
+                    IrOp op = operator == TokenKind_Greater ? IrOp_Less : IrOp_LessEqual;
+                    left = IrBlock_AppendBinary(builder->Block, op, type, right, left);
+                } else {
+                    left = IrBlock_AppendBinary(builder->Block, Lower_BinaryOp(operator), type, left, right);
+                }
+            }
+            DynamicArrayDestroy(chain);
+            return left;
+        } break;
+
+        case AstExpressionKind_Field:
+        case AstExpressionKind_Index: {
+            // Lanes of vectors in registers are extracted, the others are loaded on their own
+            AstExpression* operand = expression->Kind == AstExpressionKind_Index ? expression->Index.Operand : NULL;
+            if (operand && operand->Type->Kind == AstTypeKind_Vector &&
+                (!operand->IsLValue || (operand->Kind == AstExpressionKind_Name && !Lower_VariableAddress(builder, operand->Name.Declaration)))) {
+                IrInstruction* lane = IrBlock_AppendUnary(builder->Block, IrOp_ExtractLane, type, Lower_Expression(builder, operand));
+                lane->Index = Evaluate_Integer(expression->Index.Index);
+                return lane;
+            }
+            return Lower_Load(builder, expression->Type, Lower_Address(builder, expression));
+        } break;
+
+        case AstExpressionKind_Procedure: {
+            IrInstruction* address = IrBlock_Append(builder->Block, IrOp_ProcedureAddress, IrType_Pointer());
+            address->Procedure = Lower_Procedure(builder->Module, &expression->Procedure);
+            return address;
+        } break;
+
+        case AstExpressionKind_Call: {
+            AstExpression* operand = expression->Call.Operand;
+            AstProcedureArgument* parameters = operand->Type->Procedure.Arguments;
+            if (Ast_IsArrayMethod(operand)) {
+                Lower_ArrayMethod(builder, expression);
+                return NULL;
+            } else if (Ast_IsVectorMethod(operand)) {
+                return Lower_VectorMethod(builder, expression);
+            }
+
+            AstProcedure* source = expression->Call.Instance;
+            if (!source && operand->Kind == AstExpressionKind_Name && operand->Name.Declaration->Constant &&
+                operand->Name.Declaration->Value->Kind == AstExpressionKind_Procedure) {
+                source = &operand->Name.Declaration->Value->Procedure;
+            }
+
+            // The caller owns the slot an aggregate result is returned in
+            IrInstruction* result = NULL;
+            if (Type_IsAggregate(expression->Type)) {
+                result = Lower_Local(builder, expression->Type);
+                type = IrType_Void();
+            }
+
+            IrInstruction* call;
+            if (source) {
+                parameters = source->Arguments;
+                IrProcedure* procedure = Lower_Procedure(builder->Module, source);
+                IrInstruction** arguments = DynamicArrayCreate(IrInstruction*);
+                if (result) {
+                    DynamicArrayPush(arguments, result);
+                }
+                if (DynamicArrayLength(source->Captures) > 0) {
+                    DynamicArrayPush(arguments, Lower_Environment(builder, source));
+                }
+                for (u64 i = 0; i < DynamicArrayLength(expression->Call.Arguments); i++) {
+                    IrInstruction* argument = Lower_Expression(builder, expression->Call.Arguments[i]);
+                    DynamicArrayPush(arguments, Lower_Convert(builder, argument, Lower_Type(parameters[i].Type)));
+                }
+
+                call = IrBlock_Append(builder->Block, IrOp_Call, type);
+                call->Procedure = procedure;
+                DynamicArrayDestroy(call->Operands);
+                call->Operands = arguments;
+            } else { // Indirect calls pass the callee as the first operand
+                IrInstruction* callee = Lower_Expression(builder, operand);
+                IrInstruction** arguments = DynamicArrayCreate(IrInstruction*);
+                DynamicArrayPush(arguments, callee);
+                if (result) {
+                    DynamicArrayPush(arguments, result);
+                }
+                for (u64 i = 0; i < DynamicArrayLength(expression->Call.Arguments); i++) {
+                    IrInstruction* argument = Lower_Expression(builder, expression->Call.Arguments[i]);
+                    DynamicArrayPush(arguments, Lower_Convert(builder, argument, Lower_Type(parameters[i].Type)));
+                }
+
+                call = IrBlock_Append(builder->Block, IrOp_Call, type);
+                DynamicArrayDestroy(call->Operands);
+                call->Operands = arguments;
+            }
+            return result ? result : call;
+        } break;
+
+        case AstExpressionKind_Sizeof: {
+            return IrBlock_AppendInteger(builder->Block, type, Evaluate_Integer(expression));
+        } break;
+
+        case AstExpressionKind_Cast: {
+            return Lower_Convert(builder, Lower_Expression(builder, expression->Cast.Expression), type);
+        } break;
+
+        case AstExpressionKind_Run: {
+            if (type.Kind == IrTypeKind_Float) {
+                f64 value;
+                memcpy(&value, &expression->Run.Value, sizeof(f64));
+                return IrBlock_AppendFloat(builder->Block, type, value);
+            }
+            return IrBlock_AppendInteger(builder->Block, type, expression->Run.Value);
+        } break;
+
+        default: {
+            ASSERT(FALSE);
+        } break;
+    }
+
+    return NULL;
+}
+
+// Lower_StringHash computes the hash of hash_string before the program runs
+#define Lower_StringHashSeed 14695981039346656037ull
+#define Lower_StringHashFactor 1099511628211ull
+
+u64 Lower_StringHash(const char* data, u64 length) {
+    u64 hash = Lower_StringHashSeed;
+    for (u64 i = 0; i < length; i++) {
+        hash = (hash + cast(u8) data[i]) * Lower_StringHashFactor;
+    }
+    return hash;
+}
+
+// hash_string(string: ptr) -> u64
+IrProcedure* Lower_HashString(IrModule* module) {
+    if (module->HashString) {
+        return module->HashString;
+    }
+
+    IrType usize = Lower_Type(&Type_Usize);
+    IrProcedure* procedure = IrProcedure_Create(module, "runtime.hash_string", usize);
+    DynamicArrayPush(procedure->Parameters, IrType_Pointer());
+    module->HashString = procedure;
+
+    IrBuilder builder = {
+        .Module = module,
+        .Procedure = procedure,
+        .Entry = IrBlock_Create(procedure),
+    };
+    builder.Block = builder.Entry;
+    IrBlock_Seal(builder.Entry);
+
+    IrInstruction* string = IrBlock_Append(builder.Entry, IrOp_Parameter, IrType_Pointer());
+    IrInstruction* data = IrBlock_AppendUnary(builder.Entry, IrOp_Load, IrType_Pointer(), string);
+    IrInstruction* length = IrBlock_AppendUnary(builder.Entry, IrOp_Load, usize, Lower_ArrayField(&builder, string, ArrayField_Length));
+    IrInstruction* hash = IrBlock_AppendInteger(builder.Entry, usize, Lower_StringHashSeed);
+    IrInstruction* index = IrBlock_AppendInteger(builder.Entry, usize, 0);
+    IrBlock_WriteVariable(builder.Entry, &hash, hash);
+    IrBlock_WriteVariable(builder.Entry, &index, index);
+
+    IrBlock* header = IrBlock_Create(procedure);
+    IrBlock* body = IrBlock_Create(procedure);
+    IrBlock* done = IrBlock_Create(procedure);
+    IrBlock_AppendJump(builder.Entry, header);
+
+    IrInstruction* i = IrBlock_ReadVariable(header, &index, usize);
+    IrBlock_AppendBranch(header, IrBlock_AppendBinary(header, IrOp_Less, IrType_Bool(), i, length), body, done);
+
+    // hash = (hash + byte) * factor
+    IrBlock_Seal(body);
+    IrInstruction* byte = IrBlock_AppendUnary(body, IrOp_Load, Lower_Type(&Type_U8), IrBlock_AppendBinary(body, IrOp_Offset, IrType_Pointer(), data, i));
+    IrInstruction* sum = IrBlock_AppendBinary(body, IrOp_Add, usize, IrBlock_ReadVariable(body, &hash, usize), IrBlock_AppendUnary(body, IrOp_Convert, usize, byte));
+    IrBlock_WriteVariable(body, &hash, IrBlock_AppendBinary(body, IrOp_Multiply, usize, sum, IrBlock_AppendInteger(body, usize, Lower_StringHashFactor)));
+    IrBlock_WriteVariable(body, &index, IrBlock_AppendBinary(body, IrOp_Add, usize, i, IrBlock_AppendInteger(body, usize, 1)));
+    IrBlock_AppendJump(body, header);
+    IrBlock_Seal(header);
+
+    IrBlock_Seal(done);
+    IrBlock_AppendReturn(done, IrBlock_ReadVariable(done, &hash, usize));
+
+    IrProcedure_ApplyReplacements(procedure);
+    return procedure;
+}
+
+// string_equal(a: ptr, b: ptr) -> bool
+IrProcedure* Lower_StringEqual(IrModule* module) {
+    if (module->StringEqual) {
+        return module->StringEqual;
+    }
+
+    IrType usize = Lower_Type(&Type_Usize);
+    IrType u8 = Lower_Type(&Type_U8);
+    IrProcedure* procedure = IrProcedure_Create(module, "runtime.string_equal", IrType_Bool());
+    procedure->NoInline = TRUE; // Called once per string case
+    DynamicArrayPush(procedure->Parameters, IrType_Pointer());
+    DynamicArrayPush(procedure->Parameters, IrType_Pointer());
+    module->StringEqual = procedure;
+
+    IrBuilder builder = {
+        .Module = module,
+        .Procedure = procedure,
+        .Entry = IrBlock_Create(procedure),
+    };
+    builder.Block = builder.Entry;
+    IrBlock_Seal(builder.Entry);
+
+    IrInstruction* strings[2];
+    IrInstruction* lengths[2];
+    for (u64 i = 0; i < 2; i++) {
+        strings[i] = IrBlock_Append(builder.Entry, IrOp_Parameter, IrType_Pointer());
+        strings[i]->Index = i;
+        lengths[i] = IrBlock_AppendUnary(builder.Entry, IrOp_Load, usize, Lower_ArrayField(&builder, strings[i], ArrayField_Length));
+    }
+
+    IrBlock* compare = IrBlock_Create(procedure);
+    IrBlock* header = IrBlock_Create(procedure);
+    IrBlock* body = IrBlock_Create(procedure);
+    IrBlock* next = IrBlock_Create(procedure);
+    IrBlock* same = IrBlock_Create(procedure);
+    IrBlock* different = IrBlock_Create(procedure);
+    IrBlock_AppendBranch(builder.Entry, IrBlock_AppendBinary(builder.Entry, IrOp_Equal, IrType_Bool(), lengths[0], lengths[1]), compare, different);
+
+    IrBlock_Seal(compare);
+    IrInstruction* first = IrBlock_AppendUnary(compare, IrOp_Load, IrType_Pointer(), strings[0]);
+    IrInstruction* second = IrBlock_AppendUnary(compare, IrOp_Load, IrType_Pointer(), strings[1]);
+    IrInstruction* index = IrBlock_AppendInteger(compare, usize, 0);
+    IrBlock_WriteVariable(compare, &index, index);
+    IrBlock_AppendJump(compare, header);
+
+    IrInstruction* i = IrBlock_ReadVariable(header, &index, usize);
+    IrBlock_AppendBranch(header, IrBlock_AppendBinary(header, IrOp_Less, IrType_Bool(), i, lengths[0]), body, same);
+
+    IrBlock_Seal(body);
+    IrInstruction* a = IrBlock_AppendUnary(body, IrOp_Load, u8, IrBlock_AppendBinary(body, IrOp_Offset, IrType_Pointer(), first, i));
+    IrInstruction* b = IrBlock_AppendUnary(body, IrOp_Load, u8, IrBlock_AppendBinary(body, IrOp_Offset, IrType_Pointer(), second, i));
+    IrBlock_AppendBranch(body, IrBlock_AppendBinary(body, IrOp_Equal, IrType_Bool(), a, b), next, different);
+
+    IrBlock_Seal(next);
+    IrBlock_WriteVariable(next, &index, IrBlock_AppendBinary(next, IrOp_Add, usize, i, IrBlock_AppendInteger(next, usize, 1)));
+    IrBlock_AppendJump(next, header);
+    IrBlock_Seal(header);
+
+    IrBlock_Seal(same);
+    IrBlock_AppendReturn(same, IrBlock_AppendInteger(same, IrType_Bool(), 1));
+    IrBlock_Seal(different);
+    IrBlock_AppendReturn(different, IrBlock_AppendInteger(different, IrType_Bool(), 0));
+
+    IrProcedure_ApplyReplacements(procedure);
+    return procedure;
+}
+
+typedef struct LowerCase {
+    u64 Value; // Wrapped to the type of the switch, or the hash of a string
+    IrBlock* Block;
+    Token* String;
+} LowerCase;
+
+#define Lower_SwitchLinearCases 3 // Up to this many cases are compared one after another
+#define Lower_SwitchTableDensity 3 // Entries a jump table may have per case, the others jump to the default
+
+// Insertion sort keeps the cases with the same hash in the order they were written
+void Lower_SortCases(LowerCase* cases, b8 isSigned) {
+    for (u64 i = 1; i < DynamicArrayLength(cases); i++) {
+        LowerCase case_ = cases[i];
+        u64 j = i;
+        while (j > 0 && (isSigned ? cast(s64) case_.Value < cast(s64) cases[j - 1].Value : case_.Value < cases[j - 1].Value)) {
+            cases[j] = cases[j - 1];
+            j--;
+        }
+        cases[j] = case_;
+    }
+}
+
+// Dense runs of the sorted cases become jump tables and the others a balanced tree of comparisons
+void Lower_SwitchCases(IrBuilder* builder, IrInstruction* value, LowerCase* cases, u64 count, IrBlock* default_) {
+    IrBlock* block = builder->Block;
+    if (count == 0) {
+        IrBlock_AppendJump(block, default_);
+        return;
+    }
+
+    u64 span = cases[count - 1].Value - cases[0].Value;
+    if (count > Lower_SwitchLinearCases && span / Lower_SwitchTableDensity < count) {
+        IrBlock** table = DynamicArrayCreate(IrBlock*);
+        for (u64 i = 0; i < count; i++) {
+            while (DynamicArrayLength(table) < cases[i].Value - cases[0].Value) {
+                DynamicArrayPush(table, default_);
+            }
+            DynamicArrayPush(table, cases[i].Block);
+        }
+        IrBlock_AppendSwitch(block, value, cases[0].Value, default_, table);
+        return;
+    }
+
+    if (count <= Lower_SwitchLinearCases) {
+        for (u64 i = 0; i < count; i++) {
+            IrBlock* next = i + 1 < count ? IrBlock_Create(builder->Procedure) : default_;
+            IrInstruction* constant = IrBlock_AppendInteger(block, value->Type, cases[i].Value);
+            IrBlock_AppendBranch(block, IrBlock_AppendBinary(block, IrOp_Equal, IrType_Bool(), value, constant), cases[i].Block, next);
+            if (next != default_) {
+                IrBlock_Seal(next);
+                block = next;
+            }
+        }
+        return;
+    }
+
+    // Values below the first one of the upper half go to the lower half
+    u64 half = count / 2;
+    IrBlock* lower = IrBlock_Create(builder->Procedure);
+    IrBlock* upper = IrBlock_Create(builder->Procedure);
+    IrInstruction* pivot = IrBlock_AppendInteger(block, value->Type, cases[half].Value);
+    IrBlock_AppendBranch(block, IrBlock_AppendBinary(block, IrOp_Less, IrType_Bool(), value, pivot), lower, upper);
+
+    IrBlock_Seal(lower);
+    builder->Block = lower;
+    Lower_SwitchCases(builder, value, cases, half, default_);
+
+    IrBlock_Seal(upper);
+    builder->Block = upper;
+    Lower_SwitchCases(builder, value, cases + half, count - half, default_);
+}
+
+// Strings are told apart by their hash first, then compared with the cases that have that hash
+void Lower_StringSwitch(IrBuilder* builder, IrInstruction* value, LowerCase* cases, IrBlock* default_) {
+    u64 count = DynamicArrayLength(cases);
+    for (u64 i = 0; i < count; i++) {
+        cases[i].Value = Lower_StringHash(cases[i].String->String, cases[i].String->StringLength);
+    }
+    Lower_SortCases(cases, FALSE);
+
+    LowerCase* hashes = DynamicArrayCreate(LowerCase);
+    for (u64 i = 0; i < count; i++) {
+        if (i == 0 || cases[i].Value != cases[i - 1].Value) {
+            DynamicArrayPush(hashes, ((LowerCase){ .Value = cases[i].Value, .Block = IrBlock_Create(builder->Procedure) }));
+        }
+    }
+
+    IrInstruction* hash = IrBlock_Append(builder->Block, IrOp_Call, Lower_Type(&Type_Usize));
+    hash->Procedure = Lower_HashString(builder->Module);
+    DynamicArrayPush(hash->Operands, value);
+    Lower_SwitchCases(builder, hash, hashes, DynamicArrayLength(hashes), default_);
+
+    u64 first = 0;
+    for (u64 i = 0; i < DynamicArrayLength(hashes); i++) {
+        IrBlock* block = hashes[i].Block;
+        IrBlock_Seal(block);
+
+        u64 end = first;
+        while (end < count && cases[end].Value == hashes[i].Value) {
+            end++;
+        }
+        for (u64 j = first; j < end; j++) {
+            IrInstruction* string = IrBlock_Append(block, IrOp_String, IrType_Pointer());
+            string->Index = IrModule_InternString(builder->Module, cases[j].String->String, cases[j].String->StringLength);
+            IrInstruction* equal = IrBlock_Append(block, IrOp_Call, IrType_Bool());
+            equal->Procedure = Lower_StringEqual(builder->Module);
+            DynamicArrayPush(equal->Operands, value);
+            DynamicArrayPush(equal->Operands, string);
+
+            IrBlock* next = j + 1 < end ? IrBlock_Create(builder->Procedure) : default_;
+            IrBlock_AppendBranch(block, equal, cases[j].Block, next);
+            if (next != default_) {
+                IrBlock_Seal(next);
+                block = next;
+            }
+        }
+        first = end;
+    }
+    DynamicArrayDestroy(hashes);
+}
+
+void Lower_Statement(IrBuilder* builder, AstStatement* statement) {
+    switch (statement->Kind) {
+        case AstStatementKind_Expression: {
+            Lower_Expression(builder, &statement->Expression);
+        } break;
+
+        case AstStatementKind_Scope: {
+            b8 noBoundsCheck = builder->NoBoundsCheck;
+            builder->NoBoundsCheck |= statement->Scope.NoBoundsCheck;
+            for (u64 i = 0; i < DynamicArrayLength(statement->Scope.Statements); i++) {
+                Lower_Statement(builder, statement->Scope.Statements[i]);
+            }
+            builder->NoBoundsCheck = noBoundsCheck;
+        } break;
+
+        case AstStatementKind_Declaration: {
+            AstDeclaration* declaration = &statement->Declaration;
+            AstExpression* value = declaration->Value;
+            if (declaration->Constant) {
+                if (value->Kind == AstExpressionKind_Procedure && !Ast_IsPolymorphic(value)) {
+                    Lower_Procedure(builder->Module, &value->Procedure);
+                }
+                break;
+            }
+
+            if (Lower_IsInMemory(declaration)) {
+                declaration->Address = Lower_Local(builder, declaration->Type);
+                if (value) {
+                    Lower_Store(builder, declaration->Type, declaration->Address, Lower_Expression(builder, value));
+                } else {
+                    IrInstruction* zero = IrBlock_AppendUnary(builder->Block, IrOp_Zero, IrType_Void(), declaration->Address);
+                    zero->Memory.Size = Type_Size(declaration->Type);
+                }
+            } else {
+                IrType type = Lower_Type(declaration->Type);
+                IrInstruction* initial = value ?
+                    Lower_Convert(builder, Lower_Expression(builder, value), type) :
+                    Lower_Zero(builder, type);
+                IrBlock_WriteVariable(builder->Block, declaration, initial);
+            }
+        } break;
+
+        case AstStatementKind_Assignment: {
+            AstExpression* operand = statement->Assignment.Operand;
+            TokenKind operator = statement->Assignment.Operator.Kind;
+            IrType type = Lower_Type(operand->Type);
+
+            if (operand->Kind == AstExpressionKind_Name && !Lower_VariableAddress(builder, operand->Name.Declaration)) {
+                AstDeclaration* declaration = operand->Name.Declaration;
+                IrInstruction* value = Lower_Convert(builder, Lower_Expression(builder, statement->Assignment.Value), type);
+                if (operator != TokenKind_Equals) {
+                    IrInstruction* old = IrBlock_ReadVariable(builder->Block, declaration, type);
+                    value = IrBlock_AppendBinary(builder->Block, Lower_BinaryOp(operator), type, old, value);
+                }
+                IrBlock_WriteVariable(builder->Block, declaration, value);
+                break;
+            }
+
+            // A lane of a vector in a register is written by inserting it into the whole vector
+            AstExpression* vector = operand->Kind == AstExpressionKind_Index ? operand->Index.Operand : NULL;
+            if (vector && vector->Type->Kind == AstTypeKind_Vector && vector->Kind == AstExpressionKind_Name &&
+                !Lower_VariableAddress(builder, vector->Name.Declaration)) {
+                AstDeclaration* declaration = vector->Name.Declaration;
+                IrType vectorType = Lower_Type(declaration->Type);
+                u64 lane = Evaluate_Integer(operand->Index.Index);
+                IrInstruction* value = Lower_Convert(builder, Lower_Expression(builder, statement->Assignment.Value), type);
+                IrInstruction* old = IrBlock_ReadVariable(builder->Block, declaration, vectorType);
+                if (operator != TokenKind_Equals) {
+                    IrInstruction* oldLane = IrBlock_AppendUnary(builder->Block, IrOp_ExtractLane, type, old);
+                    oldLane->Index = lane;
+                    value = IrBlock_AppendBinary(builder->Block, Lower_BinaryOp(operator), type, oldLane, value);
+                }
+
+                IrInstruction* insert = IrBlock_AppendBinary(builder->Block, IrOp_InsertLane, vectorType, old, value);
+                insert->Index = lane;
+                IrBlock_WriteVariable(builder->Block, declaration, insert);
+                break;
+            }
+
+            if (Ast_IsSoaElement(operand)) { // Only structs, so the operator is '='
+                IrInstruction* base;
+                IrInstruction* index = Lower_SoaIndex(builder, operand, &base);
+                IrInstruction* value = Lower_Expression(builder, statement->Assignment.Value);
+                AstDeclaration* fields = operand->Type->Struct.Declarations;
+                for (u64 i = 0; i < DynamicArrayLength(fields); i++) {
+                    IrInstruction* field = Lower_Load(builder, fields[i].Type, Lower_Offset(builder, value, Type_FieldOffset(operand->Type, i)));
+                    Lower_Store(builder, fields[i].Type, Lower_SoaField(builder, operand->Index.Operand->Type, base, index, i), field);
+                }
+                break;
+            }
+
+            IrInstruction* address = Lower_Address(builder, operand);
+            IrInstruction* value = Lower_Expression(builder, statement->Assignment.Value);
+            if (operator != TokenKind_Equals) {
+                IrInstruction* old = IrBlock_AppendUnary(builder->Block, IrOp_Load, type, address);
+                value = IrBlock_AppendBinary(builder->Block, Lower_BinaryOp(operator), type, old, Lower_Convert(builder, value, type));
+            }
+            Lower_Store(builder, operand->Type, address, value);
+        } break;
+
+        case AstStatementKind_Return: {
+            IrInstruction* value = NULL;
+            if (builder->Result) {
+                Lower_Store(builder, builder->Source->ReturnType, builder->Result, Lower_Expression(builder, statement->Return.Expression));
+            } else if (statement->Return.Expression) {
+                value = Lower_Convert(builder, Lower_Expression(builder, statement->Return.Expression), builder->Procedure->ReturnType);
+            }
+            IrBlock_AppendReturn(builder->Block, value);
+
+            builder->Block = IrBlock_Create(builder->Procedure); // Anything after the return is unreachable
+            IrBlock_Seal(builder->Block);
+        } break;
+
+        case AstStatementKind_If: {
+            // 'else if' chains are lowered in a loop, the merge block of each link jumps to the one of the link before
+            IrBlock** merges = DynamicArrayCreate(IrBlock*);
+            while (statement) {
+                IrBlock* then = IrBlock_Create(builder->Procedure);
+                IrBlock* else_ = statement->If.Else ? IrBlock_Create(builder->Procedure) : NULL;
+                IrBlock* merge = IrBlock_Create(builder->Procedure);
+                DynamicArrayPush(merges, merge);
+
+                Lower_Condition(builder, statement->If.Condition, then, else_ ? else_ : merge);
+
+                IrBlock_Seal(then);
+                builder->Block = then;
+                Lower_Statement(builder, statement->If.Then);
+                IrBlock_AppendJump(builder->Block, merge);
+
+                AstStatement* next = statement->If.Else;
+                statement = NULL;
+                if (else_) {
+                    IrBlock_Seal(else_);
+                    builder->Block = else_;
+                    if (next->Kind == AstStatementKind_If) {
+                        statement = next;
+                    } else {
+                        Lower_Statement(builder, next);
+                        IrBlock_AppendJump(builder->Block, merge);
+                    }
+                }
+            }
+
+            for (u64 i = DynamicArrayLength(merges); i > 0; i--) {
+                IrBlock_Seal(merges[i - 1]);
+                builder->Block = merges[i - 1];
+                if (i > 1) {
+                    IrBlock_AppendJump(builder->Block, merges[i - 2]);
+                }
+            }
+            DynamicArrayDestroy(merges);
+        } break;
+
+        // The header is sealed once the body has added the back edge
+        case AstStatementKind_While: {
+            IrBlock* header = IrBlock_Create(builder->Procedure);
+            IrBlock* body = IrBlock_Create(builder->Procedure);
+            IrBlock* exit = IrBlock_Create(builder->Procedure);
+            IrBlock_AppendJump(builder->Block, header);
+
+            builder->Block = header;
+            Lower_Condition(builder, statement->While.Condition, body, exit);
+
+            IrBlock_Seal(body);
+            builder->Block = body;
+            Lower_Statement(builder, statement->While.Body);
+            IrBlock_AppendJump(builder->Block, header);
+
+            IrBlock_Seal(header);
+            IrBlock_Seal(exit);
+            builder->Block = exit;
+        } break;
+
+        case AstStatementKind_For: {
+            AstDeclaration* variable = &statement->For.Variable->Declaration;
+            IrType type = Lower_Type(variable->Type);
+            Lower_Statement(builder, statement->For.Variable);
+            IrInstruction* end = Lower_Convert(builder, Lower_Expression(builder, statement->For.End), type);
+
+            IrBlock* header = IrBlock_Create(builder->Procedure);
+            IrBlock* body = IrBlock_Create(builder->Procedure);
+            IrBlock* exit = IrBlock_Create(builder->Procedure);
+            IrBlock_AppendJump(builder->Block, header);
+
+            builder->Block = header;
+            IrInstruction* condition = IrBlock_AppendBinary(header, IrOp_Less, IrType_Bool(), Lower_ReadVariable(builder, variable), end);
+            IrBlock_AppendBranch(header, condition, body, exit);
+
+            IrBlock_Seal(body);
+            builder->Block = body;
+            AstScope* scope = statement->For.Body;
+            for (u64 i = 0; i < DynamicArrayLength(scope->Statements); i++) {
+                Lower_Statement(builder, scope->Statements[i]);
+            }
+
+            IrInstruction* one = IrBlock_AppendInteger(builder->Block, type, 1);
+            IrInstruction* next = IrBlock_AppendBinary(builder->Block, IrOp_Add, type, Lower_ReadVariable(builder, variable), one);
+            Lower_WriteVariable(builder, variable, next);
+            IrBlock_AppendJump(builder->Block, header);
+
+            IrBlock_Seal(header);
+            IrBlock_Seal(exit);
+            builder->Block = exit;
+        } break;
+
+        case AstStatementKind_Switch: {
+            AstSwitch* switch_ = &statement->Switch;
+            AstType* type = switch_->Value->Type;
+            IrInstruction* value = Lower_Expression(builder, switch_->Value);
+
+            // Every case gets its own block, the dispatch only jumps to them
+            LowerCase* cases = DynamicArrayCreate(LowerCase);
+            IrBlock** bodies = Allocate((DynamicArrayLength(switch_->Cases) + 1) * sizeof(IrBlock*));
+            for (u64 i = 0; i < DynamicArrayLength(switch_->Cases); i++) {
+                AstCase* case_ = &switch_->Cases[i];
+                bodies[i] = IrBlock_Create(builder->Procedure);
+                for (u64 j = 0; j < DynamicArrayLength(case_->Values); j++) {
+                    LowerCase lowered = { .Block = bodies[i] };
+                    if (type->Kind == AstTypeKind_String) {
+                        lowered.String = Evaluate_String(case_->Values[j]);
+                    } else {
+                        lowered.Value = Evaluate_Wrap(type, Evaluate_Integer(case_->Values[j]));
+                    }
+                    DynamicArrayPush(cases, lowered);
+                }
+            }
+
+            IrBlock* default_ = IrBlock_Create(builder->Procedure);
+            IrBlock* merge = IrBlock_Create(builder->Procedure);
+            if (type->Kind == AstTypeKind_String) {
+                Lower_StringSwitch(builder, value, cases, default_);
+            } else {
+                Lower_SortCases(cases, type->Signed);
+                Lower_SwitchCases(builder, value, cases, DynamicArrayLength(cases), default_);
+            }
+            DynamicArrayDestroy(cases);
+
+            for (u64 i = 0; i < DynamicArrayLength(switch_->Cases); i++) {
+                IrBlock_Seal(bodies[i]);
+                builder->Block = bodies[i];
+                Lower_Statement(builder, switch_->Cases[i].Body);
+                IrBlock_AppendJump(builder->Block, merge);
+            }
+            free(bodies);
+
+            IrBlock_Seal(default_);
+            builder->Block = default_;
+            if (switch_->Else) {
+                Lower_Statement(builder, switch_->Else);
+            }
+            IrBlock_AppendJump(builder->Block, merge);
+
+            IrBlock_Seal(merge);
+            builder->Block = merge;
+        } break;
+
+        default: {
+            ASSERT(FALSE);
+        } break;
+    }
+}
+
+IrProcedure* Lower_Procedure(IrModule* module, AstProcedure* procedure) {
+    if (procedure->Ir && procedure->Ir->Module == module) { // '#run' lowers into a module of its own
+        return procedure->Ir;
+    }
+    if (!procedure->Checked) {
+        Error("'%s' is used by '#run' before its body is checked", procedure->Name);
+    }
+
+    // Aggregates are returned through a slot in the caller's frame, its address is the first parameter
+    b8 returnsAggregate = procedure->ReturnType && Type_IsAggregate(procedure->ReturnType);
+    IrType returnType = procedure->ReturnType && !returnsAggregate ? Lower_Type(procedure->ReturnType) : IrType_Void();
+    IrProcedure* ir = IrProcedure_Create(module, procedure->Name, returnType);
+    procedure->Ir = ir;
+
+    IrBuilder builder = {
+        .Module = module,
+        .Procedure = ir,
+        .Entry = IrBlock_Create(ir),
+        .Source = procedure,
+        .Captures = DynamicArrayCreate(IrInstruction*),
+    };
+    builder.Block = builder.Entry;
+    IrBlock_Seal(builder.Entry);
+
+    u64 firstArgument = 0;
+    if (returnsAggregate) {
+        DynamicArrayPush(ir->Parameters, IrType_Pointer());
+        builder.Result = IrBlock_Append(builder.Entry, IrOp_Parameter, IrType_Pointer());
+        builder.Result->Index = firstArgument++;
+    }
+
+    // The environment comes next, each of its slots holds the address of one capture
+    if (DynamicArrayLength(procedure->Captures) > 0) {
+        DynamicArrayPush(ir->Parameters, IrType_Pointer());
+        IrInstruction* environment = IrBlock_Append(builder.Entry, IrOp_Parameter, IrType_Pointer());
+        environment->Index = firstArgument++;
+
+        for (u64 i = 0; i < DynamicArrayLength(procedure->Captures); i++) {
+            IrInstruction* slot = environment;
+            if (i > 0) {
+                IrInstruction* offset = IrBlock_AppendInteger(builder.Entry, Lower_Type(&Type_Usize), i * sizeof(u64));
+                slot = IrBlock_AppendBinary(builder.Entry, IrOp_Offset, IrType_Pointer(), environment, offset);
+            }
+            DynamicArrayPush(builder.Captures, IrBlock_AppendUnary(builder.Entry, IrOp_Load, IrType_Pointer(), slot));
+        }
+    }
+
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Arguments); i++) {
+        AstDeclaration* declaration = &procedure->Arguments[i].Declaration->Declaration;
+        IrType type = Lower_Type(declaration->Type);
+        DynamicArrayPush(ir->Parameters, type);
+
+        IrInstruction* parameter = IrBlock_Append(builder.Entry, IrOp_Parameter, type);
+        parameter->Index = firstArgument + i;
+
+        // Aggregates arrive as the address of the caller's value, writes go to a copy of it
+        if (Type_IsAggregate(declaration->Type) || declaration->AddressTaken) {
+            declaration->Address = Lower_Local(&builder, declaration->Type);
+            Lower_Store(&builder, declaration->Type, declaration->Address, parameter);
+        } else {
+            IrBlock_WriteVariable(builder.Entry, declaration, parameter);
+        }
+    }
+
+    for (u64 i = 0; i < DynamicArrayLength(procedure->Body->Statements); i++) {
+        Lower_Statement(&builder, procedure->Body->Statements[i]);
+    }
+
+    if (returnType.Kind == IrTypeKind_Void) {
+        IrBlock_AppendReturn(builder.Block, NULL);
+    } else {
+        IrBlock_AppendReturn(builder.Block, IrBlock_Append(builder.Block, IrOp_Undefined, returnType));
+    }
+
+    IrProcedure_ApplyReplacements(ir);
+    DynamicArrayDestroy(builder.Captures);
+    return ir;
+}
+
+// The operand is lowered into a module of its own and interpreted, the program only sees the result
+u64 Lower_Run(AstExpression* expression) {
+    IrModule* module = IrModule_Create();
+    IrType type = Lower_Type(expression->Type);
+    IrProcedure* ir = IrProcedure_Create(module, "#run", type);
+
+    IrBuilder builder = {
+        .Module = module,
+        .Procedure = ir,
+        .Entry = IrBlock_Create(ir),
+        .Run = TRUE,
+    };
+    builder.Block = builder.Entry;
+    IrBlock_Seal(builder.Entry);
+
+    IrInstruction* value = Lower_Convert(&builder, Lower_Expression(&builder, expression), type);
+    IrBlock_AppendReturn(builder.Block, value);
+    IrProcedure_ApplyReplacements(ir);
+
+    u64 result;
+    const char* error = IrInterpret_Run(module, ir, &result);
+    if (error) {
+        Error("'#run' failed because %s", error);
+    }
+    return result;
+}
+
+IrModule* Lower_Module(AstScope* globalScope) {
+    IrModule* module = IrModule_Create();
+    for (u64 i = 0; i < DynamicArrayLength(globalScope->Statements); i++) {
+        AstStatement* statement = globalScope->Statements[i];
+        if (statement->Kind == AstStatementKind_Declaration && statement->Declaration.Constant &&
+            statement->Declaration.Value->Kind == AstExpressionKind_Procedure) {
+            Trace_BeginZone("declaration");
+            Trace_ZoneDetail(statement->Declaration.Name.Name);
+            // Every instance the checker made, including ones only '#run' calls, like Cache_PrintIr
+            AstProcedure* procedure = &statement->Declaration.Value->Procedure;
+            if (procedure->TypeParameters) {
+                for (u64 j = 0; j < DynamicArrayLength(procedure->Instances); j++) {
+                    Lower_Procedure(module, &procedure->Instances[j].Instance->Procedure);
+                }
+            } else {
+                Lower_Procedure(module, procedure);
+            }
+            Trace_EndZone();
+        }
+    }
+    return module;
+}
+
+// Whether an ir procedure was lowered from the top level declaration, nested procedures are named 'outer.inner' and
+// instances 'polymorph(types)'
+b8 IrProcedure_BelongsTo(IrProcedure* procedure, const char* name) {
+    u64 length = strlen(name);
+    if (strncmp(procedure->Name, name, length) != 0) {
+        return FALSE;
+    }
+    char next = procedure->Name[length];
+    return next == '\0' || next == '.' || next == '(';
+}
+
+// Ir text
+//
+// The ir printed for a top level declaration, in the form the cache stores it:
+//
+//     <number of strings> <runtime procedures it calls>
+//     <length> <bytes>        one line per string, numbered from 1 in the order the procedures use them
+//     <procedures>
+//
+// A module numbers its strings in the order they were interned, which depends on everything lowered with it, so the
+// text only numbers its own strings and IrText_Print numbers them again for the whole output. The runtime procedures
+// belong to no declaration, IrText_Print lowers the ones that are called again.
+
+enum {
+    IrTextRuntime_Reallocate = 1 << 0,
+    IrTextRuntime_GrowArray = 1 << 1,
+    IrTextRuntime_HashString = 1 << 2,
+    IrTextRuntime_StringEqual = 1 << 3,
+};
+
+typedef struct IrText {
+    u64 StringCount;
+    u64 Runtime;
+    const char** Strings;
+    u64* StringLengths;
+    const char* Procedures;
+    u64 ProceduresSize;
+} IrText;
+
+char* IrText_Create(IrModule* module, const char* name, u64* size) {
+    IrProcedure** procedures = DynamicArrayCreate(IrProcedure*);
+    for (u64 i = 0; i < DynamicArrayLength(module->Procedures) && name; i++) {
+        if (IrProcedure_BelongsTo(module->Procedures[i], name)) {
+            DynamicArrayPush(procedures, module->Procedures[i]);
+        }
+    }
+
+    // Numbered in print order, the module's numbers are put back once printed
+    u64* strings = DynamicArrayCreate(u64);
+    IrInstruction** uses = DynamicArrayCreate(IrInstruction*);
+    u64 runtime = 0;
+    for (u64 i = 0; i < DynamicArrayLength(procedures); i++) {
+        for (u64 j = 0; j < DynamicArrayLength(procedures[i]->Blocks); j++) {
+            IrBlock* block = procedures[i]->Blocks[j];
+            for (u64 k = 0; k < DynamicArrayLength(block->Instructions); k++) {
+                IrInstruction* instruction = block->Instructions[k];
+                if (instruction->Op == IrOp_String) {
+                    u64 index = 0;
+                    while (index < DynamicArrayLength(strings) && strings[index] != instruction->Index) {
+                        index++;
+                    }
+                    if (index == DynamicArrayLength(strings)) {
+                        DynamicArrayPush(strings, instruction->Index);
+                    }
+                    DynamicArrayPush(uses, instruction);
+                    instruction->Index = index + 1;
+                } else if (instruction->Op == IrOp_Call || instruction->Op == IrOp_ProcedureAddress) {
+                    IrProcedure* callee = instruction->Procedure;
+                    runtime |= callee && callee == module->Reallocate ? IrTextRuntime_Reallocate : 0;
+                    runtime |= callee && callee == module->GrowArray ? IrTextRuntime_GrowArray : 0;
+                    runtime |= callee && callee == module->HashString ? IrTextRuntime_HashString : 0;
+                    runtime |= callee && callee == module->StringEqual ? IrTextRuntime_StringEqual : 0;
+                }
+            }
+        }
+    }
+
+    FILE* buffer = tmpfile();
+    if (DynamicArrayLength(procedures) > 0) {
+        fprintf(buffer, "%llu %llu\n", DynamicArrayLength(strings), runtime);
+        for (u64 i = 0; i < DynamicArrayLength(strings); i++) {
+            IrString string = module->Strings[strings[i]];
+            fprintf(buffer, "%llu ", string.Length);
+            fwrite(module->StringData + string.Offset, sizeof(char), string.Length, buffer);
+            fputc('\n', buffer);
+        }
+        for (u64 i = 0; i < DynamicArrayLength(procedures); i++) {
+            if (i > 0) {
+                fputc('\n', buffer);
+            }
+            IrProcedure_Print(buffer, procedures[i]);
+        }
+    }
+
+    for (u64 i = 0; i < DynamicArrayLength(uses); i++) {
+        uses[i]->Index = strings[uses[i]->Index - 1];
+    }
+    DynamicArrayDestroy(uses);
+    DynamicArrayDestroy(strings);
+    DynamicArrayDestroy(procedures);
+
+    *size = ftell(buffer);
+    fseek(buffer, 0, SEEK_SET);
+    char* data = Allocate(*size + 1);
+    *size = fread(data, sizeof(char), *size, buffer);
+    fclose(buffer);
+    return data;
+}
+
+// Reads the number at *at, returns FALSE when there is none or it ends before end
+b8 IrText_ParseNumber(const char** at, const char* end, u64* value) {
+    const char* p = *at;
+    *value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (*value > (~cast(u64) 0 - 9) / 10) {
+            return FALSE;
+        }
+        *value = *value * 10 + (*p - '0');
+        p++;
+    }
+    if (p == *at || p == end) {
+        return FALSE;
+    }
+    *at = p;
+    return TRUE;
+}
+
+// An empty text has no procedures, anything that does not follow the format is rejected
+b8 IrText_Parse(const char* data, u64 size, IrText* text) {
+    *text = (IrText){};
+    if (size == 0) {
+        return TRUE;
+    }
+
+    const char* at = data;
+    const char* end = data + size;
+    if (!IrText_ParseNumber(&at, end, &text->StringCount) || *at++ != ' ' ||
+        !IrText_ParseNumber(&at, end, &text->Runtime) || *at++ != '\n' || text->StringCount > size) {
+        return FALSE;
+    }
+
+    text->Strings = Allocate(text->StringCount * sizeof(const char*) + 1);
+    text->StringLengths = Allocate(text->StringCount * sizeof(u64) + 1);
+    for (u64 i = 0; i < text->StringCount; i++) {
+        u64 length;
+        if (!IrText_ParseNumber(&at, end, &length) || *at++ != ' ' || length >= cast(u64)(end - at) || at[length] != '\n') {
+            free(text->Strings);
+            free(text->StringLengths);
+            return FALSE;
+        }
+        text->Strings[i] = at;
+        text->StringLengths[i] = length;
+        at += length + 1;
+    }
+
+    text->Procedures = at;
+    text->ProceduresSize = end - at;
+    return TRUE;
+}
+
+// Prints the procedures of a text with its string numbers replaced by the ones in numbers
+void IrText_PrintProcedures(FILE* file, IrText* text, u64* numbers) {
+    static const char prefix[] = " = ptr string ";
+    const char* at = text->Procedures;
+    const char* end = text->Procedures + text->ProceduresSize;
+    while (at < end) {
+        const char* line = at;
+        while (at < end && *at != '\n') {
+            at++;
+        }
+        if (at < end) {
+            at++;
+        }
+
+        // Only IrOp_String prints as '    %<id> = ptr string <index>'
+        const char* p = line;
+        if (at - p > 5 && strncmp(p, "    %", 5) == 0) {
+            p += 5;
+            while (p < at && *p >= '0' && *p <= '9') {
+                p++;
+            }
+            u64 index;
+            const char* number = p + sizeof(prefix) - 1;
+            if (cast(u64)(at - p) > sizeof(prefix) - 1 && strncmp(p, prefix, sizeof(prefix) - 1) == 0 &&
+                IrText_ParseNumber(&number, at, &index) && index >= 1 && index <= text->StringCount) {
+                fwrite(line, sizeof(char), p + sizeof(prefix) - 1 - line, file);
+                fprintf(file, "%llu", numbers[index - 1]);
+                line = number;
+            }
+        }
+        fwrite(line, sizeof(char), at - line, file);
+    }
+}
+
+// Prints the texts of every top level declaration as one module: the strings they use, their procedures, then the
+// runtime procedures they call
+void IrText_Print(FILE* file, IrText* texts) {
+    IrModule* module = IrModule_Create();
+    u64 runtime = 0;
+    u64** numbers = Allocate(DynamicArrayLength(texts) * sizeof(u64*) + 1);
+    for (u64 i = 0; i < DynamicArrayLength(texts); i++) {
+        numbers[i] = Allocate(texts[i].StringCount * sizeof(u64) + 1);
+        for (u64 j = 0; j < texts[i].StringCount; j++) {
+            numbers[i][j] = IrModule_InternString(module, texts[i].Strings[j], texts[i].StringLengths[j]);
+        }
+        runtime |= texts[i].Runtime;
+    }
+
+    if (runtime & IrTextRuntime_GrowArray) {
+        Lower_GrowArray(module);
+    }
+    if (runtime & IrTextRuntime_Reallocate) {
+        Lower_Reallocate(module);
+    }
+    if (runtime & IrTextRuntime_HashString) {
+        Lower_HashString(module);
+    }
+    if (runtime & IrTextRuntime_StringEqual) {
+        Lower_StringEqual(module);
+    }
+    IrOptimize_Module(module);
+
+    IrModule_PrintStrings(file, module);
+    b8 first = TRUE;
+    for (u64 i = 0; i < DynamicArrayLength(texts); i++) {
+        if (texts[i].ProceduresSize > 0) {
+            if (!first) {
+                fputc('\n', file);
+            }
+            IrText_PrintProcedures(file, &texts[i], numbers[i]);
+            first = FALSE;
+        }
+        free(numbers[i]);
+    }
+    for (u64 i = 0; i < DynamicArrayLength(module->Procedures); i++) {
+        if (!first) {
+            fputc('\n', file);
+        }
+        IrProcedure_Print(file, module->Procedures[i]);
+        first = FALSE;
+    }
+    free(numbers);
+}
+
+void Compile_PrintIr(AstScope* globalScope, b8 printIr, b8 printRegisters) {
+    Stats_BeginPhase("lower");
+    IrModule* module = Lower_Module(globalScope);
+    Stats_EndPhase();
+
+    Stats_BeginPhase("optimize");
+    IrOptimize_Module(module);
+    Stats_EndPhase();
+
+    if (printIr) {
+        Stats_BeginPhase("print ir");
+        IrText* texts = DynamicArrayCreate(IrText);
+        for (u64 i = 0; i < DynamicArrayLength(globalScope->Statements); i++) {
+            AstStatement* statement = globalScope->Statements[i];
+            u64 size;
+            char* data = IrText_Create(module, statement->Kind == AstStatementKind_Declaration ? statement->Declaration.Name.Name : NULL, &size);
+            IrText text;
+            IrText_Parse(data, size, &text);
+            DynamicArrayPush(texts, text);
+        }
+        IrText_Print(stdout, texts);
+        Stats_EndPhase();
+    }
+
+    if (printRegisters) {
+        for (u64 i = 0; i < DynamicArrayLength(module->Procedures); i++) {
+            Stats_BeginPhase("register allocation");
+            Trace_BeginZone("procedure");
+            Trace_ZoneDetail(module->Procedures[i]->Name);
+            RegisterAllocation* allocation = RegisterAllocator_Allocate(module->Procedures[i]);
+            Trace_EndZone();
+            Stats_EndPhase();
+
+            if (printIr || i > 0) {
+                putchar('\n');
+            }
+            RegisterAllocation_Print(allocation);
+        }
+    }
+}
+
+// Incremental compilation cache
+
+#define CacheDirectory ".thallium-cache"
+#define CacheVersion 5 // Bump whenever the output for the same source changes
+
+typedef struct TopLevelDeclaration {
+    AstStatement* Statement;
+    // Token indices, only known when parsing from a token array. The parser looks at the token after the declaration
+    // to decide where the declaration ends, so it is part of what the declaration depends on.
+    u64 FirstToken;
+    u64 NextToken;
+    u64 ContentHash; // Hash of the tokens of the declaration
+    const char** Names; // Every name the tokens mention, a superset of the declarations referenced
+    u64 Key; // Content hash combined with the content hashes of every declaration it can reach
+    char* CachedIr;
+    u64 CachedIrSize;
+} TopLevelDeclaration;
+
+const char* TopLevelDeclaration_Name(TopLevelDeclaration* declaration) {
+    if (declaration->Statement->Kind != AstStatementKind_Declaration) {
+        return NULL;
+    }
+    return declaration->Statement->Declaration.Name.Name;
+}
+
+TopLevelDeclaration Parser_ParseTopLevelDeclaration(Parser* parser, AstScope* globalScope) {
+    parser->Hash = Hash_Initial;
+    parser->Names = DynamicArrayCreate(const char*);
+
+    u64 firstToken = parser->TokenIndex;
+    AstStatement* statement = Parser_TryParseStatement(parser, globalScope);
+    return (TopLevelDeclaration){
+        .Statement = statement,
+        .FirstToken = firstToken,
+        .NextToken = parser->TokenIndex,
+        .ContentHash = parser->Hash,
+        .Names = parser->Names,
+    };
+}
+
+void Cache_ComputeKeys(TopLevelDeclaration* declarations) {
+    u64 count = DynamicArrayLength(declarations);
+    b8* reachable = Allocate(count * sizeof(b8) + 1);
+    u64* worklist = DynamicArrayCreate(u64);
+
+    for (u64 i = 0; i < count; i++) {
+        memset(reachable, 0, count * sizeof(b8));
+        reachable[i] = TRUE;
+        DynamicArrayPush(worklist, i);
+        while (DynamicArrayLength(worklist) > 0) {
+            u64 index;
+            DynamicArrayPop(worklist, &index);
+
+            const char** names = declarations[index].Names;
+            for (u64 j = 0; j < DynamicArrayLength(names); j++) {
+                for (u64 k = 0; k < count; k++) {
+                    const char* name = TopLevelDeclaration_Name(&declarations[k]);
+                    if (!reachable[k] && name && strcmp(name, names[j]) == 0) {
+                        reachable[k] = TRUE;
+                        DynamicArrayPush(worklist, k);
+                    }
+                }
+            }
+        }
+
+        // The instances of a polymorphic procedure depend on the types it is called with, wherever that is
+        AstStatement* statement = declarations[i].Statement;
+        if (statement->Kind == AstStatementKind_Declaration && Ast_IsPolymorphic(statement->Declaration.Value)) {
+            memset(reachable, TRUE, count * sizeof(b8));
+        }
+
+        // Its own content comes first, declarations that reach each other would share a key otherwise
+        u64 key = Hash_U64(Hash_Initial, CacheVersion);
+        key = Hash_U64(key, declarations[i].ContentHash);
+        for (u64 j = 0; j < count; j++) {
+            if (reachable[j]) {
+                key = Hash_U64(key, declarations[j].ContentHash);
+            }
+        }
+        declarations[i].Key = key;
+    }
+
+    DynamicArrayDestroy(worklist);
+    free(reachable);
+}
+
+// Prints the optimized ir of every top level declaration, declarations whose key is in the cache are neither checked nor lowered
+void Cache_PrintIr(TopLevelDeclaration* declarations, AstScope* globalScope) {
+    if (!Cache_Init(CacheDirectory)) {
+        printf("Warning: unable to create '%s', compiling without a cache\n", CacheDirectory);
+    }
+
+    u64 count = DynamicArrayLength(declarations);
+    for (u64 i = 0; i < count; i++) {
+        declarations[i].CachedIr = Cache_Load(CacheDirectory, declarations[i].Key, &declarations[i].CachedIrSize);
+
+        // A damaged entry is lowered again like a miss
+        IrText text;
+        if (declarations[i].CachedIr && IrText_Parse(declarations[i].CachedIr, declarations[i].CachedIrSize, &text)) {
+            free(text.Strings);
+            free(text.StringLengths);
+        } else if (declarations[i].CachedIr) {
+            free(declarations[i].CachedIr);
+            declarations[i].CachedIr = NULL;
+        }
+    }
+
+    // Cached declarations are still completed on demand when a changed declaration refers to them
+    IrModule* module = IrModule_Create();
+    for (u64 i = 0; i < count; i++) {
+        if (declarations[i].CachedIr) {
+            continue;
+        }
+
+        Trace_BeginZone("declaration");
+        Trace_ZoneDetail(TopLevelDeclaration_Name(&declarations[i]));
+        AstStatement* statement = declarations[i].Statement;
+        Complete_Statement(statement, globalScope);
+        if (statement->Kind == AstStatementKind_Declaration && statement->Declaration.Constant &&
+            statement->Declaration.Value->Kind == AstExpressionKind_Procedure) {
+            AstProcedure* procedure = &statement->Declaration.Value->Procedure;
+            if (procedure->TypeParameters) {
+                // The instances come from calls anywhere in the file, cached or not
+                for (u64 j = 0; j < count; j++) {
+                    Complete_Statement(declarations[j].Statement, globalScope);
+                }
+                for (u64 j = 0; j < DynamicArrayLength(procedure->Instances); j++) {
+                    Lower_Procedure(module, &procedure->Instances[j].Instance->Procedure);
+                }
+            } else {
+                Lower_Procedure(module, procedure);
+            }
+        }
+        Trace_EndZone();
+    }
+    IrOptimize_Module(module);
+
+    IrText* texts = DynamicArrayCreate(IrText);
+    for (u64 i = 0; i < count; i++) {
+        TopLevelDeclaration* declaration = &declarations[i];
+        IrText text;
+        if (!declaration->CachedIr) {
+            declaration->CachedIr = IrText_Create(module, TopLevelDeclaration_Name(declaration), &declaration->CachedIrSize);
+            Cache_Store(CacheDirectory, declaration->Key, declaration->CachedIr, declaration->CachedIrSize);
+        }
+        IrText_Parse(declaration->CachedIr, declaration->CachedIrSize, &text);
+        DynamicArrayPush(texts, text);
+    }
+    IrText_Print(stdout, texts);
+}
+
+typedef enum AstDumpFormat {
+    AstDumpFormat_Text,
+    AstDumpFormat_Json,
+    AstDumpFormat_Binary,
+} AstDumpFormat;
+
+void Print_Indent(u64 indent);
+void Print_AstType(Writer* writer, AstType* type, u64 indent);
+void Print_AstStatement(Writer* writer, AstStatement* statement, u64 indent);
+void Print_AstExpression(Writer* writer, AstExpression* expression, u64 indent);
+void Dump_Ast(FILE* file, AstStatement* globalStatement, AstDumpFormat format);
+
+// Module files
+//
+// A checked AST and its types written out without any pointers so it can be mapped and read in place.
+// Every table starts with an unused entry so a ModuleRef of 0 means null.
+
+#define ModuleMagic "THMODULE"
+#define ModuleVersion 8
+
+typedef u32 ModuleRef;
+
+typedef struct ModuleSection {
+    u64 Offset;
+    u64 Count;
+} ModuleSection;
+
+typedef struct ModuleHeader {
+    char Magic[8];
+    u32 Version;
+    ModuleRef Root; // Scope statement holding the top level statements
+
+    ModuleSection Strings;
+    ModuleSection StringData;
+    ModuleSection Types;
+    ModuleSection Expressions;
+    ModuleSection Statements;
+    ModuleSection Refs; // Lists of refs, stored as a first index and a count by their owner
+    ModuleSection Integers; // Struct field offsets
+} ModuleHeader;
+
+typedef struct ModuleString {
+    u32 Offset;
+    u32 Length;
+} ModuleString;
+
+enum {
+    ModuleFlag_Signed = 1 << 0,
+    ModuleFlag_Packed = 1 << 1,
+    ModuleFlag_Reorder = 1 << 2,
+    ModuleFlag_Dynamic = 1 << 3,
+    ModuleFlag_Constant = 1 << 4,
+    ModuleFlag_LValue = 1 << 5,
+    ModuleFlag_AddressTaken = 1 << 6,
+    ModuleFlag_NoBoundsCheck = 1 << 7,
+    ModuleFlag_Polymorphic = 1 << 8,
+    ModuleFlag_Soa = 1 << 9,
+};
+
+typedef struct ModuleType {
+    u32 Kind;
+    u32 Flags;
+    u64 Size;
+    u64 Align;
+    u64 Count; // Element count of fixed arrays and lanes of vectors
+    ModuleRef Name; // Unknown and struct types
+    ModuleRef Base; // Pointer and array element type, procedure return type
+    ModuleRef First; // Procedure argument types, struct field declarations or type arguments
+    u32 Length;
+    u32 Offsets; // First struct field offset in Integers
+    u32 Padding;
+} ModuleType;
+
+typedef struct ModuleExpression {
+    u32 Kind;
+    u32 Flags;
+    ModuleRef Type;
+    ModuleRef TypeValue;
+    u32 A, B, C, D; // See ModuleWriter_Expression for what each kind stores
+    u64 Value;
+} ModuleExpression;
+
+typedef struct ModuleStatement {
+    u32 Kind;
+    u32 Flags;
+    u32 A, B, C, D; // See ModuleWriter_Statement for what each kind stores
+} ModuleStatement;
+
+STATIC_ASSERT(sizeof(ModuleType) == 56, "ModuleType is part of the file format");
+STATIC_ASSERT(sizeof(ModuleExpression) == 40, "ModuleExpression is part of the file format");
+STATIC_ASSERT(sizeof(ModuleStatement) == 24, "ModuleStatement is part of the file format");
+
+typedef struct ModulePointerEntry {
+    const void* Key;
+    ModuleRef Value;
+} ModulePointerEntry;
+
+// Open addressing map from AST pointers to the refs they were written as
+typedef struct ModulePointerMap {
+    ModulePointerEntry* Entries;
+    u64 Capacity;
+    u64 Count;
+} ModulePointerMap;
+
+typedef struct ModuleNameFixup {
+    u64 Expression;
+    AstDeclaration* Declaration;
+} ModuleNameFixup;
+
+typedef struct ModuleWriter {
+    char* StringData;
+    ModuleString* Strings;
+    ModuleType* Types;
+    ModuleExpression* Expressions;
+    ModuleStatement* Statements;
+    ModuleRef* Refs;
+    u64* Integers;
+
+    u32* StringTable; // Open addressing, indices into Strings
+    u64 StringTableCapacity;
+
+    ModulePointerMap TypeMap;
+    ModulePointerMap DeclarationMap;
+
+    ModuleNameFixup* Fixups;
+} ModuleWriter;
+
+u64 ModulePointer_Hash(const void* pointer) {
+    u64 value = cast(u64) pointer;
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDull;
+    value ^= value >> 33;
+    return value;
+}
+
+ModulePointerEntry* ModulePointerMap_Slot(ModulePointerEntry* entries, u64 capacity, const void* key) {
+    u64 index = ModulePointer_Hash(key) & (capacity - 1);
+    while (entries[index].Key && entries[index].Key != key) {
+        index = (index + 1) & (capacity - 1);
+    }
+    return &entries[index];
+}
+
+ModuleRef ModulePointerMap_Get(ModulePointerMap* map, const void* key) {
+    if (map->Capacity == 0) {
+        return 0;
+    }
+    return ModulePointerMap_Slot(map->Entries, map->Capacity, key)->Value;
+}
+
+// Returns the existing ref, or 0 after inserting the new one
+ModuleRef ModulePointerMap_Insert(ModulePointerMap* map, const void* key, ModuleRef value) {
+    if ((map->Count + 1) * 2 > map->Capacity) {
+        u64 capacity = map->Capacity ? map->Capacity * 2 : 256;
+        ModulePointerEntry* entries = Allocate(capacity * sizeof(ModulePointerEntry));
+        for (u64 i = 0; i < map->Capacity; i++) {
+            if (map->Entries[i].Key) {
+                *ModulePointerMap_Slot(entries, capacity, map->Entries[i].Key) = map->Entries[i];
+            }
+        }
+        free(map->Entries);
+        map->Entries = entries;
+        map->Capacity = capacity;
+    }
+
+    ModulePointerEntry* slot = ModulePointerMap_Slot(map->Entries, map->Capacity, key);
+    if (slot->Key) {
+        return slot->Value;
+    }
+    slot->Key = key;
+    slot->Value = value;
+    map->Count++;
+    return 0;
+}
+
+void ModuleWriter_Init(ModuleWriter* writer) {
+    *writer = (ModuleWriter){};
+    writer->StringData = DynamicArrayCreate(char);
+    writer->Strings = DynamicArrayCreate(ModuleString);
+    writer->Types = DynamicArrayCreate(ModuleType);
+    writer->Expressions = DynamicArrayCreate(ModuleExpression);
+    writer->Statements = DynamicArrayCreate(ModuleStatement);
+    writer->Refs = DynamicArrayCreate(ModuleRef);
+    writer->Integers = DynamicArrayCreate(u64);
+    writer->Fixups = DynamicArrayCreate(ModuleNameFixup);
+
+    DynamicArrayPush(writer->Strings, ((ModuleString){}));
+    DynamicArrayPush(writer->Types, ((ModuleType){}));
+    DynamicArrayPush(writer->Expressions, ((ModuleExpression){}));
+    DynamicArrayPush(writer->Statements, ((ModuleStatement){}));
+    DynamicArrayPush(writer->Refs, 0);
+    DynamicArrayPush(writer->Integers, 0);
+
+    writer->StringTableCapacity = 1024;
+    writer->StringTable = Allocate(writer->StringTableCapacity * sizeof(u32));
+}
+
+ModuleRef ModuleWriter_Bytes(ModuleWriter* writer, const char* string, u64 length) {
+    if ((DynamicArrayLength(writer->Strings) + 1) * 2 > writer->StringTableCapacity) {
+        u64 capacity = writer->StringTableCapacity * 2;
+        u32* table = Allocate(capacity * sizeof(u32));
+        for (u64 i = 1; i < DynamicArrayLength(writer->Strings); i++) {
+            ModuleString entry = writer->Strings[i];
+            u64 index = Hash_Bytes(Hash_Initial, &writer->StringData[entry.Offset], entry.Length) & (capacity - 1);
+            while (table[index]) {
+                index = (index + 1) & (capacity - 1);
+            }
+            table[index] = i;
+        }
+        free(writer->StringTable);
+        writer->StringTable = table;
+        writer->StringTableCapacity = capacity;
+    }
+
+    u64 index = Hash_Bytes(Hash_Initial, string, length) & (writer->StringTableCapacity - 1);
+    while (writer->StringTable[index]) {
+        ModuleString entry = writer->Strings[writer->StringTable[index]];
+        if (entry.Length == length && memcmp(&writer->StringData[entry.Offset], string, length) == 0) {
+            return writer->StringTable[index];
+        }
+        index = (index + 1) & (writer->StringTableCapacity - 1);
+    }
+
+    ModuleRef ref = DynamicArrayLength(writer->Strings);
+    DynamicArrayPush(writer->Strings, ((ModuleString){ .Offset = DynamicArrayLength(writer->StringData), .Length = length }));
+    for (u64 i = 0; i < length; i++) {
+        DynamicArrayPush(writer->StringData, string[i]);
+    }
+    DynamicArrayPush(writer->StringData, '\0');
+    writer->StringTable[index] = ref;
+    return ref;
+}
+
+ModuleRef ModuleWriter_String(ModuleWriter* writer, const char* string) {
+    if (!string) {
+        return 0;
+    }
+    return ModuleWriter_Bytes(writer, string, strlen(string));
+}
+
+ModuleRef ModuleWriter_Expression(ModuleWriter* writer, AstExpression* expression);
+ModuleRef ModuleWriter_Statement(ModuleWriter* writer, AstStatement* statement);
+ModuleRef ModuleWriter_Declaration(ModuleWriter* writer, AstDeclaration* declaration);
+
+ModuleRef ModuleWriter_Type(ModuleWriter* writer, AstType* type) {
+    if (!type) {
+        return 0;
+    }
+
+    // Reserved before the children are written so recursive types refer back to it
+    ModuleRef ref = DynamicArrayLength(writer->Types);
+    ModuleRef existing = ModulePointerMap_Insert(&writer->TypeMap, type, ref);
+    if (existing) {
+        return existing;
+    }
+    DynamicArrayPush(writer->Types, ((ModuleType){}));
+
+    ModuleType result = {
+        .Kind = type->Kind,
+        .Size = type->Size,
+    };
+
+    switch (type->Kind) {
+        case AstTypeKind_Unknown: {
+            AstType** typeArguments = type->Unknown.TypeArguments;
+            u64 count = typeArguments ? DynamicArrayLength(typeArguments) : 0;
+            ModuleRef* arguments = Allocate((count + 1) * sizeof(ModuleRef));
+            for (u64 i = 0; i < count; i++) {
+                arguments[i] = ModuleWriter_Type(writer, typeArguments[i]);
+            }
+
+            result.Name = ModuleWriter_String(writer, type->Unknown.Name.Name);
+            result.Flags = type->Unknown.Polymorphic ? ModuleFlag_Polymorphic : 0;
+            result.First = DynamicArrayLength(writer->Refs);
+            result.Length = count;
+            for (u64 i = 0; i < count; i++) {
+                DynamicArrayPush(writer->Refs, arguments[i]);
+            }
+            free(arguments);
+        } break;
+
+        case AstTypeKind_Integer:
+        case AstTypeKind_Float: {
+            result.Flags = type->Signed ? ModuleFlag_Signed : 0;
+        } break;
+
+        case AstTypeKind_Pointer: {
+            result.Base = ModuleWriter_Type(writer, type->Pointer.PointerTo);
+        } break;
+
+        case AstTypeKind_Procedure: {
+            u64 count = DynamicArrayLength(type->Procedure.Arguments);
+            ModuleRef* arguments = Allocate((count + 1) * sizeof(ModuleRef));
+            for (u64 i = 0; i < count; i++) {
+                arguments[i] = ModuleWriter_Type(writer, type->Procedure.Arguments[i].Type);
+            }
+
+            result.First = DynamicArrayLength(writer->Refs);
+            result.Length = count;
+            for (u64 i = 0; i < count; i++) {
+                DynamicArrayPush(writer->Refs, arguments[i]);
+            }
+            free(arguments);
+
+            result.Base = ModuleWriter_Type(writer, type->Procedure.ReturnType);
+        } break;
+
+        case AstTypeKind_Struct: {
+            AstStruct* struct_ = &type->Struct;
+            u64 count = DynamicArrayLength(struct_->Declarations);
+            ModuleRef* fields = Allocate((count + 1) * sizeof(ModuleRef));
+            for (u64 i = 0; i < count; i++) {
+                fields[i] = ModuleWriter_Declaration(writer, &struct_->Declarations[i]);
+            }
+
+            result.Name = ModuleWriter_String(writer, struct_->Name);
+            result.Flags = (struct_->Packed ? ModuleFlag_Packed : 0) | (struct_->Reorder ? ModuleFlag_Reorder : 0);
+            result.First = DynamicArrayLength(writer->Refs);
+            result.Length = count;
+            for (u64 i = 0; i < count; i++) {
+                DynamicArrayPush(writer->Refs, fields[i]);
+            }
+            free(fields);
+
+            if (struct_->Offsets) {
+                result.Align = type->Align;
+                result.Offsets = DynamicArrayLength(writer->Integers);
+                for (u64 i = 0; i < count; i++) {
+                    DynamicArrayPush(writer->Integers, struct_->Offsets[i]);
+                }
+            }
+        } break;
+
+        case AstTypeKind_Array: {
+            result.Flags = (type->Array.Dynamic ? ModuleFlag_Dynamic : 0) | (type->Array.Soa ? ModuleFlag_Soa : 0);
+            result.Count = type->Array.ElementCount;
+            result.Base = ModuleWriter_Type(writer, type->Array.ArrayOf);
+        } break;
+
+        case AstTypeKind_Vector: {
+            result.Count = type->Array.ElementCount;
+            result.Base = ModuleWriter_Type(writer, type->Array.ArrayOf);
+        } break;
+
+        default: {
+        } break;
+    }
+
+    if (type->Completion == AstTypeCompletion_Complete && type->Kind != AstTypeKind_Unknown) {
+        result.Size = Type_Size(type);
+        result.Align = Type_Align(type);
+    }
+
+    writer->Types[ref] = result;
+    return ref;
+}
+
+ModuleRef ModuleWriter_ExpressionList(ModuleWriter* writer, AstExpression** expressions, u32* count) {
+    *count = DynamicArrayLength(expressions);
+    ModuleRef* refs = Allocate((*count + 1) * sizeof(ModuleRef));
+    for (u64 i = 0; i < *count; i++) {
+        refs[i] = ModuleWriter_Expression(writer, expressions[i]);
+    }
+
+    ModuleRef first = DynamicArrayLength(writer->Refs);
+    for (u64 i = 0; i < *count; i++) {
+        DynamicArrayPush(writer->Refs, refs[i]);
+    }
+    free(refs);
+    return first;
+}
+
+// Literal: A is the token kind, B a string or Value the integer or float bits
+// Name: A is the name, B the declaration statement
+// Unary: A is the operator, B the operand
+// Binary: A is the operator, B and C the operands
+// Field: B is the operand, C the name, Value the field index
+// Struct: A and B are the field declarations, C is the name, D and Value the type parameter names
+// Procedure: A and B are the argument declarations, C is the return type, D the body, Value the name
+// Call: A and B are the arguments, C is the operand
+// Index: B is the operand, C the index
+// Sizeof: B is the operand
+// Cast: B is the operand, C the type
+// Run: B is the operand, Value the result
+ModuleExpression ModuleWriter_ExpressionHeader(ModuleWriter* writer, AstExpression* expression) {
+    return (ModuleExpression){
+        .Kind = expression->Kind,
+        .Flags = (expression->Constant ? ModuleFlag_Constant : 0) | (expression->IsLValue ? ModuleFlag_LValue : 0),
+        .Type = ModuleWriter_Type(writer, expression->Type),
+        .TypeValue = ModuleWriter_Type(writer, expression->TypeValue),
+    };
+}
+
+typedef struct ModuleWriterLink {
+    AstExpression* Expression;
+    ModuleRef Ref;
+    ModuleExpression Result;
+} ModuleWriterLink;
+
+ModuleRef ModuleWriter_Expression(ModuleWriter* writer, AstExpression* expression) {
+    if (!expression) {
+        return 0;
+    }
+
+    ModuleRef ref = DynamicArrayLength(writer->Expressions);
+    DynamicArrayPush(writer->Expressions, ((ModuleExpression){}));
+
+    ModuleExpression result = ModuleWriter_ExpressionHeader(writer, expression);
+
+    switch (expression->Kind) {
+        case AstExpressionKind_Literal: {
+            Token token = expression->Literal.Token;
+            result.A = token.Kind;
+            if (token.Kind == TokenKind_String) {
+                result.B = ModuleWriter_Bytes(writer, token.String, token.StringLength);
+            } else if (token.Kind == TokenKind_Float) {
+                memcpy(&result.Value, &token.Float, sizeof(f64));
+            } else {
+                result.Value = token.Integer;
+            }
+        } break;
+
+        case AstExpressionKind_Name: {
+            result.A = ModuleWriter_String(writer, expression->Name.Name.Name);
+            if (expression->Name.Declaration) { // Resolved once every declaration has been written
+                DynamicArrayPush(writer->Fixups, ((ModuleNameFixup){ .Expression = ref, .Declaration = expression->Name.Declaration }));
+            }
+        } break;
+
+        case AstExpressionKind_Unary: {
+            result.A = expression->Unary.Operator.Kind;
+            result.B = ModuleWriter_Expression(writer, expression->Unary.Operand);
+        } break;
+
+        case AstExpressionKind_Binary: {
+            // Binary chains nest to the left, every link is reserved walking down the chain, in the same order the
+            // recursion would, and filled in walking back up
+            ModuleWriterLink* chain = DynamicArrayCreate(ModuleWriterLink);
+            DynamicArrayPush(chain, ((ModuleWriterLink){ .Expression = expression, .Ref = ref, .Result = result }));
+            AstExpression* operand = expression->Binary.Left;
+            while (operand && operand->Kind == AstExpressionKind_Binary) {
+                ModuleWriterLink link = { .Expression = operand, .Ref = DynamicArrayLength(writer->Expressions) };
+                DynamicArrayPush(writer->Expressions, ((ModuleExpression){}));
+                link.Result = ModuleWriter_ExpressionHeader(writer, operand);
+                DynamicArrayPush(chain, link);
+                operand = operand->Binary.Left;
+            }
+
+            ModuleRef left = ModuleWriter_Expression(writer, operand);
+            for (u64 i = DynamicArrayLength(chain); i > 1; i--) {
+                ModuleWriterLink* link = &chain[i - 1];
+                link->Result.A = link->Expression->Binary.Operator.Kind;
+                link->Result.B = left;
+                link->Result.C = ModuleWriter_Expression(writer, link->Expression->Binary.Right);
+                writer->Expressions[link->Ref] = link->Result;
+                left = link->Ref;
+            }
+            DynamicArrayDestroy(chain);
+
+            result.A = expression->Binary.Operator.Kind;
+            result.B = left;
+            result.C = ModuleWriter_Expression(writer, expression->Binary.Right);
+        } break;
+
+        case AstExpressionKind_Field: {
+            result.B = ModuleWriter_Expression(writer, expression->Field.Expression);
+            result.C = ModuleWriter_String(writer, expression->Field.Name.Name);
+            result.Value = expression->Field.Index;
+        } break;
+
+        case AstExpressionKind_Struct: {
+            AstStruct* struct_ = &expression->Struct;
+            u64 count = DynamicArrayLength(struct_->Declarations);
+            ModuleRef* fields = Allocate((count + 1) * sizeof(ModuleRef));
+            for (u64 i = 0; i < count; i++) {
+                fields[i] = ModuleWriter_Declaration(writer, &struct_->Declarations[i]);
+            }
+
+            result.A = DynamicArrayLength(writer->Refs);
+            result.B = count;
+            for (u64 i = 0; i < count; i++) {
+                DynamicArrayPush(writer->Refs, fields[i]);
+            }
+            free(fields);
+
+            result.C = ModuleWriter_String(writer, struct_->Name);
+            result.Flags |= (struct_->Packed ? ModuleFlag_Packed : 0) | (struct_->Reorder ? ModuleFlag_Reorder : 0);
+
+            if (struct_->TypeParameters) {
+                u64 parameterCount = DynamicArrayLength(struct_->TypeParameters);
+                ModuleRef* parameters = Allocate((parameterCount + 1) * sizeof(ModuleRef));
+                for (u64 i = 0; i < parameterCount; i++) {
+                    parameters[i] = ModuleWriter_String(writer, struct_->TypeParameters[i].Name);
+                }
+
+                result.D = DynamicArrayLength(writer->Refs);
+                result.Value = parameterCount;
+                for (u64 i = 0; i < parameterCount; i++) {
+                    DynamicArrayPush(writer->Refs, parameters[i]);
+                }
+                free(parameters);
+            }
+        } break;
+
+        case AstExpressionKind_Procedure: {
+            AstProcedure* procedure = &expression->Procedure;
+            u64 count = DynamicArrayLength(procedure->Arguments);
+            ModuleRef* arguments = Allocate((count + 1) * sizeof(ModuleRef));
+            for (u64 i = 0; i < count; i++) {
+                arguments[i] = ModuleWriter_Statement(writer, procedure->Arguments[i].Declaration);
+            }
+
+            result.A = DynamicArrayLength(writer->Refs);
+            result.B = count;
+            for (u64 i = 0; i < count; i++) {
+                DynamicArrayPush(writer->Refs, arguments[i]);
+            }
+            free(arguments);
+
+            result.C = ModuleWriter_Type(writer, procedure->ReturnType);
+            result.D = ModuleWriter_Statement(writer, &(AstStatement){
+                .Kind = AstStatementKind_Scope,
+                .Scope = *procedure->Body,
+            });
+            result.Value = ModuleWriter_String(writer, procedure->Name);
+        } break;
+
+        case AstExpressionKind_Call: {
+            result.C = ModuleWriter_Expression(writer, expression->Call.Operand);
+            result.A = ModuleWriter_ExpressionList(writer, expression->Call.Arguments, &result.B);
+        } break;
+
+        case AstExpressionKind_Index: {
+            result.B = ModuleWriter_Expression(writer, expression->Index.Operand);
+            result.C = ModuleWriter_Expression(writer, expression->Index.Index);
+        } break;
+
+        case AstExpressionKind_Sizeof: {
+            result.B = ModuleWriter_Expression(writer, expression->SizeOf.Expression);
+        } break;
+
+        case AstExpressionKind_Cast: {
+            result.B = ModuleWriter_Expression(writer, expression->Cast.Expression);
+            result.C = ModuleWriter_Type(writer, expression->Cast.Type);
+        } break;
+
+        case AstExpressionKind_Run: {
+            result.B = ModuleWriter_Expression(writer, expression->Run.Expression);
+            result.Value = expression->Run.Value;
+        } break;
+
+        default: {
+        } break;
+    }
+
+    writer->Expressions[ref] = result;
+    return ref;
+}
+
+// Declaration: A is the name, B the type, C the value
+ModuleRef ModuleWriter_Declaration(ModuleWriter* writer, AstDeclaration* declaration) {
+    ModuleRef ref = DynamicArrayLength(writer->Statements);
+    ModuleRef existing = ModulePointerMap_Insert(&writer->DeclarationMap, declaration, ref);
+    if (existing) {
+        return existing;
+    }
+    DynamicArrayPush(writer->Statements, ((ModuleStatement){}));
+
+    ModuleStatement result = {
+        .Kind = AstStatementKind_Declaration,
+        .Flags = (declaration->Constant ? ModuleFlag_Constant : 0) | (declaration->AddressTaken ? ModuleFlag_AddressTaken : 0),
+        .A = ModuleWriter_String(writer, declaration->Name.Name),
+        .B = ModuleWriter_Type(writer, declaration->Type),
+        .C = ModuleWriter_Expression(writer, declaration->Value),
+    };
+
+    writer->Statements[ref] = result;
+    return ref;
+}
+
+// Expression: A is the expression
+// Scope: A and B are the statements, flagged with ModuleFlag_NoBoundsCheck for '#no_bounds_check'
+// Assignment: A is the operand, B the operator, C the value
+// Return: A is the value
+// If: A is the condition, B the then and C the else statement
+// While: A is the condition, B the body
+// For: A is the variable declaration, whose value is the start, B the end and C the body scope
+ModuleRef ModuleWriter_Statement(ModuleWriter* writer, AstStatement* statement) {
+    if (!statement) {
+        return 0;
+    }
+
+    if (statement->Kind == AstStatementKind_Declaration) {
+        return ModuleWriter_Declaration(writer, &statement->Declaration);
+    }
+
+    ModuleRef ref = DynamicArrayLength(writer->Statements);
+    DynamicArrayPush(writer->Statements, ((ModuleStatement){}));
+
+    ModuleStatement result = {
+        .Kind = statement->Kind,
+    };
+
+    switch (statement->Kind) {
+        case AstStatementKind_Expression: {
+            result.A = ModuleWriter_Expression(writer, &statement->Expression);
+        } break;
+
+        case AstStatementKind_Scope: {
+            u64 count = DynamicArrayLength(statement->Scope.Statements);
+            ModuleRef* statements = Allocate((count + 1) * sizeof(ModuleRef));
+            for (u64 i = 0; i < count; i++) {
+                statements[i] = ModuleWriter_Statement(writer, statement->Scope.Statements[i]);
+            }
+
+            result.Flags = statement->Scope.NoBoundsCheck ? ModuleFlag_NoBoundsCheck : 0;
+            result.A = DynamicArrayLength(writer->Refs);
+            result.B = count;
+            for (u64 i = 0; i < count; i++) {
+                DynamicArrayPush(writer->Refs, statements[i]);
+            }
+            free(statements);
+        } break;
+
+        case AstStatementKind_Assignment: {
+            result.A = ModuleWriter_Expression(writer, statement->Assignment.Operand);
+            result.B = statement->Assignment.Operator.Kind;
+            result.C = ModuleWriter_Expression(writer, statement->Assignment.Value);
+        } break;
+
+        case AstStatementKind_Return: {
+            result.A = ModuleWriter_Expression(writer, statement->Return.Expression);
+        } break;
+
+        case AstStatementKind_If: {
+            // 'else if' chains are written in a loop, each link is reserved before its condition is written, in the
+            // same order the recursion would
+            ModuleRef linkRef = ref;
+            ModuleStatement link = result;
+            while (TRUE) {
+                link.A = ModuleWriter_Expression(writer, statement->If.Condition);
+                link.B = ModuleWriter_Statement(writer, statement->If.Then);
+                AstStatement* else_ = statement->If.Else;
+                if (else_ && else_->Kind == AstStatementKind_If) {
+                    link.C = DynamicArrayLength(writer->Statements);
+                    DynamicArrayPush(writer->Statements, ((ModuleStatement){}));
+                } else {
+                    link.C = ModuleWriter_Statement(writer, else_);
+                }
+
+                if (linkRef == ref) {
+                    result = link;
+                } else {
+                    writer->Statements[linkRef] = link;
+                }
+                if (!else_ || else_->Kind != AstStatementKind_If) {
+                    break;
+                }
+                linkRef = link.C;
+                link = (ModuleStatement){ .Kind = AstStatementKind_If };
+                statement = else_;
+            }
+        } break;
+
+        case AstStatementKind_While: {
+            result.A = ModuleWriter_Expression(writer, statement->While.Condition);
+            result.B = ModuleWriter_Statement(writer, statement->While.Body);
+        } break;
+
+        case AstStatementKind_For: {
+            result.A = ModuleWriter_Statement(writer, statement->For.Variable);
+            result.B = ModuleWriter_Expression(writer, statement->For.End);
+            result.C = ModuleWriter_Statement(writer, &(AstStatement){
+                .Kind = AstStatementKind_Scope,
+                .Scope = *statement->For.Body,
+            });
+        } break;
+
+        case AstStatementKind_Switch: {
+            // Every case is its body, the number of values and the values, one after another in Refs
+            ModuleRef* cases = DynamicArrayCreate(ModuleRef);
+            for (u64 i = 0; i < DynamicArrayLength(statement->Switch.Cases); i++) {
+                AstCase* case_ = &statement->Switch.Cases[i];
+                DynamicArrayPush(cases, ModuleWriter_Statement(writer, case_->Body));
+                DynamicArrayPush(cases, cast(ModuleRef) DynamicArrayLength(case_->Values));
+                for (u64 j = 0; j < DynamicArrayLength(case_->Values); j++) {
+                    DynamicArrayPush(cases, ModuleWriter_Expression(writer, case_->Values[j]));
+                }
+            }
+
+            result.A = ModuleWriter_Expression(writer, statement->Switch.Value);
+            result.D = ModuleWriter_Statement(writer, statement->Switch.Else);
+            result.B = DynamicArrayLength(writer->Refs);
+            result.C = DynamicArrayLength(statement->Switch.Cases);
+            for (u64 i = 0; i < DynamicArrayLength(cases); i++) {
+                DynamicArrayPush(writer->Refs, cases[i]);
+            }
+            DynamicArrayDestroy(cases);
+        } break;
+
+        default: {
+            ASSERT(FALSE);
+        } break;
+    }
+
+    writer->Statements[ref] = result;
+    return ref;
+}
+
+u64 Module_Align(u64 offset) {
+    return (offset + 7) & ~cast(u64) 7;
+}
+
+b8 Module_Write(const char* path, AstStatement* root) {
+    ModuleWriter writer;
+    ModuleWriter_Init(&writer);
+    ModuleHeader header = {
+        .Version = ModuleVersion,
+        .Root = ModuleWriter_Statement(&writer, root),
+    };
+    memcpy(header.Magic, ModuleMagic, sizeof(header.Magic));
+
+    // Declarations that are not reachable from the root stay null
+    for (u64 i = 0; i < DynamicArrayLength(writer.Fixups); i++) {
+        ModuleNameFixup fixup = writer.Fixups[i];
+        writer.Expressions[fixup.Expression].B = ModulePointerMap_Get(&writer.DeclarationMap, fixup.Declaration);
+    }
+
+    struct {
+        ModuleSection* Section;
+        const void* Data;
+        u64 Count;
+        u64 Stride;
+    } sections[] = {
+        { &header.Strings, writer.Strings, DynamicArrayLength(writer.Strings), sizeof(ModuleString) },
+        { &header.StringData, writer.StringData, DynamicArrayLength(writer.StringData), sizeof(char) },
+        { &header.Types, writer.Types, DynamicArrayLength(writer.Types), sizeof(ModuleType) },
+        { &header.Expressions, writer.Expressions, DynamicArrayLength(writer.Expressions), sizeof(ModuleExpression) },
+        { &header.Statements, writer.Statements, DynamicArrayLength(writer.Statements), sizeof(ModuleStatement) },
+        { &header.Refs, writer.Refs, DynamicArrayLength(writer.Refs), sizeof(ModuleRef) },
+        { &header.Integers, writer.Integers, DynamicArrayLength(writer.Integers), sizeof(u64) },
+    };
+    u64 sectionCount = sizeof(sections) / sizeof(sections[0]);
+
+    u64 offset = Module_Align(sizeof(ModuleHeader));
+    for (u64 i = 0; i < sectionCount; i++) {
+        sections[i].Section->Offset = offset;
+        sections[i].Section->Count = sections[i].Count;
+        offset = Module_Align(offset + sections[i].Count * sections[i].Stride);
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return FALSE;
+    }
+
+    static const u8 zeros[8] = { 0 };
+    fwrite(&header, sizeof(header), 1, file);
+    u64 written = sizeof(header);
+    for (u64 i = 0; i < sectionCount; i++) {
+        fwrite(zeros, 1, sections[i].Section->Offset - written, file);
+        fwrite(sections[i].Data, sections[i].Stride, sections[i].Count, file);
+        written = sections[i].Section->Offset + sections[i].Count * sections[i].Stride;
+    }
+    fwrite(zeros, 1, offset - written, file);
+
+    b8 result = ferror(file) == 0;
+    fclose(file);
+    return result;
+}
+
+// Reads a mapped module in place, every accessor returns a pointer into the mapping. Accessors check what they read
+// and jump to Recovery when the module is corrupt.
+typedef struct ModuleView {
+    const u8* Data;
+    u64 Size;
+    const ModuleHeader* Header;
+    jmp_buf* Recovery;
+    const char* Failure;
+
+    // The printer shows every expression and statement once, refs that lead back to a node or share it are corrupt.
+    // Types are shared, so they are limited by depth and a number of visits instead.
+    u8* Printed; // Expressions, then statements
+    u64 Depth;
+    u64 TypeVisits;
+} ModuleView;
+
+// Printing recurses a few times for every level of nesting the parser allows
+#define ModuleView_MaxDepth (4 * Parser_MaxDepth)
+#define ModuleView_TypeVisitsPerEntry 64
+
+b8 ModuleView_Open(ModuleView* view, const char* path) {
+    *view = (ModuleView){};
+    view->Data = MapFile(path, &view->Size);
+    if (!view->Data) {
+        return FALSE;
+    }
+
+    view->Header = cast(const ModuleHeader*) view->Data;
+    if (view->Size < sizeof(ModuleHeader) ||
+        memcmp(view->Header->Magic, ModuleMagic, sizeof(view->Header->Magic)) != 0 ||
+        view->Header->Version != ModuleVersion) {
+        UnmapFile(view->Data, view->Size);
+        return FALSE;
+    }
+
+    const ModuleSection* sections[] = {
+        &view->Header->Strings, &view->Header->StringData, &view->Header->Types, &view->Header->Expressions,
+        &view->Header->Statements, &view->Header->Refs, &view->Header->Integers,
+    };
+    u64 strides[] = {
+        sizeof(ModuleString), sizeof(char), sizeof(ModuleType), sizeof(ModuleExpression),
+        sizeof(ModuleStatement), sizeof(ModuleRef), sizeof(u64),
+    };
+    for (u64 i = 0; i < sizeof(sections) / sizeof(sections[0]); i++) {
+        if (sections[i]->Offset > view->Size || sections[i]->Count > (view->Size - sections[i]->Offset) / strides[i]) {
+            UnmapFile(view->Data, view->Size);
+            return FALSE;
+        }
+    }
+
+    const ModuleHeader* header = view->Header;
+    view->Printed = Allocate(header->Expressions.Count + header->Statements.Count + 1);
+    view->TypeVisits = (header->Types.Count + header->Expressions.Count + header->Statements.Count + header->Refs.Count + 1) *
+        ModuleView_TypeVisitsPerEntry;
+    return TRUE;
+}
+
+void ModuleView_Close(ModuleView* view) {
+    free(view->Printed);
+    UnmapFile(view->Data, view->Size);
+}
+
+void ModuleView_Fail(ModuleView* view, const char* message) {
+    view->Failure = message;
+    ASSERT(view->Recovery);
+    longjmp(*view->Recovery, 1);
+}
+
+#define MODULE_VIEW_ACCESSOR(name, type, section) \
+    const type* ModuleView_##name(ModuleView* view, u64 index) { \
+        if (index >= view->Header->section.Count) { \
+            ModuleView_Fail(view, "a reference into " #section " is out of range"); \
+        } \
+        return (cast(const type*) (view->Data + view->Header->section.Offset)) + index; \
+    }
+
+MODULE_VIEW_ACCESSOR(Type, ModuleType, Types)
+MODULE_VIEW_ACCESSOR(Expression, ModuleExpression, Expressions)
+MODULE_VIEW_ACCESSOR(Statement, ModuleStatement, Statements)
+MODULE_VIEW_ACCESSOR(Ref, ModuleRef, Refs)
+MODULE_VIEW_ACCESSOR(Integer, u64, Integers)
+
+#undef MODULE_VIEW_ACCESSOR
+
+// Strings are stored with a terminating null, so they can be printed as C strings
+const ModuleString* ModuleView_StringEntry(ModuleView* view, ModuleRef ref) {
+    if (ref >= view->Header->Strings.Count) {
+        ModuleView_Fail(view, "a reference into Strings is out of range");
+    }
+    const ModuleString* string = (cast(const ModuleString*) (view->Data + view->Header->Strings.Offset)) + ref;
+    u64 end = cast(u64) string->Offset + string->Length;
+    if (end >= view->Header->StringData.Count || view->Data[view->Header->StringData.Offset + end] != '\0') {
+        ModuleView_Fail(view, "a string is out of range or not terminated");
+    }
+    return string;
+}
+
+const char* ModuleView_String(ModuleView* view, ModuleRef ref) {
+    if (ref == 0) {
+        return "";
+    }
+    const ModuleString* string = ModuleView_StringEntry(view, ref);
+    return cast(const char*) (view->Data + view->Header->StringData.Offset + string->Offset);
+}
+
+u64 ModuleView_StringLength(ModuleView* view, ModuleRef ref) {
+    if (ref == 0) {
+        return 0;
+    }
+    return ModuleView_StringEntry(view, ref)->Length;
+}
+
+const char* ModuleView_TokenName(ModuleView* view, u64 kind) {
+    if (kind >= sizeof(TokenKindNames) / sizeof(TokenKindNames[0]) || !TokenKindNames[kind]) {
+        ModuleView_Fail(view, "an operator is not a token");
+    }
+    return TokenKindNames[kind];
+}
+
+void ModuleView_Enter(ModuleView* view) {
+    if (++view->Depth > ModuleView_MaxDepth) {
+        ModuleView_Fail(view, "it is nested too deeply");
+    }
+}
+
+// Index is an expression ref, or a statement ref after every expression
+void ModuleView_MarkPrinted(ModuleView* view, u64 index) {
+    if (view->Printed[index]) {
+        ModuleView_Fail(view, "an expression or statement is reached twice");
+    }
+    view->Printed[index] = TRUE;
+}
+
+const ModuleExpression* ModuleView_PrintedExpression(ModuleView* view, ModuleRef ref) {
+    const ModuleExpression* expression = ModuleView_Expression(view, ref);
+    ModuleView_MarkPrinted(view, ref);
+    return expression;
+}
+
+const ModuleStatement* ModuleView_PrintedStatement(ModuleView* view, ModuleRef ref) {
+    const ModuleStatement* statement = ModuleView_Statement(view, ref);
+    ModuleView_MarkPrinted(view, view->Header->Expressions.Count + ref);
+    return statement;
+}
+
+void ModuleView_PrintType(ModuleView* view, ModuleRef ref) {
+    if (ref == 0) {
+        printf("void");
+        return;
+    }
+
+    if (view->TypeVisits == 0) {
+        ModuleView_Fail(view, "its types are too large");
+    }
+    view->TypeVisits--;
+    ModuleView_Enter(view);
+    const ModuleType* type = ModuleView_Type(view, ref);
+    switch (type->Kind) {
+        case AstTypeKind_Unknown: {
+            printf("%s%s", type->Flags & ModuleFlag_Polymorphic ? "$" : "", ModuleView_String(view, type->Name));
+            if (type->Length > 0) {
+                printf("(");
+                for (u64 i = 0; i < type->Length; i++) {
+                    printf("%s", i > 0 ? ", " : "");
+                    ModuleView_PrintType(view, *ModuleView_Ref(view, type->First + i));
+                }
+                printf(")");
+            }
+        } break;
+
+        case AstTypeKind_Struct: {
+            printf("%s", type->Name ? ModuleView_String(view, type->Name) : "struct");
+        } break;
+
+        case AstTypeKind_Integer: {
+            if (type->Size == 0) {
+                printf("untyped integer");
+            } else {
+                printf("%c%llu", type->Flags & ModuleFlag_Signed ? 's' : 'u', type->Size * 8);
+            }
+        } break;
+
+        case AstTypeKind_Float: {
+            if (type->Size == 0) {
+                printf("untyped float");
+            } else {
+                printf("f%llu", type->Size * 8);
+            }
+        } break;
+
+        case AstTypeKind_Pointer: {
+            printf("^");
+            ModuleView_PrintType(view, type->Base);
+        } break;
+
+        case AstTypeKind_Procedure: {
+            printf("(");
+            for (u64 i = 0; i < type->Length; i++) {
+                printf("%s", i > 0 ? ", " : "");
+                ModuleView_PrintType(view, *ModuleView_Ref(view, type->First + i));
+            }
+            printf(") -> ");
+            ModuleView_PrintType(view, type->Base);
+        } break;
+
+        case AstTypeKind_Array: {
+            if (type->Flags & ModuleFlag_Soa) {
+                printf("#soa ");
+            }
+            if (type->Flags & ModuleFlag_Dynamic) {
+                printf("[..]");
+            } else {
+                printf("[%llu]", type->Count);
+            }
+            ModuleView_PrintType(view, type->Base);
+        } break;
+
+        case AstTypeKind_Vector: {
+            printf("#vector(%llu) ", type->Count);
+            ModuleView_PrintType(view, type->Base);
+        } break;
+
+        case AstTypeKind_Void: {
+            printf("void");
+        } break;
+
+        case AstTypeKind_Type: {
+            printf("Type");
+        } break;
+
+        case AstTypeKind_Bool: {
+            printf("bool");
+        } break;
+
+        case AstTypeKind_String: {
+            printf("string");
+        } break;
+
+        default: {
+            printf("?");
+        } break;
+    }
+    view->Depth--;
+}
+
+void ModuleView_PrintStatement(ModuleView* view, ModuleRef ref, u64 indent);
+
+void ModuleView_PrintScope(ModuleView* view, ModuleRef ref, u64 indent) {
+    const ModuleStatement* scope = ModuleView_Statement(view, ref);
+    if (scope->Flags & ModuleFlag_NoBoundsCheck) {
+        printf("#no_bounds_check ");
+    }
+    printf("{\n");
+    for (u64 i = 0; i < scope->B; i++) {
+        ModuleView_PrintStatement(view, *ModuleView_Ref(view, scope->A + i), indent + 1);
+    }
+    Print_Indent(indent);
+    printf("}");
+}
+
+// Scopes stay on the line of the if or else, anything else goes on its own indented line
+void ModuleView_PrintBranch(ModuleView* view, ModuleRef ref, u64 indent) {
+    if (ModuleView_Statement(view, ref)->Kind == AstStatementKind_Scope) {
+        printf(" ");
+        ModuleView_PrintScope(view, ref, indent);
+        putchar('\n');
+    } else {
+        putchar('\n');
+        ModuleView_PrintStatement(view, ref, indent + 1);
+    }
+}
+
+void ModuleView_PrintExpression(ModuleView* view, ModuleRef ref, u64 indent) {
+    ModuleView_Enter(view);
+    const ModuleExpression* expression = ModuleView_PrintedExpression(view, ref);
+    switch (expression->Kind) {
+        case AstExpressionKind_True: {
+            printf("true");
+        } break;
+
+        case AstExpressionKind_False: {
+            printf("false");
+        } break;
+
+        case AstExpressionKind_Null: {
+            printf("null");
+        } break;
+
+        case AstExpressionKind_Literal: {
+            if (expression->A == TokenKind_String) {
+                static Writer writer; // Shares the buffer of stdout, so it stays in order with printf
+                Writer_Init(&writer, stdout);
+                Writer_QuotedString(&writer, ModuleView_String(view, expression->B), ModuleView_StringLength(view, expression->B));
+                Writer_Flush(&writer);
+            } else if (expression->A == TokenKind_Float) {
+                f64 value;
+                memcpy(&value, &expression->Value, sizeof(f64));
+                printf("%f", value);
+            } else {
+                printf("%llu", expression->Value);
+            }
+        } break;
+
+        case AstExpressionKind_Name: {
+            printf("%s", ModuleView_String(view, expression->A));
+        } break;
+
+        case AstExpressionKind_Unary: {
+            printf("(%s ", ModuleView_TokenName(view, expression->A));
+            ModuleView_PrintExpression(view, expression->B, indent);
+            printf(")");
+        } break;
+
+        case AstExpressionKind_Binary: {
+            // Binary chains nest to the left, so the chain is printed from its leftmost operand in a loop
+            const ModuleExpression** chain = DynamicArrayCreate(const ModuleExpression*);
+            DynamicArrayPush(chain, expression);
+            printf("(");
+            ModuleRef operand = expression->B;
+            while (ModuleView_Expression(view, operand)->Kind == AstExpressionKind_Binary) {
+                const ModuleExpression* binary = ModuleView_PrintedExpression(view, operand);
+                DynamicArrayPush(chain, binary);
+                printf("(");
+                operand = binary->B;
+            }
+
+            ModuleView_PrintExpression(view, operand, indent);
+            for (u64 i = DynamicArrayLength(chain); i > 0; i--) {
+                printf(" %s ", ModuleView_TokenName(view, chain[i - 1]->A));
+                ModuleView_PrintExpression(view, chain[i - 1]->C, indent);
+                printf(")");
+            }
+            DynamicArrayDestroy(chain);
+        } break;
+
+        case AstExpressionKind_Field: {
+            ModuleView_PrintExpression(view, expression->B, indent);
+            printf(".%s", ModuleView_String(view, expression->C));
+        } break;
+
+        case AstExpressionKind_Struct: {
+            printf("struct ");
+            if (expression->Value > 0) {
+                printf("(");
+                for (u64 i = 0; i < expression->Value; i++) {
+                    printf("%s$%s", i > 0 ? ", " : "", ModuleView_String(view, *ModuleView_Ref(view, expression->D + i)));
+                }
+                printf(") ");
+            }
+            printf("{\n");
+            for (u64 i = 0; i < expression->B; i++) {
+                ModuleView_PrintStatement(view, *ModuleView_Ref(view, expression->A + i), indent + 1);
+            }
+            Print_Indent(indent);
+            printf("}");
+        } break;
+
+        case AstExpressionKind_Procedure: {
+            printf("(");
+            for (u64 i = 0; i < expression->B; i++) {
+                const ModuleStatement* argument = ModuleView_Statement(view, *ModuleView_Ref(view, expression->A + i));
+                printf("%s%s: ", i > 0 ? ", " : "", ModuleView_String(view, argument->A));
+                ModuleView_PrintType(view, argument->B);
+            }
+            printf(") -> ");
+            ModuleView_PrintType(view, expression->C);
+            printf(" ");
+            ModuleView_PrintScope(view, expression->D, indent);
+        } break;
+
+        case AstExpressionKind_Call: {
+            ModuleView_PrintExpression(view, expression->C, indent);
+            printf("(");
+            for (u64 i = 0; i < expression->B; i++) {
+                printf("%s", i > 0 ? ", " : "");
+                ModuleView_PrintExpression(view, *ModuleView_Ref(view, expression->A + i), indent);
+            }
+            printf(")");
+        } break;
+
+        case AstExpressionKind_Index: {
+            ModuleView_PrintExpression(view, expression->B, indent);
+            printf("[");
+            ModuleView_PrintExpression(view, expression->C, indent);
+            printf("]");
+        } break;
+
+        case AstExpressionKind_Sizeof: {
+            printf("size_of(");
+            ModuleView_PrintExpression(view, expression->B, indent);
+            printf(")");
+        } break;
+
+        case AstExpressionKind_Cast: {
+            printf("cast(");
+            ModuleView_PrintType(view, expression->C);
+            printf(") ");
+            ModuleView_PrintExpression(view, expression->B, indent);
+        } break;
+
+        case AstExpressionKind_Run: {
+            printf("#run ");
+            ModuleView_PrintExpression(view, expression->B, indent);
+        } break;
+
+        default: {
+            printf("?");
+        } break;
+    }
+    view->Depth--;
+}
+
+void ModuleView_PrintStatement(ModuleView* view, ModuleRef ref, u64 indent) {
+    ModuleView_Enter(view);
+    const ModuleStatement* statement = ModuleView_PrintedStatement(view, ref);
+    Print_Indent(indent);
+
+    switch (statement->Kind) {
+        case AstStatementKind_Expression: {
+            ModuleView_PrintExpression(view, statement->A, indent);
+            printf(";\n");
+        } break;
+
+        case AstStatementKind_Scope: {
+            ModuleView_PrintScope(view, ref, indent);
+            putchar('\n');
+        } break;
+
+        case AstStatementKind_Declaration: {
+            printf("%s: ", ModuleView_String(view, statement->A));
+            ModuleView_PrintType(view, statement->B);
+            if (statement->C) {
+                printf(statement->Flags & ModuleFlag_Constant ? " : " : " = ");
+                ModuleView_PrintExpression(view, statement->C, indent);
+            }
+            printf(";\n");
+        } break;
+
+        case AstStatementKind_Assignment: {
+            ModuleView_PrintExpression(view, statement->A, indent);
+            printf(" %s ", ModuleView_TokenName(view, statement->B));
+            ModuleView_PrintExpression(view, statement->C, indent);
+            printf(";\n");
+        } break;
+
+        case AstStatementKind_Return: {
+            printf("return");
+            if (statement->A) {
+                printf(" ");
+                ModuleView_PrintExpression(view, statement->A, indent);
+            }
+            printf(";\n");
+        } break;
+
+        case AstStatementKind_If: {
+            // 'else if' chains are printed in a loop, each link indented one level further like a nested branch
+            while (TRUE) {
+                printf("if ");
+                ModuleView_PrintExpression(view, statement->A, indent);
+                ModuleView_PrintBranch(view, statement->B, indent);
+                if (!statement->C) {
+                    break;
+                }
+
+                Print_Indent(indent);
+                printf("else");
+                if (ModuleView_Statement(view, statement->C)->Kind != AstStatementKind_If) {
+                    ModuleView_PrintBranch(view, statement->C, indent);
+                    break;
+                }
+                putchar('\n');
+                indent++;
+                Print_Indent(indent);
+                statement = ModuleView_PrintedStatement(view, statement->C);
+            }
+        } break;
+
+        case AstStatementKind_While: {
+            printf("while ");
+            ModuleView_PrintExpression(view, statement->A, indent);
+            ModuleView_PrintBranch(view, statement->B, indent);
+        } break;
+
+        case AstStatementKind_For: {
+            const ModuleStatement* variable = ModuleView_Statement(view, statement->A);
+            printf("for %s in ", ModuleView_String(view, variable->A));
+            ModuleView_PrintExpression(view, variable->C, indent);
+            printf("..");
+            ModuleView_PrintExpression(view, statement->B, indent);
+            ModuleView_PrintBranch(view, statement->C, indent);
+        } break;
+
+        case AstStatementKind_Switch: {
+            printf("switch ");
+            ModuleView_PrintExpression(view, statement->A, indent);
+            printf(" {\n");
+            u64 ref = statement->B;
+            for (u64 i = 0; i < statement->C; i++) {
+                ModuleRef body = *ModuleView_Ref(view, ref);
+                u64 count = *ModuleView_Ref(view, ref + 1);
+                Print_Indent(indent + 1);
+                printf("case ");
+                for (u64 j = 0; j < count; j++) {
+                    printf(j > 0 ? ", " : "");
+                    ModuleView_PrintExpression(view, *ModuleView_Ref(view, ref + 2 + j), indent + 1);
+                }
+                printf(" ");
+                ModuleView_PrintScope(view, body, indent + 1);
+                putchar('\n');
+                ref += 2 + count;
+            }
+            if (statement->D) {
+                Print_Indent(indent + 1);
+                printf("else ");
+                ModuleView_PrintScope(view, statement->D, indent + 1);
+                putchar('\n');
+            }
+            Print_Indent(indent);
+            printf("}\n");
+        } break;
+
+        default: {
+            printf("?\n");
+        } break;
+    }
+    view->Depth--;
+}
+
+// Compiler server
+//
+// Keeps the source, tokens and parsed top level declarations of every file it has been asked about. A request only
+// relexes and reparses what the edit touched, checking and lowering run in an isolated copy of the process
+// because the checker modifies the ast in place.
+
+typedef struct ServerFile {
+    Src Src;
+    Token* Tokens;
+    AstStatement* GlobalStatement;
+    TopLevelDeclaration* Declarations;
+    b8 Parsed; // Declarations cover every token, false after a parser error
+} ServerFile;
+
+typedef struct Server {
+    ServerFile** Files;
+} Server;
+
+typedef struct ServerJob {
+    ServerFile* File;
+    const char* Command;
+    u64 Relexed;
+    u64 Reparsed;
+} ServerJob;
+
+ServerFile* Server_GetFile(Server* server, const char* path) {
+    for (u64 i = 0; i < DynamicArrayLength(server->Files); i++) {
+        if (strcmp(server->Files[i]->Src.Path, path) == 0) {
+            return server->Files[i];
+        }
+    }
+
+    char* pathCopy = Allocate(strlen(path) + 1);
+    strcpy(pathCopy, path);
+
+    ServerFile* file = Allocate(sizeof(ServerFile));
+    file->Src = (Src){
+        .Path = pathCopy,
+        .Source = "",
+        .Length = 0,
+    };
+    file->Tokens = DynamicArrayCreate(Token);
+    file->GlobalStatement = Allocate(sizeof(AstStatement));
+    file->GlobalStatement->Kind = AstStatementKind_Scope;
+    file->GlobalStatement->Scope.Statements = DynamicArrayCreate(AstStatement*);
+    file->Declarations = DynamicArrayCreate(TopLevelDeclaration);
+    DynamicArrayPush(server->Files, file);
+    return file;
+}
+
+// Relexes the edited bytes, then reuses the declarations before and after the relexed tokens and reparses the ones in
+// between until the parser lands on the first token of a reused declaration. Takes ownership of source and returns the
+// syntax errors. After an error only the declarations before it are kept, the rest is reparsed on the next update.
+Diagnostic* ServerFile_Update(ServerFile* file, char* source, u64 length, u64* relexed, u64* reparsed) {
+    const char* oldSource = file->Src.Source;
+    u64 oldLength = file->Src.Length;
+
+    u64 prefix = 0;
+    while (prefix < oldLength && prefix < length && oldSource[prefix] == source[prefix]) {
+        prefix++;
+    }
+
+    u64 suffix = 0;
+    while (suffix < oldLength - prefix && suffix < length - prefix &&
+        oldSource[oldLength - suffix - 1] == source[length - suffix - 1]) {
+        suffix++;
+    }
+
+    *relexed = 0;
+    *reparsed = 0;
+    if (file->Parsed && prefix == oldLength && prefix == length) {
+        free(source);
+        return DynamicArrayCreate(Diagnostic);
+    }
+
+    TextEdit edit = {
+        .Offset = prefix,
+        .Removed = oldLength - prefix - suffix,
+        .Inserted = source + prefix,
+        .InsertedLength = length - prefix - suffix,
+    };
+
+    file->Src.Source = source;
+    file->Src.Length = length;
+    RelexResult relex = Lexer_Relex(&file->Src, &file->Tokens, edit);
+    *relexed = relex.NewEnd - relex.First;
+
+    TopLevelDeclaration* old = file->Declarations;
+    u64 count = DynamicArrayLength(old);
+    u64 shift = relex.NewEnd - relex.OldEnd; // Wraps around when tokens were removed
+
+    // A failed parse stopped at its first error, so nothing after it can be reused
+    b8 reuse = file->Parsed;
+    file->Parsed = FALSE;
+    file->Declarations = DynamicArrayCreate(TopLevelDeclaration);
+    u64 i = 0;
+    while (i < count && old[i].NextToken < relex.First) {
+        DynamicArrayPush(file->Declarations, old[i]);
+        i++;
+    }
+
+    u64 j = i;
+    while (j < count && old[j].FirstToken < relex.OldEnd) {
+        j++;
+    }
+
+    Parser parser = {};
+    Parser_InitTokens(&parser, file->Tokens, i > 0 ? old[i - 1].NextToken : 0);
+
+    AstScope* globalScope = &file->GlobalStatement->Scope;
+    while (parser.Current.Kind != TokenKind_EndOfFile) {
+        while (j < count && old[j].FirstToken + shift < parser.TokenIndex) {
+            j++;
+        }
+        if (reuse && j < count && old[j].FirstToken + shift == parser.TokenIndex && DynamicArrayLength(parser.Diagnostics) == 0) {
+            break;
+        }
+
+        // Declarations after an error are only parsed to report their errors
+        TopLevelDeclaration declaration = Parser_ParseTopLevelDeclaration(&parser, globalScope);
+        if (DynamicArrayLength(parser.Diagnostics) == 0) {
+            DynamicArrayPush(file->Declarations, declaration);
+            (*reparsed)++;
+        }
+    }
+
+    if (DynamicArrayLength(parser.Diagnostics) > 0) {
+        return parser.Diagnostics;
+    }
+
+    if (parser.Current.Kind == TokenKind_EndOfFile) {
+        j = count;
+    }
+
+    for (; j < count; j++) {
+        TopLevelDeclaration declaration = old[j];
+        declaration.FirstToken += shift;
+        declaration.NextToken += shift;
+        DynamicArrayPush(file->Declarations, declaration);
+    }
+    DynamicArrayDestroy(old);
+    file->Parsed = TRUE;
+
+    DynamicArrayDestroy(globalScope->Statements);
+    globalScope->Statements = DynamicArrayCreate(AstStatement*);
+    for (u64 k = 0; k < DynamicArrayLength(file->Declarations); k++) {
+        DynamicArrayPush(globalScope->Statements, file->Declarations[k].Statement);
+    }
+    return parser.Diagnostics;
+}
+
+void Server_Compile(void* userData) {
+    ServerJob* job = userData;
+    AstStatement* globalStatement = job->File->GlobalStatement;
+    AstScope* globalScope = &globalStatement->Scope;
+
+    if (strcmp(job->Command, "ast") == 0) {
+        Dump_Ast(stdout, globalStatement, AstDumpFormat_Text);
+        return;
+    }
+
+    for (u64 i = 0; i < DynamicArrayLength(globalScope->Statements); i++) {
+        Complete_Statement(globalScope->Statements[i], globalScope);
+    }
+
+    if (strcmp(job->Command, "check") == 0) {
+        printf("ok, relexed %llu of %llu tokens, reparsed %llu of %llu declarations\n",
+            job->Relexed, DynamicArrayLength(job->File->Tokens), job->Reparsed, DynamicArrayLength(job->File->Declarations));
+    } else {
+        Compile_PrintIr(globalScope, strcmp(job->Command, "ir") == 0, strcmp(job->Command, "registers") == 0);
+    }
+}
+
+// A request is a single line '<command> <path>', the response is whatever the command prints
+b8 Server_HandleRequest(const char* request, void* userData) {
+    Server* server = userData;
+
+    const char* separator = strchr(request, ' ');
+    u64 commandLength = separator ? cast(u64) (separator - request) : strlen(request);
+    char command[16] = {};
+    if (commandLength >= sizeof(command)) {
+        printf("Unknown command\n");
+        return TRUE;
+    }
+    memcpy(command, request, commandLength);
+
+    if (strcmp(command, "stop") == 0) {
+        printf("stopping\n");
+        return FALSE;
+    }
+
+    if (strcmp(command, "check") != 0 && strcmp(command, "ast") != 0 &&
+        strcmp(command, "ir") != 0 && strcmp(command, "registers") != 0) {
+        printf("Unknown command '%s', expected check, ast, ir, registers or stop\n", command);
+        return TRUE;
+    } else if (!separator) {
+        printf("Expected a path after '%s'\n", command);
+        return TRUE;
+    }
+
+    const char* path = separator + 1;
+    FILE* handle = fopen(path, "rb");
+    if (!handle) {
+        printf("Unable to open '%s'\n", path);
+        return TRUE;
+    }
+
+    fseek(handle, 0, SEEK_END);
+    u64 length = ftell(handle);
+    fseek(handle, 0, SEEK_SET);
+
+    char* source = Allocate(length + 1);
+    length = fread(source, sizeof(char), length, handle);
+    source[length] = '\0';
+    fclose(handle);
+
+    ServerFile* file = Server_GetFile(server, path);
+
+    ServerJob job = {
+        .File = file,
+        .Command = command,
+    };
+
+    Diagnostic* diagnostics = ServerFile_Update(file, source, length, &job.Relexed, &job.Reparsed);
+    if (DynamicArrayLength(diagnostics) > 0) {
+        for (u64 i = 0; i < DynamicArrayLength(diagnostics); i++) {
+            Diagnostic_Print(&diagnostics[i]);
+        }
+        return TRUE;
+    }
+
+    Server_Isolate(Server_Compile, &job);
+    return TRUE;
+}
+
+// Statistics
+
+typedef struct AstCounts {
+    u64 Statements[sizeof(AstStatementKindNames) / sizeof(AstStatementKindNames[0])];
+    u64 Expressions[sizeof(AstExpressionKindNames) / sizeof(AstExpressionKindNames[0])];
+} AstCounts;
+
+b8 AstCounts_Statement(AstStatement* statement, void* userData) {
+    AstCounts* counts = userData;
+    counts->Statements[statement->Kind]++;
+    return TRUE;
+}
+
+b8 AstCounts_Expression(AstExpression* expression, void* userData) {
+    AstCounts* counts = userData;
+    counts->Expressions[expression->Kind]++;
+    if (expression->Kind == AstExpressionKind_Struct) {
+        counts->Statements[AstStatementKind_Declaration] += DynamicArrayLength(expression->Struct.Declarations);
+    }
+    return TRUE;
+}
+
+void AstCounts_Count(AstCounts* counts, AstStatement* root) {
+    Ast_Visit(root, &(AstVisitor){
+        .Statement = AstCounts_Statement,
+        .Expression = AstCounts_Expression,
+        .UserData = counts,
+    });
+}
+
+void Print_Stats(u64 sourceBytes, u64 tokenCount, AstCounts* counts) {
+    printf("\n");
+    Stats_PrintPhases();
+
+    f64 lexTime = Stats_PhaseWallTime("lex");
+    f64 frontEndTime = lexTime + Stats_PhaseWallTime("parse") + Stats_PhaseWallTime("check");
+    printf("\nsource: %llu bytes, %llu tokens\n", sourceBytes, tokenCount);
+    if (lexTime > 0.0) {
+        printf("lex: %.2f MB/s, %.0f tokens/s\n", sourceBytes / lexTime * 1e-6, tokenCount / lexTime);
+    }
+    if (frontEndTime > 0.0) {
+        printf("front end: %.2f MB/s, %.0f tokens/s\n", sourceBytes / frontEndTime * 1e-6, tokenCount / frontEndTime);
+    }
+
+    printf("\nast nodes after parsing:\n");
+    u64 statementCount = sizeof(counts->Statements) / sizeof(counts->Statements[0]);
+    for (u64 i = 1; i < statementCount; i++) {
+        if (counts->Statements[i] > 0) {
+            printf("    %-12s statement  %llu\n", AstStatementKindNames[i], counts->Statements[i]);
+        }
+    }
+    u64 expressionCount = sizeof(counts->Expressions) / sizeof(counts->Expressions[0]);
+    for (u64 i = 1; i < expressionCount; i++) {
+        if (counts->Expressions[i] > 0) {
+            printf("    %-12s expression %llu\n", AstExpressionKindNames[i], counts->Expressions[i]);
+        }
+    }
+
+    printf("\nAllocate: %llu calls, %llu bytes\n", Allocations.AllocateCalls, Allocations.AllocateBytes);
+    printf("DynamicArrayCreate_: %llu calls, %llu bytes\n", Allocations.DynamicArrayCalls, Allocations.DynamicArrayBytes);
+    u64 peak = Stats_PeakResidentBytes();
+    if (peak > 0) {
+        printf("peak rss: %llu KiB\n", peak / 1024);
+    }
+}
+
+// Benchmarks
+
+#define Bench_Repetitions 5 // After one warm up run, the best and mean of these are reported
+#define Bench_TargetSize (256 * 1024) // Generated sources stop growing once they are bigger than this
+
+void Bench_Append(char** buffer, const char* format, ...) {
+    __builtin_va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    char* string = Allocate(length + 1);
+    va_start(args, format);
+    vsnprintf(string, length + 1, format, args);
+    va_end(args);
+    DynamicArrayReplace(*buffer, DynamicArrayLength(*buffer), 0, string, length);
+}
+
+// Every generator appends one top-level procedure named after index
+
+void Bench_GenerateWideScope(char** buffer, u64 index) {
+    Bench_Append(buffer, "wide%llu :: () -> int {\n    v0 := %llu;\n", index, index);
+    for (u64 i = 1; i < 200; i++) {
+        Bench_Append(buffer, "    v%llu := v%llu * 3 + %llu;\n", i, i - 1, i);
+    }
+    Bench_Append(buffer, "    return v199;\n}\n\n");
+}
+
+void Bench_GenerateDeepNesting(char** buffer, u64 index) {
+    u64 depth = 48;
+    Bench_Append(buffer, "deep%llu :: () -> int {\n    x := %llu;\n", index, index);
+    for (u64 i = 0; i < depth; i++) {
+        Bench_Append(buffer, "%*sif x == %llu {\n", cast(int) (i + 1) * 4, "", i);
+        Bench_Append(buffer, "%*sx = x + 1;\n", cast(int) (i + 2) * 4, "");
+    }
+    for (u64 i = depth; i > 0; i--) {
+        Bench_Append(buffer, "%*s}\n", cast(int) i * 4, "");
+    }
+
+    Bench_Append(buffer, "    y := ");
+    for (u64 i = 0; i < depth; i++) {
+        Bench_Append(buffer, "(");
+    }
+    Bench_Append(buffer, "x");
+    for (u64 i = 0; i < depth; i++) {
+        Bench_Append(buffer, " + %llu)", i);
+    }
+    Bench_Append(buffer, ";\n    return y;\n}\n\n");
+}
+
+void Bench_GenerateLongIdentifiers(char** buffer, u64 index) {
+    const char* prefix = "a_rather_long_identifier_that_names_a_value_in_some_deeply_layered_subsystem";
+    Bench_Append(buffer, "%s_procedure_%llu :: (%s_parameter: int) -> int {\n", prefix, index, prefix);
+    Bench_Append(buffer, "    %s_0 := %s_parameter;\n", prefix, prefix);
+    for (u64 i = 1; i < 32; i++) {
+        Bench_Append(buffer, "    %s_%llu := %s_%llu + %s_parameter;\n", prefix, i, prefix, i - 1, prefix);
+    }
+    Bench_Append(buffer, "    return %s_31;\n}\n\n", prefix);
+}
+
+void Bench_GenerateNumericLiterals(char** buffer, u64 index) {
+    Bench_Append(buffer, "numbers%llu :: () -> float {\n", index);
+    for (u64 i = 0; i < 64; i++) {
+        Bench_Append(buffer, "    i%llu := 0x%llX + 0b101101011 * %llu - 0o7654321 + 18446744073;\n", i,
+                     index * 2654435761u + i, 1000000007 + i);
+        Bench_Append(buffer, "    f%llu := 3.14159265358979 * 2.71828182845904 + %llu.%llu;\n", i, i, index + 1);
+    }
+    Bench_Append(buffer, "    return f63;\n}\n\n");
+}
+
+void Bench_GenerateBlockComments(char** buffer, u64 index) {
+    u64 depth = 8;
+    for (u64 i = 0; i < depth; i++) {
+        Bench_Append(buffer, "%*s/*\n", cast(int) i * 4, "");
+        for (u64 j = 0; j < 4; j++) {
+            Bench_Append(buffer, "%*s    Comment %llu at depth %llu, /* is nested but */ stays balanced\n", cast(int) i * 4,
+                         "", j, i);
+        }
+    }
+    for (u64 i = depth; i > 0; i--) {
+        Bench_Append(buffer, "%*s*/\n", cast(int) (i - 1) * 4, "");
+    }
+    Bench_Append(buffer, "commented%llu :: () -> int {\n    return %llu; // Trailing comment\n}\n\n", index, index);
+}
+
+typedef struct Bench {
+    const char* Name;
+    void (*Generate)(char** buffer, u64 index);
+} Bench;
+
+typedef struct BenchTiming {
+    f64 Best;
+    f64 Mean;
+} BenchTiming;
+
+void BenchTiming_Add(BenchTiming* timing, f64 time, u64 repetition) {
+    if (repetition == 0) {
+        return; // Warm up
+    }
+    if (repetition == 1 || time < timing->Best) {
+        timing->Best = time;
+    }
+    timing->Mean += time / Bench_Repetitions;
+}
+
+void BenchTiming_Print(const char* name, BenchTiming* timing, const char* unit, u64 count, u64 bytes, b8 last) {
+    printf("            \"%s\": {\"best_ms\": %.4f, \"mean_ms\": %.4f, \"%s_per_s\": %.0f", name, timing->Best * 1e3,
+           timing->Mean * 1e3, unit, count / timing->Best);
+    if (bytes > 0) {
+        printf(", \"mb_per_s\": %.2f", bytes / timing->Best * 1e-6);
+    }
+    printf("}%s\n", last ? "" : ",");
+}
+
+AstStatement** Bench_Parse(Token* tokens, AstScope* globalScope) {
+    Parser parser;
+    Parser_InitTokens(&parser, tokens, 0);
+    AstStatement** statements = DynamicArrayCreate(AstStatement*);
+    while (parser.Current.Kind != TokenKind_EndOfFile) {
+        AstStatement* statement = Parser_TryParseStatement(&parser, globalScope);
+        if (statement) {
+            DynamicArrayPush(statements, statement);
+        }
+    }
+    if (DynamicArrayLength(parser.Diagnostics) > 0) {
+        Diagnostic_Print(&parser.Diagnostics[0]);
+        Error("Generated benchmark source does not parse\n");
+    }
+    return statements;
+}
+
+// Times the lexer, the parser and the checker separately on generated sources and prints the results as json
+void Bench_Run(void) {
+    Bench benches[] = {
+        { "wide scope", Bench_GenerateWideScope },
+        { "deep nesting", Bench_GenerateDeepNesting },
+        { "long identifiers", Bench_GenerateLongIdentifiers },
+        { "numeric literals", Bench_GenerateNumericLiterals },
+        { "block comments", Bench_GenerateBlockComments },
+    };
+
+    printf("{\n    \"repetitions\": %d,\n    \"benchmarks\": [\n", Bench_Repetitions);
+    u64 benchCount = sizeof(benches) / sizeof(benches[0]);
+    for (u64 i = 0; i < benchCount; i++) {
+        char* source = DynamicArrayCreate(char);
+        for (u64 j = 0; DynamicArrayLength(source) < Bench_TargetSize; j++) {
+            benches[i].Generate(&source, j);
+        }
+        u64 length = DynamicArrayLength(source);
+        DynamicArrayPush(source, '\0');
+
+        BenchTiming lex = {};
+        BenchTiming parse = {};
+        BenchTiming check = {};
+        Token* tokens = NULL;
+        u64 statementCount = 0;
+        AstCounts counts = {};
+        for (u64 repetition = 0; repetition <= Bench_Repetitions; repetition++) {
+            f64 start = Stats_WallTime();
+            Lexer lexer;
+            Lexer_Init(&lexer, benches[i].Name, source);
+            tokens = DynamicArrayCreate(Token);
+            while (TRUE) {
+                Token token = Lexer_NextToken(&lexer);
+                DynamicArrayPush(tokens, token);
+                if (token.Kind == TokenKind_EndOfFile) {
+                    break;
+                }
+            }
+            BenchTiming_Add(&lex, Stats_WallTime() - start, repetition);
+
+            AstStatement* globalStatement = Allocate(sizeof(AstStatement));
+            globalStatement->Kind = AstStatementKind_Scope;
+            AstScope* globalScope = &globalStatement->Scope;
+            start = Stats_WallTime();
+            globalScope->Statements = Bench_Parse(tokens, globalScope);
+            BenchTiming_Add(&parse, Stats_WallTime() - start, repetition);
+
+            if (repetition == 0) {
+                AstCounts_Count(&counts, globalStatement);
+                statementCount = DynamicArrayLength(globalScope->Statements);
+            }
+
+            start = Stats_WallTime();
+            for (u64 j = 0; j < DynamicArrayLength(globalScope->Statements); j++) {
+                Complete_Statement(globalScope->Statements[j], globalScope);
+            }
+            BenchTiming_Add(&check, Stats_WallTime() - start, repetition);
+        }
+
+        u64 expressionCount = 0;
+        for (u64 j = 0; j < sizeof(counts.Expressions) / sizeof(counts.Expressions[0]); j++) {
+            expressionCount += counts.Expressions[j];
+        }
+
+        printf("        {\n");
+        printf("            \"name\": \"%s\",\n", benches[i].Name);
+        printf("            \"bytes\": %llu,\n", length);
+        printf("            \"tokens\": %llu,\n", DynamicArrayLength(tokens));
+        printf("            \"declarations\": %llu,\n", statementCount);
+        printf("            \"expressions\": %llu,\n", expressionCount);
+        BenchTiming_Print("lex", &lex, "tokens", DynamicArrayLength(tokens), length, FALSE);
+        BenchTiming_Print("parse", &parse, "tokens", DynamicArrayLength(tokens), 0, FALSE);
+        BenchTiming_Print("check", &check, "expressions", expressionCount, 0, TRUE);
+        printf("        }%s\n", i + 1 < benchCount ? "," : "");
+    }
+    printf("    ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+    const char* path = NULL;
+    b8 printIr = FALSE;
+    b8 printRegisters = FALSE;
+    b8 useCache = FALSE;
+    b8 printStats = FALSE;
+    b8 runBenchmarks = FALSE;
+    const char* tracePath = NULL;
+    AstDumpFormat dumpFormat = AstDumpFormat_Text;
+    const char* emitModulePath = NULL;
+    const char* dumpModulePath = NULL;
+    const char* serverPath = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--ir") == 0) {
+            printIr = TRUE;
+        } else if (strcmp(argv[i], "--registers") == 0) {
+            printRegisters = TRUE;
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            useCache = TRUE;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            runBenchmarks = TRUE;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            printStats = TRUE;
+        } else if (strcmp(argv[i], "--dump-ast") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "text") == 0) {
+                dumpFormat = AstDumpFormat_Text;
+            } else if (strcmp(argv[i], "json") == 0) {
+                dumpFormat = AstDumpFormat_Json;
+            } else if (strcmp(argv[i], "binary") == 0) {
+                dumpFormat = AstDumpFormat_Binary;
+            } else {
+                path = NULL;
+                break;
+            }
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (strcmp(argv[i], "--emit-module") == 0 && i + 1 < argc) {
+            emitModulePath = argv[++i];
+        } else if (strcmp(argv[i], "--dump-module") == 0 && i + 1 < argc) {
+            dumpModulePath = argv[++i];
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            serverPath = argv[++i];
+        } else if (!path) {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+
+    if (serverPath && !path) {
+        Server server = {
+            .Files = DynamicArrayCreate(ServerFile*),
+        };
+        if (!Server_Run(serverPath, Server_HandleRequest, &server)) {
+            printf("Unable to listen on '%s'\n", serverPath);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (runBenchmarks && !path) {
+        Bench_Run();
+        return 0;
+    }
+
+    if (dumpModulePath && !path) {
+        ModuleView view;
+        if (!ModuleView_Open(&view, dumpModulePath)) {
+            printf("Unable to open module '%s'\n", dumpModulePath);
+            return -1;
+        }
+
+        jmp_buf recovery;
+        view.Recovery = &recovery;
+        if (setjmp(recovery) != 0) {
+            printf("\nModule '%s' is corrupt, %s\n", dumpModulePath, view.Failure);
+            ModuleView_Close(&view);
+            return -1;
+        }
+        ModuleView_PrintScope(&view, view.Header->Root, 0);
+        putchar('\n');
+        ModuleView_Close(&view);
+        return 0;
+    }
+
+    if (!path) {
+        printf("usage Thallium.exe [options] [main file]\n");
+        printf("options:\n");
+        printf("    --ir           print the optimized ir instead of the ast\n");
+        printf("    --registers    print the register allocation of every procedure\n");
+        printf("    --dump-ast     [text|json|binary] format of the ast printed without --ir or --registers\n");
+        printf("    --cache        reuse the ir of unchanged declarations from " CacheDirectory "\n");
+        printf("    --stats        print the time spent in each phase, node counts and allocations\n");
+        printf("    --trace        [path] write a chrome trace-event timeline of the compilation\n");
+        printf("    --emit-module  [path] write the checked ast to a module file\n");
+        printf("    --dump-module  [path] print a module file without a main file\n");
+        printf("    --server       [socket] serve check, ast, ir and registers requests on a unix socket\n");
+        printf("    --bench        time the lexer, parser and checker on generated sources without a main file\n");
+        return -2;
+    }
+
+    if (emitModulePath && useCache && printIr && !printRegisters) {
+        printf("--emit-module cannot be combined with --cache --ir, which does not check unchanged declarations\n");
+        return -2;
+    }
+
+    if (printStats) {
+        Stats_Enable();
+    }
+
+    if (tracePath && !Trace_Begin(tracePath)) {
+        printf("Unable to write trace '%s'\n", tracePath);
+        return -1;
+    }
+    Trace_BeginZone("file");
+    Trace_ZoneDetail(path);
+
+    Stats_BeginPhase("load");
+    FILE* file = fopen(path, "rb");
+
+    fseek(file, 0, SEEK_END);
+    u64 length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* source = Allocate(length + 1);
+    fread(source, sizeof(char), length, file);
+    source[length] = '\0';
+
+    fclose(file);
+    Stats_EndPhase();
+
+#if 0
+    Lexer lexer;
+    Lexer_Init(&lexer, path, source);
+
+    Token token;
+    while ((token = Lexer_NextToken(&lexer)).Kind != TokenKind_EndOfFile) {
+        switch (token.Kind) {
+            case TokenKind_Name: {
+                printf("%s: '%s'\n", TokenKindNames[token.Kind], token.Name);
+            } break;
+
+            case TokenKind_Integer: {
+                printf("%s: %llu\n", TokenKindNames[token.Kind], token.Integer);
+            } break;
+
+            case TokenKind_Float: {
+                printf("%s: %f\n", TokenKindNames[token.Kind], token.Float);
+            } break;
+
+            case TokenKind_String: {
+                printf("%s: \"%.*s\"\n", TokenKindNames[token.Kind], cast(int) token.StringLength, token.String);
+            } break;
+
+            default: {
+                printf("%s\n", TokenKindNames[token.Kind]);
+            } break;
+        }
+    }
+    
+    putchar('\n');
+    putchar('\n');
+#endif
+
+    // Lexed up front so that lexing and parsing can be timed separately
+    Stats_BeginPhase("lex");
+    Lexer lexer;
+    Lexer_Init(&lexer, path, source);
+    Token* tokens = DynamicArrayCreate(Token);
+    while (TRUE) {
+        Token token = Lexer_NextToken(&lexer);
+        DynamicArrayPush(tokens, token);
+        if (token.Kind == TokenKind_EndOfFile) {
+            break;
+        }
+    }
+    Stats_EndPhase();
+
+    Stats_BeginPhase("parse");
+    Parser parser;
+    Parser_InitTokens(&parser, tokens, 0);
+
+    AstStatement* globalStatement = Allocate(sizeof(AstStatement));
+    globalStatement->Kind = AstStatementKind_Scope;
+    AstScope* globalScope = &globalStatement->Scope;
+    globalScope->Statements = DynamicArrayCreate(AstStatement*);
+
+    TopLevelDeclaration* declarations = DynamicArrayCreate(TopLevelDeclaration);
+    while (parser.Current.Kind != TokenKind_EndOfFile) {
+        Trace_BeginZone("declaration");
+        TopLevelDeclaration declaration = Parser_ParseTopLevelDeclaration(&parser, globalScope);
+        if (declaration.Statement) {
+            Trace_ZoneDetail(TopLevelDeclaration_Name(&declaration));
+            DynamicArrayPush(globalScope->Statements, declaration.Statement);
+            DynamicArrayPush(declarations, declaration);
+        }
+        Trace_EndZone();
+    }
+    Stats_EndPhase();
+
+    if (DynamicArrayLength(parser.Diagnostics) > 0) {
+        for (u64 i = 0; i < DynamicArrayLength(parser.Diagnostics); i++) {
+            Diagnostic_Print(&parser.Diagnostics[i]);
+        }
+        Trace_End();
+        return 1;
+    }
+
+    // Counted before the checker inserts implicit casts
+    AstCounts counts = {};
+    if (printStats) {
+        AstCounts_Count(&counts, globalStatement);
+    }
+
+    Stats_BeginPhase("cache keys");
+    Cache_ComputeKeys(declarations);
+    Stats_EndPhase();
+
+    // The checker replaces the types with builtin ones and inserts casts, so the ast is printed from a copy made before
+    // it runs. The copy is printed once checking succeeded, so checker errors are not buried under the dump.
+    AstStatement* dumpStatement = NULL;
+    if (!printIr && !printRegisters) {
+        Stats_BeginPhase("copy ast");
+        dumpStatement = Ast_CloneStatement(globalStatement, NULL);
+        Stats_EndPhase();
+    }
+
+    if (useCache && printIr && !printRegisters) {
+        Stats_BeginPhase("cache");
+        Cache_PrintIr(declarations, globalScope);
+        Stats_EndPhase();
+    } else {
+        Stats_BeginPhase("check");
+        for (u64 i = 0; i < DynamicArrayLength(declarations); i++) {
+            Trace_BeginZone("declaration");
+            Trace_ZoneDetail(TopLevelDeclaration_Name(&declarations[i]));
+            Complete_Statement(declarations[i].Statement, globalScope);
+            Trace_EndZone();
+        }
+        Stats_EndPhase();
+
+        if (dumpStatement) {
+            Stats_BeginPhase("print ast");
+            Dump_Ast(stdout, dumpStatement, dumpFormat);
+            Stats_EndPhase();
+        }
+
+        if (emitModulePath) {
+            Stats_BeginPhase("emit module");
+            b8 written = Module_Write(emitModulePath, globalStatement);
+            Stats_EndPhase();
+            if (!written) {
+                printf("Unable to write module '%s'\n", emitModulePath);
+                Trace_End();
+                return -1;
+            }
+        }
+
+        if (printIr || printRegisters) {
+            Compile_PrintIr(globalScope, printIr, printRegisters);
+        }
+    }
+
+    Trace_EndZone();
+    Trace_End();
+
+    if (printStats) {
+        Print_Stats(length, DynamicArrayLength(tokens), &counts);
+    }
+
+    return 0;
+}
+
+void Print_Indent(u64 indent) {
+    for (u64 i = 0; i < indent; i++) {
+        printf("    ");
+    }
+}
+
+void Print_WriteIndent(Writer* writer, u64 indent) {
+    for (u64 i = 0; i < indent; i++) {
+        Writer_Write(writer, "    ", 4);
+    }
+}
+
+void Print_AstType(Writer* writer, AstType* type, u64 indent) {
+    switch (type->Kind) {
+        case AstTypeKind_Unknown: {
+            if (type->Unknown.Polymorphic) {
+                Writer_Char(writer, '$');
+            }
+            Writer_String(writer, type->Unknown.Name.Name);
+            if (type->Unknown.TypeArguments) {
+                Writer_Char(writer, '(');
+                for (u64 i = 0; i < DynamicArrayLength(type->Unknown.TypeArguments); i++) {
+                    if (i > 0) {
+                        Writer_String(writer, ", ");
+                    }
+                    Print_AstType(writer, type->Unknown.TypeArguments[i], indent);
+                }
+                Writer_Char(writer, ')');
+            }
+        } break;
+
+        case AstTypeKind_Pointer: {
+            Writer_Char(writer, '^');
+            Print_AstType(writer, type->Pointer.PointerTo, indent);
+        } break;
+
+        case AstTypeKind_Array: {
+            if (type->Array.Soa) {
+                Writer_String(writer, "#soa ");
+            }
+            Writer_Char(writer, '[');
+            if (type->Array.Dynamic) {
+                Writer_String(writer, "..");
+            } else if (type->Array.Count) {
+                Print_AstExpression(writer, type->Array.Count, indent);
+            }
+            Writer_Char(writer, ']');
+            Print_AstType(writer, type->Array.ArrayOf, indent);
+        } break;
+
+        case AstTypeKind_Vector: {
+            Writer_String(writer, "#vector(");
+            Print_AstExpression(writer, type->Array.Count, indent);
+            Writer_String(writer, ") ");
+            Print_AstType(writer, type->Array.ArrayOf, indent);
+        } break;
+
+        default: {
+            ASSERT(FALSE);
+        } break;
+    }
+}
+
+void Print_AstStatement(Writer* writer, AstStatement* statement, u64 indent) {
+    switch (statement->Kind) {
+        case AstStatementKind_Expression: {
+            Print_AstExpression(writer, &statement->Expression, indent);
+            Writer_String(writer, ";\n");
+        } break;
+
+        case AstStatementKind_Declaration: {
+            Print_WriteIndent(writer, indent);
+            Writer_String(writer, statement->Declaration.Name.Name);
+
+            if (statement->Declaration.Type) {
+                Writer_String(writer, ": ");
+                Print_AstType(writer, statement->Declaration.Type, indent);
+            } else {
+                Writer_String(writer, statement->Declaration.Constant ? " :: " : " := ");
+            }
+
+            if (statement->Declaration.Value) {
+                if (statement->Declaration.Type) {
+                    Writer_String(writer, statement->Declaration.Constant ? " : " : " = ");
+                }
+
+                Print_AstExpression(writer, statement->Declaration.Value, indent);
+            }
+
+            Writer_String(writer, ";\n");
+        } break;
+
+        case AstStatementKind_Assignment: {
+            Print_WriteIndent(writer, indent);
+            Print_AstExpression(writer, statement->Assignment.Operand, indent);
+            Writer_Char(writer, ' ');
+            Writer_String(writer, TokenKindNames[statement->Assignment.Operator.Kind]);
+            Writer_Char(writer, ' ');
+            Print_AstExpression(writer, statement->Assignment.Value, indent);
+            Writer_String(writer, ";\n");
+        } break;
+
+        case AstStatementKind_Scope: {
+            if (statement->Scope.NoBoundsCheck) {
+                Writer_String(writer, "#no_bounds_check ");
+            }
+            Writer_String(writer, "{\n");
+            for (u64 i = 0; i < DynamicArrayLength(statement->Scope.Statements); i++) {
+                Print_AstStatement(writer, statement->Scope.Statements[i], indent + 1);
+            }
+            Print_WriteIndent(writer, indent);
+            Writer_Char(writer, '}');
+        } break;
+
+        case AstStatementKind_Return: {
+            Print_WriteIndent(writer, indent);
+            Writer_String(writer, "return ");
+            Print_AstExpression(writer, statement->Return.Expression, indent);
+            Writer_String(writer, ";\n");
+        } break;
+
+        case AstStatementKind_If: {
+            // 'else if' chains are printed in a loop, every link ends with its own newline once the chain is done
+            u64 links = 0;
+            while (TRUE) {
+                links++;
+                Print_WriteIndent(writer, indent);
+                Writer_String(writer, "if ");
+                Print_AstExpression(writer, statement->If.Condition, indent);
+
+                if (statement->If.Then->Kind != AstStatementKind_Scope) {
+                    Writer_Char(writer, '\n');
+                    Print_WriteIndent(writer, indent);
+                } else {
+                    Writer_Char(writer, ' ');
+                }
+                Print_AstStatement(writer, statement->If.Then, indent);
+
+                if (!statement->If.Else) {
+                    break;
+                }
+
+                if (statement->If.Then->Kind == AstStatementKind_Scope) {
+                    Writer_Char(writer, ' ');
+                } else {
+                    Print_WriteIndent(writer, indent);
+                }
+
+                Writer_String(writer, "else ");
+                if (statement->If.Else->Kind != AstStatementKind_Scope) {
+                    Writer_Char(writer, '\n');
+                    Print_WriteIndent(writer, indent);
+                }
+
+                if (statement->If.Else->Kind != AstStatementKind_If) {
+                    Print_AstStatement(writer, statement->If.Else, indent);
+                    break;
+                }
+                statement = statement->If.Else;
+            }
+
+            for (u64 i = 0; i < links; i++) {
+                Writer_Char(writer, '\n');
+            }
+        } break;
+
+        case AstStatementKind_While: {
+            Print_WriteIndent(writer, indent);
+            Writer_String(writer, "while ");
+            Print_AstExpression(writer, statement->While.Condition, indent);
+
+            if (statement->While.Body->Kind != AstStatementKind_Scope) {
+                Writer_Char(writer, '\n');
+                Print_WriteIndent(writer, indent);
+            } else {
+                Writer_Char(writer, ' ');
+            }
+            Print_AstStatement(writer, statement->While.Body, indent);
+
+            Writer_Char(writer, '\n');
+        } break;
+
+        case AstStatementKind_For: {
+            Print_WriteIndent(writer, indent);
+            Writer_String(writer, "for ");
+            Writer_String(writer, statement->For.Variable->Declaration.Name.Name);
+            Writer_String(writer, " in ");
+            Print_AstExpression(writer, statement->For.Variable->Declaration.Value, indent);
+            Writer_String(writer, "..");
+            Print_AstExpression(writer, statement->For.End, indent);
+            Writer_Char(writer, ' ');
+            Print_AstStatement(writer, &(AstStatement){
+                .Kind = AstStatementKind_Scope,
+                .Scope = *statement->For.Body,
+            }, indent);
+
+            Writer_Char(writer, '\n');
+        } break;
+
+        case AstStatementKind_Switch: {
+            Print_WriteIndent(writer, indent);
+            Writer_String(writer, "switch ");
+            Print_AstExpression(writer, statement->Switch.Value, indent);
+            Writer_String(writer, " {\n");
+            for (u64 i = 0; i < DynamicArrayLength(statement->Switch.Cases); i++) {
+                AstCase* case_ = &statement->Switch.Cases[i];
+                Print_WriteIndent(writer, indent + 1);
+                Writer_String(writer, "case ");
+                for (u64 j = 0; j < DynamicArrayLength(case_->Values); j++) {
+                    if (j > 0) {
+                        Writer_String(writer, ", ");
+                    }
+                    Print_AstExpression(writer, case_->Values[j], indent + 1);
+                }
+                Writer_Char(writer, ' ');
+                Print_AstStatement(writer, case_->Body, indent + 1);
+                Writer_Char(writer, '\n');
+            }
+            if (statement->Switch.Else) {
+                Print_WriteIndent(writer, indent + 1);
+                Writer_String(writer, "else ");
+                Print_AstStatement(writer, statement->Switch.Else, indent + 1);
+                Writer_Char(writer, '\n');
+            }
+            Print_WriteIndent(writer, indent);
+            Writer_String(writer, "}\n");
+        } break;
+
+        default: {
+            ASSERT(FALSE);
+        } break;
+    }
+}
+
+void Print_AstExpression(Writer* writer, AstExpression* expression, u64 indent) {
+    switch (expression->Kind) {
+        case AstExpressionKind_Name: {
+            Writer_String(writer, expression->Name.Name.Name);
+        } break;
+
+        case AstExpressionKind_Literal: {
+            switch (expression->Literal.Token.Kind) {
+                case TokenKind_Integer: {
+                    Writer_U64(writer, expression->Literal.Token.Integer);
+                } break;
+
+                case TokenKind_Float: {
+                    Writer_Format(writer, "%f", expression->Literal.Token.Float);
+                } break;
+
+                case TokenKind_String: {
+                    Writer_QuotedString(writer, expression->Literal.Token.String, expression->Literal.Token.StringLength);
+                } break;
+
+                default: {
+                    ASSERT(FALSE);
+                } break;
+            }
+        } break;
+
+        case AstExpressionKind_Unary: {
+            Writer_Char(writer, '(');
+            Writer_String(writer, TokenKindNames[expression->Unary.Operator.Kind]);
+            Writer_Char(writer, ' ');
+            Print_AstExpression(writer, expression->Unary.Operand, indent);
+            Writer_Char(writer, ')');
+        } break;
+
+        case AstExpressionKind_Binary: {
+            // Binary chains nest to the left, so the chain is printed from its leftmost operand in a loop
+            AstExpression** chain = DynamicArrayCreate(AstExpression*);
+            AstExpression* operand = expression;
+            while (operand->Kind == AstExpressionKind_Binary) {
+                DynamicArrayPush(chain, operand);
+                Writer_Char(writer, '(');
+                operand = operand->Binary.Left;
+            }
+
+            Print_AstExpression(writer, operand, indent);
+            for (u64 i = DynamicArrayLength(chain); i > 0; i--) {
+                Writer_Char(writer, ' ');
+                Writer_String(writer, TokenKindNames[chain[i - 1]->Binary.Operator.Kind]);
+                Writer_Char(writer, ' ');
+                Print_AstExpression(writer, chain[i - 1]->Binary.Right, indent);
+                Writer_Char(writer, ')');
+            }
+            DynamicArrayDestroy(chain);
+        } break;
+
+        case AstExpressionKind_Field: {
+            Writer_Char(writer, '(');
+            Print_AstExpression(writer, expression->Field.Expression, indent);
+            Writer_Char(writer, '.');
+            Writer_String(writer, expression->Field.Name.Name);
+            Writer_Char(writer, ')');
+        } break;
+
+        case AstExpressionKind_Procedure: {
+            Writer_Char(writer, '(');
+            for (u64 i = 0; i < DynamicArrayLength(expression->Procedure.Arguments); i++) {
+                if (i > 0) {
+                    Writer_String(writer, ", ");
+                }
+
+                Writer_String(writer, expression->Procedure.Arguments[i].Name.Name);
+                Writer_String(writer, ": ");
+                Print_AstType(writer, expression->Procedure.Arguments[i].Type, indent);
+            }
+            Writer_Char(writer, ')');
+
+            if (expression->Procedure.ReturnType) {
+                Writer_String(writer, " -> ");
+                Print_AstType(writer, expression->Procedure.ReturnType, indent);
+            }
+
+            Writer_Char(writer, ' ');
+            Print_AstStatement(writer, &(AstStatement){
+                .Kind = AstStatementKind_Scope,
+                .Scope = *expression->Procedure.Body,
+            }, indent);
+        } break;
+
+        case AstExpressionKind_Struct: {
+            Writer_String(writer, "struct ");
+            if (expression->Struct.TypeParameters) {
+                Writer_Char(writer, '(');
+                for (u64 i = 0; i < DynamicArrayLength(expression->Struct.TypeParameters); i++) {
+                    if (i > 0) {
+                        Writer_String(writer, ", ");
+                    }
+                    Writer_Char(writer, '$');
+                    Writer_String(writer, expression->Struct.TypeParameters[i].Name);
+                }
+                Writer_String(writer, ") ");
+            }
+            if (expression->Struct.Packed) {
+                Writer_String(writer, "#packed ");
+            }
+            if (expression->Struct.Reorder) {
+                Writer_String(writer, "#reorder ");
+            }
+            Writer_String(writer, "{\n");
+            for (u64 i = 0; i < DynamicArrayLength(expression->Struct.Declarations); i++) {
+                AstStatement statement = {};
+                statement.Kind = AstStatementKind_Declaration;
+                statement.Declaration = expression->Struct.Declarations[i];
+                Print_AstStatement(writer, &statement, indent + 1);
+            }
+            Print_WriteIndent(writer, indent);
+            Writer_Char(writer, '}');
+        } break;
+
+        case AstExpressionKind_True: {
+            Writer_String(writer, "true");
+        } break;
+
+        case AstExpressionKind_False: {
+            Writer_String(writer, "false");
+        } break;
+
+        case AstExpressionKind_Null: {
+            Writer_String(writer, "null");
+        } break;
+
+        case AstExpressionKind_Call: {
+            Print_AstExpression(writer, expression->Call.Operand, indent);
+            Writer_Char(writer, '(');
+            for (u64 i = 0; i < DynamicArrayLength(expression->Call.Arguments); i++) {
+                if (i > 0) {
+                    Writer_String(writer, ", ");
+                }
+                Print_AstExpression(writer, expression->Call.Arguments[i], indent);
+            }
+            Writer_Char(writer, ')');
+        } break;
+
+        case AstExpressionKind_Index: {
+            Print_AstExpression(writer, expression->Index.Operand, indent);
+            Writer_Char(writer, '[');
+            Print_AstExpression(writer, expression->Index.Index, indent);
+            Writer_Char(writer, ']');
+        } break;
+
+        case AstExpressionKind_Sizeof: {
+            Writer_String(writer, "size_of(");
+            Print_AstExpression(writer, expression->SizeOf.Expression, indent);
+            Writer_Char(writer, ')');
+        } break;
+
+        case AstExpressionKind_Cast: {
+            Writer_String(writer, "(cast(");
+            Print_AstType(writer, expression->Cast.Type, indent);
+            Writer_String(writer, ") ");
+            Print_AstExpression(writer, expression->Cast.Expression, indent);
+            Writer_Char(writer, ')');
+        } break;
+
+        case AstExpressionKind_Run: {
+            Writer_String(writer, "(#run ");
+            Print_AstExpression(writer, expression->Run.Expression, indent);
+            Writer_Char(writer, ')');
+        } break;
+
+        default: {
+            ASSERT(FALSE);
+        } break;
+    }
+}
+
+// Json AST dump, one object per node with the kind as a string and null for missing children
+
+void Json_AstExpression(Writer* writer, AstExpression* expression);
+void Json_AstStatement(Writer* writer, AstStatement* statement);
+
+void Json_AstType(Writer* writer, AstType* type) {
+    if (!type) {
+        Writer_String(writer, "null");
+        return;
+    }
+
+    switch (type->Kind) {
+        case AstTypeKind_Unknown: {
+            Writer_String(writer, "{\"kind\":\"Name\",\"name\":");
+            Writer_JsonString(writer, type->Unknown.Name.Name);
+            if (type->Unknown.Polymorphic) {
+                Writer_String(writer, ",\"polymorphic\":true");
+            }
+            if (type->Unknown.TypeArguments) {
+                Writer_String(writer, ",\"arguments\":[");
+                for (u64 i = 0; i < DynamicArrayLength(type->Unknown.TypeArguments); i++) {
+                    if (i > 0) {
+                        Writer_Char(writer, ',');
+                    }
+                    Json_AstType(writer, type->Unknown.TypeArguments[i]);
+                }
+                Writer_Char(writer, ']');
+            }
+        } break;
+
+        case AstTypeKind_Pointer: {
+            Writer_String(writer, "{\"kind\":\"Pointer\",\"to\":");
+            Json_AstType(writer, type->Pointer.PointerTo);
+        } break;
+
+        case AstTypeKind_Array: {
+            Writer_String(writer, type->Array.Dynamic ? "{\"kind\":\"Array\",\"dynamic\":true,\"count\":" :
+                                                        "{\"kind\":\"Array\",\"dynamic\":false,\"count\":");
+            Json_AstExpression(writer, type->Array.Count);
+            if (type->Array.Soa) {
+                Writer_String(writer, ",\"soa\":true");
+            }
+            Writer_String(writer, ",\"of\":");
+            Json_AstType(writer, type->Array.ArrayOf);
+        } break;
+
+        case AstTypeKind_Vector: {
+            Writer_String(writer, "{\"kind\":\"Vector\",\"count\":");
+            Json_AstExpression(writer, type->Array.Count);
+            Writer_String(writer, ",\"of\":");
+            Json_AstType(writer, type->Array.ArrayOf);
+        } break;
+
+        default: {
+            ASSERT(FALSE);
+        } break;
+    }
+    Writer_Char(writer, '}');
+}
+
+void Json_AstDeclaration(Writer* writer, AstDeclaration* declaration) {
+    Writer_String(writer, "{\"kind\":\"Declaration\",\"name\":");
+    Writer_JsonString(writer, declaration->Name.Name);
+    Writer_String(writer, declaration->Constant ? ",\"constant\":true,\"type\":" : ",\"constant\":false,\"type\":");
+    Json_AstType(writer, declaration->Type);
+    Writer_String(writer, ",\"value\":");
+    Json_AstExpression(writer, declaration->Value);
+    Writer_Char(writer, '}');
+}
+
+void Json_AstStatements(Writer* writer, AstStatement** statements) {
+    Writer_Char(writer, '[');
+    for (u64 i = 0; i < DynamicArrayLength(statements); i++) {
+        if (i > 0) {
+            Writer_Char(writer, ',');
+        }
+        Json_AstStatement(writer, statements[i]);
+    }
+    Writer_Char(writer, ']');
+}
+
+void Json_AstStatement(Writer* writer, AstStatement* statement) {
+    if (!statement) {
+        Writer_String(writer, "null");
+        return;
+    }
+
+    switch (statement->Kind) {
+        case AstStatementKind_Expression: {
+            Writer_String(writer, "{\"kind\":\"Expression\",\"expression\":");
+            Json_AstExpression(writer, &statement->Expression);
+        } break;
+
+        case AstStatementKind_Scope: {
+            Writer_String(writer, statement->Scope.NoBoundsCheck ? "{\"kind\":\"Scope\",\"no_bounds_check\":true,\"statements\":" :
+                                                                   "{\"kind\":\"Scope\",\"no_bounds_check\":false,\"statements\":");
+            Json_AstStatements(writer, statement->Scope.Statements);
+        } break;
+
+        case AstStatementKind_Declaration: {
+            Json_AstDeclaration(writer, &statement->Declaration);
+            return;
+        } break;
+
+        case AstStatementKind_Assignment: {
+            Writer_String(writer, "{\"kind\":\"Assignment\",\"operator\":");
+            Writer_JsonString(writer, TokenKindNames[statement->Assignment.Operator.Kind]);
+            Writer_String(writer, ",\"operand\":");
+            Json_AstExpression(writer, statement->Assignment.Operand);
+            Writer_String(writer, ",\"value\":");
+            Json_AstExpression(writer, statement->Assignment.Value);
+        } break;
+
+        case AstStatementKind_Return: {
+            Writer_String(writer, "{\"kind\":\"Return\",\"value\":");
+            Json_AstExpression(writer, statement->Return.Expression);
+        } break;
+
+        case AstStatementKind_If: {
+            // 'else if' chains are written in a loop and every link but the first is closed at the end
+            u64 links = 0;
+            while (TRUE) {
+                links++;
+                Writer_String(writer, "{\"kind\":\"If\",\"condition\":");
+                Json_AstExpression(writer, statement->If.Condition);
+                Writer_String(writer, ",\"then\":");
+                Json_AstStatement(writer, statement->If.Then);
+                Writer_String(writer, ",\"else\":");
+                if (!statement->If.Else || statement->If.Else->Kind != AstStatementKind_If) {
+                    Json_AstStatement(writer, statement->If.Else);
+                    break;
+                }
+                statement = statement->If.Else;
+            }
+
+            for (u64 i = 1; i < links; i++) {
+                Writer_Char(writer, '}');
+            }
+        } break;
+
+        case AstStatementKind_While: {
+            Writer_String(writer, "{\"kind\":\"While\",\"condition\":");
+            Json_AstExpression(writer, statement->While.Condition);
+            Writer_String(writer, ",\"body\":");
+            Json_AstStatement(writer, statement->While.Body);
+        } break;
+
+        case AstStatementKind_For: {
+            Writer_String(writer, "{\"kind\":\"For\",\"name\":");
+            Writer_JsonString(writer, statement->For.Variable->Declaration.Name.Name);
+            Writer_String(writer, ",\"start\":");
+            Json_AstExpression(writer, statement->For.Variable->Declaration.Value);
+            Writer_String(writer, ",\"end\":");
+            Json_AstExpression(writer, statement->For.End);
+            Writer_String(writer, ",\"statements\":");
+            Json_AstStatements(writer, statement->For.Body->Statements);
+        } break;
+
+        case AstStatementKind_Switch: {
+            Writer_String(writer, "{\"kind\":\"Switch\",\"value\":");
+            Json_AstExpression(writer, statement->Switch.Value);
+            Writer_String(writer, ",\"cases\":[");
+            for (u64 i = 0; i < DynamicArrayLength(statement->Switch.Cases); i++) {
+                AstCase* case_ = &statement->Switch.Cases[i];
+                Writer_String(writer, i > 0 ? ",{\"values\":[" : "{\"values\":[");
+                for (u64 j = 0; j < DynamicArrayLength(case_->Values); j++) {
+                    if (j > 0) {
+                        Writer_Char(writer, ',');
+                    }
+                    Json_AstExpression(writer, case_->Values[j]);
+                }
+                Writer_String(writer, "],\"body\":");
+                Json_AstStatement(writer, case_->Body);
+                Writer_Char(writer, '}');
+            }
+            Writer_String(writer, "],\"else\":");
+            Json_AstStatement(writer, statement->Switch.Else);
+        } break;
+
+        default: {
+            ASSERT(FALSE);
+        } break;
+    }
+    Writer_Char(writer, '}');
 }
 
-void Complete_Expression(AstExpression* expression, AstScope* parentScope) {
-    if (!expression->Type) {
-        expression->Type = Allocate(sizeof(AstType));
-    } else if (expression->Type->Completion == AstTypeCompletion_Complete) {
-        return;
-    } else if (expression->Type->Completion == AstTypeCompletion_Completing) {
-        Error("Cyclic dependency detected!");
+void Json_AstExpression(Writer* writer, AstExpression* expression) {
+    if (!expression) {
+        Writer_String(writer, "null");
         return;
     }
 
-    expression->Type->Completion = AstTypeCompletion_Completing;
-
+    Writer_String(writer, "{\"kind\":");
+    Writer_JsonString(writer, AstExpressionKindNames[expression->Kind]);
     switch (expression->Kind) {
+        case AstExpressionKind_Name: {
+            Writer_String(writer, ",\"name\":");
+            Writer_JsonString(writer, expression->Name.Name.Name);
+        } break;
+
         case AstExpressionKind_Literal: {
-            expression->Constant = TRUE;
-            switch (expression->Literal.Token.Kind) {
+            Token token = expression->Literal.Token;
+            switch (token.Kind) {
                 case TokenKind_Integer: {
-                    expression->Type->Kind = AstTypeKind_Integer;
-                    expression->Type->Size = 0;
+                    Writer_String(writer, ",\"integer\":");
+                    Writer_U64(writer, token.Integer);
                 } break;
 
                 case TokenKind_Float: {
-                    expression->Type->Kind = AstTypeKind_Float;
-                    expression->Type->Size = 0;
+                    Writer_Format(writer, ",\"float\":%.17g", token.Float);
                 } break;
 
                 case TokenKind_String: {
-                    expression->Type->Kind = AstTypeKind_String;
-                    expression->Type->Size = sizeof(u8*) + sizeof(u64); // TODO:
+                    Writer_String(writer, ",\"string\":");
+                    Writer_JsonBytes(writer, token.String, token.StringLength);
                 } break;
 
                 default: {
@@ -1459,120 +9703,209 @@ void Complete_Expression(AstExpression* expression, AstScope* parentScope) {
             }
         } break;
 
-        case AstExpressionKind_Name: {
-            AstScope* foundScope = NULL;
-            AstStatement* statement = FindDeclaration(expression->Name.Name.Name, parentScope, &foundScope);
-            if (!statement) {
-                expression->Type->Completion = AstTypeCompletion_Incomplete;
-                Error("Unable to find '%s'", expression->Name.Name.Name);
-                return;
+        case AstExpressionKind_Unary: {
+            Writer_String(writer, ",\"operator\":");
+            Writer_JsonString(writer, TokenKindNames[expression->Unary.Operator.Kind]);
+            Writer_String(writer, ",\"operand\":");
+            Json_AstExpression(writer, expression->Unary.Operand);
+        } break;
+
+        case AstExpressionKind_Binary: {
+            // Binary chains nest to the left, every link is opened walking down the chain and gets its right operand
+            // walking back up
+            AstExpression** chain = DynamicArrayCreate(AstExpression*);
+            AstExpression* operand = expression;
+            while (TRUE) {
+                DynamicArrayPush(chain, operand);
+                Writer_String(writer, ",\"operator\":");
+                Writer_JsonString(writer, TokenKindNames[operand->Binary.Operator.Kind]);
+                Writer_String(writer, ",\"left\":");
+                operand = operand->Binary.Left;
+                if (!operand || operand->Kind != AstExpressionKind_Binary) {
+                    break;
+                }
+                Writer_String(writer, "{\"kind\":");
+                Writer_JsonString(writer, AstExpressionKindNames[operand->Kind]);
             }
-            Complete_Statement(statement, foundScope);
 
-            AstType* type = Allocate(sizeof(AstType));
-            memcpy(type, statement->Declaration.Type, sizeof(AstType));
-            expression->Type = type;
+            Json_AstExpression(writer, operand);
+            for (u64 i = DynamicArrayLength(chain); i > 0; i--) {
+                Writer_String(writer, ",\"right\":");
+                Json_AstExpression(writer, chain[i - 1]->Binary.Right);
+                if (i > 1) {
+                    Writer_Char(writer, '}');
+                }
+            }
+            DynamicArrayDestroy(chain);
         } break;
 
-        default: {
-            ASSERT(FALSE);
+        case AstExpressionKind_Field: {
+            Writer_String(writer, ",\"expression\":");
+            Json_AstExpression(writer, expression->Field.Expression);
+            Writer_String(writer, ",\"name\":");
+            Writer_JsonString(writer, expression->Field.Name.Name);
         } break;
-    }
-
-    expression->Type->Completion = AstTypeCompletion_Complete;
-}
-
-void Print_AstType(AstType* type, u64 indent);
-void Print_AstStatement(AstStatement* statement, u64 indent);
-void Print_AstExpression(AstExpression* expression, u64 indent);
-
-int main(int argc, char** argv) {
-    if (argc != 2) {
-        printf("usage Thallium.exe [main file]\n");
-        return -2;
-    }
-
-    const char* path = argv[1];
-
-    FILE* file = fopen(path, "rb");
-
-    fseek(file, 0, SEEK_END);
-    u64 length = ftell(file);
-    fseek(file, 0, SEEK_SET);
 
-    char* source = Allocate(length + 1);
-    fread(source, sizeof(char), length, file);
-    source[length] = '\0';
+        case AstExpressionKind_Struct: {
+            Writer_String(writer, expression->Struct.Packed ? ",\"packed\":true" : ",\"packed\":false");
+            Writer_String(writer, expression->Struct.Reorder ? ",\"reorder\":true" : ",\"reorder\":false");
+            if (expression->Struct.TypeParameters) {
+                Writer_String(writer, ",\"parameters\":[");
+                for (u64 i = 0; i < DynamicArrayLength(expression->Struct.TypeParameters); i++) {
+                    if (i > 0) {
+                        Writer_Char(writer, ',');
+                    }
+                    Writer_JsonString(writer, expression->Struct.TypeParameters[i].Name);
+                }
+                Writer_Char(writer, ']');
+            }
+            Writer_String(writer, ",\"fields\":[");
+            for (u64 i = 0; i < DynamicArrayLength(expression->Struct.Declarations); i++) {
+                if (i > 0) {
+                    Writer_Char(writer, ',');
+                }
+                Json_AstDeclaration(writer, &expression->Struct.Declarations[i]);
+            }
+            Writer_Char(writer, ']');
+        } break;
 
-    fclose(file);
+        case AstExpressionKind_Procedure: {
+            Writer_String(writer, ",\"arguments\":[");
+            for (u64 i = 0; i < DynamicArrayLength(expression->Procedure.Arguments); i++) {
+                if (i > 0) {
+                    Writer_Char(writer, ',');
+                }
+                Writer_String(writer, "{\"name\":");
+                Writer_JsonString(writer, expression->Procedure.Arguments[i].Name.Name);
+                Writer_String(writer, ",\"type\":");
+                Json_AstType(writer, expression->Procedure.Arguments[i].Type);
+                Writer_Char(writer, '}');
+            }
+            Writer_String(writer, "],\"return_type\":");
+            Json_AstType(writer, expression->Procedure.ReturnType);
+            Writer_String(writer, ",\"body\":");
+            Json_AstStatements(writer, expression->Procedure.Body->Statements);
+        } break;
 
-#if 0
-    Lexer lexer;
-    Lexer_Init(&lexer, path, source);
+        case AstExpressionKind_Call: {
+            Writer_String(writer, ",\"operand\":");
+            Json_AstExpression(writer, expression->Call.Operand);
+            Writer_String(writer, ",\"arguments\":[");
+            for (u64 i = 0; i < DynamicArrayLength(expression->Call.Arguments); i++) {
+                if (i > 0) {
+                    Writer_Char(writer, ',');
+                }
+                Json_AstExpression(writer, expression->Call.Arguments[i]);
+            }
+            Writer_Char(writer, ']');
+        } break;
 
-    Token token;
-    while ((token = Lexer_NextToken(&lexer)).Kind != TokenKind_EndOfFile) {
-        switch (token.Kind) {
-            case TokenKind_Name: {
-                printf("%s: '%s'\n", TokenKindNames[token.Kind], token.Name);
-            } break;
+        case AstExpressionKind_Index: {
+            Writer_String(writer, ",\"operand\":");
+            Json_AstExpression(writer, expression->Index.Operand);
+            Writer_String(writer, ",\"index\":");
+            Json_AstExpression(writer, expression->Index.Index);
+        } break;
 
-            case TokenKind_Integer: {
-                printf("%s: %llu\n", TokenKindNames[token.Kind], token.Integer);
-            } break;
+        case AstExpressionKind_Sizeof: {
+            Writer_String(writer, ",\"expression\":");
+            Json_AstExpression(writer, expression->SizeOf.Expression);
+        } break;
 
-            case TokenKind_Float: {
-                printf("%s: %f\n", TokenKindNames[token.Kind], token.Float);
-            } break;
+        case AstExpressionKind_Cast: {
+            Writer_String(writer, ",\"type\":");
+            Json_AstType(writer, expression->Cast.Type);
+            Writer_String(writer, ",\"expression\":");
+            Json_AstExpression(writer, expression->Cast.Expression);
+        } break;
 
-            case TokenKind_String: {
-                printf("%s: \"%s\"\n", TokenKindNames[token.Kind], token.String);
-            } break;
+        case AstExpressionKind_Run: {
+            Writer_String(writer, ",\"expression\":");
+            Json_AstExpression(writer, expression->Run.Expression);
+        } break;
 
-            default: {
-                printf("%s\n", TokenKindNames[token.Kind]);
-            } break;
-        }
+        default: {
+        } break;
     }
-    
-    putchar('\n');
-    putchar('\n');
-#endif
-
-    Parser parser;
-    Parser_Init(&parser, path, source);
-    AstStatement* statement = Parser_ParseStatement(&parser, NULL);
-    Print_AstStatement(statement, 0);
+    Writer_Char(writer, '}');
+}
 
-    return 0;
+// Binary AST dump
+//
+// A preorder stream starting with the bytes "THAST" and a version byte. Numbers are LEB128 varints, strings a varint
+// length followed by the bytes and lists a varint count followed by the elements. Every statement, expression and type
+// starts with its kind as a byte, a kind of 0 stands for a missing one. Operators are token kinds, also as a byte.
+// Floats are their 8 bytes little endian.
+//
+// Expression: Expression
+// Scope: No bounds check byte, Count, Statements
+// Declaration: Name, Constant byte, Type, Value
+// Assignment: Operator, Operand, Value
+// Return: Value
+// If: Condition, Then, Else
+// While: Condition, Body
+// For: Name, Start, End, Count, Statements
+// Switch: Value, Count, Cases as Count, Values and Body, Else
+//
+// Name: Name
+// Literal: Token kind, then the integer, float or string
+// Unary: Operator, Operand
+// Binary: Operator, Left, Right
+// Field: Operand, Name
+// Struct: Packed | Reorder << 1 as a byte, Count, Type parameter names, Count, Fields as declarations without the kind byte
+// Procedure: Count, Arguments as Name and Type, Return type, Count, Statements
+// Call: Operand, Count, Arguments
+// Index: Operand, Index
+// Sizeof: Operand
+// Cast: Type, Operand
+// Run: Operand
+//
+// Name (type): Name, Polymorphic byte, Count, Type arguments
+// Pointer: Type
+// Array: Dynamic | Soa << 1 as a byte, Count, Element type
+// Vector: Count, Lane type
+
+#define Binary_AstVersion 8
+
+void Binary_AstExpression(Writer* writer, AstExpression* expression);
+void Binary_AstStatement(Writer* writer, AstStatement* statement);
+
+void Binary_String(Writer* writer, const char* string) {
+    u64 length = strlen(string);
+    Writer_VarU64(writer, length);
+    Writer_Write(writer, string, length);
 }
 
-void Print_Indent(u64 indent) {
-    for (u64 i = 0; i < indent; i++) {
-        printf("    ");
+void Binary_AstType(Writer* writer, AstType* type) {
+    if (!type) {
+        Writer_Char(writer, AstTypeKind_None);
+        return;
     }
-}
 
-void Print_AstType(AstType* type, u64 indent) {
+    Writer_Char(writer, cast(char) type->Kind);
     switch (type->Kind) {
         case AstTypeKind_Unknown: {
-            printf("%s", type->Unknown.Name.Name);
+            Binary_String(writer, type->Unknown.Name.Name);
+            Writer_Char(writer, cast(char) type->Unknown.Polymorphic);
+            Writer_VarU64(writer, type->Unknown.TypeArguments ? DynamicArrayLength(type->Unknown.TypeArguments) : 0);
+            for (u64 i = 0; type->Unknown.TypeArguments && i < DynamicArrayLength(type->Unknown.TypeArguments); i++) {
+                Binary_AstType(writer, type->Unknown.TypeArguments[i]);
+            }
         } break;
 
         case AstTypeKind_Pointer: {
-            printf("^");
-            Print_AstType(type->Pointer.PointerTo, indent);
+            Binary_AstType(writer, type->Pointer.PointerTo);
         } break;
 
         case AstTypeKind_Array: {
-            printf("[");
-            if (type->Array.Dynamic) {
-                printf("..");
-            } else if (type->Array.Count) {
-                Print_AstExpression(type->Array.Count, indent);
-            }
-            printf("]");
-            Print_AstType(type->Array.ArrayOf, indent);
+            Writer_Char(writer, cast(char) (type->Array.Dynamic | (type->Array.Soa << 1)));
+            Binary_AstExpression(writer, type->Array.Count);
+            Binary_AstType(writer, type->Array.ArrayOf);
+        } break;
+
+        case AstTypeKind_Vector: {
+            Binary_AstExpression(writer, type->Array.Count);
+            Binary_AstType(writer, type->Array.ArrayOf);
         } break;
 
         default: {
@@ -1581,89 +9914,89 @@ void Print_AstType(AstType* type, u64 indent) {
     }
 }
 
-void Print_AstStatement(AstStatement* statement, u64 indent) {
-    switch (statement->Kind) {
-        case AstStatementKind_Expression: {
-            Print_AstExpression(&statement->Expression, indent);
-            printf(";\n");
-        } break;
-
-        case AstStatementKind_Declaration: {
-            Print_Indent(indent);
-            printf("%s", statement->Declaration.Name.Name);
+void Binary_AstDeclaration(Writer* writer, AstDeclaration* declaration) {
+    Binary_String(writer, declaration->Name.Name);
+    Writer_Char(writer, cast(char) declaration->Constant);
+    Binary_AstType(writer, declaration->Type);
+    Binary_AstExpression(writer, declaration->Value);
+}
 
-            if (statement->Declaration.Type) {
-                printf(": ");
-                Print_AstType(statement->Declaration.Type, indent);
-            } else {
-                printf(" :%c ", statement->Declaration.Constant ? ':' : '=');
-            }
+void Binary_AstStatements(Writer* writer, AstStatement** statements) {
+    Writer_VarU64(writer, DynamicArrayLength(statements));
+    for (u64 i = 0; i < DynamicArrayLength(statements); i++) {
+        Binary_AstStatement(writer, statements[i]);
+    }
+}
 
-            if (statement->Declaration.Value) {
-                if (statement->Declaration.Type) {
-                    printf(" %c ", statement->Declaration.Constant ? ':' : '=');
-                }
+void Binary_AstStatement(Writer* writer, AstStatement* statement) {
+    if (!statement) {
+        Writer_Char(writer, AstStatementKind_None);
+        return;
+    }
 
-                Print_AstExpression(statement->Declaration.Value, indent);
-            }
+    Writer_Char(writer, cast(char) statement->Kind);
+    switch (statement->Kind) {
+        case AstStatementKind_Expression: {
+            Binary_AstExpression(writer, &statement->Expression);
+        } break;
 
-            printf(";\n");
+        case AstStatementKind_Scope: {
+            Writer_Char(writer, cast(char) statement->Scope.NoBoundsCheck);
+            Binary_AstStatements(writer, statement->Scope.Statements);
         } break;
 
-        case AstStatementKind_Assignment: {
-            Print_Indent(indent);
-            Print_AstExpression(statement->Assignment.Operand, indent);
-            printf(" %s ", TokenKindNames[statement->Assignment.Operator.Kind]);
-            Print_AstExpression(statement->Assignment.Value, indent);
-            printf(";\n");
+        case AstStatementKind_Declaration: {
+            Binary_AstDeclaration(writer, &statement->Declaration);
         } break;
 
-        case AstStatementKind_Scope: {
-            printf("{\n");
-            for (u64 i = 0; i < DynamicArrayLength(statement->Scope.Statements); i++) {
-                Print_AstStatement(statement->Scope.Statements[i], indent + 1);
-            }
-            Print_Indent(indent);
-            printf("}");
+        case AstStatementKind_Assignment: {
+            Writer_Char(writer, cast(char) statement->Assignment.Operator.Kind);
+            Binary_AstExpression(writer, statement->Assignment.Operand);
+            Binary_AstExpression(writer, statement->Assignment.Value);
         } break;
 
         case AstStatementKind_Return: {
-            Print_Indent(indent);
-            printf("return ");
-            Print_AstExpression(statement->Return.Expression, indent);
-            printf(";\n");
+            Binary_AstExpression(writer, statement->Return.Expression);
         } break;
 
         case AstStatementKind_If: {
-            Print_Indent(indent);
-            printf("if ");
-            Print_AstExpression(statement->If.Condition, indent);
-
-            if (statement->If.Then->Kind != AstStatementKind_Scope) {
-                printf("\n");
-                Print_Indent(indent);
-            } else {
-                printf(" ");
+            // 'else if' chains are written in a loop, each link after its kind byte
+            while (TRUE) {
+                Binary_AstExpression(writer, statement->If.Condition);
+                Binary_AstStatement(writer, statement->If.Then);
+                if (!statement->If.Else || statement->If.Else->Kind != AstStatementKind_If) {
+                    Binary_AstStatement(writer, statement->If.Else);
+                    break;
+                }
+                statement = statement->If.Else;
+                Writer_Char(writer, cast(char) statement->Kind);
             }
-            Print_AstStatement(statement->If.Then, indent);
+        } break;
 
-            if (statement->If.Else) {
-                if (statement->If.Then->Kind == AstStatementKind_Scope) {
-                    printf(" ");
-                } else {
-                    Print_Indent(indent);
-                }
+        case AstStatementKind_While: {
+            Binary_AstExpression(writer, statement->While.Condition);
+            Binary_AstStatement(writer, statement->While.Body);
+        } break;
 
-                printf("else ");
-                if (statement->If.Else->Kind != AstStatementKind_Scope) {
-                    printf("\n");
-                    Print_Indent(indent);
-                }
+        case AstStatementKind_For: {
+            Binary_String(writer, statement->For.Variable->Declaration.Name.Name);
+            Binary_AstExpression(writer, statement->For.Variable->Declaration.Value);
+            Binary_AstExpression(writer, statement->For.End);
+            Binary_AstStatements(writer, statement->For.Body->Statements);
+        } break;
 
-                Print_AstStatement(statement->If.Else, indent);
+        case AstStatementKind_Switch: {
+            Binary_AstExpression(writer, statement->Switch.Value);
+            Writer_VarU64(writer, DynamicArrayLength(statement->Switch.Cases));
+            for (u64 i = 0; i < DynamicArrayLength(statement->Switch.Cases); i++) {
+                AstCase* case_ = &statement->Switch.Cases[i];
+                Writer_VarU64(writer, DynamicArrayLength(case_->Values));
+                for (u64 j = 0; j < DynamicArrayLength(case_->Values); j++) {
+                    Binary_AstExpression(writer, case_->Values[j]);
+                }
+                Binary_AstStatement(writer, case_->Body);
             }
-
-            printf("\n");
+            Binary_AstStatement(writer, statement->Switch.Else);
         } break;
 
         default: {
@@ -1672,24 +10005,37 @@ void Print_AstStatement(AstStatement* statement, u64 indent) {
     }
 }
 
-void Print_AstExpression(AstExpression* expression, u64 indent) {
+void Binary_AstExpression(Writer* writer, AstExpression* expression) {
+    if (!expression) {
+        Writer_Char(writer, AstExpressionKind_None);
+        return;
+    }
+
+    Writer_Char(writer, cast(char) expression->Kind);
     switch (expression->Kind) {
         case AstExpressionKind_Name: {
-            printf("%s", expression->Name.Name.Name);
+            Binary_String(writer, expression->Name.Name.Name);
         } break;
 
         case AstExpressionKind_Literal: {
-            switch (expression->Literal.Token.Kind) {
+            Token token = expression->Literal.Token;
+            Writer_Char(writer, cast(char) token.Kind);
+            switch (token.Kind) {
                 case TokenKind_Integer: {
-                    printf("%llu", expression->Literal.Token.Integer);
+                    Writer_VarU64(writer, token.Integer);
                 } break;
 
                 case TokenKind_Float: {
-                    printf("%f", expression->Literal.Token.Float);
+                    u64 bits;
+                    memcpy(&bits, &token.Float, sizeof(bits));
+                    for (u64 i = 0; i < sizeof(bits); i++) {
+                        Writer_Char(writer, cast(char) (bits >> (i * 8)));
+                    }
                 } break;
 
                 case TokenKind_String: {
-                    printf("\"%s\"", expression->Literal.Token.String);
+                    Writer_VarU64(writer, token.StringLength);
+                    Writer_Write(writer, token.String, token.StringLength);
                 } break;
 
                 default: {
@@ -1699,108 +10045,115 @@ void Print_AstExpression(AstExpression* expression, u64 indent) {
         } break;
 
         case AstExpressionKind_Unary: {
-            printf("(%s ", TokenKindNames[expression->Unary.Operator.Kind]);
-            Print_AstExpression(expression->Unary.Operand, indent);
-            putchar(')');
+            Writer_Char(writer, cast(char) expression->Unary.Operator.Kind);
+            Binary_AstExpression(writer, expression->Unary.Operand);
         } break;
 
         case AstExpressionKind_Binary: {
-            putchar('(');
-            Print_AstExpression(expression->Binary.Left, indent);
-            printf(" %s ", TokenKindNames[expression->Binary.Operator.Kind]);
-            Print_AstExpression(expression->Binary.Right, indent);
-            putchar(')');
-        } break;
-
-        case AstExpressionKind_Field: {
-            putchar('(');
-            Print_AstExpression(expression->Field.Expression, indent);
-            printf(".%s)", expression->Field.Name.Name);
-        } break;
-
-        case AstExpressionKind_Procedure: {
-            printf("(");
-            for (u64 i = 0; i < DynamicArrayLength(expression->Procedure.Arguments); i++) {
-                if (i > 0) {
-                    printf(", ");
+            // Binary chains nest to the left, the operators are written walking down the chain and the right operands
+            // walking back up
+            AstExpression** chain = DynamicArrayCreate(AstExpression*);
+            AstExpression* operand = expression;
+            while (TRUE) {
+                DynamicArrayPush(chain, operand);
+                Writer_Char(writer, cast(char) operand->Binary.Operator.Kind);
+                operand = operand->Binary.Left;
+                if (!operand || operand->Kind != AstExpressionKind_Binary) {
+                    break;
                 }
-
-                printf("%s: ", expression->Procedure.Arguments[i].Name.Name);
-                Print_AstType(expression->Procedure.Arguments[i].Type, indent);
+                Writer_Char(writer, cast(char) operand->Kind);
             }
-            printf(")");
 
-            if (expression->Procedure.ReturnType) {
-                printf(" -> ");
-                Print_AstType(expression->Procedure.ReturnType, indent);
+            Binary_AstExpression(writer, operand);
+            for (u64 i = DynamicArrayLength(chain); i > 0; i--) {
+                Binary_AstExpression(writer, chain[i - 1]->Binary.Right);
             }
+            DynamicArrayDestroy(chain);
+        } break;
 
-            printf(" ");
-            Print_AstStatement(&(AstStatement){
-                .Kind = AstStatementKind_Scope,
-                .Scope = *expression->Procedure.Body,
-            }, indent);
+        case AstExpressionKind_Field: {
+            Binary_AstExpression(writer, expression->Field.Expression);
+            Binary_String(writer, expression->Field.Name.Name);
         } break;
 
         case AstExpressionKind_Struct: {
-            printf("struct {\n");
+            Writer_Char(writer, cast(char) (expression->Struct.Packed | (expression->Struct.Reorder << 1)));
+            Writer_VarU64(writer, expression->Struct.TypeParameters ? DynamicArrayLength(expression->Struct.TypeParameters) : 0);
+            for (u64 i = 0; expression->Struct.TypeParameters && i < DynamicArrayLength(expression->Struct.TypeParameters); i++) {
+                Binary_String(writer, expression->Struct.TypeParameters[i].Name);
+            }
+            Writer_VarU64(writer, DynamicArrayLength(expression->Struct.Declarations));
             for (u64 i = 0; i < DynamicArrayLength(expression->Struct.Declarations); i++) {
-                AstStatement statement = {};
-                statement.Kind = AstStatementKind_Declaration;
-                statement.Declaration = expression->Struct.Declarations[i];
-                Print_AstStatement(&statement, indent + 1);
+                Binary_AstDeclaration(writer, &expression->Struct.Declarations[i]);
             }
-            Print_Indent(indent);
-            printf("}");
-        } break;
-
-        case AstExpressionKind_True: {
-            printf("true");
         } break;
 
-        case AstExpressionKind_False: {
-            printf("false");
-        } break;
-
-        case AstExpressionKind_Null: {
-            printf("null");
+        case AstExpressionKind_Procedure: {
+            Writer_VarU64(writer, DynamicArrayLength(expression->Procedure.Arguments));
+            for (u64 i = 0; i < DynamicArrayLength(expression->Procedure.Arguments); i++) {
+                Binary_String(writer, expression->Procedure.Arguments[i].Name.Name);
+                Binary_AstType(writer, expression->Procedure.Arguments[i].Type);
+            }
+            Binary_AstType(writer, expression->Procedure.ReturnType);
+            Binary_AstStatements(writer, expression->Procedure.Body->Statements);
         } break;
 
         case AstExpressionKind_Call: {
-            Print_AstExpression(expression->Call.Operand, indent);
-            printf("(");
+            Binary_AstExpression(writer, expression->Call.Operand);
+            Writer_VarU64(writer, DynamicArrayLength(expression->Call.Arguments));
             for (u64 i = 0; i < DynamicArrayLength(expression->Call.Arguments); i++) {
-                if (i > 0) {
-                    printf(", ");
-                }
-                Print_AstExpression(expression->Call.Arguments[i], indent);
+                Binary_AstExpression(writer, expression->Call.Arguments[i]);
             }
-            printf(")");
         } break;
 
         case AstExpressionKind_Index: {
-            Print_AstExpression(expression->Index.Operand, indent);
-            printf("[");
-            Print_AstExpression(expression->Index.Index, indent);
-            printf("]");
+            Binary_AstExpression(writer, expression->Index.Operand);
+            Binary_AstExpression(writer, expression->Index.Index);
         } break;
 
         case AstExpressionKind_Sizeof: {
-            printf("size_of(");
-            Print_AstExpression(expression->SizeOf.Expression, indent);
-            printf(")");
+            Binary_AstExpression(writer, expression->SizeOf.Expression);
         } break;
 
         case AstExpressionKind_Cast: {
-            printf("(cast(");
-            Print_AstType(expression->Cast.Type, indent);
-            printf(") ");
-            Print_AstExpression(expression->Cast.Expression, indent);
-            printf(")");
+            Binary_AstType(writer, expression->Cast.Type);
+            Binary_AstExpression(writer, expression->Cast.Expression);
+        } break;
+
+        case AstExpressionKind_Run: {
+            Binary_AstExpression(writer, expression->Run.Expression);
+        } break;
+
+        default: {
+        } break;
+    }
+}
+
+// Writes the global scope as text, json or the binary stream described above
+void Dump_Ast(FILE* file, AstStatement* globalStatement, AstDumpFormat format) {
+    Writer* writer = malloc(sizeof(Writer));
+    Writer_Init(writer, file);
+    switch (format) {
+        case AstDumpFormat_Text: {
+            Print_AstStatement(writer, globalStatement, 0);
+        } break;
+
+        case AstDumpFormat_Json: {
+            Json_AstStatement(writer, globalStatement);
+            Writer_Char(writer, '\n');
+        } break;
+
+        case AstDumpFormat_Binary: {
+            Writer_BinaryMode(writer);
+            Writer_Write(writer, "THAST", 5);
+            Writer_Char(writer, Binary_AstVersion);
+            Binary_AstStatement(writer, globalStatement);
         } break;
 
         default: {
             ASSERT(FALSE);
         } break;
     }
+    Writer_Flush(writer);
+    free(writer);
 }
@@ -0,0 +1,94 @@
+#include "./Memory.h"
+#include "./Stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+void* Allocate(u64 size) {
+    Allocations.AllocateCalls++;
+    Allocations.AllocateBytes += size;
+
+    void* ptr = malloc(size);
+    if (!ptr) {
+        perror("Allocate failed!");
+        abort();
+        return NULL;
+    }
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+#if defined(_WIN32)
+
+const void* MapFile(const char* path, u64* size) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) {
+        return NULL;
+    }
+
+    const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!data) {
+        return NULL;
+    }
+
+    *size = fileSize.QuadPart;
+    return data;
+}
+
+void UnmapFile(const void* data, u64 size) {
+    UnmapViewOfFile(data);
+}
+
+#else
+
+const void* MapFile(const char* path, u64* size) {
+    int file = open(path, O_RDONLY);
+    if (file < 0) {
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0) {
+        close(file);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    *size = info.st_size;
+    return data;
+}
+
+void UnmapFile(const void* data, u64 size) {
+    munmap(cast(void*) data, size);
+}
+
+#endif
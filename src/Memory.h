@@ -0,0 +1,9 @@
+#pragma once
+
+#include "./Typedefs.h"
+
+void* Allocate(u64 size);
+
+// Maps a whole file read only, returns NULL if it cannot be opened or is empty
+const void* MapFile(const char* path, u64* size);
+void UnmapFile(const void* data, u64 size);
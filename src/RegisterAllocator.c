@@ -0,0 +1,513 @@
+#include "./RegisterAllocator.h"
+#include "./Memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char* RegisterNames[Register_Count] = {
+    [Register_None] = "none",
+
+    [Register_Rax] = "rax",
+    [Register_Rcx] = "rcx",
+    [Register_Rdx] = "rdx",
+    [Register_Rbx] = "rbx",
+    [Register_Rsi] = "rsi",
+    [Register_Rdi] = "rdi",
+    [Register_R8] = "r8",
+    [Register_R9] = "r9",
+    [Register_R10] = "r10",
+    [Register_R11] = "r11",
+    [Register_R12] = "r12",
+    [Register_R13] = "r13",
+    [Register_R14] = "r14",
+    [Register_R15] = "r15",
+
+    [Register_Xmm0] = "xmm0",
+    [Register_Xmm1] = "xmm1",
+    [Register_Xmm2] = "xmm2",
+    [Register_Xmm3] = "xmm3",
+    [Register_Xmm4] = "xmm4",
+    [Register_Xmm5] = "xmm5",
+    [Register_Xmm6] = "xmm6",
+    [Register_Xmm7] = "xmm7",
+    [Register_Xmm8] = "xmm8",
+    [Register_Xmm9] = "xmm9",
+    [Register_Xmm10] = "xmm10",
+    [Register_Xmm11] = "xmm11",
+    [Register_Xmm12] = "xmm12",
+    [Register_Xmm13] = "xmm13",
+    [Register_Xmm14] = "xmm14",
+    [Register_Xmm15] = "xmm15",
+};
+
+// Volatile registers come first so values that do not live across a call stay out of the callee saved ones
+static const Register GeneralRegisters[] = {
+    Register_Rax, Register_Rcx, Register_Rdx, Register_R8, Register_R9, Register_R10, Register_R11,
+    Register_Rbx, Register_Rsi, Register_Rdi, Register_R12, Register_R13, Register_R14, Register_R15,
+};
+
+static const Register FloatRegisters[] = {
+    Register_Xmm0, Register_Xmm1, Register_Xmm2, Register_Xmm3, Register_Xmm4, Register_Xmm5,
+    Register_Xmm6, Register_Xmm7, Register_Xmm8, Register_Xmm9, Register_Xmm10, Register_Xmm11,
+    Register_Xmm12, Register_Xmm13, Register_Xmm14, Register_Xmm15,
+};
+
+static const Register GeneralArgumentRegisters[] = { Register_Rcx, Register_Rdx, Register_R8, Register_R9 };
+static const Register FloatArgumentRegisters[] = { Register_Xmm0, Register_Xmm1, Register_Xmm2, Register_Xmm3 };
+
+RegisterClass Register_GetClass(Register reg) {
+    if (reg >= Register_Rax && reg <= Register_R15) {
+        return RegisterClass_General;
+    } else if (reg >= Register_Xmm0 && reg <= Register_Xmm15) {
+        return RegisterClass_Float;
+    }
+    return RegisterClass_None;
+}
+
+b8 Register_IsVolatile(Register reg) {
+    switch (reg) {
+        case Register_Rax:
+        case Register_Rcx:
+        case Register_Rdx:
+        case Register_R8:
+        case Register_R9:
+        case Register_R10:
+        case Register_R11:
+        case Register_Xmm0:
+        case Register_Xmm1:
+        case Register_Xmm2:
+        case Register_Xmm3:
+        case Register_Xmm4:
+        case Register_Xmm5: {
+            return TRUE;
+        } break;
+
+        default: {
+            return FALSE;
+        } break;
+    }
+}
+
+static RegisterClass RegisterClass_FromType(IrType type) {
+    switch (type.Kind) {
+        case IrTypeKind_Void: {
+            return RegisterClass_None;
+        } break;
+
+        case IrTypeKind_Float:
+        case IrTypeKind_Vector: {
+            return RegisterClass_Float;
+        } break;
+
+        default: {
+            return RegisterClass_General;
+        } break;
+    }
+}
+
+static Register RegisterClass_ArgumentRegister(RegisterClass class, u64 index) {
+    if (index >= 4) {
+        return Register_None;
+    }
+    return class == RegisterClass_Float ? FloatArgumentRegisters[index] : GeneralArgumentRegisters[index];
+}
+
+static Register RegisterClass_ReturnRegister(RegisterClass class) {
+    return class == RegisterClass_Float ? Register_Xmm0 : Register_Rax;
+}
+
+// Locals are addressed relative to the frame and never need a register of their own
+static b8 IrInstruction_NeedsRegister(IrInstruction* instruction) {
+    return instruction->Type.Kind != IrTypeKind_Void && instruction->Op != IrOp_Local && instruction->Op != IrOp_Undefined;
+}
+
+// Loop depth of every block, indexed by IrBlock::Order
+static u64* IrProcedure_LoopDepths(IrProcedure* procedure) {
+    u64 blockCount = DynamicArrayLength(procedure->Blocks);
+    u64* depths = Allocate(blockCount * sizeof(u64));
+    b8* inLoop = Allocate(blockCount * sizeof(b8));
+    IrBlock** worklist = DynamicArrayCreate(IrBlock*);
+
+    for (u64 i = 0; i < blockCount; i++) {
+        IrBlock* block = procedure->Blocks[i];
+        for (u64 j = 0; j < IrBlock_SuccessorCount(block); j++) {
+            IrBlock* header = IrBlock_Successor(block, j);
+            if (!IrBlock_Dominates(header, block)) {
+                continue;
+            }
+
+            // Back edge, walk the natural loop backwards from the latch up to the header
+            memset(inLoop, 0, blockCount * sizeof(b8));
+            inLoop[header->Order] = TRUE;
+            DynamicArrayPush(worklist, block);
+            while (DynamicArrayLength(worklist) > 0) {
+                IrBlock* current;
+                DynamicArrayPop(worklist, &current);
+                if (inLoop[current->Order]) {
+                    continue;
+                }
+                inLoop[current->Order] = TRUE;
+
+                for (u64 k = 0; k < DynamicArrayLength(current->Predecessors); k++) {
+                    DynamicArrayPush(worklist, current->Predecessors[k]);
+                }
+            }
+
+            for (u64 k = 0; k < blockCount; k++) {
+                depths[k] += inLoop[k];
+            }
+        }
+    }
+
+    DynamicArrayDestroy(worklist);
+    free(inLoop);
+    return depths;
+}
+
+static f64 LoopDepth_Weight(u64 depth) {
+    f64 weight = 1.0;
+    for (u64 i = 0; i < depth; i++) {
+        weight *= 10.0;
+    }
+    return weight;
+}
+
+#define BitSet_Get(set, index) (((set)[(index) / 64] >> ((index) % 64)) & 1)
+#define BitSet_Set(set, index) ((set)[(index) / 64] |= 1ull << ((index) % 64))
+#define BitSet_Clear(set, index) ((set)[(index) / 64] &= ~(1ull << ((index) % 64)))
+
+static void LiveInterval_Extend(LiveInterval* interval, u64 position) {
+    if (position < interval->Start) {
+        interval->Start = position;
+    }
+    if (position > interval->End) {
+        interval->End = position;
+    }
+}
+
+static int LiveInterval_CompareStart(const void* a, const void* b) {
+    const LiveInterval* left = a;
+    const LiveInterval* right = b;
+    if (left->Start != right->Start) {
+        return left->Start < right->Start ? -1 : 1;
+    }
+    return left->Value->Id < right->Value->Id ? -1 : left->Value->Id > right->Value->Id;
+}
+
+static void RegisterAllocation_BuildIntervals(RegisterAllocation* allocation) {
+    IrProcedure* procedure = allocation->Procedure;
+    u64 blockCount = DynamicArrayLength(procedure->Blocks);
+    u64 valueCount = procedure->NextInstructionId;
+    u64 words = (valueCount + 63) / 64;
+
+    // Every instruction takes two positions so a definition never starts where an operand ends
+    u64* blockStarts = Allocate(blockCount * sizeof(u64));
+    u64* blockEnds = Allocate(blockCount * sizeof(u64));
+    u64 position = 0;
+    for (u64 i = 0; i < blockCount; i++) {
+        blockStarts[i] = position;
+        position += DynamicArrayLength(procedure->Blocks[i]->Instructions) * 2;
+        blockEnds[i] = position;
+        position += 2;
+    }
+
+    // Liveness, the operands of a phi are live out of the matching predecessor
+    u64* liveIn = Allocate(blockCount * words * sizeof(u64));
+    u64* liveOut = Allocate(blockCount * words * sizeof(u64));
+    u64* live = Allocate(words * sizeof(u64));
+    b8 changed = TRUE;
+    while (changed) {
+        changed = FALSE;
+        for (u64 i = blockCount; i-- > 0;) {
+            IrBlock* block = procedure->Blocks[i];
+            u64* out = &liveOut[i * words];
+
+            for (u64 j = 0; j < IrBlock_SuccessorCount(block); j++) {
+                IrBlock* successor = IrBlock_Successor(block, j);
+                u64* successorIn = &liveIn[successor->Order * words];
+                for (u64 k = 0; k < words; k++) {
+                    out[k] |= successorIn[k];
+                }
+
+                for (u64 k = 0; k < DynamicArrayLength(successor->Instructions); k++) {
+                    IrInstruction* phi = successor->Instructions[k];
+                    if (phi->Op != IrOp_Phi) {
+                        continue;
+                    }
+                    for (u64 l = 0; l < DynamicArrayLength(phi->Operands); l++) {
+                        if (successor->Predecessors[l] == block && IrInstruction_NeedsRegister(phi->Operands[l])) {
+                            BitSet_Set(out, phi->Operands[l]->Id);
+                        }
+                    }
+                }
+            }
+
+            memcpy(live, out, words * sizeof(u64));
+            for (u64 j = DynamicArrayLength(block->Instructions); j-- > 0;) {
+                IrInstruction* instruction = block->Instructions[j];
+                BitSet_Clear(live, instruction->Id);
+                if (instruction->Op == IrOp_Phi) {
+                    continue;
+                }
+
+                for (u64 k = 0; k < DynamicArrayLength(instruction->Operands); k++) {
+                    if (IrInstruction_NeedsRegister(instruction->Operands[k])) {
+                        BitSet_Set(live, instruction->Operands[k]->Id);
+                    }
+                }
+            }
+
+            u64* in = &liveIn[i * words];
+            if (memcmp(in, live, words * sizeof(u64)) != 0) {
+                memcpy(in, live, words * sizeof(u64));
+                changed = TRUE;
+            }
+        }
+    }
+
+    u64* depths = IrProcedure_LoopDepths(procedure);
+
+    allocation->IntervalsById = Allocate(valueCount * sizeof(LiveInterval*));
+    LiveInterval* intervals = Allocate(valueCount * sizeof(LiveInterval));
+    u64* callPositions = DynamicArrayCreate(u64);
+
+    for (u64 i = 0; i < blockCount; i++) {
+        IrBlock* block = procedure->Blocks[i];
+        f64 weight = LoopDepth_Weight(depths[i]);
+
+        for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+            IrInstruction* instruction = block->Instructions[j];
+            u64 position = blockStarts[i] + j * 2;
+
+            if (IrInstruction_NeedsRegister(instruction)) {
+                LiveInterval* interval = &intervals[instruction->Id];
+                interval->Value = instruction;
+                interval->Class = RegisterClass_FromType(instruction->Type);
+                interval->Start = instruction->Op == IrOp_Phi ? blockStarts[i] : position + 1;
+                interval->End = interval->Start;
+                interval->SpillWeight += weight;
+
+                if (instruction->Op == IrOp_Parameter) {
+                    interval->Hint = RegisterClass_ArgumentRegister(interval->Class, instruction->Index);
+                } else if (instruction->Op == IrOp_Call) {
+                    interval->Hint = RegisterClass_ReturnRegister(interval->Class);
+                }
+                allocation->IntervalsById[instruction->Id] = interval;
+            }
+
+            if (instruction->Op == IrOp_Call) {
+                DynamicArrayPush(callPositions, position);
+            }
+        }
+    }
+
+    for (u64 i = 0; i < blockCount; i++) {
+        IrBlock* block = procedure->Blocks[i];
+        f64 weight = LoopDepth_Weight(depths[i]);
+
+        for (u64 j = 0; j < valueCount; j++) {
+            if (BitSet_Get(&liveIn[i * words], j)) {
+                LiveInterval_Extend(&intervals[j], blockStarts[i]);
+            }
+            if (BitSet_Get(&liveOut[i * words], j)) {
+                LiveInterval_Extend(&intervals[j], blockEnds[i]);
+            }
+        }
+
+        for (u64 j = 0; j < DynamicArrayLength(block->Instructions); j++) {
+            IrInstruction* instruction = block->Instructions[j];
+            u64 position = blockStarts[i] + j * 2;
+
+            for (u64 k = 0; k < DynamicArrayLength(instruction->Operands); k++) {
+                IrInstruction* operand = instruction->Operands[k];
+                if (!IrInstruction_NeedsRegister(operand)) {
+                    continue;
+                }
+
+                LiveInterval* interval = &intervals[operand->Id];
+                if (instruction->Op == IrOp_Phi) {
+                    interval->SpillWeight += LoopDepth_Weight(depths[block->Predecessors[k]->Order]);
+                    continue;
+                }
+                LiveInterval_Extend(interval, position);
+                interval->SpillWeight += weight;
+
+                if (interval->Hint == Register_None) {
+                    if (instruction->Op == IrOp_Return) {
+                        interval->Hint = RegisterClass_ReturnRegister(interval->Class);
+                    } else if (instruction->Op == IrOp_Call) {
+                        u64 index = instruction->Procedure ? k : k - 1;
+                        if (instruction->Procedure || k > 0) {
+                            interval->Hint = RegisterClass_ArgumentRegister(interval->Class, index);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    allocation->Intervals = DynamicArrayCreate(LiveInterval);
+    for (u64 i = 0; i < valueCount; i++) {
+        LiveInterval* interval = &intervals[i];
+        if (!interval->Value) {
+            continue;
+        }
+
+        for (u64 j = 0; j < DynamicArrayLength(callPositions); j++) {
+            if (interval->Start < callPositions[j] && callPositions[j] < interval->End) {
+                interval->CrossesCall = TRUE;
+                break;
+            }
+        }
+
+        // Constants can be rematerialized instead of reloaded so they are the cheapest to spill
+        if (interval->Value->Op == IrOp_Constant || interval->Value->Op == IrOp_ProcedureAddress || interval->Value->Op == IrOp_String) {
+            interval->SpillWeight = 0.0;
+        }
+
+        DynamicArrayPush(allocation->Intervals, *interval);
+    }
+
+    qsort(allocation->Intervals, DynamicArrayLength(allocation->Intervals), sizeof(LiveInterval), LiveInterval_CompareStart);
+    for (u64 i = 0; i < DynamicArrayLength(allocation->Intervals); i++) {
+        allocation->IntervalsById[allocation->Intervals[i].Value->Id] = &allocation->Intervals[i];
+    }
+
+    DynamicArrayDestroy(callPositions);
+    free(intervals);
+    free(depths);
+    free(live);
+    free(liveOut);
+    free(liveIn);
+    free(blockEnds);
+    free(blockStarts);
+}
+
+// 32 byte vectors use the whole ymm register, calls only preserve the lower half of the callee saved ones
+static b8 LiveInterval_IsWide(LiveInterval* interval) {
+    return interval->Value->Type.Size > 16;
+}
+
+static b8 LiveInterval_CanUse(LiveInterval* interval, Register reg) {
+    if (interval->CrossesCall && (Register_IsVolatile(reg) || LiveInterval_IsWide(interval))) {
+        return FALSE;
+    }
+    return Register_GetClass(reg) == interval->Class;
+}
+
+// Spill slots are 8 bytes, vectors take as many consecutive slots as they need
+static void LiveInterval_Spill(RegisterAllocation* allocation, LiveInterval* interval) {
+    u64 size = interval->Value->Type.Size;
+    interval->Register = Register_None;
+    interval->SpillSlot = allocation->SpillSlotCount;
+    allocation->SpillSlotCount += size > 8 ? (size + 7) / 8 : 1;
+}
+
+RegisterAllocation* RegisterAllocator_Allocate(IrProcedure* procedure) {
+    IrProcedure_Analyze(procedure);
+
+    RegisterAllocation* allocation = Allocate(sizeof(RegisterAllocation));
+    allocation->Procedure = procedure;
+    if (DynamicArrayLength(procedure->Blocks) == 0) {
+        allocation->Intervals = DynamicArrayCreate(LiveInterval);
+        return allocation;
+    }
+    RegisterAllocation_BuildIntervals(allocation);
+
+    LiveInterval** active = DynamicArrayCreate(LiveInterval*); // Sorted by end
+    LiveInterval* owners[Register_Count] = { 0 };
+
+    for (u64 i = 0; i < DynamicArrayLength(allocation->Intervals); i++) {
+        LiveInterval* interval = &allocation->Intervals[i];
+
+        while (DynamicArrayLength(active) > 0 && active[0]->End < interval->Start) {
+            LiveInterval* expired;
+            DynamicArrayPopAt(active, 0, &expired);
+            owners[expired->Register] = NULL;
+        }
+
+        const Register* registers = interval->Class == RegisterClass_Float ? FloatRegisters : GeneralRegisters;
+        u64 registerCount = interval->Class == RegisterClass_Float ?
+            sizeof(FloatRegisters) / sizeof(FloatRegisters[0]) :
+            sizeof(GeneralRegisters) / sizeof(GeneralRegisters[0]);
+
+        Register chosen = Register_None;
+        if (interval->Hint != Register_None && !owners[interval->Hint] && LiveInterval_CanUse(interval, interval->Hint)) {
+            chosen = interval->Hint;
+        }
+        for (u64 j = 0; j < registerCount && chosen == Register_None; j++) {
+            if (!owners[registers[j]] && LiveInterval_CanUse(interval, registers[j])) {
+                chosen = registers[j];
+            }
+        }
+
+        if (chosen == Register_None) {
+            // Evict the cheapest interval holding a register we could use, preferring the one that lives the longest
+            LiveInterval* victim = NULL;
+            for (u64 j = 0; j < DynamicArrayLength(active); j++) {
+                LiveInterval* candidate = active[j];
+                if (!LiveInterval_CanUse(interval, candidate->Register)) {
+                    continue;
+                }
+                if (!victim || candidate->SpillWeight < victim->SpillWeight ||
+                    (candidate->SpillWeight == victim->SpillWeight && candidate->End > victim->End)) {
+                    victim = candidate;
+                }
+            }
+
+            if (!victim || victim->SpillWeight > interval->SpillWeight ||
+                (victim->SpillWeight == interval->SpillWeight && victim->End <= interval->End)) {
+                LiveInterval_Spill(allocation, interval);
+                continue;
+            }
+
+            chosen = victim->Register;
+            for (u64 j = 0; j < DynamicArrayLength(active); j++) {
+                if (active[j] == victim) {
+                    DynamicArrayPopAt(active, j, NULL);
+                    break;
+                }
+            }
+            LiveInterval_Spill(allocation, victim);
+        }
+
+        interval->Register = chosen;
+        owners[chosen] = interval;
+        allocation->UsedRegisters[chosen] = TRUE;
+
+        u64 index = 0;
+        while (index < DynamicArrayLength(active) && active[index]->End <= interval->End) {
+            index++;
+        }
+        DynamicArrayInsert(active, index, interval);
+    }
+
+    DynamicArrayDestroy(active);
+    return allocation;
+}
+
+void RegisterAllocation_Print(RegisterAllocation* allocation) {
+    printf("registers %s {\n", allocation->Procedure->Name);
+    for (u64 i = 0; i < DynamicArrayLength(allocation->Intervals); i++) {
+        LiveInterval* interval = &allocation->Intervals[i];
+        printf("    %%%llu: ", interval->Value->Id);
+        if (interval->Register != Register_None && LiveInterval_IsWide(interval)) {
+            printf("ymm%u", interval->Register - Register_Xmm0);
+        } else if (interval->Register != Register_None) {
+            printf("%s", RegisterNames[interval->Register]);
+        } else {
+            printf("spill %llu", interval->SpillSlot);
+        }
+        printf(" [%llu, %llu] weight %g%s\n", interval->Start, interval->End, interval->SpillWeight, interval->CrossesCall ? " crosses call" : "");
+    }
+
+    printf("    spill slots: %llu\n", allocation->SpillSlotCount);
+    printf("    saved:");
+    for (Register reg = Register_Rax; reg < Register_Count; reg++) {
+        if (allocation->UsedRegisters[reg] && !Register_IsVolatile(reg)) {
+            printf(" %s", RegisterNames[reg]);
+        }
+    }
+    printf("\n}\n");
+}
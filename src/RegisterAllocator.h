@@ -0,0 +1,78 @@
+#pragma once
+
+#include "./Typedefs.h"
+#include "./Ir.h"
+
+typedef enum RegisterClass {
+    RegisterClass_None,
+    RegisterClass_General,
+    RegisterClass_Float,
+} RegisterClass;
+
+typedef enum Register {
+    Register_None,
+
+    Register_Rax,
+    Register_Rcx,
+    Register_Rdx,
+    Register_Rbx,
+    Register_Rsi,
+    Register_Rdi,
+    Register_R8,
+    Register_R9,
+    Register_R10,
+    Register_R11,
+    Register_R12,
+    Register_R13,
+    Register_R14,
+    Register_R15,
+
+    Register_Xmm0,
+    Register_Xmm1,
+    Register_Xmm2,
+    Register_Xmm3,
+    Register_Xmm4,
+    Register_Xmm5,
+    Register_Xmm6,
+    Register_Xmm7,
+    Register_Xmm8,
+    Register_Xmm9,
+    Register_Xmm10,
+    Register_Xmm11,
+    Register_Xmm12,
+    Register_Xmm13,
+    Register_Xmm14,
+    Register_Xmm15,
+
+    Register_Count,
+} Register;
+
+extern const char* RegisterNames[Register_Count];
+
+RegisterClass Register_GetClass(Register reg);
+b8 Register_IsVolatile(Register reg); // Clobbered by calls in the Win64 calling convention
+
+typedef struct LiveInterval {
+    IrInstruction* Value;
+    RegisterClass Class;
+    u64 Start;
+    u64 End;
+    f64 SpillWeight; // Every definition and use adds 10^(loop depth)
+    b8 CrossesCall;
+    Register Hint;
+
+    Register Register;
+    u64 SpillSlot; // Only valid when Register is Register_None
+} LiveInterval;
+
+typedef struct RegisterAllocation {
+    IrProcedure* Procedure;
+    LiveInterval* Intervals;
+    LiveInterval** IntervalsById; // Indexed by instruction id, NULL for values without an interval
+    u64 SpillSlotCount;
+    b8 UsedRegisters[Register_Count];
+} RegisterAllocation;
+
+// Linear scan as described in "Linear Scan Register Allocation" (Poletto and Sarkar)
+RegisterAllocation* RegisterAllocator_Allocate(IrProcedure* procedure);
+void RegisterAllocation_Print(RegisterAllocation* allocation);
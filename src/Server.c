@@ -0,0 +1,114 @@
+#include "./Server.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(_WIN32)
+
+b8 Server_Run(const char* path, ServerHandler handler, void* userData) {
+    return FALSE;
+}
+
+b8 Server_Isolate(void (*procedure)(void* userData), void* userData) {
+    procedure(userData);
+    return TRUE;
+}
+
+#else
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define Server_MaxRequestLength 4096
+
+// Reads up to the first newline, the request is always null terminated
+static b8 Server_ReadRequest(int client, char* request, u64 size) {
+    u64 length = 0;
+    while (length + 1 < size) {
+        ssize_t count = read(client, request + length, 1);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count <= 0 || request[length] == '\n') {
+            break;
+        }
+        length++;
+    }
+    request[length] = '\0';
+    return length > 0;
+}
+
+b8 Server_Run(const char* path, ServerHandler handler, void* userData) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return FALSE;
+    }
+    strcpy(address.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        return FALSE;
+    }
+
+    unlink(path);
+    if (bind(listener, cast(struct sockaddr*) &address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        close(listener);
+        return FALSE;
+    }
+
+    // A client that disconnects early must not kill the server while it writes the response
+    signal(SIGPIPE, SIG_IGN);
+
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+
+    b8 running = TRUE;
+    while (running) {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        char request[Server_MaxRequestLength];
+        if (Server_ReadRequest(client, request, sizeof(request))) {
+            dup2(client, STDOUT_FILENO);
+            running = handler(request, userData);
+            fflush(stdout);
+            dup2(savedStdout, STDOUT_FILENO);
+        }
+        close(client);
+    }
+
+    close(savedStdout);
+    close(listener);
+    unlink(path);
+    return TRUE;
+}
+
+b8 Server_Isolate(void (*procedure)(void* userData), void* userData) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child < 0) {
+        return FALSE;
+    } else if (child == 0) {
+        procedure(userData);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    int status;
+    while (waitpid(child, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return FALSE;
+        }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+#endif
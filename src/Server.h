@@ -0,0 +1,13 @@
+#pragma once
+
+#include "./Typedefs.h"
+
+// Called once per connection with the request line and stdout redirected to the client, returns FALSE to stop the server
+typedef b8 (*ServerHandler)(const char* request, void* userData);
+
+// Listens on a unix domain socket, returns FALSE if the socket cannot be created or the platform has no unix sockets
+b8 Server_Run(const char* path, ServerHandler handler, void* userData);
+
+// Runs procedure in a copy of the process so it can neither modify the state of the server nor bring it down,
+// returns TRUE if it finished without aborting
+b8 Server_Isolate(void (*procedure)(void* userData), void* userData);
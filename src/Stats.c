@@ -0,0 +1,137 @@
+#include "./Stats.h"
+#include "./Trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+AllocationStats Allocations = {};
+
+f64 Stats_WallTime(void) {
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return cast(f64) time.tv_sec + cast(f64) time.tv_nsec * 1e-9;
+}
+
+#if defined(_WIN32)
+
+f64 Stats_CpuTime(void) {
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        return 0.0;
+    }
+    u64 kernelTicks = (cast(u64) kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    u64 userTicks = (cast(u64) user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return cast(f64) (kernelTicks + userTicks) * 1e-7;
+}
+
+u64 Stats_PeakResidentBytes(void) {
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+}
+
+#else
+
+f64 Stats_CpuTime(void) {
+    return cast(f64) clock() / CLOCKS_PER_SEC;
+}
+
+u64 Stats_PeakResidentBytes(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return usage.ru_maxrss;
+#else
+    return cast(u64) usage.ru_maxrss * 1024;
+#endif
+}
+
+#endif
+
+typedef struct StatsPhase {
+    const char* Name;
+    f64 Wall;
+    f64 Cpu;
+} StatsPhase;
+
+#define Stats_MaxPhases 32
+
+static b8 StatsEnabled = FALSE;
+static StatsPhase StatsPhases[Stats_MaxPhases];
+static u64 StatsPhaseCount = 0;
+static StatsPhase* StatsCurrentPhase = NULL;
+static f64 StatsPhaseWallStart = 0.0;
+static f64 StatsPhaseCpuStart = 0.0;
+
+void Stats_Enable(void) {
+    StatsEnabled = TRUE;
+}
+
+static StatsPhase* Stats_FindPhase(const char* name) {
+    for (u64 i = 0; i < StatsPhaseCount; i++) {
+        if (strcmp(StatsPhases[i].Name, name) == 0) {
+            return &StatsPhases[i];
+        }
+    }
+    return NULL;
+}
+
+void Stats_BeginPhase(const char* name) {
+    Trace_BeginZone(name);
+    if (!StatsEnabled) {
+        return;
+    }
+
+    ASSERT(!StatsCurrentPhase);
+    StatsCurrentPhase = Stats_FindPhase(name);
+    if (!StatsCurrentPhase) {
+        ASSERT(StatsPhaseCount < Stats_MaxPhases);
+        StatsCurrentPhase = &StatsPhases[StatsPhaseCount++];
+        StatsCurrentPhase->Name = name;
+    }
+
+    StatsPhaseWallStart = Stats_WallTime();
+    StatsPhaseCpuStart = Stats_CpuTime();
+}
+
+void Stats_EndPhase(void) {
+    Trace_EndZone();
+    if (!StatsEnabled) {
+        return;
+    }
+
+    ASSERT(StatsCurrentPhase);
+    StatsCurrentPhase->Wall += Stats_WallTime() - StatsPhaseWallStart;
+    StatsCurrentPhase->Cpu += Stats_CpuTime() - StatsPhaseCpuStart;
+    StatsCurrentPhase = NULL;
+}
+
+f64 Stats_PhaseWallTime(const char* name) {
+    StatsPhase* phase = Stats_FindPhase(name);
+    return phase ? phase->Wall : 0.0;
+}
+
+void Stats_PrintPhases(void) {
+    f64 totalWall = 0.0;
+    f64 totalCpu = 0.0;
+    printf("%-24s %12s %12s\n", "phase", "wall ms", "cpu ms");
+    for (u64 i = 0; i < StatsPhaseCount; i++) {
+        printf("%-24s %12.3f %12.3f\n", StatsPhases[i].Name, StatsPhases[i].Wall * 1e3, StatsPhases[i].Cpu * 1e3);
+        totalWall += StatsPhases[i].Wall;
+        totalCpu += StatsPhases[i].Cpu;
+    }
+    printf("%-24s %12.3f %12.3f\n", "total", totalWall * 1e3, totalCpu * 1e3);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "./Typedefs.h"
+
+// Counted unconditionally, incrementing is cheaper than checking whether anyone asked for them
+typedef struct AllocationStats {
+    u64 AllocateCalls;
+    u64 AllocateBytes;
+    u64 DynamicArrayCalls; // DynamicArrayCreate_, which growing arrays also go through
+    u64 DynamicArrayBytes;
+} AllocationStats;
+
+extern AllocationStats Allocations;
+
+f64 Stats_WallTime(void); // Seconds since an arbitrary point
+f64 Stats_CpuTime(void); // Seconds of processor time used by the process
+u64 Stats_PeakResidentBytes(void); // 0 when the platform does not say
+
+// Phases are only recorded after Stats_Enable, a phase that runs more than once is accumulated.
+// Every phase is also a trace zone.
+void Stats_Enable(void);
+void Stats_BeginPhase(const char* name);
+void Stats_EndPhase(void);
+f64 Stats_PhaseWallTime(const char* name);
+void Stats_PrintPhases(void);
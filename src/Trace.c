@@ -0,0 +1,115 @@
+#include "./Trace.h"
+#include "./Stats.h"
+
+#include <stdio.h>
+
+typedef struct TraceZone {
+    const char* Name;
+    const char* Detail;
+    f64 Start;
+} TraceZone;
+
+#define Trace_MaxDepth 64
+
+static FILE* TraceFile = NULL;
+static f64 TraceStart = 0.0;
+static u64 TraceEventCount = 0;
+static TraceZone TraceZones[Trace_MaxDepth];
+static u64 TraceDepth = 0;
+
+static void Trace_WriteString(const char* string) {
+    fputc('"', TraceFile);
+    for (const char* c = string; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', TraceFile);
+            fputc(*c, TraceFile);
+        } else if (cast(u8) *c < 0x20) {
+            fprintf(TraceFile, "\\u%04x", *c);
+        } else {
+            fputc(*c, TraceFile);
+        }
+    }
+    fputc('"', TraceFile);
+}
+
+static void Trace_BeginEvent(void) {
+    fprintf(TraceFile, TraceEventCount > 0 ? ",\n" : "\n");
+    TraceEventCount++;
+}
+
+b8 Trace_Begin(const char* path) {
+    ASSERT(!TraceFile);
+    TraceFile = fopen(path, "wb");
+    if (!TraceFile) {
+        return FALSE;
+    }
+
+    TraceStart = Stats_WallTime();
+    TraceEventCount = 0;
+    TraceDepth = 0;
+    fprintf(TraceFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    // The compiler is single threaded, everything goes on one track
+    Trace_BeginEvent();
+    fprintf(TraceFile, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"thallium\"}}");
+    Trace_BeginEvent();
+    fprintf(TraceFile, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"main\"}}");
+    return TRUE;
+}
+
+void Trace_End(void) {
+    if (!TraceFile) {
+        return;
+    }
+
+    while (TraceDepth > 0) {
+        Trace_EndZone();
+    }
+    fprintf(TraceFile, "\n]}\n");
+    fclose(TraceFile);
+    TraceFile = NULL;
+}
+
+void Trace_BeginZone(const char* name) {
+    if (!TraceFile) {
+        return;
+    }
+
+    ASSERT(TraceDepth < Trace_MaxDepth);
+    TraceZones[TraceDepth++] = (TraceZone){
+        .Name = name,
+        .Detail = NULL,
+        .Start = Stats_WallTime(),
+    };
+}
+
+void Trace_ZoneDetail(const char* detail) {
+    if (!TraceFile) {
+        return;
+    }
+
+    ASSERT(TraceDepth > 0);
+    TraceZones[TraceDepth - 1].Detail = detail;
+}
+
+void Trace_EndZone(void) {
+    if (!TraceFile) {
+        return;
+    }
+
+    // Complete events are written when the zone ends, so a zone only needs to be remembered while it is open
+    ASSERT(TraceDepth > 0);
+    TraceZone* zone = &TraceZones[--TraceDepth];
+    f64 end = Stats_WallTime();
+    Trace_BeginEvent();
+    fprintf(TraceFile, "{\"name\":");
+    Trace_WriteString(zone->Name);
+    fprintf(TraceFile, ",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f", (zone->Start - TraceStart) * 1e6,
+            (end - zone->Start) * 1e6);
+    if (zone->Detail) {
+        fprintf(TraceFile, ",\"args\":{\"detail\":");
+        Trace_WriteString(zone->Detail);
+        fprintf(TraceFile, "}");
+    }
+    fprintf(TraceFile, "}");
+}
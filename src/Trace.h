@@ -0,0 +1,12 @@
+#pragma once
+
+#include "./Typedefs.h"
+
+// Writes scoped zones as Chrome trace-event JSON, which chrome://tracing and ui.perfetto.dev can open.
+// Every zone call does nothing until Trace_Begin succeeds.
+b8 Trace_Begin(const char* path);
+void Trace_End(void);
+
+void Trace_BeginZone(const char* name);
+void Trace_ZoneDetail(const char* detail); // Shown as an argument of the innermost zone, can be set after it began
+void Trace_EndZone(void);
@@ -0,0 +1,160 @@
+#include "./Writer.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+    #include <fcntl.h>
+    #include <io.h>
+#endif
+
+void Writer_Init(Writer* writer, FILE* file) {
+    writer->File = file;
+    writer->Length = 0;
+}
+
+void Writer_BinaryMode(Writer* writer) {
+#if defined(_WIN32)
+    fflush(writer->File);
+    _setmode(_fileno(writer->File), _O_BINARY);
+#endif
+}
+
+void Writer_Flush(Writer* writer) {
+    if (writer->Length > 0) {
+        fwrite(writer->Buffer, sizeof(char), writer->Length, writer->File);
+        writer->Length = 0;
+    }
+}
+
+void Writer_Write(Writer* writer, const void* data, u64 size) {
+    if (writer->Length + size > Writer_BufferSize) {
+        Writer_Flush(writer);
+        if (size > Writer_BufferSize) {
+            fwrite(data, sizeof(char), size, writer->File);
+            return;
+        }
+    }
+    memcpy(writer->Buffer + writer->Length, data, size);
+    writer->Length += size;
+}
+
+void Writer_Char(Writer* writer, char c) {
+    if (writer->Length == Writer_BufferSize) {
+        Writer_Flush(writer);
+    }
+    writer->Buffer[writer->Length++] = c;
+}
+
+void Writer_String(Writer* writer, const char* string) {
+    Writer_Write(writer, string, strlen(string));
+}
+
+void Writer_Format(Writer* writer, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(writer->Buffer + writer->Length, Writer_BufferSize - writer->Length, format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+
+    if (writer->Length + length < Writer_BufferSize) {
+        writer->Length += length; // vsnprintf needs room for the terminator even though it is not kept
+        return;
+    }
+
+    // Did not fit, format it again into a buffer of the right size
+    char* string = malloc(length + 1);
+    va_start(args, format);
+    vsnprintf(string, length + 1, format, args);
+    va_end(args);
+    Writer_Write(writer, string, length);
+    free(string);
+}
+
+void Writer_U64(Writer* writer, u64 value) {
+    char digits[20];
+    u64 count = 0;
+    do {
+        digits[sizeof(digits) - ++count] = cast(char) ('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    Writer_Write(writer, digits + sizeof(digits) - count, count);
+}
+
+void Writer_JsonString(Writer* writer, const char* string) {
+    Writer_JsonBytes(writer, string, strlen(string));
+}
+
+void Writer_JsonBytes(Writer* writer, const char* data, u64 length) {
+    Writer_Char(writer, '"');
+    const char* start = data;
+    for (const char* c = data; c < data + length; c++) {
+        if (*c != '"' && *c != '\\' && cast(u8) *c >= 0x20 && cast(u8) *c < 0x80) {
+            continue;
+        }
+
+        Writer_Write(writer, start, c - start);
+        switch (*c) {
+            case '"': {
+                Writer_String(writer, "\\\"");
+            } break;
+
+            case '\\': {
+                Writer_String(writer, "\\\\");
+            } break;
+
+            case '\n': {
+                Writer_String(writer, "\\n");
+            } break;
+
+            case '\r': {
+                Writer_String(writer, "\\r");
+            } break;
+
+            case '\t': {
+                Writer_String(writer, "\\t");
+            } break;
+
+            default: {
+                Writer_Format(writer, "\\u%04x", cast(u8) *c);
+            } break;
+        }
+        start = c + 1;
+    }
+    Writer_Write(writer, start, data + length - start);
+    Writer_Char(writer, '"');
+}
+
+void Writer_QuotedString(Writer* writer, const char* data, u64 length) {
+    Writer_Char(writer, '"');
+    for (u64 i = 0; i < length; i++) {
+        u8 c = cast(u8) data[i];
+        switch (c) {
+            case '"': Writer_String(writer, "\\\""); break;
+            case '\\': Writer_String(writer, "\\\\"); break;
+            case '\n': Writer_String(writer, "\\n"); break;
+            case '\r': Writer_String(writer, "\\r"); break;
+            case '\t': Writer_String(writer, "\\t"); break;
+            case '\0': Writer_String(writer, "\\0"); break;
+            default: {
+                if (c < 0x20 || c >= 0x7F) {
+                    Writer_Format(writer, "\\x%02x", c);
+                } else {
+                    Writer_Char(writer, cast(char) c);
+                }
+            } break;
+        }
+    }
+    Writer_Char(writer, '"');
+}
+
+void Writer_VarU64(Writer* writer, u64 value) {
+    while (value >= 0x80) {
+        Writer_Char(writer, cast(char) ((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    Writer_Char(writer, cast(char) value);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "./Typedefs.h"
+
+#include <stdio.h>
+
+#define Writer_BufferSize (64 * 1024)
+
+// Collects output in a buffer and hands it to the file in large blocks instead of one stdio call per fragment
+typedef struct Writer {
+    FILE* File;
+    u64 Length;
+    char Buffer[Writer_BufferSize];
+} Writer;
+
+void Writer_Init(Writer* writer, FILE* file);
+void Writer_BinaryMode(Writer* writer); // Stops Windows from turning '\n' into "\r\n" in the file
+void Writer_Flush(Writer* writer);
+
+void Writer_Write(Writer* writer, const void* data, u64 size);
+void Writer_Char(Writer* writer, char c);
+void Writer_String(Writer* writer, const char* string);
+void Writer_Format(Writer* writer, const char* format, ...);
+void Writer_U64(Writer* writer, u64 value); // Decimal
+void Writer_JsonString(Writer* writer, const char* string); // Quoted and escaped
+void Writer_JsonBytes(Writer* writer, const char* data, u64 length); // Bytes from 0x80 up are escaped as \u0080 to \u00ff
+void Writer_QuotedString(Writer* writer, const char* data, u64 length); // With the escapes of string literals
+void Writer_VarU64(Writer* writer, u64 value); // LEB128, 7 bits per byte with the high bit set on all but the last